@@ -6,6 +6,7 @@
 #include <stdint.h>                        /* for intptr_t */
 #endif
 #include <assert.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -36,6 +37,33 @@
 #define TEALET_WITH_STATS 1
 #endif
 
+/* cross-check the incrementally maintained stack statistics against a full
+ * walk of all tealets in tealet_get_stats().  O(n), for debug builds only */
+#ifndef TEALET_WITH_STATS_VERIFY
+#define TEALET_WITH_STATS_VERIFY 0
+#endif
+
+/* maximum number of released tealet blocks kept per domain for reuse.
+ * define TEALET_FREELIST_MAX=0 to disable recycling */
+#ifndef TEALET_FREELIST_MAX
+#define TEALET_FREELIST_MAX 32
+#endif
+
+/* maximum number of scratch ranges a tealet can have registered at once */
+#ifndef TEALET_SCRATCH_MAX
+#define TEALET_SCRATCH_MAX 8
+#endif
+
+/* number of tealet records per chunk of the compact-mode table */
+#ifndef TEALET_TABLE_CHUNK
+#define TEALET_TABLE_CHUNK 256
+#endif
+
+/* allocation size of a regular per-tealet arena block */
+#ifndef TEALET_ARENA_BLOCK
+#define TEALET_ARENA_BLOCK 4096
+#endif
+
 #ifndef MIN
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #endif
@@ -58,6 +86,14 @@
 #define TEALET_TFLAGS_FORK (1u << 5)
 #define TEALET_TFLAGS_AUTODELETE (1u << 6)
 #define TEALET_TFLAGS_SAVEFORCE (1u << 7)
+#define TEALET_TFLAGS_SLAB (1u << 8)
+#define TEALET_TFLAGS_TABLE (1u << 9)
+
+/* Flags describing how a tealet was allocated rather than its execution
+ * state.  They survive state resets and are ignored by NEW/unbound checks.
+ */
+#define TEALET_TFLAGS_ALLOC_MASK (TEALET_TFLAGS_SLAB | TEALET_TFLAGS_TABLE)
+#define TEALET_IS_UNBOUND(t) ((((tealet_sub_t *)(t))->flags & ~TEALET_TFLAGS_ALLOC_MASK) == 0)
 
 /* Internal per-stack flags (stored in tealet_stack_t::flags). */
 #define TEALET_SFLAGS_DEFUNCT (1u << 0)
@@ -75,6 +111,14 @@ typedef struct tealet_chunk_t {
   char data[1];                /* the data follows here */
 } tealet_chunk_t;
 
+/* a range of stack that is not preserved, as byte offsets from the near end
+ * of a saved stack.  See tealet_scratch_register().
+ */
+typedef struct tealet_hole_t {
+  size_t begin;
+  size_t end;
+} tealet_hole_t;
+
 /* The main stack structure, contains the initial chunk and a link to further
  * segments.  Stacks can be shared by different tealets, hence the reference
  * count.  They can also be linked into a list of partially unsaved
@@ -88,10 +132,45 @@ typedef struct tealet_stack_t {
   char *stack_far;              /* the far boundary of this stack (or STACKMAN_SP_FURTHEST
                                    for unbounded) */
   size_t saved;                 /* total amount of memory saved in all chunks */
+  size_t n_holes;               /* number of ranges in 'holes' */
+  tealet_hole_t *holes;         /* sorted ranges skipped by saves, follow the data */
+  tealet_group_t *group;        /* group charged for this stack, or NULL */
+#if TEALET_WITH_STATS
+  size_t expanded; /* bytes of storage held by this stack */
+  size_t naive;    /* bytes a fixed-size copy of this stack would take */
+#endif
   struct tealet_chunk_t *last;  /* last chunk in the chain */
   struct tealet_chunk_t chunk;  /* the initial chunk */
 } tealet_stack_t;
 
+/* scratch ranges registered by a tealet, see tealet_scratch_register() */
+typedef struct tealet_scratch_t {
+  size_t count;
+  struct {
+    char *begin;
+    size_t size;
+  } range[TEALET_SCRATCH_MAX];
+} tealet_scratch_t;
+
+/* a block of a per-tealet bump arena.  The head of the chain is the block
+ * currently allocated from.
+ */
+typedef struct tealet_arena_t {
+  struct tealet_arena_t *next; /* older blocks */
+  size_t size;                 /* usable bytes after the header */
+  size_t used;                 /* bytes handed out from this block */
+} tealet_arena_t;
+
+/* Fields that most tealets never use.  They are allocated on first use,
+ * or with the tealet if its extra area is not the domain default.
+ */
+typedef struct tealet_cold_t {
+  size_t extrasize;          /* size of the tealet's extra area */
+  tealet_scratch_t *scratch; /* registered scratch ranges, or NULL */
+  tealet_arena_t *arena;     /* bump arena blocks, or NULL */
+  tealet_group_t *group;     /* accounting group, or NULL */
+} tealet_cold_t;
+
 /* the actual tealet structure as used internally
  * The main tealet will have stack_far set to STACKMAN_SP_FURTHEST,
  * representing an unbounded stack extent (the entire process stack).
@@ -99,15 +178,15 @@ typedef struct tealet_stack_t {
  * to the saved stack.
  */
 typedef struct tealet_sub_t {
-  tealet_t base;         /* the public part of the tealet */
-  char *stack_far;       /* the "far" end of the stack, or STACKMAN_SP_FURTHEST
-                            for unbounded */
-  tealet_stack_t *stack; /* saved stack or 0 if active */
-  unsigned int flags;    /* internal per-tealet state flags */
-#if TEALET_WITH_STATS
+  tealet_t base;                    /* the public part of the tealet */
+  char *stack_far;                  /* the "far" end of the stack, or STACKMAN_SP_FURTHEST
+                                       for unbounded */
+  tealet_stack_t *stack;            /* saved stack or 0 if active */
+  unsigned int flags;               /* internal per-tealet state flags */
+  tealet_handle_t handle;           /* slot in the compact table, or TEALET_HANDLE_NONE */
+  tealet_cold_t *cold;              /* rarely used fields, or NULL */
   struct tealet_sub_t *next_tealet; /* next in circular list of all tealets */
   struct tealet_sub_t *prev_tealet; /* prev in circular list of all tealets */
-#endif
 #ifndef NDEBUG
   int id; /* number of this tealet */
 #endif
@@ -119,6 +198,31 @@ typedef struct tealet_nonmain_t {
   double _extra[1]; /* start of any extra data */
 } tealet_nonmain_t;
 
+/* A slab holds tealets created together by tealet_spawn_many().  The slab
+ * is a single allocation and is released when its last member is freed.
+ */
+typedef struct tealet_slab_t {
+  int refcount;    /* number of live member tealets */
+  int has_args;    /* members start with their slot argument */
+  size_t size;     /* size of the slab allocation */
+  size_t slotsize; /* size of each member slot */
+} tealet_slab_t;
+
+/* Each slab member is prefixed with a small slot header */
+typedef struct tealet_slot_t {
+  tealet_slab_t *slab;
+  void *start_arg;         /* run argument for the member's first run */
+  tealet_nonmain_t tealet; /* the member tealet, followed by extra data */
+} tealet_slot_t;
+
+/* read a field of the cold part, or 'none' if it has none */
+#define TEALET_COLD(t, field, none) ((t)->cold != NULL ? (t)->cold->field : (none))
+#define TEALET_EXTRASIZE(main, t) TEALET_COLD(t, extrasize, (main)->g_extrasize)
+
+#define TEALET_SLOT(t) ((tealet_slot_t *)((char *)(t)-offsetof(tealet_slot_t, tealet)))
+#define TEALET_ALIGN_UP(size, align) (((size) + (align)-1) & ~((size_t)(align)-1))
+#define TEALET_SLAB_ALIGN (sizeof(double) > sizeof(void *) ? sizeof(double) : sizeof(void *))
+
 #if TEALET_WITH_STACK_SNAPSHOT || TEALET_WITH_STACK_GUARD
 typedef struct tealet_integrity_data_t {
   char *stack_base; /* the "base" of the monitored stack interval (the end of
@@ -154,6 +258,7 @@ typedef struct tealet_main_t {
   tealet_sub_t *g_target;   /* Temporary store when switching */
   void *g_arg;              /* argument passed around when switching */
   tealet_alloc_t g_alloc;   /* the allocation context used */
+  tealet_alloc2_t g_alloc2; /* version 2 allocator, malloc_p NULL if unused */
   tealet_lock_t g_locking;  /* optional external lock callbacks */
   tealet_stack_t *g_prev;   /* previously active unsaved stacks */
   tealet_sr_e g_sw;         /* save/restore state */
@@ -167,8 +272,17 @@ typedef struct tealet_main_t {
 #if TEALET_WITH_STACK_SNAPSHOT || TEALET_WITH_STACK_GUARD
   tealet_integrity_data_t g_integrity_data;
 #endif
-  int g_tealets; /* number of active tealets excluding main */
-  int g_counter; /* total number of tealets */
+  int g_tealets;             /* number of active tealets excluding main */
+  int g_counter;             /* total number of tealets */
+  tealet_sub_t *g_freelist;  /* released tealet blocks, linked via stack_far */
+  size_t g_freelist_count;   /* number of blocks on g_freelist */
+  int g_compact;             /* allocate default-sized tealets from g_table */
+  char **g_table;            /* chunks of TEALET_TABLE_CHUNK tealet records */
+  size_t g_table_chunks;     /* number of chunks in g_table */
+  size_t g_table_cap;        /* capacity of the g_table directory */
+  size_t g_table_stride;     /* bytes per record, including the extra area */
+  tealet_handle_t g_table_top; /* records handed out so far, live or free */
+  tealet_sub_t *g_table_free;  /* released records, linked via stack_far */
 #if TEALET_WITH_STATS
   /* Extended memory statistics */
   size_t g_bytes_allocated;        /* Current heap allocation */
@@ -176,12 +290,20 @@ typedef struct tealet_main_t {
   size_t g_blocks_allocated;       /* Current number of allocated blocks */
   size_t g_blocks_allocated_peak;  /* Peak number of allocated blocks */
   size_t g_blocks_allocated_total; /* Total allocation calls */
+  size_t g_freelist_reused;        /* Tealet allocations served from g_freelist */
   size_t g_stack_bytes;            /* Bytes used for stack storage */
   size_t g_stack_count;            /* Number of stack structures currently allocated */
   size_t g_stack_chunk_count;      /* Number of stack chunks currently allocated
                                       (including initial) */
-#endif
-  size_t g_extrasize; /* amount of extra memory in tealets */
+  size_t g_stack_bytes_expanded;   /* Sum of stack->expanded over all tealets */
+  size_t g_stack_bytes_naive;      /* Sum of stack->naive over all tealets */
+  size_t g_arena_bytes;            /* Bytes reserved in arena blocks */
+  size_t g_arena_used;             /* Bytes handed out from arena blocks */
+  size_t g_switches;               /* Completed stack switches */
+  size_t g_bytes_saved;            /* Stack bytes copied to the heap */
+  size_t g_bytes_restored;         /* Stack bytes copied back to the stack */
+#endif
+  size_t g_extrasize; /* default amount of extra memory in tealets */
   double _extra[1];   /* start of any extra data */
 } tealet_main_t;
 
@@ -194,10 +316,9 @@ typedef struct tealet_main_t {
 #define TEALET_GET_MAIN(t) ((tealet_main_t *)(((tealet_t *)(t))->main))
 
 /* ----------------------------------------------------------------
- * Statistics tracking macros
+ * Circular list of all tealets in a domain.  Maintained in every build so
+ * that a domain can be torn down without the caller deleting each tealet.
  */
-#if TEALET_WITH_STATS
-/* Forward declaration for list verification */
 /* Link a tealet into the circular list after main tealet */
 #define TEALET_LIST_ADD(main, t)                                                                                       \
   do {                                                                                                                 \
@@ -214,6 +335,10 @@ typedef struct tealet_main_t {
     (t)->next_tealet->prev_tealet = (t)->prev_tealet;                                                                  \
   } while (0)
 
+/* ----------------------------------------------------------------
+ * Statistics tracking macros
+ */
+#if TEALET_WITH_STATS
 #define STATS_ADD_ALLOC(main, size)                                                                                    \
   do {                                                                                                                 \
     (main)->g_bytes_allocated += (size);                                                                               \
@@ -231,8 +356,6 @@ typedef struct tealet_main_t {
     (main)->g_blocks_allocated--;                                                                                      \
   } while (0)
 #else
-#define TEALET_LIST_ADD(main, t) ((void)0)
-#define TEALET_LIST_REMOVE(t) ((void)0)
 #define STATS_ADD_ALLOC(main, size) ((void)0)
 #define STATS_SUB_ALLOC(main, size) ((void)0)
 #endif
@@ -240,10 +363,25 @@ typedef struct tealet_main_t {
 /* ----------------------------------------------------------------
  * helpers to call the malloc functions provided by the user
  */
-static void *tealet_int_malloc(tealet_main_t *main, size_t size) {
+static void *tealet_int_malloc(tealet_main_t *main, size_t size, tealet_alloc_purpose_t purpose) {
+  if (main->g_alloc2.malloc_p != NULL)
+    return main->g_alloc2.malloc_p(size, 0, purpose, main->g_alloc2.context);
   return main->g_alloc.malloc_p(size, main->g_alloc.context);
 }
-static void tealet_int_free(tealet_main_t *main, void *ptr) { main->g_alloc.free_p(ptr, main->g_alloc.context); }
+static void tealet_int_free(tealet_main_t *main, void *ptr, tealet_alloc_purpose_t purpose) {
+  if (main->g_alloc2.malloc_p != NULL)
+    main->g_alloc2.free_p(ptr, purpose, main->g_alloc2.context);
+  else
+    main->g_alloc.free_p(ptr, main->g_alloc.context);
+}
+/* resize a block in place or move it.  Returns NULL, leaving the block
+ * untouched, on failure or if the allocator has no realloc callback.
+ */
+static void *tealet_int_realloc(tealet_main_t *main, void *ptr, size_t size, tealet_alloc_purpose_t purpose) {
+  if (main->g_alloc2.realloc_p == NULL)
+    return NULL;
+  return main->g_alloc2.realloc_p(ptr, size, purpose, main->g_alloc2.context);
+}
 
 /* Debug-only sanity check that caller stack plausibly matches current tealet.
  *
@@ -304,7 +442,7 @@ static void tealet_integrity_data_init(tealet_integrity_data_t *data) {
 static void tealet_integrity_data_free(tealet_main_t *g_main, tealet_integrity_data_t *data) {
 #if TEALET_WITH_STACK_SNAPSHOT
   if (data->snapshot_block != NULL) {
-    tealet_int_free(g_main, data->snapshot_block);
+    tealet_int_free(g_main, data->snapshot_block, TEALET_ALLOC_PURPOSE_SNAPSHOT);
     data->snapshot_block = NULL;
   }
   data->snapshot_capacity = 0;
@@ -567,7 +705,7 @@ static int tealet_snapshot_ensure_capacity(tealet_main_t *g_main, size_t require
   if (g_main->g_integrity_data.snapshot_capacity >= required)
     return 0;
 
-  new_block = (char *)tealet_int_malloc(g_main, required);
+  new_block = (char *)tealet_int_malloc(g_main, required, TEALET_ALLOC_PURPOSE_SNAPSHOT);
   if (new_block == NULL)
     return TEALET_ERR_MEM;
 
@@ -579,7 +717,7 @@ static int tealet_snapshot_ensure_capacity(tealet_main_t *g_main, size_t require
   g_main->g_integrity_data.stack_base = NULL;
 
   if (g_main->g_integrity_data.snapshot_block) {
-    tealet_int_free(g_main, g_main->g_integrity_data.snapshot_block);
+    tealet_int_free(g_main, g_main->g_integrity_data.snapshot_block, TEALET_ALLOC_PURPOSE_SNAPSHOT);
   }
   g_main->g_integrity_data.snapshot_block = new_block;
   g_main->g_integrity_data.snapshot_capacity = required;
@@ -751,33 +889,468 @@ static void tealet_config_fill_from_main(tealet_main_t *g_main, tealet_config_t
   tealet_config_canonicalize(config);
 }
 
+/** Return the cold part of a tealet, allocating it if needed */
+static tealet_cold_t *tealet_cold_get(tealet_main_t *main, tealet_sub_t *t) {
+  tealet_cold_t *cold = t->cold;
+
+  if (cold != NULL)
+    return cold;
+  cold = (tealet_cold_t *)tealet_int_malloc(main, sizeof(tealet_cold_t), TEALET_ALLOC_PURPOSE_TEALET);
+  if (cold == NULL)
+    return NULL;
+  STATS_ADD_ALLOC(main, sizeof(tealet_cold_t));
+  cold->extrasize = main->g_extrasize;
+  cold->scratch = NULL;
+  cold->arena = NULL;
+  cold->group = NULL;
+  t->cold = cold;
+  return cold;
+}
+
+/** Release the cold part of a tealet, whose scratch and arena are gone */
+static void tealet_cold_free(tealet_main_t *main, tealet_sub_t *t) {
+  if (t->cold == NULL)
+    return;
+  if (t->cold->group != NULL)
+    t->cold->group->n_tealets--;
+  STATS_SUB_ALLOC(main, sizeof(tealet_cold_t));
+  tealet_int_free(main, t->cold, TEALET_ALLOC_PURPOSE_TEALET);
+  t->cold = NULL;
+}
+
+/** Release the scratch range registrations of a tealet */
+static void tealet_scratch_free(tealet_main_t *main, tealet_sub_t *t) {
+  if (TEALET_COLD(t, scratch, NULL) == NULL)
+    return;
+  STATS_SUB_ALLOC(main, sizeof(tealet_scratch_t));
+  tealet_int_free(main, t->cold->scratch, TEALET_ALLOC_PURPOSE_TEALET);
+  t->cold->scratch = NULL;
+}
+
+/** Give 'dst' a copy of the scratch range registrations of 'src' */
+static int tealet_scratch_copy(tealet_main_t *main, tealet_sub_t *dst, tealet_sub_t *src) {
+  tealet_scratch_t *scratch = TEALET_COLD(src, scratch, NULL);
+  tealet_cold_t *cold;
+
+  if (scratch == NULL || scratch->count == 0)
+    return 0;
+  cold = tealet_cold_get(main, dst);
+  if (cold == NULL)
+    return TEALET_ERR_MEM;
+  if (cold->scratch == NULL) {
+    cold->scratch = (tealet_scratch_t *)tealet_int_malloc(main, sizeof(tealet_scratch_t), TEALET_ALLOC_PURPOSE_TEALET);
+    if (cold->scratch == NULL)
+      return TEALET_ERR_MEM;
+    STATS_ADD_ALLOC(main, sizeof(tealet_scratch_t));
+  }
+  memcpy(cold->scratch, scratch, sizeof(tealet_scratch_t));
+  return 0;
+}
+
+/** Forget the scratch ranges of a tealet that starts over */
+static void tealet_scratch_clear(tealet_sub_t *t) {
+  if (TEALET_COLD(t, scratch, NULL) != NULL)
+    t->cold->scratch->count = 0;
+}
+
+/* offset of the first usable byte in an arena block */
+#define TEALET_ARENA_HEAD TEALET_ALIGN_UP(sizeof(tealet_arena_t), TEALET_SLAB_ALIGN)
+
+/** Release all arena blocks of a tealet in one pass */
+static void tealet_arena_free(tealet_main_t *main, tealet_sub_t *t) {
+  if (t->cold == NULL)
+    return;
+  while (t->cold->arena != NULL) {
+    tealet_arena_t *block = t->cold->arena;
+    t->cold->arena = block->next;
+    STATS_SUB_ALLOC(main, TEALET_ARENA_HEAD + block->size);
+#if TEALET_WITH_STATS
+    main->g_arena_bytes -= block->size;
+    main->g_arena_used -= block->used;
+#endif
+    tealet_int_free(main, block, TEALET_ALLOC_PURPOSE_ARENA);
+  }
+}
+
+/** Release a slab member.  The slab memory is freed with its last member. */
+static void tealet_free_slab_member(tealet_main_t *main, tealet_sub_t *t) {
+  tealet_slab_t *slab = TEALET_SLOT(t)->slab;
+
+  if (--slab->refcount > 0)
+    return;
+  STATS_SUB_ALLOC(main, slab->size);
+  tealet_int_free(main, slab, TEALET_ALLOC_PURPOSE_TEALET);
+}
+
 /** Free a tealet, unlinking it from the circular list first */
 static void tealet_free_tealet(tealet_main_t *main, tealet_sub_t *t) {
   size_t basesize = offsetof(tealet_nonmain_t, _extra);
-  size_t size = basesize + main->g_extrasize;
+  size_t extrasize = TEALET_EXTRASIZE(main, t);
+  size_t size = basesize + extrasize;
 
   if (main->g_previous == t)
     main->g_previous = NULL;
 
-#if TEALET_WITH_STATS
   TEALET_LIST_REMOVE(t);
-#endif
+  tealet_scratch_free(main, t);
+  tealet_arena_free(main, t);
+  tealet_cold_free(main, t);
+  if (t->flags & TEALET_TFLAGS_SLAB) {
+    tealet_free_slab_member(main, t);
+    return;
+  }
+  if (t->flags & TEALET_TFLAGS_TABLE) {
+    /* a NULL main marks the record as free for table walks */
+    *((tealet_t **)&t->base.main) = NULL;
+    t->stack = NULL;
+    t->stack_far = (void *)main->g_table_free;
+    main->g_table_free = t;
+    return;
+  }
+  if (extrasize == main->g_extrasize && main->g_freelist_count < TEALET_FREELIST_MAX) {
+    /* keep default-sized blocks for reuse by tealet_alloc().  They stay
+     * accounted as allocated memory until the domain is finalized.
+     */
+    t->stack = NULL;
+    t->stack_far = (void *)main->g_freelist;
+    main->g_freelist = t;
+    main->g_freelist_count++;
+    return;
+  }
   STATS_SUB_ALLOC(main, size);
-  tealet_int_free(main, t);
+  tealet_int_free(main, t, TEALET_ALLOC_PURPOSE_TEALET);
+}
+
+static void tealet_init_raw(tealet_main_t *g_main, tealet_sub_t *g, size_t basesize, size_t extrasize);
+
+/** Record 'index' of the compact table */
+#define TEALET_TABLE_RECORD(main, index)                                                                               \
+  ((tealet_sub_t *)((main)->g_table[(index) / TEALET_TABLE_CHUNK] +                                                    \
+                    ((index) % TEALET_TABLE_CHUNK) * (main)->g_table_stride))
+
+/** Add a chunk of records to the compact table */
+static int tealet_table_grow(tealet_main_t *main) {
+  size_t size = TEALET_TABLE_CHUNK * main->g_table_stride;
+  char *chunk;
+
+  if (main->g_table_chunks == main->g_table_cap) {
+    size_t cap = main->g_table_cap ? 2 * main->g_table_cap : 8;
+    char **table = (char **)tealet_int_malloc(main, cap * sizeof(char *), TEALET_ALLOC_PURPOSE_TEALET);
+    if (table == NULL)
+      return TEALET_ERR_MEM;
+    STATS_ADD_ALLOC(main, cap * sizeof(char *));
+    if (main->g_table != NULL) {
+      memcpy(table, main->g_table, main->g_table_chunks * sizeof(char *));
+      STATS_SUB_ALLOC(main, main->g_table_cap * sizeof(char *));
+      tealet_int_free(main, main->g_table, TEALET_ALLOC_PURPOSE_TEALET);
+    }
+    main->g_table = table;
+    main->g_table_cap = cap;
+  }
+  chunk = (char *)tealet_int_malloc(main, size, TEALET_ALLOC_PURPOSE_TEALET);
+  if (chunk == NULL)
+    return TEALET_ERR_MEM;
+  STATS_ADD_ALLOC(main, size);
+  main->g_table[main->g_table_chunks++] = chunk;
+  return 0;
+}
+
+/** Take a record from the compact table.  It is not linked into the
+ * circular list; table walks find it instead.
+ */
+static tealet_sub_t *tealet_table_alloc(tealet_main_t *main) {
+  size_t basesize = offsetof(tealet_nonmain_t, _extra);
+  tealet_sub_t *t = main->g_table_free;
+  tealet_handle_t handle;
+
+  if (t != NULL) {
+    main->g_table_free = (tealet_sub_t *)t->stack_far;
+    handle = t->handle;
+  } else {
+    handle = main->g_table_top;
+    if (handle == TEALET_HANDLE_NONE)
+      return NULL;
+    if (handle / TEALET_TABLE_CHUNK == main->g_table_chunks && tealet_table_grow(main))
+      return NULL;
+    main->g_table_top++;
+    t = TEALET_TABLE_RECORD(main, handle);
+  }
+  tealet_init_raw(main, t, basesize, main->g_extrasize);
+  TEALET_LIST_REMOVE(t);
+  t->next_tealet = t;
+  t->prev_tealet = t;
+  t->flags = TEALET_TFLAGS_TABLE;
+  t->handle = handle;
+  return t;
+}
+
+/** Release the compact table.  All its tealets must have been freed. */
+static void tealet_table_clear(tealet_main_t *main) {
+  size_t i;
+
+  for (i = 0; i < main->g_table_chunks; i++) {
+    STATS_SUB_ALLOC(main, TEALET_TABLE_CHUNK * main->g_table_stride);
+    tealet_int_free(main, main->g_table[i], TEALET_ALLOC_PURPOSE_TEALET);
+  }
+  if (main->g_table != NULL) {
+    STATS_SUB_ALLOC(main, main->g_table_cap * sizeof(char *));
+    tealet_int_free(main, main->g_table, TEALET_ALLOC_PURPOSE_TEALET);
+  }
+  main->g_table = NULL;
+  main->g_table_chunks = 0;
+  main->g_table_cap = 0;
+  main->g_table_top = 0;
+  main->g_table_free = NULL;
+}
+
+/** Release all tealet blocks kept on the freelist */
+static void tealet_freelist_clear(tealet_main_t *main) {
+  size_t size = offsetof(tealet_nonmain_t, _extra) + main->g_extrasize;
+
+  while (main->g_freelist != NULL) {
+    tealet_sub_t *t = main->g_freelist;
+    main->g_freelist = (tealet_sub_t *)t->stack_far;
+    main->g_freelist_count--;
+    STATS_SUB_ALLOC(main, size);
+    tealet_int_free(main, t, TEALET_ALLOC_PURPOSE_TEALET);
+  }
+  (void)size;
 }
 
 /* ----------------------------------------------------------------
  * actual stack management routines.  Copying, growing
  * restoring, duplicating, deleting
  */
-static tealet_stack_t *tealet_stack_new(tealet_main_t *main, char *stack_near, char *stack_far, size_t size) {
+static void tealet_chunk_decref(tealet_main_t *main, tealet_group_t *group, tealet_chunk_t *chunk);
+static void tealet_stack_decref(tealet_main_t *main, tealet_stack_t *stack);
+
+/** Charge stack storage to a group.  If 'enforce' is set, fails with
+ * TEALET_ERR_MEM, charging nothing, if the group's quota would be exceeded.
+ * Stacks grown while some other tealet switches are charged with 'enforce'
+ * clear: the quota must not fail a switch made on behalf of another group.
+ */
+static int tealet_group_charge(tealet_group_t *group, size_t bytes, size_t chunks, int enforce) {
+  if (group == NULL)
+    return 0;
+  if (enforce && group->quota != 0 &&
+      (group->stack_bytes > group->quota || bytes > group->quota - group->stack_bytes)) {
+    group->n_quota_failures++;
+    return TEALET_ERR_MEM;
+  }
+  group->stack_bytes += bytes;
+  group->chunk_count += chunks;
+  return 0;
+}
+
+static void tealet_group_uncharge(tealet_group_t *group, size_t bytes, size_t chunks) {
+  if (group == NULL)
+    return;
+  group->stack_bytes -= bytes;
+  group->chunk_count -= chunks;
+}
+
+/* Check a group before spawning into it: a group at its quota can't
+ * save even the first frames of a new tealet, so refuse up front.
+ */
+static int tealet_group_full(tealet_group_t *group) {
+  if (group == NULL || group->quota == 0 || group->stack_bytes < group->quota)
+    return 0;
+  group->n_quota_failures++;
+  return 1;
+}
+
+/** Collect the scratch ranges of a tealet as sorted, merged offsets from
+ * 'stack_near', limited to 'limit' bytes.  Returns the number of holes.
+ */
+static size_t tealet_scratch_holes(tealet_scratch_t *scratch, char *stack_near, size_t limit, tealet_hole_t *holes) {
+  size_t i, j, n = 0;
+
+  if (scratch == NULL)
+    return 0;
+  for (i = 0; i < scratch->count; i++) {
+    char *begin = scratch->range[i].begin;
+    ptrdiff_t a = STACKMAN_SP_DIFF(begin, stack_near);
+    ptrdiff_t b = STACKMAN_SP_DIFF(begin + scratch->range[i].size, stack_near);
+    tealet_hole_t hole;
+
+    if (a > b) {
+      ptrdiff_t tmp = a;
+      a = b;
+      b = tmp;
+    }
+    if (a < 0)
+      a = 0;
+    if (b <= a)
+      continue;
+    hole.begin = (size_t)a;
+    hole.end = MIN((size_t)b, limit);
+    if (hole.end <= hole.begin)
+      continue;
+    /* insert sorted, merging overlapping holes */
+    for (j = n; j > 0 && holes[j - 1].begin > hole.begin; j--)
+      holes[j] = holes[j - 1];
+    holes[j] = hole;
+    n++;
+  }
+  for (i = 0, j = 1; j < n; j++) {
+    if (holes[j].begin <= holes[i].end) {
+      if (holes[j].end > holes[i].end)
+        holes[i].end = holes[j].end;
+    } else {
+      holes[++i] = holes[j];
+    }
+  }
+  return n ? i + 1 : 0;
+}
+
+/** Size of the heap block holding a stack and its initial chunk */
+static size_t tealet_stack_blocksize(tealet_stack_t *stack) {
+  size_t size = offsetof(tealet_stack_t, chunk.data[0]) + stack->chunk.size;
+  if (stack->n_holes)
+    size = TEALET_ALIGN_UP(size, sizeof(size_t)) + stack->n_holes * sizeof(tealet_hole_t);
+  return size;
+}
+
+#if TEALET_WITH_STATS
+/** Set the expanded and naive sizes of a stack.  The domain totals count a
+ * stack once per tealet referencing it, i.e. 'refcount' times.
+ */
+static void tealet_stack_stats_set(tealet_main_t *main, tealet_stack_t *stack, size_t expanded, size_t naive) {
+  size_t n = (size_t)stack->refcount;
+  main->g_stack_bytes_expanded += n * expanded - n * stack->expanded;
+  main->g_stack_bytes_naive += n * naive - n * stack->naive;
+  stack->expanded = expanded;
+  stack->naive = naive;
+}
+
+/** Account for 'bytes' of new storage in a stack, now saved out to the far
+ * end of 'chunk'.  The naive size of an unbounded stack is its furthest
+ * saved extent, that of a bounded stack the whole extent to its far boundary.
+ */
+static void tealet_stack_stats_grow(tealet_main_t *main, tealet_stack_t *stack, tealet_chunk_t *chunk, size_t bytes) {
+  char *far = stack->stack_far;
+  size_t naive;
+
+  if (far == STACKMAN_SP_FURTHEST)
+    far = (char *)STACKMAN_SP_ADD((ptrdiff_t)chunk->stack_near, (ptrdiff_t)chunk->size);
+  naive = offsetof(tealet_stack_t, chunk.data[0]) +
+          (size_t)STACKMAN_SP_DIFF((ptrdiff_t)far, (ptrdiff_t)stack->chunk.stack_near);
+  if (naive < stack->naive)
+    naive = stack->naive;
+  tealet_stack_stats_set(main, stack, stack->expanded + bytes, naive);
+}
+#endif
+
+/** End of the run of saveable bytes starting at 'offset', or 'limit'.  If
+ * 'offset' lies in a hole, the end of that hole is returned in *skip.
+ */
+static size_t tealet_stack_run_end(tealet_stack_t *stack, size_t offset, size_t limit, size_t *skip) {
+  size_t i;
+
+  *skip = 0;
+  for (i = 0; i < stack->n_holes; i++) {
+    if (stack->holes[i].end <= offset)
+      continue;
+    if (stack->holes[i].begin <= offset) {
+      *skip = MIN(stack->holes[i].end, limit);
+      return offset;
+    }
+    return MIN(stack->holes[i].begin, limit);
+  }
+  return limit;
+}
+
+/** Append a chunk with 'size' bytes of stack, 'offset' bytes from the near
+ * end.  'enforce' applies the group quota, see tealet_group_charge().
+ */
+static int tealet_stack_append(tealet_main_t *main, tealet_stack_t *stack, size_t offset, size_t size,
+                               int enforce) {
+  tealet_chunk_t *chunk;
   size_t tsize;
-  tealet_stack_t *s;
 
-  tsize = offsetof(tealet_stack_t, chunk.data[0]) + size;
-  s = (tealet_stack_t *)tealet_int_malloc(main, tsize);
-  if (!s)
+  tsize = offsetof(tealet_chunk_t, data[0]) + size;
+  if (tealet_group_charge(stack->group, tsize, 1, enforce))
+    return TEALET_ERR_MEM;
+  chunk = (tealet_chunk_t *)tealet_int_malloc(main, tsize, TEALET_ALLOC_PURPOSE_CHUNK);
+  if (!chunk) {
+    tealet_group_uncharge(stack->group, tsize, 1);
+    return TEALET_ERR_MEM;
+  }
+  STATS_ADD_ALLOC(main, tsize);
+#if TEALET_WITH_STATS
+  main->g_stack_chunk_count++; /* Additional chunk */
+  main->g_stack_bytes += tsize;
+#endif
+  chunk->refcount = 1;
+#if STACK_DIRECTION == 0
+  chunk->stack_near = stack->chunk.stack_near + offset;
+  memcpy(&chunk->data[0], chunk->stack_near, size);
+#else
+  chunk->stack_near = stack->chunk.stack_near - offset;
+  memcpy(&chunk->data[0], chunk->stack_near - size, size);
+#endif
+#if TEALET_WITH_STATS
+  main->g_bytes_saved += size;
+#endif
+  chunk->size = size;
+  chunk->next = NULL;
+  assert(stack->last != NULL);
+  stack->last->next = chunk;
+  stack->last = chunk;
+#if TEALET_WITH_STATS
+  tealet_stack_stats_grow(main, stack, chunk, tsize);
+#endif
+  return 0;
+}
+
+/** Save the stack bytes between offsets 'from' and 'to', skipping holes */
+static int tealet_stack_save_range(tealet_main_t *main, tealet_stack_t *stack, size_t from, size_t to,
+                                   int enforce) {
+  while (from < to) {
+    size_t skip;
+    size_t end = tealet_stack_run_end(stack, from, to, &skip);
+    if (end == from) {
+      from = skip;
+      continue;
+    }
+    if (tealet_stack_append(main, stack, from, end - from, enforce))
+      return TEALET_ERR_MEM;
+    from = end;
+  }
+  return 0;
+}
+
+static tealet_stack_t *tealet_stack_new(tealet_main_t *main, char *stack_near, char *stack_far, size_t size,
+                                        tealet_scratch_t *scratch, tealet_group_t *group) {
+  size_t tsize;
+  size_t first;
+  size_t skip;
+  size_t n_holes;
+  size_t limit;
+  tealet_stack_t *s;
+  tealet_hole_t holes[TEALET_SCRATCH_MAX];
+
+  limit = (size_t)-1;
+  if (stack_far != STACKMAN_SP_FURTHEST)
+    limit = (size_t)STACKMAN_SP_DIFF(stack_far, stack_near);
+  n_holes = tealet_scratch_holes(scratch, stack_near, limit, holes);
+
+  /* the initial chunk holds the first run of saveable bytes */
+  first = size;
+  if (n_holes && holes[0].begin < size)
+    first = holes[0].begin;
+  tsize = offsetof(tealet_stack_t, chunk.data[0]) + first;
+  if (n_holes)
+    tsize = TEALET_ALIGN_UP(tsize, sizeof(size_t)) + n_holes * sizeof(tealet_hole_t);
+  if (tealet_group_charge(group, tsize, 1, 1))
+    return NULL;
+  s = (tealet_stack_t *)tealet_int_malloc(main, tsize, TEALET_ALLOC_PURPOSE_STACK_HEADER);
+  if (!s) {
+    tealet_group_uncharge(group, tsize, 1);
     return NULL;
+  }
+  if (group != NULL)
+    group->stack_count++;
   STATS_ADD_ALLOC(main, tsize);
 #if TEALET_WITH_STATS
   main->g_stack_count++;
@@ -790,65 +1363,142 @@ static tealet_stack_t *tealet_stack_new(tealet_main_t *main, char *stack_near, c
   s->flags = 0;
   s->saved = size;
   s->last = &s->chunk;
+  s->n_holes = n_holes;
+  s->holes = NULL;
+  s->group = group;
+#if TEALET_WITH_STATS
+  s->expanded = 0;
+  s->naive = 0;
+#endif
 
   s->chunk.next = NULL;
   s->chunk.refcount = 1;
   s->chunk.stack_near = stack_near;
-  s->chunk.size = size;
+  s->chunk.size = first;
+  if (n_holes) {
+    s->holes = (tealet_hole_t *)((char *)s + (tsize - n_holes * sizeof(tealet_hole_t)));
+    memcpy(s->holes, holes, n_holes * sizeof(tealet_hole_t));
+  }
 #if STACK_DIRECTION == 0
-  memcpy(&s->chunk.data[0], stack_near, size);
+  memcpy(&s->chunk.data[0], stack_near, first);
 #else
-  memcpy(&s->chunk.data[0], stack_near - size, size);
+  memcpy(&s->chunk.data[0], stack_near - first, first);
 #endif
+#if TEALET_WITH_STATS
+  main->g_bytes_saved += first;
+  tealet_stack_stats_grow(main, s, &s->chunk, tsize);
+#endif
+  if (first < size) {
+    /* skip the hole and save the rest in additional chunks */
+    tealet_stack_run_end(s, first, size, &skip);
+    if (tealet_stack_save_range(main, s, skip, size, 1)) {
+      tealet_stack_decref(main, s);
+      return NULL;
+    }
+  }
   return s;
 }
 
-static int tealet_stack_grow(tealet_main_t *main, tealet_stack_t *stack, size_t size) {
+/** Grow the last additional chunk of a stack in place to cover 'size' bytes.
+ * Only possible when the allocator provides realloc_p and no hole interrupts
+ * the range.  Returns nonzero if the stack was not extended.
+ */
+static int tealet_stack_extend(tealet_main_t *main, tealet_stack_t *stack, size_t size) {
+  tealet_chunk_t *last = stack->last;
+  tealet_chunk_t *prev;
   tealet_chunk_t *chunk;
-  size_t tsize, diff;
-  assert(size > stack->saved);
+  size_t skip;
+  size_t extra = size - stack->saved;
+  size_t tsize;
 
-  diff = size - stack->saved;
-  tsize = offsetof(tealet_chunk_t, data[0]) + diff;
-  chunk = (tealet_chunk_t *)tealet_int_malloc(main, tsize);
-  if (!chunk)
-    return TEALET_ERR_MEM;
-  STATS_ADD_ALLOC(main, tsize);
-#if TEALET_WITH_STATS
-  main->g_stack_chunk_count++; /* Additional chunk */
-  main->g_stack_bytes += tsize;
-#endif
-  chunk->refcount = 1;
+  if (main->g_alloc2.realloc_p == NULL || last == &stack->chunk || last->refcount != 1)
+    return -1;
+  if (tealet_stack_run_end(stack, stack->saved, size, &skip) != size)
+    return -1;
+  if ((size_t)STACKMAN_SP_DIFF(last->stack_near, stack->chunk.stack_near) + last->size != stack->saved)
+    return -1; /* a hole ends right at the saved extent */
+
+  tsize = offsetof(tealet_chunk_t, data[0]) + last->size + extra;
+  tealet_group_charge(stack->group, extra, 0, 0);
+  chunk = (tealet_chunk_t *)tealet_int_realloc(main, last, tsize, TEALET_ALLOC_PURPOSE_CHUNK);
+  if (chunk == NULL) {
+    tealet_group_uncharge(stack->group, extra, 0);
+    return -1;
+  }
+  for (prev = &stack->chunk; prev->next != last; prev = prev->next)
+    ;
+  prev->next = chunk;
+  stack->last = chunk;
 #if STACK_DIRECTION == 0
-  chunk->stack_near = stack->chunk.stack_near + stack->saved;
-  memcpy(&chunk->data[0], chunk->stack_near, diff);
+  memcpy(&chunk->data[chunk->size], chunk->stack_near + chunk->size, extra);
 #else
-  chunk->stack_near = stack->chunk.stack_near - stack->saved;
-  memcpy(&chunk->data[0], chunk->stack_near - diff, diff);
+  memmove(&chunk->data[extra], &chunk->data[0], chunk->size);
+  memcpy(&chunk->data[0], chunk->stack_near - chunk->size - extra, extra);
 #endif
-  chunk->size = diff;
-  chunk->next = NULL;
-  assert(stack->last != NULL);
-  stack->last->next = chunk;
-  stack->last = chunk;
+  chunk->size += extra;
+  stack->saved = size;
+#if TEALET_WITH_STATS
+  main->g_bytes_allocated += extra;
+  if (main->g_bytes_allocated > main->g_bytes_allocated_peak)
+    main->g_bytes_allocated_peak = main->g_bytes_allocated;
+  main->g_stack_bytes += extra;
+  main->g_bytes_saved += extra;
+  tealet_stack_stats_grow(main, stack, chunk, extra);
+#endif
+  return 0;
+}
+
+static int tealet_stack_grow(tealet_main_t *main, tealet_stack_t *stack, size_t size) {
+  tealet_chunk_t *last = stack->last;
+  int fail;
+#if TEALET_WITH_STATS
+  size_t expanded = stack->expanded;
+  size_t naive = stack->naive;
+#endif
+  assert(size > stack->saved);
+
+  if (tealet_stack_extend(main, stack, size) == 0)
+    return 0;
+  fail = tealet_stack_save_range(main, stack, stack->saved, size, 0);
+  if (fail) {
+    /* drop any chunks added before the failure */
+    if (last->next != NULL)
+      tealet_chunk_decref(main, stack->group, last->next);
+    last->next = NULL;
+    stack->last = last;
+#if TEALET_WITH_STATS
+    tealet_stack_stats_set(main, stack, expanded, naive);
+#endif
+    return fail;
+  }
   stack->saved = size;
   return 0;
 }
 
-static void tealet_stack_restore(tealet_stack_t *stack) {
+/* copy a saved stack back into place, returns the number of bytes copied */
+static size_t tealet_stack_restore(tealet_stack_t *stack) {
   tealet_chunk_t *chunk = &stack->chunk;
+  size_t copied = 0;
   do {
 #if STACK_DIRECTION == 0
     memcpy(chunk->stack_near, &chunk->data[0], chunk->size);
 #else
     memcpy(chunk->stack_near - chunk->size, &chunk->data[0], chunk->size);
 #endif
+    copied += chunk->size;
     chunk = chunk->next;
   } while (chunk);
+  return copied;
 }
 
-static tealet_stack_t *tealet_stack_dup(tealet_stack_t *stack) {
+static tealet_stack_t *tealet_stack_dup(tealet_main_t *main, tealet_stack_t *stack) {
   stack->refcount += 1;
+#if TEALET_WITH_STATS
+  main->g_stack_bytes_expanded += stack->expanded;
+  main->g_stack_bytes_naive += stack->naive;
+#else
+  (void)main;
+#endif
   return stack;
 }
 
@@ -877,7 +1527,7 @@ static void tealet_stack_unlink(tealet_stack_t *stack) {
   stack->prev = NULL;
 }
 
-static void tealet_chunk_decref(tealet_main_t *main, tealet_chunk_t *chunk) {
+static void tealet_chunk_decref(tealet_main_t *main, tealet_group_t *group, tealet_chunk_t *chunk) {
   while (chunk != NULL) {
     tealet_chunk_t *next;
 
@@ -893,28 +1543,42 @@ static void tealet_chunk_decref(tealet_main_t *main, tealet_chunk_t *chunk) {
     main->g_stack_chunk_count--; /* Additional chunk */
     main->g_stack_bytes -= offsetof(tealet_chunk_t, data[0]) + chunk->size;
 #endif
-    tealet_int_free(main, (void *)chunk);
+    tealet_group_uncharge(group, offsetof(tealet_chunk_t, data[0]) + chunk->size, 1);
+    tealet_int_free(main, (void *)chunk, TEALET_ALLOC_PURPOSE_CHUNK);
     chunk = next;
   }
 }
 
 static void tealet_stack_decref(tealet_main_t *main, tealet_stack_t *stack) {
   tealet_chunk_t *chunk;
-  if (stack == NULL || --stack->refcount > 0)
+  tealet_group_t *group;
+  size_t size;
+  if (stack == NULL)
+    return;
+#if TEALET_WITH_STATS
+  main->g_stack_bytes_expanded -= stack->expanded;
+  main->g_stack_bytes_naive -= stack->naive;
+#endif
+  if (--stack->refcount > 0)
     return;
   if (stack->prev)
     tealet_stack_unlink(stack);
 
   chunk = stack->chunk.next;
-  STATS_SUB_ALLOC(main, offsetof(tealet_stack_t, chunk.data[0]) + stack->chunk.size);
+  group = stack->group;
+  size = tealet_stack_blocksize(stack);
+  STATS_SUB_ALLOC(main, size);
 #if TEALET_WITH_STATS
   main->g_stack_count--;
   main->g_stack_chunk_count--; /* Initial chunk */
-  main->g_stack_bytes -= offsetof(tealet_stack_t, chunk.data[0]) + stack->chunk.size;
+  main->g_stack_bytes -= size;
 #endif
-  tealet_int_free(main, (void *)stack);
+  tealet_group_uncharge(group, size, 1);
+  if (group != NULL)
+    group->stack_count--;
+  tealet_int_free(main, (void *)stack, TEALET_ALLOC_PURPOSE_STACK_HEADER);
   if (chunk != NULL)
-    tealet_chunk_decref(main, chunk);
+    tealet_chunk_decref(main, group, chunk);
 }
 
 static void tealet_stack_defunct(tealet_main_t *main, tealet_stack_t *stack) {
@@ -927,7 +1591,12 @@ static void tealet_stack_defunct(tealet_main_t *main, tealet_stack_t *stack) {
   stack->flags |= TEALET_SFLAGS_DEFUNCT;
   stack->saved = 0;
   if (chunk != NULL)
-    tealet_chunk_decref(main, chunk);
+    tealet_chunk_decref(main, stack->group, chunk);
+#if TEALET_WITH_STATS
+  /* only the initial chunk is left */
+  tealet_stack_stats_set(main, stack, 0, 0);
+  tealet_stack_stats_grow(main, stack, &stack->chunk, tealet_stack_blocksize(stack));
+#endif
 }
 
 static int tealet_is_defunct(tealet_sub_t *tealet) {
@@ -946,7 +1615,7 @@ static int tealet_is_defunct(tealet_sub_t *tealet) {
 
 /** save a new stack, at least up to "saveto" */
 static tealet_stack_t *tealet_stack_saveto(tealet_main_t *main, char *stack_near, char *stack_far, char *saveto,
-                                           int *full) {
+                                           tealet_scratch_t *scratch, tealet_group_t *group, int *full) {
   ptrdiff_t size;
   /* boundary convention for saveto in copied range:
    *  - descending stacks: [stack_near, saveto)  (saveto is exclusive)
@@ -961,7 +1630,7 @@ static tealet_stack_t *tealet_stack_saveto(tealet_main_t *main, char *stack_near
   size = STACKMAN_SP_DIFF(saveto, stack_near);
   if (size < 0)
     size = 0;
-  return tealet_stack_new(main, (char *)stack_near, stack_far, size);
+  return tealet_stack_new(main, (char *)stack_near, stack_far, size, scratch, group);
 }
 
 static int tealet_stack_growto(tealet_main_t *main, tealet_stack_t *stack, char *saveto, int *full, int fail_ok) {
@@ -1111,6 +1780,7 @@ static int tealet_save_state(tealet_main_t *g_main, void *old_stack_pointer) {
     auto_delete = ((g_current->flags & TEALET_TFLAGS_AUTODELETE) != 0);
     g_current->flags &= ~(TEALET_TFLAGS_EXITING | TEALET_TFLAGS_AUTODELETE | TEALET_TFLAGS_SAVEFORCE);
     g_current->flags |= TEALET_TFLAGS_EXITED;
+    tealet_arena_free(g_main, g_current);
     if (auto_delete) {
       /* auto-delete the tealet */
 #if TEALET_WITH_STATS
@@ -1125,7 +1795,8 @@ static int tealet_save_state(tealet_main_t *g_main, void *old_stack_pointer) {
     /* save the initial stack chunk */
     int full;
     tealet_stack_t *stack =
-        tealet_stack_saveto(g_main, (char *)old_stack_pointer, g_current->stack_far, target_stop, &full);
+        tealet_stack_saveto(g_main, (char *)old_stack_pointer, g_current->stack_far, target_stop,
+                            TEALET_COLD(g_current, scratch, NULL), TEALET_COLD(g_current, group, NULL), &full);
     if (!stack) {
       if (fail_ok)
         return -1;
@@ -1153,7 +1824,11 @@ static void tealet_restore_state(tealet_main_t *g_main, void *new_stack_pointer)
   /* Restore the heap copy back into the C stack */
   assert(g->stack != NULL);
   assert((char *)new_stack_pointer == g->stack->chunk.stack_near);
+#if TEALET_WITH_STATS
+  g_main->g_bytes_restored += tealet_stack_restore(g->stack);
+#else
   tealet_stack_restore(g->stack);
+#endif
   tealet_stack_decref(g_main, g->stack);
   g->stack = NULL;
 }
@@ -1319,6 +1994,9 @@ static int tealet_switchstack(tealet_main_t *g_main, tealet_sub_t *target, void
 
   if (g_main->g_sw != SW_ERR) {
     g_main->g_current = g_main->g_target;
+#if TEALET_WITH_STATS
+    g_main->g_switches++;
+#endif
   } else {
     g_main->g_previous = old_previous;
     g_main->g_target = NULL;
@@ -1377,6 +2055,21 @@ static void tealet_unlock_auto(tealet_main_t *g_main) {
     g_main->g_locking.unlock(g_main->g_locking.arg);
 }
 
+/** Return the argument for the first run of a deferred-start tealet.
+ * Slab members created with an argument array take their own argument,
+ * everything else uses the argument of the first switch.
+ */
+static void *tealet_start_arg(tealet_sub_t *g_new, void *switch_arg) {
+  tealet_slot_t *slot;
+
+  if ((g_new->flags & TEALET_TFLAGS_SLAB) == 0)
+    return switch_arg;
+  slot = TEALET_SLOT(g_new);
+  if (!slot->slab->has_args)
+    return switch_arg;
+  return slot->start_arg;
+}
+
 /** We are initializing a new tealet, either switching to it and
  * running it, or switching from it (saving its virgin stack) back
  * to the caller, in order to switch to it later and run it.
@@ -1441,7 +2134,10 @@ static int tealet_initialstub(tealet_main_t *g_main, tealet_sub_t *g_new, tealet
       assert(g_main->g_current == g_new); /* only valid for TEALET_START_SWITCH */
       run_arg = initial_run_arg;          /* captured before stack switch */
     } else {
-      run_arg = switch_arg; /* TEALET_START_DEFAULT: use the arg from the switch */
+      /* TEALET_START_DEFAULT: use the arg from the switch, unless this is a
+       * slab member that was given its own start argument.
+       */
+      run_arg = tealet_start_arg(g_main->g_current, switch_arg);
     }
     assert(g_main->g_current->stack == NULL); /* running */
 
@@ -1477,24 +2173,22 @@ static int tealet_initialstub(tealet_main_t *g_main, tealet_sub_t *g_new, tealet
   return 0;
 }
 
-static tealet_sub_t *tealet_alloc_raw(tealet_main_t *g_main, tealet_alloc_t *alloc, size_t basesize, size_t extrasize) {
+static tealet_sub_t *tealet_alloc_raw(tealet_main_t *g_main, size_t basesize, size_t extrasize) {
   tealet_sub_t *g;
   size_t size = basesize + extrasize;
-  g = (tealet_sub_t *)alloc->malloc_p(size, alloc->context);
+  g = (tealet_sub_t *)tealet_int_malloc(g_main, size, TEALET_ALLOC_PURPOSE_TEALET);
   if (g == NULL)
     return NULL;
-  if (g_main == NULL) {
-    g_main = (tealet_main_t *)g;
-#if TEALET_WITH_STATS
-    g_main->g_counter = 0;
-    /* Initialize stats before tracking this allocation */
-    g_main->g_bytes_allocated = 0;
-    g_main->g_blocks_allocated = 0;
-    g_main->g_blocks_allocated_total = 0;
-#endif
-  }
   /* Track tealet structure allocation */
   STATS_ADD_ALLOC(g_main, size);
+  tealet_init_raw(g_main, g, basesize, extrasize);
+  return g;
+}
+
+/** Initialize the common fields of a freshly allocated tealet and link it
+ * into the domain.
+ */
+static void tealet_init_raw(tealet_main_t *g_main, tealet_sub_t *g, size_t basesize, size_t extrasize) {
   /* main is const in public type; initialize once during allocation. */
   *((tealet_t **)&g->base.main) = (tealet_t *)g_main;
   if (extrasize)
@@ -1504,6 +2198,8 @@ static tealet_sub_t *tealet_alloc_raw(tealet_main_t *g_main, tealet_alloc_t *all
   g->stack = NULL;
   g->stack_far = NULL;
   g->flags = 0;
+  g->handle = TEALET_HANDLE_NONE;
+  g->cold = NULL;
 #ifndef NDEBUG
   g->id = 0;
 #endif
@@ -1511,60 +2207,164 @@ static tealet_sub_t *tealet_alloc_raw(tealet_main_t *g_main, tealet_alloc_t *all
   g_main->g_counter++;
 #ifndef NDEBUG
   g->id = g_main->g_counter;
+#endif
 #endif
   /* Link into the circular list (but not the main tealet itself during init) */
   if (g != (tealet_sub_t *)g_main) {
     TEALET_LIST_ADD(g_main, g);
   }
-#endif
-  return g;
 }
 
-static tealet_sub_t *tealet_alloc_main(tealet_alloc_t *alloc, size_t extrasize) {
+/** Allocate the main tealet with either a version 1 or a version 2 allocator
+ * and install that allocator in it.
+ */
+static tealet_sub_t *tealet_alloc_main(tealet_alloc_t *alloc, const tealet_alloc2_t *alloc2, size_t extrasize) {
+  tealet_main_t *g_main;
   size_t basesize = offsetof(tealet_main_t, _extra);
-  return tealet_alloc_raw(NULL, alloc, basesize, extrasize);
+  size_t size = basesize + extrasize;
+
+  if (alloc2 != NULL)
+    g_main = (tealet_main_t *)alloc2->malloc_p(size, 0, TEALET_ALLOC_PURPOSE_TEALET, alloc2->context);
+  else
+    g_main = (tealet_main_t *)alloc->malloc_p(size, alloc->context);
+  if (g_main == NULL)
+    return NULL;
+  memset(&g_main->g_alloc, 0, sizeof(g_main->g_alloc));
+  memset(&g_main->g_alloc2, 0, sizeof(g_main->g_alloc2));
+  if (alloc2 != NULL) {
+    /* copy only the prefix known to this build */
+    memcpy(&g_main->g_alloc2, alloc2, sizeof(tealet_alloc2_t));
+    g_main->g_alloc2.size = sizeof(tealet_alloc2_t);
+  } else {
+    g_main->g_alloc = *alloc;
+  }
+#if TEALET_WITH_STATS
+  g_main->g_counter = 0;
+  /* Initialize stats before tracking this allocation */
+  g_main->g_bytes_allocated = 0;
+  g_main->g_blocks_allocated = 0;
+  g_main->g_blocks_allocated_total = 0;
+#endif
+  /* Track tealet structure allocation */
+  STATS_ADD_ALLOC(g_main, size);
+  tealet_init_raw(g_main, (tealet_sub_t *)g_main, basesize, extrasize);
+  return (tealet_sub_t *)g_main;
 }
 
-static tealet_sub_t *tealet_alloc(tealet_main_t *g_main) {
+static tealet_sub_t *tealet_alloc(tealet_main_t *g_main, size_t extrasize) {
   tealet_sub_t *result;
   size_t basesize = offsetof(tealet_nonmain_t, _extra);
-  size_t extrasize = g_main->g_extrasize;
 
-  result = tealet_alloc_raw(g_main, &g_main->g_alloc, basesize, extrasize);
+  if (extrasize > (size_t)-1 - basesize)
+    return NULL;
+  result = NULL;
+  if (extrasize == g_main->g_extrasize && g_main->g_compact) {
+    result = tealet_table_alloc(g_main);
 #if TEALET_WITH_STATS
-  if (result != NULL)
-    g_main->g_tealets++;
+    if (result != NULL)
+      g_main->g_tealets++;
 #endif
-  return result;
-}
+    return result;
+  }
+  if (extrasize == g_main->g_extrasize)
+    result = g_main->g_freelist;
+  if (result != NULL) {
+    /* recycle a released block */
+    g_main->g_freelist = (tealet_sub_t *)result->stack_far;
+    g_main->g_freelist_count--;
+#if TEALET_WITH_STATS
+    g_main->g_freelist_reused++;
+#endif
+    tealet_init_raw(g_main, result, basesize, extrasize);
+  } else {
+    result = tealet_alloc_raw(g_main, basesize, extrasize);
+    if (result != NULL && extrasize != g_main->g_extrasize) {
+      /* a size other than the default is kept in the cold part */
+      if (tealet_cold_get(g_main, result) == NULL) {
+        TEALET_LIST_REMOVE(result);
+        STATS_SUB_ALLOC(g_main, basesize + extrasize);
+        tealet_int_free(g_main, result, TEALET_ALLOC_PURPOSE_TEALET);
+        return NULL;
+      }
+      result->cold->extrasize = extrasize;
+    }
+  }
+#if TEALET_WITH_STATS
+  if (result != NULL)
+    g_main->g_tealets++;
+#endif
+  return result;
+}
+
+/** Allocate 'n' NEW tealets in a single slab and return them in 'out'. */
+static tealet_slab_t *tealet_alloc_slab(tealet_main_t *g_main, size_t n, void **args, tealet_t **out) {
+  tealet_slab_t *slab;
+  size_t basesize = offsetof(tealet_nonmain_t, _extra);
+  size_t headsize = TEALET_ALIGN_UP(sizeof(tealet_slab_t), TEALET_SLAB_ALIGN);
+  size_t slotsize;
+  size_t size;
+  size_t i;
+
+  slotsize = offsetof(tealet_slot_t, tealet) + basesize + g_main->g_extrasize;
+  slotsize = TEALET_ALIGN_UP(slotsize, TEALET_SLAB_ALIGN);
+  if (n > ((size_t)-1 - headsize) / slotsize)
+    return NULL;
+  size = headsize + n * slotsize;
+  slab = (tealet_slab_t *)tealet_int_malloc(g_main, size, TEALET_ALLOC_PURPOSE_TEALET);
+  if (slab == NULL)
+    return NULL;
+  STATS_ADD_ALLOC(g_main, size);
+  slab->refcount = (int)n;
+  slab->has_args = (args != NULL);
+  slab->size = size;
+  slab->slotsize = slotsize;
+
+  for (i = 0; i < n; i++) {
+    tealet_slot_t *slot = (tealet_slot_t *)((char *)slab + headsize + i * slotsize);
+    tealet_sub_t *g = &slot->tealet.base;
+
+    slot->slab = slab;
+    slot->start_arg = args != NULL ? args[i] : NULL;
+    tealet_init_raw(g_main, g, basesize, g_main->g_extrasize);
+    g->flags = TEALET_TFLAGS_SLAB;
+    out[i] = (tealet_t *)g;
+  }
+#if TEALET_WITH_STATS
+  g_main->g_tealets += (int)n;
+#endif
+  return slab;
+}
 
 /* ----------------------------------------------------------------
  * Public API - core lifecycle and switching
  */
 
-tealet_t *tealet_initialize(tealet_alloc_t *alloc, size_t extrasize) {
-  char stack_probe;
-  tealet_sub_t *g;
-  tealet_main_t *g_main;
-  g = tealet_alloc_main(alloc, extrasize);
-  if (g == NULL)
-    return NULL;
-  g_main = (tealet_main_t *)g;
+/** Set up a freshly allocated main tealet */
+static tealet_t *tealet_init_main(tealet_sub_t *g, size_t extrasize, char *stack_probe) {
+  tealet_main_t *g_main = (tealet_main_t *)g;
   g->stack = NULL;
   g->stack_far = STACKMAN_SP_FURTHEST;
   g->flags |= (TEALET_TFLAGS_MAIN_LINEAGE | TEALET_TFLAGS_BOUND);
   g_main->g_user = NULL;
-  g_main->g_main_stack_probe = &stack_probe;
+  g_main->g_main_stack_probe = stack_probe;
   g_main->g_current = g;
   g_main->g_previous = NULL;
   g_main->g_target = NULL;
   g_main->g_arg = NULL;
-  g_main->g_alloc = *alloc;
   g_main->g_locking.mode = TEALET_LOCK_OFF;
   g_main->g_locking.lock = NULL;
   g_main->g_locking.unlock = NULL;
   g_main->g_locking.arg = NULL;
   g_main->g_prev = NULL;
+  g_main->g_freelist = NULL;
+  g_main->g_freelist_count = 0;
+  g_main->g_compact = 0;
+  g_main->g_table = NULL;
+  g_main->g_table_chunks = 0;
+  g_main->g_table_cap = 0;
+  g_main->g_table_stride = 0;
+  g_main->g_table_top = 0;
+  g_main->g_table_free = NULL;
   g_main->g_extrasize = extrasize;
   g_main->g_sw = SW_NOP;
   g_main->g_flags = 0;
@@ -1577,10 +2377,10 @@ tealet_t *tealet_initialize(tealet_alloc_t *alloc, size_t extrasize) {
 #if TEALET_WITH_STACK_SNAPSHOT || TEALET_WITH_STACK_GUARD
   tealet_integrity_data_init(&g_main->g_integrity_data);
 #endif
-#if TEALET_WITH_STATS
   /* Initialize circular list - main tealet points to itself */
   g->next_tealet = g;
   g->prev_tealet = g;
+#if TEALET_WITH_STATS
   /* init these.  the main tealet counts as one */
   g_main->g_tealets = 1;
   assert(g_main->g_counter == 1); /* set in alloc_raw */
@@ -1590,17 +2390,52 @@ tealet_t *tealet_initialize(tealet_alloc_t *alloc, size_t extrasize) {
   g_main->g_stack_bytes = 0;
   g_main->g_stack_count = 0;
   g_main->g_stack_chunk_count = 0;
+  g_main->g_stack_bytes_expanded = 0;
+  g_main->g_stack_bytes_naive = 0;
+  g_main->g_freelist_reused = 0;
+  g_main->g_arena_bytes = 0;
+  g_main->g_arena_used = 0;
+  g_main->g_switches = 0;
+  g_main->g_bytes_saved = 0;
+  g_main->g_bytes_restored = 0;
 #endif
   assert(TEALET_IS_MAIN((tealet_t *)g_main));
   return (tealet_t *)g_main;
 }
 
+tealet_t *tealet_initialize(tealet_alloc_t *alloc, size_t extrasize) {
+  char stack_probe;
+  tealet_sub_t *g;
+  g = tealet_alloc_main(alloc, NULL, extrasize);
+  if (g == NULL)
+    return NULL;
+  return tealet_init_main(g, extrasize, &stack_probe);
+}
+
+tealet_t *tealet_initialize2(const tealet_alloc2_t *alloc, size_t extrasize) {
+  char stack_probe;
+  tealet_sub_t *g;
+  if (alloc == NULL || alloc->size < sizeof(tealet_alloc2_t) || alloc->version < TEALET_ALLOC2_VERSION_1)
+    return NULL;
+  if (alloc->malloc_p == NULL || alloc->free_p == NULL)
+    return NULL;
+  g = tealet_alloc_main(NULL, alloc, extrasize);
+  if (g == NULL)
+    return NULL;
+  return tealet_init_main(g, extrasize, &stack_probe);
+}
+
 tealet_t *tealet_new(tealet_t *tealet) {
+  tealet_main_t *g_main = TEALET_GET_MAIN(tealet);
+  return tealet_new_ex(tealet, g_main->g_extrasize);
+}
+
+tealet_t *tealet_new_ex(tealet_t *tealet, size_t extrasize) {
   tealet_main_t *g_main = TEALET_GET_MAIN(tealet);
   tealet_sub_t *result;
 
   tealet_lock_auto(g_main);
-  result = tealet_alloc(g_main);
+  result = tealet_alloc(g_main, extrasize);
   if (result == NULL) {
     tealet_unlock_auto(g_main);
     return NULL;
@@ -1611,22 +2446,81 @@ tealet_t *tealet_new(tealet_t *tealet) {
    */
   result->stack_far = NULL;
   result->stack = NULL;
-  result->flags = 0;
+  result->flags &= TEALET_TFLAGS_ALLOC_MASK;
   tealet_unlock_auto(g_main);
   return (tealet_t *)result;
 }
 
+/** Release every non-main tealet of a domain together with its saved stack.
+ * Must be called from the main tealet, so that no other stack is live.
+ */
+static void tealet_release_all(tealet_main_t *g_main) {
+  tealet_sub_t *t = g_main->base.next_tealet;
+  tealet_handle_t i;
+
+  while (t != (tealet_sub_t *)g_main) {
+    tealet_sub_t *next = t->next_tealet;
+    tealet_stack_decref(g_main, t->stack);
+#if TEALET_WITH_STATS
+    g_main->g_tealets--;
+#endif
+    tealet_free_tealet(g_main, t);
+    t = next;
+  }
+  /* compact-mode tealets are not on the list; sweep the table */
+  for (i = 0; i < g_main->g_table_top; i++) {
+    t = TEALET_TABLE_RECORD(g_main, i);
+    if (t->base.main == NULL)
+      continue;
+    tealet_stack_decref(g_main, t->stack);
+#if TEALET_WITH_STATS
+    g_main->g_tealets--;
+#endif
+    tealet_free_tealet(g_main, t);
+  }
+  assert(g_main->g_prev == NULL);
+  g_main->g_previous = NULL;
+  g_main->g_target = NULL;
+  g_main->g_arg = NULL;
+}
+
+int tealet_reset(tealet_t *tealet) {
+  tealet_main_t *g_main = TEALET_GET_MAIN(tealet);
+
+  if (!TEALET_IS_MAIN(tealet) || g_main->g_current != (tealet_sub_t *)g_main)
+    return TEALET_ERR_INVAL;
+  tealet_lock_auto(g_main);
+  tealet_release_all(g_main);
+  tealet_scratch_clear((tealet_sub_t *)g_main);
+  tealet_arena_free(g_main, (tealet_sub_t *)g_main);
+  tealet_unlock_auto(g_main);
+  return 0;
+}
+
+void tealet_finalize_all(tealet_t *tealet) {
+  tealet_main_t *g_main = TEALET_GET_MAIN(tealet);
+  assert(TEALET_IS_MAIN(tealet));
+  assert(g_main->g_current == (tealet_sub_t *)g_main);
+  tealet_release_all(g_main);
+  tealet_finalize(tealet);
+}
+
 void tealet_finalize(tealet_t *tealet) {
   tealet_main_t *g_main = TEALET_GET_MAIN(tealet);
   assert(TEALET_IS_MAIN(tealet));
   assert(g_main->g_current == (tealet_sub_t *)g_main);
+  tealet_freelist_clear(g_main);
+  tealet_table_clear(g_main);
+  tealet_scratch_free(g_main, (tealet_sub_t *)g_main);
+  tealet_arena_free(g_main, (tealet_sub_t *)g_main);
+  tealet_cold_free(g_main, (tealet_sub_t *)g_main);
 #if TEALET_WITH_STACK_GUARD
   tealet_guard_unprotect_current(g_main);
 #endif
 #if TEALET_WITH_STACK_SNAPSHOT || TEALET_WITH_STACK_GUARD
   tealet_integrity_data_free(g_main, &g_main->g_integrity_data);
 #endif
-  tealet_int_free(g_main, g_main);
+  tealet_int_free(g_main, g_main, TEALET_ALLOC_PURPOSE_TEALET);
 }
 
 /** choose initial far boundary for tealet creation.
@@ -1660,8 +2554,10 @@ int tealet_run(tealet_t *tealet, tealet_run_t run, void **parg, void *stack_far,
   assert(run != NULL);
   assert((flags & ~TEALET_START_SWITCH) == 0);
 
-  if (result->flags != 0)
+  if (!TEALET_IS_UNBOUND(result))
     return TEALET_ERR_INVAL;
+  if (tealet_group_full(TEALET_COLD(result, group, NULL)))
+    return TEALET_ERR_MEM;
 
   switch_now = ((flags & TEALET_START_SWITCH) != 0);
 
@@ -1686,9 +2582,11 @@ int tealet_run(tealet_t *tealet, tealet_run_t run, void **parg, void *stack_far,
   }
 
   if (fail) {
+    /* a panicking START_SWITCH child has saved its stack on the way out */
+    tealet_stack_decref(g_main, result->stack);
     result->stack = NULL;
     result->stack_far = NULL;
-    result->flags = 0;
+    result->flags &= TEALET_TFLAGS_ALLOC_MASK;
     if (!switch_now)
       g_main->g_current = current;
     api_result = fail;
@@ -1701,6 +2599,67 @@ done:
   return api_result;
 }
 
+/* Create and bind many tealets sharing one initial stack capture.
+ *
+ * All members live in one slab allocation.  The first member captures the
+ * initial stack state like tealet_run(..., TEALET_START_DEFAULT) does, and
+ * the remaining members take a reference on that same saved stack.
+ */
+int tealet_spawn_many(tealet_t *tealet, size_t n, tealet_run_t run, void **args, tealet_t **out) {
+  tealet_main_t *g_main = TEALET_GET_MAIN(tealet);
+  tealet_sub_t *current;
+  tealet_sub_t *previous;
+  tealet_sub_t *first;
+  tealet_slab_t *slab;
+  size_t i;
+  int fail;
+
+  if (run == NULL || n > INT_MAX)
+    return TEALET_ERR_INVAL; /* the slab refcount is an int */
+  if (n == 0)
+    return 0;
+
+  current = g_main->g_current;
+  tealet_verify_current_matches_caller(current);
+
+  tealet_lock_auto(g_main);
+  assert(!g_main->g_target);
+  slab = tealet_alloc_slab(g_main, n, args, out);
+  if (slab == NULL) {
+    tealet_unlock_auto(g_main);
+    return TEALET_ERR_MEM;
+  }
+
+  first = (tealet_sub_t *)out[0];
+  first->flags |= TEALET_TFLAGS_BOUND;
+  previous = g_main->g_previous;
+  g_main->g_current = first;
+  fail = tealet_initialstub(g_main, first, current, run, NULL, tealet_pick_initial_far((void *)&slab, NULL));
+  if (fail) {
+    tealet_stack_decref(g_main, first->stack);
+    first->stack = NULL;
+    g_main->g_current = current;
+    for (i = 0; i < n; i++)
+      tealet_free_tealet(g_main, (tealet_sub_t *)out[i]);
+#if TEALET_WITH_STATS
+    g_main->g_tealets -= (int)n;
+#endif
+    tealet_unlock_auto(g_main);
+    return fail;
+  }
+  g_main->g_previous = previous;
+
+  for (i = 1; i < n; i++) {
+    tealet_sub_t *member = (tealet_sub_t *)out[i];
+
+    member->stack_far = first->stack_far;
+    member->flags = first->flags;
+    member->stack = tealet_stack_dup(g_main, first->stack); /* can't fail */
+  }
+  tealet_unlock_auto(g_main);
+  return 0;
+}
+
 /* Fork the active tealet.
  *
  * Switching API lock policy:
@@ -1717,6 +2676,8 @@ int tealet_fork(tealet_t *_tealet, void **parg, int flags) {
   int result;
   int switch_now;
   int api_result;
+  tealet_group_t *group;
+  int inherited;
 
   g_current = g_main->g_current;
   tealet_verify_current_matches_caller(g_current);
@@ -1726,7 +2687,7 @@ int tealet_fork(tealet_t *_tealet, void **parg, int flags) {
   switch_now = ((flags & TEALET_START_SWITCH) != 0);
 
   /* Fork target must be a NEW/unbound tealet */
-  if (g_child->flags != 0) {
+  if (!TEALET_IS_UNBOUND(g_child)) {
     return TEALET_ERR_INVAL;
   }
 
@@ -1740,6 +2701,13 @@ int tealet_fork(tealet_t *_tealet, void **parg, int flags) {
   /* Active tealets have NULL stack (implied by the check above) */
   assert(g_current->stack == NULL);
 
+  group = TEALET_COLD(g_child, group, NULL);
+  inherited = group == NULL && TEALET_COLD(g_current, group, NULL) != NULL;
+  if (inherited)
+    group = g_current->cold->group;
+  if (tealet_group_full(group))
+    return TEALET_ERR_MEM;
+
   /* Copy the far boundary */
   g_child->stack_far = g_current->stack_far;
   g_child->flags |= TEALET_TFLAGS_FORK;
@@ -1749,6 +2717,21 @@ int tealet_fork(tealet_t *_tealet, void **parg, int flags) {
 
   tealet_lock_auto(g_main);
 
+  /* the child continues from the same frames, with the same scratch ranges,
+   * and joins the parent's group unless it was given one
+   */
+  if (tealet_scratch_copy(g_main, g_child, g_current) || (inherited && tealet_cold_get(g_main, g_child) == NULL)) {
+    g_child->stack_far = NULL;
+    g_child->flags &= TEALET_TFLAGS_ALLOC_MASK;
+    tealet_scratch_clear(g_child);
+    api_result = TEALET_ERR_MEM;
+    goto done;
+  }
+  if (inherited) {
+    g_child->cold->group = group;
+    group->n_tealets++;
+  }
+
   /* result of tealet_switchstack is:
    * 1 if this was just a save
    * 0 if this was a restore (switch back)
@@ -1773,9 +2756,15 @@ int tealet_fork(tealet_t *_tealet, void **parg, int flags) {
 
   if (result < 0) {
     /* Failed to save/restore; keep child reusable as NEW. */
+    tealet_stack_decref(g_main, g_child->stack);
     g_child->stack = NULL;
     g_child->stack_far = NULL;
-    g_child->flags = 0;
+    g_child->flags &= TEALET_TFLAGS_ALLOC_MASK;
+    tealet_scratch_clear(g_child);
+    if (inherited) {
+      group->n_tealets--;
+      g_child->cold->group = NULL;
+    }
     if (!switch_now)
       g_main->g_current = g_current;
     api_result = result;
@@ -1956,24 +2945,45 @@ tealet_t *tealet_duplicate(tealet_t *tealet) {
   tealet_sub_t *g_tealet = (tealet_sub_t *)tealet;
   tealet_main_t *g_main = TEALET_GET_MAIN(g_tealet);
   tealet_sub_t *g_copy;
+  tealet_group_t *group;
+  size_t extrasize;
 
   tealet_lock_auto(g_main);
 
   /* can't dup the current or the main tealet */
   assert(g_tealet != g_main->g_current && g_tealet != (tealet_sub_t *)g_main);
-  g_copy = tealet_alloc(g_main);
+  group = TEALET_COLD(g_tealet, group, NULL);
+  if (tealet_group_full(group)) {
+    tealet_unlock_auto(g_main);
+    return NULL;
+  }
+  extrasize = TEALET_EXTRASIZE(g_main, g_tealet);
+  g_copy = tealet_alloc(g_main, extrasize);
   if (g_copy == NULL) {
     tealet_unlock_auto(g_main);
     return NULL;
   }
   g_copy->stack_far = g_tealet->stack_far;
-  g_copy->flags = g_tealet->flags;
+  g_copy->flags = (g_copy->flags & TEALET_TFLAGS_ALLOC_MASK) | (g_tealet->flags & ~TEALET_TFLAGS_ALLOC_MASK);
   if (g_tealet->stack != NULL)
-    g_copy->stack = tealet_stack_dup(g_tealet->stack); /* can't fail */
+    g_copy->stack = tealet_stack_dup(g_main, g_tealet->stack); /* can't fail */
   else
     g_copy->stack = NULL;
-  if (g_main->g_extrasize)
-    memcpy(g_copy->base.extra, g_tealet->base.extra, g_main->g_extrasize);
+  if (extrasize)
+    memcpy(g_copy->base.extra, g_tealet->base.extra, extrasize);
+  if (tealet_scratch_copy(g_main, g_copy, g_tealet) || (group != NULL && tealet_cold_get(g_main, g_copy) == NULL)) {
+    tealet_stack_decref(g_main, g_copy->stack);
+#if TEALET_WITH_STATS
+    g_main->g_tealets--;
+#endif
+    tealet_free_tealet(g_main, g_copy);
+    tealet_unlock_auto(g_main);
+    return NULL;
+  }
+  if (group != NULL) {
+    g_copy->cold->group = group;
+    group->n_tealets++;
+  }
   tealet_unlock_auto(g_main);
   return (tealet_t *)g_copy;
 }
@@ -1991,6 +3001,26 @@ void tealet_delete(tealet_t *target) {
   tealet_unlock_auto(g_main);
 }
 
+int tealet_rebind(tealet_t *tealet) {
+  tealet_sub_t *g_tealet = (tealet_sub_t *)tealet;
+  tealet_main_t *g_main = TEALET_GET_MAIN(g_tealet);
+  int result = TEALET_ERR_INVAL;
+
+  if (TEALET_IS_MAIN(tealet))
+    return TEALET_ERR_INVAL;
+  tealet_lock_auto(g_main);
+  if (g_tealet->flags & TEALET_TFLAGS_EXITED) {
+    /* an exited tealet holds no stack; reset it to the NEW state */
+    assert(g_tealet->stack == NULL);
+    g_tealet->stack_far = NULL;
+    tealet_scratch_clear(g_tealet);
+    g_tealet->flags &= TEALET_TFLAGS_ALLOC_MASK;
+    result = 0;
+  }
+  tealet_unlock_auto(g_main);
+  return result;
+}
+
 /* ----------------------------------------------------------------
  * Public API - status and query
  */
@@ -2041,11 +3071,133 @@ size_t tealet_get_stacksize(tealet_t *_tealet) {
   return 0;
 }
 
+size_t tealet_switch_cost(tealet_t *target) {
+  tealet_main_t *g_main = TEALET_GET_MAIN(target);
+  tealet_sub_t *g_target = (tealet_sub_t *)target;
+  tealet_sub_t *g_current = g_main->g_current;
+  char *stop = g_target->stack_far;
+  char *sp = (char *)&stop; /* close enough to the caller's stack pointer */
+  char *to;
+  tealet_stack_t *list;
+  ptrdiff_t size;
+  size_t cost = 0;
+
+  if (g_target == g_current || (g_target->flags & TEALET_TFLAGS_EXITED) || tealet_is_defunct(g_target))
+    return 0;
+
+  /* the current stack is saved up to the target's far boundary */
+  to = STACKMAN_SP_LE(g_current->stack_far, stop) ? g_current->stack_far : stop;
+  size = STACKMAN_SP_DIFF(to, sp);
+  if (size > 0)
+    cost += (size_t)size;
+
+  /* partially saved stacks still on the C stack are grown to the same point */
+  for (list = g_main->g_prev; list != NULL; list = list->next) {
+    if (list == g_target->stack && list->refcount == 1)
+      break;
+    to = STACKMAN_SP_LE(list->stack_far, stop) ? list->stack_far : stop;
+    size = STACKMAN_SP_DIFF(to, list->chunk.stack_near);
+    if (size > (ptrdiff_t)list->saved)
+      cost += (size_t)size - list->saved;
+    if (list == g_target->stack)
+      break;
+  }
+
+  /* and the target's saved stack is copied back */
+  if (g_target->stack != NULL)
+    cost += g_target->stack->saved;
+  return cost;
+}
+
 void *tealet_get_far(tealet_t *_tealet) {
   tealet_sub_t *tealet = (tealet_sub_t *)_tealet;
   return tealet->stack_far;
 }
 
+size_t tealet_get_extrasize(tealet_t *_tealet) {
+  tealet_sub_t *tealet = (tealet_sub_t *)_tealet;
+  return TEALET_EXTRASIZE(TEALET_GET_MAIN(tealet), tealet);
+}
+
+#if TEALET_WITH_STATS && TEALET_WITH_STATS_VERIFY
+/** Add the expanded and naive sizes of a tealet's saved stack */
+static void tealet_stats_measure(tealet_sub_t *t, size_t *expanded, size_t *naive) {
+  tealet_stack_t *stack = t->stack;
+  tealet_chunk_t *chunk;
+  size_t this_naive = 0;
+  size_t this_expanded = 0;
+  size_t extent;
+  void *effective_far;
+
+  /* Compute the effective "far" boundary for naive calculation */
+  if (stack->stack_far == STACKMAN_SP_FURTHEST) {
+    /* For unbounded stacks, recompute the furthest point from actual chunks
+     */
+    /* Compute far = near + size for the initial chunk */
+    effective_far = (void *)STACKMAN_SP_ADD((ptrdiff_t)stack->chunk.stack_near, (ptrdiff_t)stack->chunk.size);
+    chunk = stack->chunk.next;
+    while (chunk) {
+      /* Compute far for this chunk and keep the furthest */
+      void *chunk_far = (void *)STACKMAN_SP_ADD((ptrdiff_t)chunk->stack_near, (ptrdiff_t)chunk->size);
+      if (STACKMAN_SP_DIFF((ptrdiff_t)chunk_far, (ptrdiff_t)effective_far) > 0)
+        effective_far = chunk_far;
+      chunk = chunk->next;
+    }
+  } else {
+    /* For bounded stacks, use the recorded far boundary */
+    effective_far = stack->stack_far;
+  }
+
+  /* Compute naive size: extent from effective_far to near, plus overhead */
+  extent = (size_t)STACKMAN_SP_DIFF((ptrdiff_t)effective_far, (ptrdiff_t)stack->chunk.stack_near);
+  this_naive = offsetof(tealet_stack_t, chunk.data[0]) + extent;
+  *naive += this_naive;
+
+  /* Add up all chunk allocations for this tealet (counts shared chunks
+   * multiple times) */
+  /* Initial chunk is part of stack structure */
+  this_expanded = tealet_stack_blocksize(stack);
+
+  /* Count additional chunks */
+  chunk = stack->chunk.next;
+  while (chunk) {
+    this_expanded += offsetof(tealet_chunk_t, data[0]) + chunk->size;
+    chunk = chunk->next;
+  }
+  *expanded += this_expanded;
+}
+
+/** Recompute the expanded and naive stack sizes by walking all tealets and
+ * check them against the incrementally maintained totals.
+ */
+static void tealet_stats_verify(tealet_main_t *tmain) {
+  size_t expanded = 0;
+  size_t naive = 0;
+  tealet_sub_t *start = (tealet_sub_t *)tmain;
+  tealet_sub_t *t = start;
+  tealet_handle_t i;
+
+  /* Walk the circular list of all tealets */
+  do {
+    /* Count tealets with saved stacks (current tealet won't have stack saved)
+     */
+    if (t->stack)
+      tealet_stats_measure(t, &expanded, &naive);
+    t = t->next_tealet;
+  } while (t != start);
+  /* then the compact table, which holds tealets not on the list */
+  for (i = 0; i < tmain->g_table_top; i++) {
+    t = TEALET_TABLE_RECORD(tmain, i);
+    if (t->base.main != NULL && t->stack)
+      tealet_stats_measure(t, &expanded, &naive);
+  }
+  assert(expanded == tmain->g_stack_bytes_expanded);
+  assert(naive == tmain->g_stack_bytes_naive);
+  (void)expanded;
+  (void)naive;
+}
+#endif
+
 void tealet_get_stats(tealet_t *tealet, tealet_stats_t *stats) {
 #if !TEALET_WITH_STATS
   (void)tealet; /* unused */
@@ -2063,68 +3215,26 @@ void tealet_get_stats(tealet_t *tealet, tealet_stats_t *stats) {
   stats->blocks_allocated = tmain->g_blocks_allocated;
   stats->blocks_allocated_peak = tmain->g_blocks_allocated_peak;
   stats->blocks_allocated_total = tmain->g_blocks_allocated_total;
+  stats->freelist_count = tmain->g_freelist_count;
+  stats->freelist_reused = tmain->g_freelist_reused;
+  stats->arena_bytes = tmain->g_arena_bytes;
+  stats->arena_used = tmain->g_arena_used;
 
   /* Stack memory storage statistics - from tracked values */
   stats->stack_bytes = tmain->g_stack_bytes;
   stats->stack_count = tmain->g_stack_count;
   stats->stack_chunk_count = tmain->g_stack_chunk_count;
 
-  /* Compute expanded and naive sizes by walking all tealets */
-  stats->stack_bytes_expanded = 0;
-  stats->stack_bytes_naive = 0;
+  stats->stack_bytes_expanded = tmain->g_stack_bytes_expanded;
+  stats->stack_bytes_naive = tmain->g_stack_bytes_naive;
 
-  /* Walk the circular list of all tealets */
-  tealet_sub_t *start = (tealet_sub_t *)tmain;
-  tealet_sub_t *t = start;
-  do {
-    /* Count tealets with saved stacks (current tealet won't have stack saved)
-     */
-    if (t->stack) {
-      tealet_stack_t *stack = t->stack;
-      tealet_chunk_t *chunk;
-      size_t this_naive = 0;
-      size_t this_expanded = 0;
-      void *effective_far;
-
-      /* Compute the effective "far" boundary for naive calculation */
-      if (stack->stack_far == STACKMAN_SP_FURTHEST) {
-        /* For unbounded stacks, recompute the furthest point from actual chunks
-         */
-        /* Compute far = near + size for the initial chunk */
-        effective_far = (void *)STACKMAN_SP_ADD((ptrdiff_t)stack->chunk.stack_near, (ptrdiff_t)stack->chunk.size);
-        chunk = stack->chunk.next;
-        while (chunk) {
-          /* Compute far for this chunk and keep the furthest */
-          void *chunk_far = (void *)STACKMAN_SP_ADD((ptrdiff_t)chunk->stack_near, (ptrdiff_t)chunk->size);
-          if (STACKMAN_SP_DIFF((ptrdiff_t)chunk_far, (ptrdiff_t)effective_far) > 0)
-            effective_far = chunk_far;
-          chunk = chunk->next;
-        }
-      } else {
-        /* For bounded stacks, use the recorded far boundary */
-        effective_far = stack->stack_far;
-      }
-
-      /* Compute naive size: extent from effective_far to near, plus overhead */
-      size_t extent = (size_t)STACKMAN_SP_DIFF((ptrdiff_t)effective_far, (ptrdiff_t)stack->chunk.stack_near);
-      this_naive = offsetof(tealet_stack_t, chunk.data[0]) + extent;
-      stats->stack_bytes_naive += this_naive;
-
-      /* Add up all chunk allocations for this tealet (counts shared chunks
-       * multiple times) */
-      /* Initial chunk is part of stack structure */
-      this_expanded = offsetof(tealet_stack_t, chunk.data[0]) + stack->chunk.size;
-
-      /* Count additional chunks */
-      chunk = stack->chunk.next;
-      while (chunk) {
-        this_expanded += offsetof(tealet_chunk_t, data[0]) + chunk->size;
-        chunk = chunk->next;
-      }
-      stats->stack_bytes_expanded += this_expanded;
-    }
-    t = t->next_tealet;
-  } while (t != start);
+  /* Cumulative stack copy statistics */
+  stats->n_switches = tmain->g_switches;
+  stats->stack_bytes_saved = tmain->g_bytes_saved;
+  stats->stack_bytes_restored = tmain->g_bytes_restored;
+#if TEALET_WITH_STATS_VERIFY
+  tealet_stats_verify(tmain);
+#endif
 #endif
 }
 
@@ -2133,9 +3243,7 @@ void tealet_reset_peak_stats(tealet_t *tealet) {
   tealet_main_t *tmain = TEALET_GET_MAIN(tealet);
   tmain->g_bytes_allocated_peak = tmain->g_bytes_allocated;
   tmain->g_blocks_allocated_peak = tmain->g_blocks_allocated;
-  /* Note: We don't track stack_bytes_naive_peak as it would require walking
-   * all tealets on every allocation. stack_bytes_naive is computed on demand.
-   */
+  /* stack_bytes_expanded and stack_bytes_naive have no peak counterparts */
 #else
   (void)tealet; /* unused */
 #endif
@@ -2284,18 +3392,236 @@ int tealet_configure_check_stack(tealet_t *_tealet, size_t stack_integrity_bytes
   return tealet_configure_set(_tealet, &cfg);
 }
 
+/* ----------------------------------------------------------------
+ * Public API - scratch ranges
+ */
+
+int tealet_scratch_register(tealet_t *tealet, void *begin, size_t size) {
+  tealet_main_t *g_main = TEALET_GET_MAIN(tealet);
+  tealet_sub_t *g_current = (tealet_sub_t *)tealet;
+  tealet_scratch_t *scratch;
+  tealet_cold_t *cold;
+
+  if (g_current != g_main->g_current || begin == NULL || size == 0)
+    return TEALET_ERR_INVAL;
+  cold = tealet_cold_get(g_main, g_current);
+  if (cold == NULL)
+    return TEALET_ERR_MEM;
+  scratch = cold->scratch;
+  if (scratch == NULL) {
+    scratch = (tealet_scratch_t *)tealet_int_malloc(g_main, sizeof(tealet_scratch_t), TEALET_ALLOC_PURPOSE_TEALET);
+    if (scratch == NULL)
+      return TEALET_ERR_MEM;
+    STATS_ADD_ALLOC(g_main, sizeof(tealet_scratch_t));
+    scratch->count = 0;
+    cold->scratch = scratch;
+  }
+  if (scratch->count == TEALET_SCRATCH_MAX)
+    return TEALET_ERR_MEM;
+  scratch->range[scratch->count].begin = (char *)begin;
+  scratch->range[scratch->count].size = size;
+  scratch->count++;
+  return 0;
+}
+
+int tealet_scratch_unregister(tealet_t *tealet, void *begin) {
+  tealet_main_t *g_main = TEALET_GET_MAIN(tealet);
+  tealet_sub_t *g_current = (tealet_sub_t *)tealet;
+  tealet_scratch_t *scratch = TEALET_COLD(g_current, scratch, NULL);
+  size_t i;
+
+  if (g_current != g_main->g_current || scratch == NULL)
+    return TEALET_ERR_INVAL;
+  /* search from the most recent registration */
+  for (i = scratch->count; i > 0; i--) {
+    if (scratch->range[i - 1].begin == (char *)begin) {
+      memmove(&scratch->range[i - 1], &scratch->range[i], (scratch->count - i) * sizeof(scratch->range[0]));
+      scratch->count--;
+      return 0;
+    }
+  }
+  return TEALET_ERR_INVAL;
+}
+
+/* ----------------------------------------------------------------
+ * Public API - per-tealet arenas
+ */
+
+void *tealet_arena_alloc(tealet_t *tealet, size_t size) {
+  tealet_main_t *g_main = TEALET_GET_MAIN(tealet);
+  tealet_sub_t *g = (tealet_sub_t *)tealet;
+  tealet_arena_t *block = TEALET_COLD(g, arena, NULL);
+  char *p;
+
+  if (size == 0)
+    size = 1;
+  if (size > (size_t)-1 - TEALET_ARENA_BLOCK)
+    return NULL;
+  size = TEALET_ALIGN_UP(size, TEALET_SLAB_ALIGN);
+  if (block == NULL || block->size - block->used < size) {
+    size_t bsize = TEALET_ARENA_BLOCK - TEALET_ARENA_HEAD;
+    int large = (size > bsize / 2);
+    tealet_arena_t *fresh;
+
+    if (size > bsize)
+      bsize = size;
+    if (tealet_cold_get(g_main, g) == NULL)
+      return NULL;
+    fresh = (tealet_arena_t *)tealet_int_malloc(g_main, TEALET_ARENA_HEAD + bsize, TEALET_ALLOC_PURPOSE_ARENA);
+    if (fresh == NULL)
+      return NULL;
+    STATS_ADD_ALLOC(g_main, TEALET_ARENA_HEAD + bsize);
+#if TEALET_WITH_STATS
+    g_main->g_arena_bytes += bsize;
+#endif
+    fresh->size = bsize;
+    fresh->used = 0;
+    if (large && block != NULL && block->size - block->used >= TEALET_ARENA_BLOCK / 4) {
+      /* a large request gets its own block behind the current one, so the
+       * room left in the current block is not wasted
+       */
+      fresh->next = block->next;
+      block->next = fresh;
+      block = fresh;
+    } else {
+      fresh->next = block;
+      g->cold->arena = block = fresh;
+    }
+  }
+  p = (char *)block + TEALET_ARENA_HEAD + block->used;
+  block->used += size;
+#if TEALET_WITH_STATS
+  g_main->g_arena_used += size;
+#endif
+  return p;
+}
+
+size_t tealet_arena_usage(tealet_t *tealet, size_t *reserved) {
+  tealet_arena_t *block;
+  size_t used = 0;
+  size_t total = 0;
+
+  for (block = TEALET_COLD((tealet_sub_t *)tealet, arena, NULL); block != NULL; block = block->next) {
+    used += block->used;
+    total += block->size;
+  }
+  if (reserved != NULL)
+    *reserved = total;
+  return used;
+}
+
+void tealet_arena_release(tealet_t *tealet) {
+  tealet_arena_free(TEALET_GET_MAIN(tealet), (tealet_sub_t *)tealet);
+}
+
+/* ----------------------------------------------------------------
+ * Public API - accounting groups
+ */
+
+void tealet_group_init(tealet_group_t *group, size_t quota) {
+  memset(group, 0, sizeof(*group));
+  group->quota = quota;
+}
+
+int tealet_group_add(tealet_group_t *group, tealet_t *tealet) {
+  tealet_sub_t *g_tealet = (tealet_sub_t *)tealet;
+
+  if (TEALET_IS_MAIN(tealet) || !TEALET_IS_UNBOUND(g_tealet) || TEALET_COLD(g_tealet, group, NULL) != NULL)
+    return TEALET_ERR_INVAL;
+  if (tealet_cold_get(TEALET_GET_MAIN(g_tealet), g_tealet) == NULL)
+    return TEALET_ERR_MEM;
+  g_tealet->cold->group = group;
+  group->n_tealets++;
+  return 0;
+}
+
+tealet_group_t *tealet_get_group(tealet_t *tealet) {
+  return TEALET_COLD((tealet_sub_t *)tealet, group, NULL);
+}
+
+/* ----------------------------------------------------------------
+ * Public API - compact mode
+ */
+
+int tealet_set_compact(tealet_t *tealet) {
+  tealet_main_t *g_main = TEALET_GET_MAIN(tealet);
+
+  if (!TEALET_IS_MAIN(tealet))
+    return TEALET_ERR_INVAL;
+  if (g_main->g_compact)
+    return 0;
+  /* existing tealets keep their own blocks and stay on the list */
+  g_main->g_table_stride = TEALET_ALIGN_UP(offsetof(tealet_nonmain_t, _extra) + g_main->g_extrasize, TEALET_SLAB_ALIGN);
+  g_main->g_compact = 1;
+  return 0;
+}
+
+tealet_handle_t tealet_get_handle(tealet_t *tealet) {
+  return ((tealet_sub_t *)tealet)->handle;
+}
+
+tealet_t *tealet_from_handle(tealet_t *tealet, tealet_handle_t handle) {
+  tealet_main_t *g_main = TEALET_GET_MAIN(tealet);
+  tealet_sub_t *t;
+
+  if (handle >= g_main->g_table_top)
+    return NULL;
+  t = TEALET_TABLE_RECORD(g_main, handle);
+  if (t->base.main == NULL)
+    return NULL;
+  return (tealet_t *)t;
+}
+
+tealet_handle_t tealet_handle_limit(tealet_t *tealet) {
+  return TEALET_GET_MAIN(tealet)->g_table_top;
+}
+
 /* ----------------------------------------------------------------
  * Public API - utility helpers
  */
 
 void *tealet_malloc(tealet_t *tealet, size_t s) {
   tealet_main_t *g_main = TEALET_GET_MAIN(tealet);
-  return tealet_int_malloc(g_main, s);
+  return tealet_int_malloc(g_main, s, TEALET_ALLOC_PURPOSE_USER);
 }
 
 void tealet_free(tealet_t *tealet, void *p) {
   tealet_main_t *g_main = TEALET_GET_MAIN(tealet);
-  tealet_int_free(g_main, p);
+  tealet_int_free(g_main, p, TEALET_ALLOC_PURPOSE_USER);
+}
+
+void *tealet_malloc_aligned(tealet_t *tealet, size_t s, size_t align) {
+  tealet_main_t *g_main = TEALET_GET_MAIN(tealet);
+  char *raw;
+  char *p;
+
+  if (align == 0 || (align & (align - 1)) != 0)
+    return NULL;
+  if (g_main->g_alloc2.malloc_p != NULL)
+    return g_main->g_alloc2.malloc_p(s, align, TEALET_ALLOC_PURPOSE_USER, g_main->g_alloc2.context);
+
+  /* over-allocate and keep the original pointer just below the block */
+  if (align < sizeof(void *))
+    align = sizeof(void *);
+  if (s > (size_t)-1 - align - sizeof(void *))
+    return NULL;
+  raw = (char *)tealet_int_malloc(g_main, s + align - 1 + sizeof(void *), TEALET_ALLOC_PURPOSE_USER);
+  if (raw == NULL)
+    return NULL;
+  p = (char *)(((uintptr_t)(raw + sizeof(void *)) + (align - 1)) & ~(uintptr_t)(align - 1));
+  ((void **)p)[-1] = raw;
+  return p;
+}
+
+void tealet_free_aligned(tealet_t *tealet, void *p) {
+  tealet_main_t *g_main = TEALET_GET_MAIN(tealet);
+
+  if (p == NULL)
+    return;
+  if (g_main->g_alloc2.malloc_p != NULL)
+    tealet_int_free(g_main, p, TEALET_ALLOC_PURPOSE_USER);
+  else
+    tealet_int_free(g_main, ((void **)p)[-1], TEALET_ALLOC_PURPOSE_USER);
 }
 
 void tealet_lock(tealet_t *tealet) {
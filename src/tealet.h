@@ -31,6 +31,10 @@
 #define TEALET_API
 #endif
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /** A structure to define the memory allocation api used.
  * the functions have C89 semantics and take an additional "context"
  * pointer that they can use as they please
@@ -58,8 +62,8 @@ typedef struct tealet_alloc_t {
  *
  * In #TEALET_LOCK_AUTO mode, libtealet automatically acquires/releases this
  * lock for key lifecycle/transfer operations: tealet_new(), tealet_run(),
- * tealet_fork(), tealet_switch(), tealet_exit(), tealet_duplicate(), and
- * tealet_delete().
+ * tealet_spawn_many(), tealet_fork(), tealet_switch(), tealet_exit(),
+ * tealet_duplicate(), tealet_delete(), tealet_rebind(), and tealet_reset().
  *
  * In #TEALET_LOCK_OFF mode, libtealet never auto-locks; callers are fully
  * responsible for lock scopes.
@@ -95,9 +99,56 @@ typedef struct tealet_lock_t {
 #define TEALET_ALLOC_MALLOC(alloc, size) (alloc)->malloc_p((size), (alloc)->context)
 #define TEALET_ALLOC_FREE(alloc, ptr) (alloc)->free_p((ptr), (alloc)->context)
 
+/** Allocation purpose tags passed to the version 2 allocator callbacks, so
+ * that an allocator can route each class of block to a different arena.
+ */
+typedef enum tealet_alloc_purpose_t {
+  TEALET_ALLOC_PURPOSE_TEALET = 0,       /* tealet objects, batch slabs, scratch tables */
+  TEALET_ALLOC_PURPOSE_STACK_HEADER = 1, /* saved stack header with its first chunk */
+  TEALET_ALLOC_PURPOSE_CHUNK = 2,        /* additional saved stack chunks */
+  TEALET_ALLOC_PURPOSE_SNAPSHOT = 3,     /* stack integrity snapshot workspace */
+  TEALET_ALLOC_PURPOSE_USER = 4,         /* tealet_malloc() and tealet_malloc_aligned() */
+  TEALET_ALLOC_PURPOSE_ARENA = 5,        /* per-tealet arena blocks */
+} tealet_alloc_purpose_t;
+
+/** Version 2 allocator callbacks.
+ *
+ * malloc_p receives the requested alignment, which is 0 for the default
+ * alignment of malloc() or otherwise a power of two.  realloc_p is optional;
+ * when present, it is only called for blocks allocated with the default
+ * alignment and must leave the block untouched when it returns NULL.
+ * All callbacks receive the purpose the block was allocated with.
+ * The threading contract is the same as for tealet_alloc_t.
+ */
+typedef void *(*tealet_malloc2_t)(size_t size, size_t align, tealet_alloc_purpose_t purpose, void *context);
+typedef void *(*tealet_realloc2_t)(void *ptr, size_t size, tealet_alloc_purpose_t purpose, void *context);
+typedef void (*tealet_free2_t)(void *ptr, tealet_alloc_purpose_t purpose, void *context);
+
+/** Versioned allocator interface used with tealet_initialize2().
+ * 'size' must be set to sizeof(tealet_alloc2_t) and 'version' to
+ * TEALET_ALLOC2_CURRENT_VERSION; fields unknown to the library are ignored.
+ */
+typedef struct tealet_alloc2_t {
+  size_t size;
+  unsigned int version;
+  tealet_malloc2_t malloc_p;
+  tealet_realloc2_t realloc_p; /* optional, may be NULL */
+  tealet_free2_t free_p;
+  void *context;
+} tealet_alloc2_t;
+
+/* version 2 allocator structure versioning */
+#define TEALET_ALLOC2_VERSION_1 1
+#define TEALET_ALLOC2_CURRENT_VERSION TEALET_ALLOC2_VERSION_1
+
+/** use the following macro to initialize a tealet_alloc2_t structure */
+#define TEALET_ALLOC2_INIT(malloc_fn, realloc_fn, free_fn, context)                                                   \
+  { sizeof(tealet_alloc2_t), TEALET_ALLOC2_CURRENT_VERSION, (malloc_fn), (realloc_fn), (free_fn), (context) }
+
 /** The user-visible tealet structure.  If an "extrasize" is provided when
  * the main tealet was initialized, "extra" points to a private block of
- * that size, otherwise it is initialized to NULL
+ * that size, otherwise it is initialized to NULL.  Tealets created with
+ * tealet_new_ex() carry an extra block of their own requested size.
  */
 typedef struct tealet_t {
   struct tealet_t *const main; /* pointer to the main tealet */
@@ -198,16 +249,61 @@ typedef struct tealet_config_t {
 TEALET_API
 tealet_t *tealet_initialize(tealet_alloc_t *alloc, size_t extrasize);
 
+/**
+ * @brief Initialize libtealet with a version 2 allocator.
+ * @param alloc Versioned allocator interface, see tealet_alloc2_t.
+ * @param extrasize Default extra bytes reserved for user payload in each tealet.
+ * @return Main tealet for this thread, or NULL on failure or if @p alloc is
+ *         invalid (too small, unknown version, or missing malloc_p/free_p).
+ *
+ * Same as tealet_initialize(), but every internal allocation is tagged with
+ * a #tealet_alloc_purpose_t, and saved stacks are grown in place with
+ * realloc_p when it is provided.
+ */
+TEALET_API
+tealet_t *tealet_initialize2(const tealet_alloc2_t *alloc, size_t extrasize);
+
 /**
  * @brief Destroy a previously initialized main tealet.
  * @param tealet Main tealet returned by tealet_initialize().
  *
- * @warning This does not delete child tealets. Delete all non-main tealets first.
+ * @warning This does not delete child tealets. Delete all non-main tealets first,
+ *          or use tealet_finalize_all().
  * @warning After finalize returns, all handles associated with that main tealet are invalid.
  */
 TEALET_API
 void tealet_finalize(tealet_t *tealet);
 
+/**
+ * @brief Destroy a main tealet together with all of its child tealets.
+ * @param tealet Main tealet returned by tealet_initialize().
+ *
+ * Equivalent to calling tealet_delete() on every remaining non-main tealet
+ * of the domain followed by tealet_finalize(), but done in a single pass.
+ * Must be called while the main tealet is current.
+ *
+ * @warning After this returns, all handles associated with that main tealet are invalid.
+ */
+TEALET_API
+void tealet_finalize_all(tealet_t *tealet);
+
+/**
+ * @brief Release all child tealets of a domain and keep the main tealet.
+ * @param tealet Main tealet returned by tealet_initialize().
+ * @return 0 on success, #TEALET_ERR_INVAL if @p tealet is not the main tealet
+ *         or the main tealet is not current.
+ *
+ * Every non-main tealet and its saved stack is released, as with
+ * tealet_delete().  The main tealet, its configuration, locking callbacks,
+ * user data and internal block caches stay in place, so the domain can be
+ * reused without another tealet_initialize().  Registered scratch ranges of
+ * the main tealet are cleared.
+ *
+ * @warning All handles to non-main tealets of the domain are invalid afterwards.
+ */
+TEALET_API
+int tealet_reset(tealet_t *tealet);
+
 /**
  * @brief Allocate a new unbound tealet object.
  * @param tealet Main/related tealet context used for allocation and ownership.
@@ -220,6 +316,21 @@ void tealet_finalize(tealet_t *tealet);
 TEALET_API
 tealet_t *tealet_new(tealet_t *tealet);
 
+/**
+ * @brief Allocate a new unbound tealet with its own extra-area size.
+ * @param tealet Main/related tealet context used for allocation and ownership.
+ * @param extrasize Size of the tealet's extra area; 0 leaves `extra` NULL.
+ * @return Newly allocated unbound tealet, or NULL on allocation failure.
+ *
+ * Like tealet_new(), but the extra area is sized for this tealet instead of
+ * using the domain default passed to tealet_initialize(). This lets domains
+ * with a few large-payload tealet types keep small tealets small.
+ * tealet_duplicate() preserves the size, and tealet_get_extrasize() reports
+ * it.
+ */
+TEALET_API
+tealet_t *tealet_new_ex(tealet_t *tealet, size_t extrasize);
+
 /* start mode flags shared by tealet_run() and tealet_fork() */
 #define TEALET_START_DEFAULT 0 /* capture initial stack state, do not switch to target */
 #define TEALET_START_SWITCH 1  /* capture initial stack state and immediately switch to target */
@@ -250,6 +361,35 @@ tealet_t *tealet_new(tealet_t *tealet);
 TEALET_API
 int tealet_run(tealet_t *tealet, tealet_run_t run, void **parg, void *stack_far, int flags);
 
+/**
+ * @brief Create many tealets bound to the same run function in one call.
+ * @param tealet Main/related tealet context used for allocation and ownership.
+ * @param n Number of tealets to create.
+ * @param run Callable entry function for all created tealets.
+ * @param args Optional array of @p n run arguments; may be NULL.
+ * @param out Array of @p n pointers receiving the created tealets.
+ * @retval 0 Success.
+ * @retval TEALET_ERR_INVAL @p run is NULL or @p n exceeds INT_MAX.
+ * @retval TEALET_ERR_MEM The slab or the initial stack capture could not be allocated.
+ *
+ * This is equivalent to calling tealet_new() and
+ * tealet_run(..., #TEALET_START_DEFAULT) @p n times from the same call site,
+ * but much cheaper for large worker pools: the tealets are allocated in a
+ * single slab and share one initial stack capture (reference counted).
+ *
+ * Each tealet starts on its first tealet_switch(). If @p args is non-NULL,
+ * tealet @c out[i] is run with @c args[i] and the argument of the first
+ * switch is ignored; otherwise the first switch argument is passed to
+ * @p run, as with #TEALET_START_DEFAULT.
+ *
+ * The created tealets are independent and are deleted individually; the slab
+ * memory is released together with the last of them. Duplicates of a
+ * created tealet are ordinary tealets and always receive their first switch
+ * argument.
+ */
+TEALET_API
+int tealet_spawn_many(tealet_t *tealet, size_t n, tealet_run_t run, void **args, tealet_t **out);
+
 /**
  * @brief Fork the active tealet by duplicating its execution state.
  * @param tealet NEW/unbound tealet (from tealet_new()) to become the fork child.
@@ -392,6 +532,25 @@ tealet_t *tealet_duplicate(tealet_t *tealet);
 TEALET_API
 void tealet_delete(tealet_t *target);
 
+/**
+ * @brief Return an exited tealet to the NEW/unbound state for reuse.
+ * @param tealet Exited non-main tealet.
+ * @return 0 on success, #TEALET_ERR_INVAL if @p tealet has not exited.
+ *
+ * Reuse a tealet that exited with tealet_exit() (without
+ * #TEALET_EXIT_DELETE) instead of deleting it and allocating a new one.
+ * After a successful call, tealet_status() reports #TEALET_STATUS_NEW and
+ * the tealet can be bound again with tealet_run() or tealet_fork().
+ * The extra payload area (`extra`) is left unchanged.
+ *
+ * Deleted tealets are recycled internally as well: released tealet blocks are
+ * kept on a small per-domain freelist (see `freelist_count` and
+ * `freelist_reused` in #tealet_stats_t) and reused by tealet_new() and
+ * tealet_duplicate().
+ */
+TEALET_API
+int tealet_rebind(tealet_t *tealet);
+
 /* ----------------------------------------------------------------
  * Public API - status and query
  */
@@ -461,6 +620,21 @@ int tealet_status(tealet_t *tealet);
 TEALET_API
 size_t tealet_get_stacksize(tealet_t *tealet);
 
+/**
+ * @brief Estimate the stack bytes a switch from the current tealet would copy.
+ * @param target Prospective switch target in the same domain.
+ * @return Estimated bytes saved and restored, or 0 if @p target is current,
+ *         exited or defunct.
+ *
+ * A switch saves the current stack and grows partially saved stacks up to
+ * the target's far boundary, then restores the target's saved stack.
+ * Targets whose stack region does not overlap the live stack are therefore
+ * cheap. Schedulers can use this to prefer cheap targets; the estimate
+ * ignores scratch holes and chunk headers.
+ */
+TEALET_API
+size_t tealet_switch_cost(tealet_t *target);
+
 /**
  * @brief Get a tealet's far stack boundary marker.
  * @param tealet Target tealet.
@@ -473,6 +647,14 @@ size_t tealet_get_stacksize(tealet_t *tealet);
 TEALET_API
 void *tealet_get_far(tealet_t *tealet);
 
+/**
+ * @brief Return the size of a tealet's extra area.
+ * @param tealet Tealet to query.
+ * @return Size in bytes of the block at `tealet->extra` (0 when NULL).
+ */
+TEALET_API
+size_t tealet_get_extrasize(tealet_t *tealet);
+
 /* Aggregate resource statistics for a main-tealet domain. */
 typedef struct tealet_stats_t {
   /* Basic tealet counts */
@@ -485,6 +667,10 @@ typedef struct tealet_stats_t {
   size_t blocks_allocated;       /* Current number of allocated stack blocks */
   size_t blocks_allocated_peak;  /* Peak number of allocated stack blocks */
   size_t blocks_allocated_total; /* Total allocation calls */
+  size_t freelist_count;         /* Released tealet blocks kept for reuse */
+  size_t freelist_reused;        /* Tealet allocations served from the freelist */
+  size_t arena_bytes;            /* Bytes reserved in per-tealet arena blocks */
+  size_t arena_used;             /* Bytes handed out by tealet_arena_alloc() */
 
   /* stack memory storage statistics */
   size_t stack_bytes;          /* Bytes used for stack storage */
@@ -492,6 +678,11 @@ typedef struct tealet_stats_t {
   size_t stack_bytes_naive;    /* Bytes used for stack if we stored stack naively */
   size_t stack_count;          /* Number of currently stored unique stacks */
   size_t stack_chunk_count;    /* Number of currently stored unique stack chunks */
+
+  /* cumulative stack copy statistics */
+  size_t n_switches;           /* Completed stack switches */
+  size_t stack_bytes_saved;    /* Bytes copied from the C stack to the heap */
+  size_t stack_bytes_restored; /* Bytes copied from the heap back to the C stack */
 } tealet_stats_t;
 
 TEALET_API
@@ -611,8 +802,9 @@ int tealet_configure_set(tealet_t *tealet, tealet_config_t *config);
  * Automatic locking mode is selected by locking->mode:
  * - #TEALET_LOCK_OFF: no internal auto-locking,
  * - #TEALET_LOCK_AUTO: auto-locking for key lifecycle/transfer operations
- *   (tealet_new(), tealet_run(), tealet_fork(), tealet_switch(),
- *   tealet_exit(), tealet_duplicate(), tealet_delete()).
+ *   (tealet_new(), tealet_run(), tealet_spawn_many(), tealet_fork(),
+ *   tealet_switch(), tealet_exit(), tealet_duplicate(), tealet_delete(),
+ *   tealet_rebind(), tealet_reset()).
  *
  * Returns #TEALET_ERR_INVAL when locking is non-NULL and locking->mode is not
  * #TEALET_LOCK_OFF or #TEALET_LOCK_AUTO.
@@ -646,6 +838,11 @@ int tealet_configure_set_locking(tealet_t *tealet, const tealet_lock_t *locking)
  * If stack_integrity_bytes is 0, a default window of one OS memory page is
  * used where available.
  *
+ * The window lies just past the far end of the running tealet's stack, in
+ * the frames of the function that started it.  While checks are on, a
+ * tealet must not access those locals: with the no-access guard a read
+ * faults whenever it lands on a guarded page.
+ *
  * Note: this helper sets stack_guard_limit to a local stack marker inside this
  * function. For best results, call it from a program top-level function whose
  * frame should remain within the intended stack region for switched tealets.
@@ -660,6 +857,193 @@ int tealet_configure_set_locking(tealet_t *tealet, const tealet_lock_t *locking)
 TEALET_API
 int tealet_configure_check_stack(tealet_t *tealet, size_t stack_integrity_bytes);
 
+/* ----------------------------------------------------------------
+ * Public API - scratch ranges
+ */
+
+/**
+ * @brief Exclude a stack range of the current tealet from stack saves.
+ * @param tealet The current tealet.
+ * @param begin Lowest address of the range, typically a local buffer.
+ * @param size Size of the range in bytes.
+ * @return 0 on success, #TEALET_ERR_INVAL if @p tealet is not current or the
+ * range is empty, #TEALET_ERR_MEM on allocation failure or when the per-tealet
+ * limit of registered ranges is reached.
+ *
+ * Declares that the contents of a stack buffer of the current tealet are dead
+ * across switches.  While registered, the bytes in the range are not copied
+ * when the tealet's stack is saved, and are left untouched when it is
+ * restored, so they hold indeterminate data after every switch. This is
+ * intended for large on-stack scratch buffers (parsers, compressors) whose
+ * contents are only used between switches.
+ *
+ * Registrations belong to the tealet and are inherited by tealet_duplicate()
+ * and tealet_fork(). They must be removed with tealet_scratch_unregister()
+ * before the buffer goes out of scope.
+ */
+TEALET_API
+int tealet_scratch_register(tealet_t *tealet, void *begin, size_t size);
+
+/**
+ * @brief Remove a scratch range registered with tealet_scratch_register().
+ * @param tealet The current tealet.
+ * @param begin The @p begin address used at registration.
+ * @return 0 on success, #TEALET_ERR_INVAL if no such range is registered.
+ */
+TEALET_API
+int tealet_scratch_unregister(tealet_t *tealet, void *begin);
+
+/* ----------------------------------------------------------------
+ * Public API - per-tealet arenas
+ */
+
+/**
+ * @brief Allocate memory from a tealet's bump arena.
+ * @param tealet Tealet owning the memory; any tealet in the domain.
+ * @param size Byte count.
+ * @return Block aligned for any basic type, or NULL on allocation failure.
+ *
+ * Arena memory is carved from blocks obtained from the domain allocator
+ * and cannot be freed individually. All of it is released in one step when
+ * @p tealet exits, is deleted, or tealet_arena_release() is called; the main
+ * tealet's arena is released by tealet_reset() and finalization.
+ *
+ * Memory passed as the exit argument must not come from the exiting
+ * tealet's arena. Allocate payloads for another tealet from the receiver's
+ * arena instead. Duplicated and forked tealets start with an empty arena.
+ */
+TEALET_API
+void *tealet_arena_alloc(tealet_t *tealet, size_t size);
+
+/**
+ * @brief Query arena usage of a tealet.
+ * @param tealet Any tealet in the domain.
+ * @param reserved If non-NULL, receives the bytes reserved in arena blocks.
+ * @return Bytes handed out by tealet_arena_alloc() and not yet released.
+ */
+TEALET_API
+size_t tealet_arena_usage(tealet_t *tealet, size_t *reserved);
+
+/**
+ * @brief Release all arena memory of a tealet.
+ * @param tealet Any tealet in the domain.
+ */
+TEALET_API
+void tealet_arena_release(tealet_t *tealet);
+
+/* ----------------------------------------------------------------
+ * Public API - accounting groups
+ */
+
+/* Stack storage accounting for a set of tealets, e.g. one tenant.
+ * Owned by the caller and updated by the library; treat as read-only
+ * except for `quota`.
+ */
+typedef struct tealet_group_t {
+  size_t quota;            /* byte limit for stack_bytes, 0 for none */
+  size_t stack_bytes;      /* Bytes of saved stack storage charged to the group */
+  size_t stack_count;      /* Number of stored stacks charged to the group */
+  size_t chunk_count;      /* Number of stack chunks charged to the group */
+  size_t n_tealets;        /* Number of tealets in the group */
+  size_t n_quota_failures; /* Saves and spawns refused because of the quota */
+} tealet_group_t;
+
+/**
+ * @brief Initialize an accounting group.
+ * @param group Group to initialize.
+ * @param quota Maximum stack bytes the group may hold, or 0 for no limit.
+ */
+TEALET_API
+void tealet_group_init(tealet_group_t *group, size_t quota);
+
+/**
+ * @brief Assign a freshly created tealet to a group.
+ * @param group Group to join.
+ * @param tealet Tealet from tealet_new() or tealet_new_ex() that has not
+ *        been started yet.
+ * @return 0 on success, #TEALET_ERR_INVAL if @p tealet is the main tealet,
+ *         already running, or already in a group, #TEALET_ERR_MEM if
+ *         memory for the tealet's group link cannot be allocated.
+ *
+ * From then on every stack save made on behalf of @p tealet is charged to
+ * @p group. When @p tealet switches out, a save that would take the group
+ * over its quota fails with #TEALET_ERR_MEM, the same way as an allocation
+ * failure. Starting a tealet of a group that is at or above its quota also
+ * fails with #TEALET_ERR_MEM. Growing the partially saved stack of
+ * @p tealet while some other tealet switches is charged but never refused,
+ * so the group's stack_bytes may exceed its quota.
+ * Tealets made by tealet_duplicate() and tealet_fork() inherit the group.
+ *
+ * The group must stay valid until all its tealets have been deleted and
+ * its count fields have dropped to zero.
+ */
+TEALET_API
+int tealet_group_add(tealet_group_t *group, tealet_t *tealet);
+
+/**
+ * @brief Return the group of a tealet.
+ * @param tealet Tealet to query.
+ * @return The group set with tealet_group_add(), or NULL.
+ */
+TEALET_API
+tealet_group_t *tealet_get_group(tealet_t *tealet);
+
+/* ----------------------------------------------------------------
+ * Public API - compact mode
+ */
+
+/* Index of a tealet record in a domain's compact table */
+typedef unsigned int tealet_handle_t;
+
+/* Handle of tealets that are not in the compact table */
+#define TEALET_HANDLE_NONE ((tealet_handle_t)-1)
+
+/**
+ * @brief Allocate subsequent tealets of a domain from a compact table.
+ * @param tealet The main tealet.
+ * @return 0 on success, #TEALET_ERR_INVAL if @p tealet is not the main tealet.
+ *
+ * In compact mode, tealets with the domain's default extra size are carved
+ * from chunks of `TEALET_TABLE_CHUNK` fixed-size records (default 256) with
+ * the extra area inline, instead of one heap block each. Each record gets a
+ * 32-bit handle, its index in the table. Released records are reused, and
+ * the table is freed by tealet_finalize().
+ *
+ * Whole-domain walks, such as tealet_reset() and tealet_finalize_all(),
+ * sweep the table in address order. Tealets that already exist, tealets
+ * with another extra size, and tealet_spawn_many() members keep their own
+ * blocks. Compact mode cannot be switched off again.
+ */
+TEALET_API
+int tealet_set_compact(tealet_t *tealet);
+
+/**
+ * @brief Return the compact-table handle of a tealet.
+ * @param tealet Tealet to query.
+ * @return The handle, or #TEALET_HANDLE_NONE if @p tealet is not a table record.
+ */
+TEALET_API
+tealet_handle_t tealet_get_handle(tealet_t *tealet);
+
+/**
+ * @brief Look up a tealet by its compact-table handle.
+ * @param tealet Any tealet in the domain.
+ * @param handle Handle from tealet_get_handle().
+ * @return The live tealet in that record, or NULL if the record is free.
+ *
+ * Handles are reused once their tealet has been deleted.
+ */
+TEALET_API
+tealet_t *tealet_from_handle(tealet_t *tealet, tealet_handle_t handle);
+
+/**
+ * @brief Return one past the highest handle handed out so far.
+ * @param tealet Any tealet in the domain.
+ * @return Bound for enumerating the table with tealet_from_handle().
+ */
+TEALET_API
+tealet_handle_t tealet_handle_limit(tealet_t *tealet);
+
 /* ----------------------------------------------------------------
  * Public API - utility helpers
  */
@@ -685,6 +1069,28 @@ void *tealet_malloc(tealet_t *tealet, size_t s);
 TEALET_API
 void tealet_free(tealet_t *tealet, void *p);
 
+/**
+ * @brief Allocate aligned memory using the tealet-domain allocator.
+ * @param tealet Any tealet in the domain.
+ * @param s Byte count.
+ * @param align Alignment in bytes, a power of two.
+ * @return Allocated block or NULL.
+ *
+ * With a version 2 allocator the alignment is passed through to malloc_p.
+ * Otherwise the block is over-allocated and aligned by libtealet.
+ * Release the block with tealet_free_aligned().
+ */
+TEALET_API
+void *tealet_malloc_aligned(tealet_t *tealet, size_t s, size_t align);
+
+/**
+ * @brief Free memory allocated with tealet_malloc_aligned().
+ * @param tealet Any tealet in the domain.
+ * @param p Pointer returned by tealet_malloc_aligned(), or NULL.
+ */
+TEALET_API
+void tealet_free_aligned(tealet_t *tealet, void *p);
+
 /**
  * @brief Invoke configured lock callback for this tealet domain.
  * @param tealet Any tealet in the domain.
@@ -764,4 +1170,8 @@ void *tealet_new_probe(tealet_t *dummy1, tealet_run_t dummy2, void **dummy3, voi
 /* convenience access to a typecast extra pointer */
 #define TEALET_EXTRA(t, tp) ((tp *)((t)->extra))
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* _TEALET_H_ */
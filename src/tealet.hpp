@@ -0,0 +1,450 @@
+/**
+ * @file tealet.hpp
+ * @brief Header-only C++17 wrapper: RAII handles, typed tasks and generators.
+ */
+#ifndef _TEALET_HPP_
+#define _TEALET_HPP_
+
+#include "tealet.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace tealet {
+
+/** @brief Exception carrying a negative #TEALET_ERR_* code. */
+class error : public std::runtime_error {
+public:
+  explicit error(int code) : std::runtime_error("tealet error"), code_(code) {}
+
+  int code() const noexcept { return code_; }
+
+private:
+  int code_;
+};
+
+/**
+ * @brief Thrown from a suspension point when the owning task or generator is
+ *        destroyed while the tealet is suspended.
+ *
+ * It unwinds the tealet's own frames so their destructors run. The body may
+ * catch it for cleanup but should let it propagate.
+ */
+struct cancelled {};
+
+/**
+ * @brief Owns a main tealet; the destructor calls tealet_finalize_all().
+ *
+ * The domain must be destroyed on its thread while the main tealet is
+ * current, and after every task and generator created in it.
+ */
+class domain {
+public:
+  explicit domain(std::size_t extrasize = 0) {
+    tealet_alloc_t alloc = TEALET_ALLOC_INIT_MALLOC;
+    init(tealet_initialize(&alloc, extrasize));
+  }
+
+  explicit domain(tealet_alloc_t *alloc, std::size_t extrasize = 0) { init(tealet_initialize(alloc, extrasize)); }
+
+  explicit domain(const tealet_alloc2_t *alloc, std::size_t extrasize = 0) {
+    init(tealet_initialize2(alloc, extrasize));
+  }
+
+  domain(domain &&other) noexcept : main_(std::exchange(other.main_, nullptr)) {}
+
+  domain &operator=(domain &&other) noexcept {
+    if (this != &other) {
+      reset();
+      main_ = std::exchange(other.main_, nullptr);
+    }
+    return *this;
+  }
+
+  ~domain() { reset(); }
+
+  tealet_t *get() const noexcept { return main_; }
+  tealet_t *current() const noexcept { return tealet_current(main_); }
+
+private:
+  void init(tealet_t *main) {
+    if (main == nullptr)
+      throw std::bad_alloc();
+    main_ = main;
+  }
+
+  void reset() noexcept {
+    if (main_ != nullptr)
+      tealet_finalize_all(main_);
+    main_ = nullptr;
+  }
+
+  tealet_t *main_ = nullptr;
+};
+
+/**
+ * @brief Move-only owner of a non-main tealet; the destructor calls
+ *        tealet_delete().
+ *
+ * For tealets driven with the raw C API. Deleting a suspended tealet does
+ * not unwind its stack; use task or generator for C++ bodies with locals
+ * that need destruction.
+ */
+class fiber {
+public:
+  fiber() noexcept = default;
+  explicit fiber(tealet_t *t) noexcept : t_(t) {}
+  fiber(fiber &&other) noexcept : t_(std::exchange(other.t_, nullptr)) {}
+
+  fiber &operator=(fiber &&other) noexcept {
+    if (this != &other)
+      reset(std::exchange(other.t_, nullptr));
+    return *this;
+  }
+
+  ~fiber() { reset(); }
+
+  tealet_t *get() const noexcept { return t_; }
+  tealet_t *release() noexcept { return std::exchange(t_, nullptr); }
+  explicit operator bool() const noexcept { return t_ != nullptr; }
+  int status() const noexcept { return tealet_status(t_); }
+
+  void reset(tealet_t *t = nullptr) noexcept {
+    if (t_ != nullptr)
+      tealet_delete(t_);
+    t_ = t;
+  }
+
+private:
+  tealet_t *t_ = nullptr;
+};
+
+namespace detail {
+
+enum frame_state : unsigned char { FRAME_BOUND, FRAME_RUNNING, FRAME_DONE };
+
+/* Common state of a typed tealet, placed in its extra area.  The body,
+ * its arguments and the value slot live in the derived frame, so starting,
+ * resuming and yielding never allocate.
+ */
+struct frame_base {
+  tealet_t *self = nullptr;
+  tealet_t *resumer = nullptr; /* switched to on suspend and exit */
+  std::exception_ptr error;
+  frame_state state = FRAME_BOUND;
+  bool cancel = false;
+
+  virtual ~frame_base() = default;
+};
+
+template <class T> struct value_slot {
+  std::optional<T> value;
+};
+
+template <> struct value_slot<void> {
+  bool value = false;
+};
+
+/* the extra area is only double-aligned: reserve slack for stricter types */
+template <class Frame> constexpr std::size_t frame_extrasize() {
+  return sizeof(Frame) + (alignof(Frame) > alignof(double) ? alignof(Frame) - 1 : 0);
+}
+
+template <class Frame> inline void *frame_address(tealet_t *t) noexcept {
+  std::uintptr_t p = reinterpret_cast<std::uintptr_t>(t->extra);
+  return reinterpret_cast<void *>((p + alignof(Frame) - 1) & ~(std::uintptr_t)(alignof(Frame) - 1));
+}
+
+inline void suspend(frame_base *f) {
+  int rc = tealet_switch(f->resumer, nullptr, TEALET_XFER_DEFAULT);
+  if (f->cancel)
+    throw cancelled();
+  if (rc < 0)
+    throw error(rc);
+}
+
+/* drive @p f until its next suspension point or exit */
+inline void resume(frame_base *f) {
+  int rc;
+
+  f->resumer = tealet_current(f->self);
+  rc = tealet_switch(f->self, nullptr, TEALET_XFER_DEFAULT);
+  if (rc < 0)
+    throw error(rc);
+  if (f->error)
+    std::rethrow_exception(std::exchange(f->error, nullptr));
+}
+
+template <class Frame> tealet_t *trampoline(tealet_t *t, void *arg) {
+  Frame *f = static_cast<Frame *>(frame_address<Frame>(t));
+
+  (void)arg;
+  f->state = FRAME_RUNNING;
+  try {
+    f->invoke();
+  } catch (const cancelled &) {
+  } catch (...) {
+    f->error = std::current_exception();
+  }
+  f->drop_body();
+  f->state = FRAME_DONE;
+  return f->resumer;
+}
+
+/* Frame holding the body and its bound arguments until the body returns */
+template <class Base, class Fn, class... Args> struct bound_frame final : Base {
+  union {
+    Fn fn;
+  };
+  union {
+    std::tuple<Args...> args;
+  };
+
+  template <class F, class... A> bound_frame(F &&f, A &&...a) {
+    ::new (static_cast<void *>(&fn)) Fn(std::forward<F>(f));
+    try {
+      ::new (static_cast<void *>(&args)) std::tuple<Args...>(std::forward<A>(a)...);
+    } catch (...) {
+      fn.~Fn();
+      throw;
+    }
+  }
+
+  ~bound_frame() override {
+    if (this->state == FRAME_BOUND)
+      drop_body();
+  }
+
+  void drop_body() noexcept {
+    args.~tuple();
+    fn.~Fn();
+  }
+
+  void invoke() { this->run(fn, args); }
+};
+
+/* create a tealet whose extra area holds a Frame and bind it to the trampoline */
+template <class Frame, class... A> Frame *spawn_frame(tealet_t *tealet, A &&...a) {
+  tealet_t *t = tealet_new_ex(tealet, frame_extrasize<Frame>());
+  Frame *f;
+  int rc;
+
+  if (t == nullptr)
+    throw std::bad_alloc();
+  try {
+    f = ::new (frame_address<Frame>(t)) Frame(std::forward<A>(a)...);
+  } catch (...) {
+    tealet_delete(t);
+    throw;
+  }
+  f->self = t;
+  rc = tealet_run(t, &trampoline<Frame>, nullptr, nullptr, TEALET_START_DEFAULT);
+  if (rc < 0) {
+    f->~Frame();
+    tealet_delete(t);
+    if (rc == TEALET_ERR_MEM)
+      throw std::bad_alloc();
+    throw error(rc);
+  }
+  return f;
+}
+
+/* unwind a suspended body, then destroy the frame and the tealet */
+inline void destroy_frame(frame_base *f) noexcept {
+  tealet_t *t = f->self;
+
+  if (f->state == FRAME_RUNNING) {
+    f->cancel = true;
+    f->resumer = tealet_current(t);
+    /* if the switch fails the body cannot be unwound and its locals leak */
+    tealet_switch(t, nullptr, TEALET_XFER_DEFAULT);
+  }
+  f->~frame_base();
+  tealet_delete(t);
+}
+
+} /* namespace detail */
+
+/**
+ * @brief Passed to a task body; suspend() returns control to whoever last
+ *        resumed the task.
+ */
+class context {
+public:
+  explicit context(detail::frame_base *f) noexcept : f_(f) {}
+
+  tealet_t *self() const noexcept { return f_->self; }
+
+  /** @throws cancelled when the owning task is destroyed meanwhile. */
+  void suspend() { detail::suspend(f_); }
+
+protected:
+  detail::frame_base *f_;
+};
+
+/** @brief Passed to a generator body; yield() hands one value to next(). */
+template <class T> class yielder : public context {
+public:
+  yielder(detail::frame_base *f, std::optional<T> *slot) noexcept : context(f), slot_(slot) {}
+
+  /** Move @p v into the generator's slot and suspend until the next call to next(). */
+  template <class U> void yield(U &&v) {
+    slot_->emplace(std::forward<U>(v));
+    suspend();
+  }
+
+private:
+  std::optional<T> *slot_;
+};
+
+namespace detail {
+
+template <class T> struct task_base : frame_base, value_slot<T> {
+  template <class Fn, class Tuple> void run(Fn &fn, Tuple &args) {
+    context ctx(this);
+    if constexpr (std::is_void_v<T>) {
+      std::apply([&](auto &...a) { std::invoke(std::move(fn), ctx, std::move(a)...); }, args);
+      this->value = true;
+    } else {
+      this->value.emplace(
+          std::apply([&](auto &...a) -> T { return std::invoke(std::move(fn), ctx, std::move(a)...); }, args));
+    }
+  }
+};
+
+template <class T> struct generator_base : frame_base, value_slot<T> {
+  template <class Fn, class Tuple> void run(Fn &fn, Tuple &args) {
+    yielder<T> y(this, &this->value);
+    std::apply([&](auto &...a) { std::invoke(std::move(fn), y, std::move(a)...); }, args);
+  }
+};
+
+} /* namespace detail */
+
+/**
+ * @brief A tealet running `R body(context &, Args...)`.
+ *
+ * The body, its arguments and the result live in the tealet's extra area
+ * (the tealet is created with tealet_new_ex()), so starting and switching
+ * allocate nothing beyond the tealet itself. The task starts on the first
+ * resume(). An exception leaving the body is rethrown from resume(), and
+ * destroying a suspended task unwinds it by throwing #cancelled from its
+ * pending suspend().
+ */
+template <class R> class task {
+public:
+  task() noexcept = default;
+  task(task &&other) noexcept : f_(std::exchange(other.f_, nullptr)) {}
+
+  task &operator=(task &&other) noexcept {
+    if (this != &other) {
+      reset();
+      f_ = std::exchange(other.f_, nullptr);
+    }
+    return *this;
+  }
+
+  ~task() { reset(); }
+
+  /** Create a task in the domain of @p tealet; throws std::bad_alloc or #error. */
+  template <class Fn, class... Args> static task spawn(tealet_t *tealet, Fn &&fn, Args &&...args) {
+    using frame = detail::bound_frame<detail::task_base<R>, std::decay_t<Fn>, std::decay_t<Args>...>;
+    return task(detail::spawn_frame<frame>(tealet, std::forward<Fn>(fn), std::forward<Args>(args)...));
+  }
+
+  /** Run the task until it suspends or returns; returns done(). */
+  bool resume() {
+    detail::resume(f_);
+    return done();
+  }
+
+  bool done() const noexcept { return f_->state == detail::FRAME_DONE; }
+
+  /** The returned value; only valid once done(). */
+  decltype(auto) get() {
+    if constexpr (!std::is_void_v<R>)
+      return static_cast<R &>(*f_->value);
+  }
+
+  tealet_t *handle() const noexcept { return f_ ? f_->self : nullptr; }
+  explicit operator bool() const noexcept { return f_ != nullptr; }
+
+private:
+  explicit task(detail::task_base<R> *f) noexcept : f_(f) {}
+
+  void reset() noexcept {
+    if (f_ != nullptr)
+      detail::destroy_frame(std::exchange(f_, nullptr));
+  }
+
+  detail::task_base<R> *f_ = nullptr;
+};
+
+/**
+ * @brief A tealet running `void body(yielder<T> &, Args...)` that produces
+ *        a sequence of T.
+ *
+ * Each yielded value is moved into a slot in the tealet's extra area, so
+ * the consumer never reads the body's saved stack and nothing is allocated
+ * per value. Destroying an unfinished generator unwinds the body by
+ * throwing #cancelled from its pending yield().
+ */
+template <class T> class generator {
+public:
+  generator() noexcept = default;
+  generator(generator &&other) noexcept : f_(std::exchange(other.f_, nullptr)) {}
+
+  generator &operator=(generator &&other) noexcept {
+    if (this != &other) {
+      reset();
+      f_ = std::exchange(other.f_, nullptr);
+    }
+    return *this;
+  }
+
+  ~generator() { reset(); }
+
+  /** Create a generator in the domain of @p tealet; throws std::bad_alloc or #error. */
+  template <class Fn, class... Args> static generator spawn(tealet_t *tealet, Fn &&fn, Args &&...args) {
+    using frame = detail::bound_frame<detail::generator_base<T>, std::decay_t<Fn>, std::decay_t<Args>...>;
+    return generator(detail::spawn_frame<frame>(tealet, std::forward<Fn>(fn), std::forward<Args>(args)...));
+  }
+
+  /**
+   * Resume the body until it yields. Returns a pointer to the value, valid
+   * until the next call, or nullptr once the body has returned.
+   */
+  T *next() {
+    if (f_->state == detail::FRAME_DONE)
+      return nullptr;
+    f_->value.reset();
+    detail::resume(f_);
+    return f_->value ? &*f_->value : nullptr;
+  }
+
+  bool done() const noexcept { return f_->state == detail::FRAME_DONE; }
+  tealet_t *handle() const noexcept { return f_ ? f_->self : nullptr; }
+  explicit operator bool() const noexcept { return f_ != nullptr; }
+
+private:
+  explicit generator(detail::generator_base<T> *f) noexcept : f_(f) {}
+
+  void reset() noexcept {
+    if (f_ != nullptr)
+      detail::destroy_frame(std::exchange(f_, nullptr));
+  }
+
+  detail::generator_base<T> *f_ = nullptr;
+};
+
+} /* namespace tealet */
+
+#endif /* _TEALET_HPP_ */
@@ -1,5 +1,29 @@
 #include "tealet_extras.h"
 
+#include <string.h>
+#if defined(_MSC_VER)
+#include <windows.h>
+#endif
+#if TEALET_WITH_REACTOR
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#if TEALET_WITH_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#endif
+
 /* the stats allocator, used to collect memory usage statistics */
 static void *tealet_statsalloc_malloc(size_t size, void *context) {
   size_t nsize;
@@ -36,6 +60,305 @@ void tealet_statsalloc_init(tealet_statsalloc_t *alloc, tealet_alloc_t *base) {
   alloc->n_allocs = alloc->s_allocs = 0;
 }
 
+/* the shared stack buffer pool.
+ * Depot slots are claimed with atomic pointer exchange: a magazine is
+ * published by a compare-and-swap of an empty slot and taken by swapping
+ * the slot back to NULL, so the taker owns it exclusively and no ABA
+ * problem can arise.
+ */
+#if defined(_MSC_VER)
+static int tealet_atomic_cas_ptr(void **p, void *expected, void *desired) {
+  return InterlockedCompareExchangePointer((PVOID volatile *)p, desired, expected) == expected;
+}
+static void *tealet_atomic_xchg_ptr(void **p, void *v) { return InterlockedExchangePointer((PVOID volatile *)p, v); }
+static void *tealet_atomic_load_ptr(void **p) {
+  return InterlockedCompareExchangePointer((PVOID volatile *)p, NULL, NULL);
+}
+static void tealet_atomic_inc(size_t *p) {
+#ifdef _WIN64
+  InterlockedIncrement64((LONG64 volatile *)p);
+#else
+  InterlockedIncrement((LONG volatile *)p);
+#endif
+}
+#else
+static int tealet_atomic_cas_ptr(void **p, void *expected, void *desired) {
+  return __atomic_compare_exchange_n(p, &expected, desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+static void *tealet_atomic_xchg_ptr(void **p, void *v) { return __atomic_exchange_n(p, v, __ATOMIC_ACQ_REL); }
+static void *tealet_atomic_load_ptr(void **p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+static void tealet_atomic_inc(size_t *p) { __atomic_fetch_add(p, 1, __ATOMIC_RELAXED); }
+#endif
+
+struct tealet_bufpool_magazine_t {
+  size_t count;
+  void *rounds[TEALET_BUFPOOL_ROUNDS]; /* buffer headers */
+};
+
+/* every block handed out by a cache is preceded by this header */
+typedef union tealet_bufhead_t {
+  struct {
+    void *raw;  /* start of the underlying allocation */
+    size_t cls; /* size class, or TEALET_BUFPOOL_CLASSES if not pooled */
+    size_t size; /* usable size */
+  } h;
+  double align_[4];
+} tealet_bufhead_t;
+
+/* The alignment the base allocator guarantees, as malloc() does: that
+ * of max_align_t, probed the C89 way.
+ */
+struct tealet_maxalign_probe_t {
+  char c;
+  union {
+    long double ld;
+    double d;
+    long l;
+    void *p;
+    void (*fp)(void);
+  } u;
+};
+#define TEALET_MALLOC_ALIGN offsetof(struct tealet_maxalign_probe_t, u)
+
+#define TEALET_BUFPOOL_CLASS_SIZE(cls) ((size_t)1 << (TEALET_BUFPOOL_MIN_SHIFT + (cls)))
+
+static size_t tealet_bufpool_class(size_t size) {
+  size_t cls = 0;
+  while (cls < TEALET_BUFPOOL_CLASSES && TEALET_BUFPOOL_CLASS_SIZE(cls) < size)
+    cls++;
+  return cls;
+}
+
+static void tealet_bufpool_release(tealet_bufpool_t *pool, void *head) {
+  TEALET_ALLOC_FREE(pool->base, ((tealet_bufhead_t *)head)->h.raw);
+  tealet_atomic_inc(&pool->n_base_frees);
+}
+
+/* return all buffers of a magazine to the base allocator */
+static void tealet_bufpool_drain(tealet_bufpool_t *pool, tealet_bufpool_magazine_t *mag) {
+  while (mag->count > 0)
+    tealet_bufpool_release(pool, mag->rounds[--mag->count]);
+}
+
+static int tealet_bufpool_depot_put(tealet_bufpool_t *pool, size_t cls, tealet_bufpool_magazine_t *mag) {
+  size_t i;
+  for (i = 0; i < TEALET_BUFPOOL_DEPOT; i++) {
+    if (tealet_atomic_cas_ptr((void **)&pool->depot[cls][i], NULL, mag)) {
+      tealet_atomic_inc(&pool->n_depot_puts);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static tealet_bufpool_magazine_t *tealet_bufpool_depot_get(tealet_bufpool_t *pool, size_t cls) {
+  size_t i;
+  for (i = 0; i < TEALET_BUFPOOL_DEPOT; i++) {
+    void **slot = (void **)&pool->depot[cls][i];
+    if (tealet_atomic_load_ptr(slot) != NULL) {
+      tealet_bufpool_magazine_t *mag = (tealet_bufpool_magazine_t *)tealet_atomic_xchg_ptr(slot, NULL);
+      if (mag != NULL) {
+        tealet_atomic_inc(&pool->n_depot_gets);
+        return mag;
+      }
+    }
+  }
+  return NULL;
+}
+
+/* take a buffer header of class 'cls' from the cache, or NULL */
+static void *tealet_bufcache_get(tealet_bufcache_t *cache, size_t cls) {
+  tealet_bufpool_magazine_t *mag = cache->loaded[cls];
+  tealet_bufpool_magazine_t *full;
+
+  if (mag != NULL && mag->count > 0)
+    return mag->rounds[--mag->count];
+  if (cache->previous[cls] != NULL && cache->previous[cls]->count > 0) {
+    cache->loaded[cls] = cache->previous[cls];
+    cache->previous[cls] = mag;
+    mag = cache->loaded[cls];
+    return mag->rounds[--mag->count];
+  }
+  full = tealet_bufpool_depot_get(cache->pool, cls);
+  if (full == NULL)
+    return NULL;
+  cache->n_depot_gets++;
+  /* both local magazines are empty; keep one of them for later frees */
+  if (cache->previous[cls] != NULL)
+    TEALET_ALLOC_FREE(cache->pool->base, cache->previous[cls]);
+  cache->previous[cls] = mag;
+  cache->loaded[cls] = full;
+  return full->rounds[--full->count];
+}
+
+/* keep a buffer header of class 'cls' in the cache */
+static void tealet_bufcache_put(tealet_bufcache_t *cache, size_t cls, void *head) {
+  tealet_bufpool_t *pool = cache->pool;
+  tealet_bufpool_magazine_t *mag = cache->loaded[cls];
+
+  if (mag != NULL && mag->count < TEALET_BUFPOOL_ROUNDS) {
+    mag->rounds[mag->count++] = head;
+    cache->n_recycled++;
+    return;
+  }
+  mag = cache->previous[cls];
+  if (mag != NULL && mag->count == 0) {
+    cache->previous[cls] = cache->loaded[cls];
+    cache->loaded[cls] = mag;
+    mag->rounds[mag->count++] = head;
+    cache->n_recycled++;
+    return;
+  }
+  /* no room: hand the full previous magazine to the depot */
+  if (mag != NULL) {
+    if (tealet_bufpool_depot_put(pool, cls, mag)) {
+      cache->n_depot_puts++;
+      mag = NULL;
+    } else {
+      tealet_bufpool_drain(pool, mag);
+    }
+  }
+  if (mag == NULL) {
+    mag = (tealet_bufpool_magazine_t *)TEALET_ALLOC_MALLOC(pool->base, sizeof(*mag));
+    if (mag == NULL) {
+      tealet_bufpool_release(pool, head);
+      return;
+    }
+    mag->count = 0;
+  }
+  cache->previous[cls] = cache->loaded[cls];
+  cache->loaded[cls] = mag;
+  mag->rounds[mag->count++] = head;
+  cache->n_recycled++;
+}
+
+static void *tealet_bufcache_malloc(size_t size, size_t align, tealet_alloc_purpose_t purpose, void *context) {
+  tealet_bufcache_t *cache = (tealet_bufcache_t *)context;
+  tealet_bufhead_t *head;
+  char *raw;
+  size_t cls = TEALET_BUFPOOL_CLASSES;
+
+  if (align == 0 && (purpose == TEALET_ALLOC_PURPOSE_STACK_HEADER || purpose == TEALET_ALLOC_PURPOSE_CHUNK)) {
+    cls = tealet_bufpool_class(size);
+    if (cls < TEALET_BUFPOOL_CLASSES) {
+      head = (tealet_bufhead_t *)tealet_bufcache_get(cache, cls);
+      if (head != NULL) {
+        cache->n_hits++;
+        return (void *)(head + 1);
+      }
+      cache->n_misses++;
+      size = TEALET_BUFPOOL_CLASS_SIZE(cls);
+    }
+  }
+  if (align <= TEALET_MALLOC_ALIGN)
+    align = 0; /* the header is a multiple of it, so the block keeps it */
+  if (size > (size_t)-1 - sizeof(tealet_bufhead_t) - align)
+    return NULL;
+  raw = (char *)TEALET_ALLOC_MALLOC(cache->pool->base, sizeof(tealet_bufhead_t) + size + align);
+  if (raw == NULL)
+    return NULL;
+  tealet_atomic_inc(&cache->pool->n_base_allocs);
+  head = (tealet_bufhead_t *)raw;
+  if (align != 0) {
+    size_t pad = align - ((size_t)(raw + sizeof(tealet_bufhead_t)) & (align - 1));
+    head = (tealet_bufhead_t *)(raw + (pad == align ? 0 : pad));
+  }
+  head->h.raw = raw;
+  head->h.cls = cls;
+  head->h.size = size;
+  return (void *)(head + 1);
+}
+
+static void tealet_bufcache_free(void *ptr, tealet_alloc_purpose_t purpose, void *context) {
+  tealet_bufcache_t *cache = (tealet_bufcache_t *)context;
+  tealet_bufhead_t *head;
+
+  (void)purpose;
+  if (ptr == NULL)
+    return;
+  head = (tealet_bufhead_t *)ptr - 1;
+  if (head->h.cls < TEALET_BUFPOOL_CLASSES)
+    tealet_bufcache_put(cache, head->h.cls, head);
+  else
+    tealet_bufpool_release(cache->pool, head);
+}
+
+static void *tealet_bufcache_realloc(void *ptr, size_t size, tealet_alloc_purpose_t purpose, void *context) {
+  tealet_bufhead_t *head = (tealet_bufhead_t *)ptr - 1;
+  void *result;
+
+  if (size <= head->h.size)
+    return ptr; /* still fits its size class */
+  result = tealet_bufcache_malloc(size, 0, purpose, context);
+  if (result == NULL)
+    return NULL;
+  memcpy(result, ptr, head->h.size);
+  tealet_bufcache_free(ptr, purpose, context);
+  return result;
+}
+
+void tealet_bufpool_init(tealet_bufpool_t *pool, tealet_alloc_t *base) {
+  memset(pool, 0, sizeof(*pool));
+  pool->base = base;
+}
+
+void tealet_bufpool_destroy(tealet_bufpool_t *pool) {
+  size_t cls, i;
+  for (cls = 0; cls < TEALET_BUFPOOL_CLASSES; cls++) {
+    for (i = 0; i < TEALET_BUFPOOL_DEPOT; i++) {
+      tealet_bufpool_magazine_t *mag;
+      mag = (tealet_bufpool_magazine_t *)tealet_atomic_xchg_ptr((void **)&pool->depot[cls][i], NULL);
+      if (mag != NULL) {
+        tealet_bufpool_drain(pool, mag);
+        TEALET_ALLOC_FREE(pool->base, mag);
+      }
+    }
+  }
+}
+
+void tealet_bufpool_get_stats(tealet_bufpool_t *pool, tealet_bufpool_stats_t *stats) {
+  size_t cls, i;
+  stats->n_depot_puts = pool->n_depot_puts;
+  stats->n_depot_gets = pool->n_depot_gets;
+  stats->n_base_allocs = pool->n_base_allocs;
+  stats->n_base_frees = pool->n_base_frees;
+  stats->depot_magazines = 0;
+  for (cls = 0; cls < TEALET_BUFPOOL_CLASSES; cls++)
+    for (i = 0; i < TEALET_BUFPOOL_DEPOT; i++)
+      if (tealet_atomic_load_ptr((void **)&pool->depot[cls][i]) != NULL)
+        stats->depot_magazines++;
+}
+
+void tealet_bufcache_init(tealet_bufcache_t *cache, tealet_bufpool_t *pool) {
+  tealet_alloc2_t alloc =
+      TEALET_ALLOC2_INIT(tealet_bufcache_malloc, tealet_bufcache_realloc, tealet_bufcache_free, (void *)cache);
+  memset(cache, 0, sizeof(*cache));
+  cache->alloc = alloc;
+  cache->pool = pool;
+}
+
+void tealet_bufcache_flush(tealet_bufcache_t *cache) {
+  tealet_bufpool_t *pool = cache->pool;
+  size_t cls;
+  int i;
+
+  for (cls = 0; cls < TEALET_BUFPOOL_CLASSES; cls++) {
+    for (i = 0; i < 2; i++) {
+      tealet_bufpool_magazine_t **pmag = i ? &cache->previous[cls] : &cache->loaded[cls];
+      tealet_bufpool_magazine_t *mag = *pmag;
+      *pmag = NULL;
+      if (mag == NULL)
+        continue;
+      if (mag->count > 0 && tealet_bufpool_depot_put(pool, cls, mag)) {
+        cache->n_depot_puts++;
+        continue;
+      }
+      tealet_bufpool_drain(pool, mag);
+      TEALET_ALLOC_FREE(pool->base, mag);
+    }
+  }
+}
+
 int tealet_spawn(tealet_t *tealet, tealet_t **pcreated, tealet_run_t run, void **parg, void *stack_far, int flags) {
   tealet_t *created;
   int result;
@@ -121,3 +444,2726 @@ int tealet_stub_run(tealet_t *stub, tealet_run_t run, void **parg) {
     *parg = myarg;
   return result;
 }
+
+/****************************************************************
+ * A pool of pre-captured stubs.
+ * All stubs in the pool are duplicates of one prototype and share its
+ * initial stack snapshot.  Launching a stub hands the run function and its
+ * argument over in the pool's launch slot.  This is safe without locking
+ * because the trampoline consumes the slot immediately after the switch,
+ * before any other tealet can run.
+ */
+static tealet_t *_tealet_stubpool_main(tealet_t *current, void *arg) {
+  tealet_stubpool_t *pool = (tealet_stubpool_t *)arg;
+  tealet_run_t run = pool->run;
+  void *runarg = pool->runarg;
+  pool->run = NULL;
+  pool->runarg = NULL;
+  return run(current, runarg);
+}
+
+int tealet_stubpool_new(tealet_t *tealet, tealet_stubpool_t **ppool, size_t capacity, void *stack_far) {
+  tealet_stubpool_t *pool;
+  int result;
+
+  *ppool = NULL;
+  pool = (tealet_stubpool_t *)tealet_malloc(tealet, sizeof(*pool) + capacity * sizeof(tealet_t *));
+  if (pool == NULL)
+    return TEALET_ERR_MEM;
+  pool->proto = NULL;
+  pool->stubs = (tealet_t **)(pool + 1);
+  pool->capacity = capacity;
+  pool->count = 0;
+  pool->run = NULL;
+  pool->runarg = NULL;
+  pool->spill = NULL;
+  pool->spillarg = NULL;
+  pool->n_hits = pool->n_misses = pool->n_refills = 0;
+
+  result = tealet_spawn(tealet, &pool->proto, _tealet_stubpool_main, NULL, stack_far, TEALET_START_DEFAULT);
+  if (result != 0) {
+    tealet_free(tealet, pool);
+    return result;
+  }
+  tealet_stubpool_refill(pool, 0);
+  *ppool = pool;
+  return 0;
+}
+
+void tealet_stubpool_delete(tealet_stubpool_t *pool) {
+  tealet_t *proto = pool->proto;
+  while (pool->count > 0)
+    tealet_delete(pool->stubs[--pool->count]);
+  tealet_free(proto, pool);
+  tealet_delete(proto);
+}
+
+int tealet_stubpool_refill(tealet_stubpool_t *pool, size_t max) {
+  size_t added = 0;
+
+  if (max == 0 || max > pool->capacity - pool->count)
+    max = pool->capacity - pool->count;
+  while (added < max) {
+    tealet_t *stub = tealet_duplicate(pool->proto);
+    if (stub == NULL)
+      break;
+    pool->stubs[pool->count++] = stub;
+    added++;
+  }
+  pool->n_refills += added;
+  if (added == 0 && max > 0)
+    return TEALET_ERR_MEM;
+  return (int)added;
+}
+
+int tealet_stubpool_spawn(tealet_stubpool_t *pool, tealet_t **pcreated, tealet_run_t run, void **parg) {
+  tealet_t *stub;
+  void *myarg;
+  int hit;
+  int result;
+
+  if (pcreated != NULL)
+    *pcreated = NULL;
+  hit = (pool->count > 0);
+  if (hit) {
+    stub = pool->stubs[--pool->count];
+  } else {
+    stub = tealet_duplicate(pool->proto);
+    if (stub == NULL)
+      return TEALET_ERR_MEM;
+  }
+
+  pool->run = run;
+  pool->runarg = parg ? *parg : NULL;
+  myarg = (void *)pool;
+  result = tealet_switch(stub, &myarg, TEALET_XFER_DEFAULT);
+  if (result && result != TEALET_ERR_PANIC) {
+    /* failure, the stub was not consumed */
+    pool->run = NULL;
+    pool->runarg = NULL;
+    if (hit)
+      pool->stubs[pool->count++] = stub;
+    else
+      tealet_delete(stub);
+    return result;
+  }
+  if (hit)
+    pool->n_hits++;
+  else
+    pool->n_misses++;
+  if (pcreated != NULL)
+    *pcreated = stub;
+  if (parg)
+    *parg = myarg;
+  return result;
+}
+
+/****************************************************************
+ * Stack spilling.
+ * The spilled call is handed to a pool stub through the pool's spill slot,
+ * and its result travels back as the argument of the stub's exit switch
+ * to the caller.  The caller is the tealet that switched to the stub.
+ */
+static tealet_t *_tealet_spill_main(tealet_t *current, void *arg) {
+  tealet_stubpool_t *pool = (tealet_stubpool_t *)arg;
+  tealet_spill_t fn = pool->spill;
+  void *fnarg = pool->spillarg;
+  tealet_t *caller = tealet_previous(current);
+  void *result;
+
+  pool->spill = NULL;
+  pool->spillarg = NULL;
+  result = fn(current, fnarg);
+  tealet_exit(caller, result, TEALET_EXIT_DELETE | TEALET_EXIT_DEFER);
+  return caller;
+}
+
+int tealet_call_spilled(tealet_stubpool_t *pool, tealet_spill_t fn, void **parg, size_t threshold) {
+  tealet_t *current = tealet_current(pool->proto);
+  void *far;
+  void *arg = parg ? *parg : NULL;
+  int result;
+
+  /* the main tealet has no far boundary of its own */
+  if (TEALET_IS_MAIN(current))
+    far = tealet_get_far(pool->proto);
+  else
+    far = tealet_get_far(current);
+  if (tealet_stack_diff(far, (void *)&far) <= (ptrdiff_t)threshold) {
+    arg = fn(current, arg);
+    if (parg)
+      *parg = arg;
+    return 0;
+  }
+
+  pool->spill = fn;
+  pool->spillarg = arg;
+  arg = (void *)pool;
+  result = tealet_stubpool_spawn(pool, NULL, _tealet_spill_main, &arg);
+  if (result && result != TEALET_ERR_PANIC) {
+    pool->spill = NULL;
+    pool->spillarg = NULL;
+    return result;
+  }
+  if (parg)
+    *parg = arg;
+  return result;
+}
+
+/****************************************************************
+ * The run-queue scheduler.
+ * The ready queue is a FIFO threaded through the scheduler nodes at the
+ * start of each task's extra area.  Whoever gives up the CPU picks the
+ * successor itself: the head of the queue, or the main tealet when the
+ * queue is empty.
+ * Other threads cannot touch the queue.  tealet_wake_remote() pushes the
+ * node on a lock-free stack instead, which the owner takes in one swap at
+ * its next pick.  A node's link doubles as its queued flag: it is claimed
+ * with a compare-and-swap from NULL, and the end of the stack is marked
+ * with TEALET_REMOTE_END rather than NULL.
+ */
+static void tealet_timer_disarm(tealet_sched_t *sched, tealet_timer_t *timer);
+static void tealet_chan_withdraw(tealet_sched_node_t *node);
+static void tealet_taskgroup_finished(tealet_sched_node_t *node);
+
+static char tealet_remote_end;
+#define TEALET_REMOTE_END ((tealet_sched_node_t *)(void *)&tealet_remote_end)
+
+#define TEALET_SCHED_STARTED 0x100   /* node flag: the task function was entered */
+#define TEALET_SCHED_CANCELLED 0x200 /* node flag: cancelled by its group, so waits fail */
+
+static void tealet_sched_push(tealet_sched_t *sched, tealet_sched_node_t *node) {
+  node->state = TEALET_SCHED_READY;
+  node->next = NULL;
+  if (sched->tail != NULL)
+    sched->tail->next = node;
+  else
+    sched->head = node;
+  sched->tail = node;
+  sched->n_ready++;
+}
+
+static void tealet_sched_push_front(tealet_sched_t *sched, tealet_sched_node_t *node) {
+  node->state = TEALET_SCHED_READY;
+  node->next = sched->head;
+  sched->head = node;
+  if (sched->tail == NULL)
+    sched->tail = node;
+  sched->n_ready++;
+}
+
+static tealet_sched_node_t *tealet_sched_pop(tealet_sched_t *sched) {
+  tealet_sched_node_t *node = sched->head;
+  if (node == NULL)
+    return NULL;
+  sched->head = node->next;
+  if (sched->head == NULL)
+    sched->tail = NULL;
+  node->next = NULL;
+  node->skips = 0;
+  sched->n_ready--;
+  return node;
+}
+
+/* Take the wakeups pushed by other threads and deliver them in order. */
+static int tealet_sched_remote_drain(tealet_sched_t *sched) {
+  tealet_sched_node_t *node, *next, *fifo = NULL;
+  int woken = 0;
+
+  node = (tealet_sched_node_t *)tealet_atomic_xchg_ptr((void **)&sched->remote, NULL);
+  for (; node != NULL; node = next) {
+    next = node->remote_next != TEALET_REMOTE_END ? node->remote_next : NULL;
+    node->remote_next = fifo != NULL ? fifo : TEALET_REMOTE_END;
+    fifo = node;
+  }
+  for (node = fifo; node != NULL; node = next) {
+    next = node->remote_next != TEALET_REMOTE_END ? node->remote_next : NULL;
+    tealet_atomic_xchg_ptr((void **)&node->remote_next, NULL); /* it may be queued again from here */
+    node->remote_permit = 1;
+    sched->n_remote++;
+    woken += tealet_sched_wake(sched, node->tealet);
+  }
+  return woken;
+}
+
+/* Take the next task to run from the ready queue.  With the SLICE policy
+ * the cheapest of the first 'window' tasks other than 'current' is taken,
+ * unless the head has already been passed over 'fairness' times.
+ */
+static tealet_sched_node_t *tealet_sched_pick(tealet_sched_t *sched, tealet_t *current) {
+  tealet_sched_node_t *node, *prev;
+  tealet_sched_node_t *best = NULL, *best_prev = NULL;
+  size_t cost, best_cost = 0;
+  unsigned int i;
+
+  if (tealet_atomic_load_ptr((void **)&sched->remote) != NULL)
+    tealet_sched_remote_drain(sched);
+  if (sched->policy == TEALET_SCHED_FIFO || sched->head == NULL || sched->head->next == NULL ||
+      sched->head->skips >= sched->fairness)
+    return tealet_sched_pop(sched);
+
+  prev = NULL;
+  for (node = sched->head, i = 0; node != NULL && i < sched->window; prev = node, node = node->next, i++) {
+    if (node->tealet == current)
+      continue;
+    cost = tealet_switch_cost(node->tealet);
+    if (best == NULL || cost < best_cost) {
+      best = node;
+      best_prev = prev;
+      best_cost = cost;
+      if (cost == 0)
+        break;
+    }
+  }
+  if (best == NULL || best == sched->head)
+    return tealet_sched_pop(sched);
+
+  /* everything ahead of the chosen task was passed over */
+  for (node = sched->head; node != best; node = node->next)
+    node->skips++;
+  best_prev->next = best->next;
+  if (sched->tail == best)
+    sched->tail = best_prev;
+  best->next = NULL;
+  best->skips = 0;
+  sched->n_ready--;
+  return best;
+}
+
+/* unlink 'node' from the ready queue; only used to undo a failed switch */
+static void tealet_sched_unlink(tealet_sched_t *sched, tealet_sched_node_t *node) {
+  tealet_sched_node_t **pp = &sched->head;
+  tealet_sched_node_t *prev = NULL;
+
+  while (*pp != NULL && *pp != node) {
+    prev = *pp;
+    pp = &prev->next;
+  }
+  if (*pp == NULL)
+    return;
+  *pp = node->next;
+  if (sched->tail == node)
+    sched->tail = prev;
+  node->next = NULL;
+  sched->n_ready--;
+}
+
+/* Switch from the current tealet to the next ready task or to main.
+ * On failure the chosen task is put back at the head of the queue.
+ */
+static int tealet_sched_switch_next(tealet_sched_t *sched, tealet_t *current) {
+  tealet_sched_node_t *next = tealet_sched_pick(sched, current);
+  int result;
+
+  if (next == NULL)
+    return tealet_switch(sched->main, NULL, TEALET_XFER_DEFAULT);
+  next->state = TEALET_SCHED_RUNNING;
+  if (next->tealet == current)
+    return 0; /* a remote wakeup arrived while it was blocking */
+  sched->n_switches++;
+  result = tealet_switch(next->tealet, NULL, TEALET_XFER_DEFAULT);
+  if (result < 0 && result != TEALET_ERR_PANIC)
+    tealet_sched_push_front(sched, next);
+  return result;
+}
+
+static tealet_t *_tealet_sched_main(tealet_t *current, void *arg) {
+  tealet_sched_node_t *node = TEALET_SCHED_NODE(current);
+  tealet_sched_t *sched = node->sched;
+  tealet_sched_node_t *next;
+  tealet_t *target;
+
+  (void)arg;
+  node->flags |= TEALET_SCHED_STARTED;
+  node->result = node->fn(current, node->arg);
+  tealet_timer_disarm(sched, &node->timer);
+  node->state = TEALET_SCHED_DONE;
+  if (node->joiner != NULL && !TEALET_IS_MAIN(node->joiner))
+    tealet_sched_wake(sched, node->joiner);
+  if (node->group != NULL)
+    tealet_taskgroup_finished(node);
+
+  next = tealet_sched_pick(sched, current);
+  if (next != NULL) {
+    next->state = TEALET_SCHED_RUNNING;
+    sched->n_switches++;
+    target = next->tealet;
+  } else {
+    target = sched->main;
+  }
+  if (node->flags & TEALET_SCHED_DETACHED) {
+    sched->n_tasks--;
+    tealet_exit(target, NULL, TEALET_EXIT_DELETE | TEALET_EXIT_DEFER);
+  }
+  return target;
+}
+
+void tealet_sched_init(tealet_sched_t *sched, tealet_t *tealet) {
+  sched->main = TEALET_MAIN(tealet);
+  sched->head = sched->tail = NULL;
+  sched->n_ready = 0;
+  sched->n_tasks = 0;
+  sched->n_switches = 0;
+  sched->n_yields = 0;
+  sched->policy = TEALET_SCHED_FIFO;
+  sched->window = TEALET_SCHED_WINDOW;
+  sched->fairness = TEALET_SCHED_FAIRNESS;
+  sched->now = 0;
+  sched->n_timers = 0;
+  sched->n_expired = 0;
+  memset(sched->wheel_count, 0, sizeof(sched->wheel_count));
+  memset(sched->wheel, 0, sizeof(sched->wheel));
+  sched->remote = NULL;
+  sched->doorbell = NULL;
+  sched->doorbell_arg = NULL;
+  sched->n_remote = 0;
+  sched->n_remote_waiting = 0;
+}
+
+int tealet_sched_set_policy(tealet_sched_t *sched, int policy, unsigned int window, unsigned int fairness) {
+  if (policy != TEALET_SCHED_FIFO && policy != TEALET_SCHED_SLICE)
+    return TEALET_ERR_INVAL;
+  sched->policy = policy;
+  sched->window = window ? window : TEALET_SCHED_WINDOW;
+  sched->fairness = fairness ? fairness : TEALET_SCHED_FAIRNESS;
+  return 0;
+}
+
+int tealet_sched_spawn(tealet_sched_t *sched, tealet_t **pcreated, tealet_sched_fn_t fn, void *arg, size_t extrasize,
+                       int flags) {
+  tealet_sched_node_t *node;
+  tealet_t *task;
+  int result;
+
+  if (pcreated != NULL)
+    *pcreated = NULL;
+  if (fn == NULL || (flags & ~TEALET_SCHED_DETACHED) != 0)
+    return TEALET_ERR_INVAL;
+  task = tealet_new_ex(sched->main, sizeof(tealet_sched_node_t) + extrasize);
+  if (task == NULL)
+    return TEALET_ERR_MEM;
+  result = tealet_run(task, _tealet_sched_main, NULL, NULL, TEALET_START_DEFAULT);
+  if (result != 0) {
+    tealet_delete(task);
+    return result;
+  }
+
+  node = TEALET_SCHED_NODE(task);
+  node->tealet = task;
+  node->sched = sched;
+  node->fn = fn;
+  node->arg = arg;
+  node->result = NULL;
+  node->joiner = NULL;
+  node->flags = (unsigned int)flags;
+  node->permit = 0;
+  node->skips = 0;
+  node->waiters = NULL;
+  node->n_waiters = 0;
+  node->fired = -1;
+  node->fired_status = 0;
+  node->timer.next = NULL;
+  node->timer.pprev = NULL;
+  node->timed_out = 0;
+  node->remote_next = NULL;
+  node->remote_permit = 0;
+  node->sync_next = NULL;
+  node->sync_queue = NULL;
+  node->sync_mutex = NULL;
+  node->sync_granted = 0;
+  node->group = NULL;
+  node->group_next = NULL;
+  node->group_prev = NULL;
+  node->group_slot = NULL;
+  node->group_status = 0;
+  tealet_sched_push(sched, node);
+  sched->n_tasks++;
+  if (pcreated != NULL)
+    *pcreated = task;
+  return 0;
+}
+
+int tealet_sched_run(tealet_sched_t *sched) {
+  int result;
+
+  if (!TEALET_CURRENT_IS_MAIN(sched->main))
+    return TEALET_ERR_INVAL;
+  if (tealet_atomic_load_ptr((void **)&sched->remote) != NULL)
+    tealet_sched_remote_drain(sched);
+  if (sched->head != NULL) {
+    result = tealet_sched_switch_next(sched, sched->main);
+    if (result < 0 && result != TEALET_ERR_PANIC)
+      return result;
+  }
+  return (int)sched->n_tasks;
+}
+
+int tealet_sched_yield(tealet_sched_t *sched) {
+  tealet_t *current = tealet_current(sched->main);
+  tealet_sched_node_t *node;
+  int result;
+
+  if (TEALET_IS_MAIN(current)) {
+    result = tealet_sched_run(sched);
+    return result < 0 ? result : 0;
+  }
+  if (sched->head == NULL)
+    return 0;
+  node = TEALET_SCHED_NODE(current);
+  tealet_sched_push(sched, node);
+  sched->n_yields++;
+  result = tealet_sched_switch_next(sched, current);
+  if (result < 0 && result != TEALET_ERR_PANIC) {
+    tealet_sched_unlink(sched, node);
+    node->state = TEALET_SCHED_RUNNING;
+  }
+  return result;
+}
+
+int tealet_sched_suspend(tealet_sched_t *sched) {
+  tealet_t *current = tealet_current(sched->main);
+  tealet_sched_node_t *node;
+  int result;
+
+  if (TEALET_IS_MAIN(current))
+    return TEALET_ERR_INVAL;
+  node = TEALET_SCHED_NODE(current);
+  if (node->flags & TEALET_SCHED_CANCELLED)
+    return TEALET_ERR_PANIC;
+  if (node->permit) {
+    node->permit = 0;
+    return 0;
+  }
+  if (node->timed_out)
+    return TEALET_SCHED_TIMEOUT;
+  node->state = TEALET_SCHED_BLOCKED;
+  result = tealet_sched_switch_next(sched, current);
+  if (result < 0 && result != TEALET_ERR_PANIC)
+    node->state = TEALET_SCHED_RUNNING;
+  else if (node->fired == -2) {
+    node->fired = -1;
+    result = TEALET_SCHED_TIMEOUT;
+  }
+  return result;
+}
+
+int tealet_sched_wake(tealet_sched_t *sched, tealet_t *task) {
+  tealet_sched_node_t *node = TEALET_SCHED_NODE(task);
+
+  if (node->state != TEALET_SCHED_BLOCKED) {
+    if (node->state != TEALET_SCHED_DONE)
+      node->permit = 1;
+    return 0;
+  }
+  tealet_sched_push(sched, node);
+  return 1;
+}
+
+int tealet_sched_join(tealet_sched_t *sched, tealet_t *task, void **presult) {
+  tealet_t *current = tealet_current(sched->main);
+  tealet_sched_node_t *node = TEALET_SCHED_NODE(task);
+  int result = 0;
+
+  if (node->joiner != NULL || (node->flags & TEALET_SCHED_DETACHED) || task == current)
+    return TEALET_ERR_INVAL;
+  node->joiner = current;
+  while (node->state != TEALET_SCHED_DONE) {
+    if (TEALET_IS_MAIN(current)) {
+      if (sched->head == NULL) {
+        result = TEALET_ERR_INVAL; /* nothing can finish the task */
+        break;
+      }
+      result = tealet_sched_switch_next(sched, current);
+      if (result == TEALET_ERR_PANIC)
+        result = 0; /* a failed exit fell back to main */
+    } else {
+      result = tealet_sched_suspend(sched);
+    }
+    if (result < 0 || result == TEALET_SCHED_TIMEOUT)
+      break;
+  }
+  if (node->state != TEALET_SCHED_DONE) {
+    node->joiner = NULL;
+    return result;
+  }
+  if (presult != NULL)
+    *presult = node->result;
+  sched->n_tasks--;
+  tealet_delete(task);
+  return 0;
+}
+
+int tealet_wake_remote(tealet_t *task) {
+  tealet_sched_node_t *node, *head;
+  tealet_sched_t *sched;
+
+  if (TEALET_IS_MAIN(task))
+    return TEALET_ERR_INVAL;
+  node = TEALET_SCHED_NODE(task);
+  sched = node->sched;
+  if (!tealet_atomic_cas_ptr((void **)&node->remote_next, NULL, TEALET_REMOTE_END))
+    return 0; /* already queued */
+  do {
+    head = (tealet_sched_node_t *)tealet_atomic_load_ptr((void **)&sched->remote);
+    node->remote_next = head != NULL ? head : TEALET_REMOTE_END;
+  } while (!tealet_atomic_cas_ptr((void **)&sched->remote, head, node));
+  if (head == NULL && sched->doorbell != NULL)
+    sched->doorbell(sched->doorbell_arg);
+  return 0;
+}
+
+int tealet_sched_suspend_remote(tealet_sched_t *sched) {
+  tealet_t *current = tealet_current(sched->main);
+  tealet_sched_node_t *node;
+  unsigned int cancelled;
+  int timed_out, panicked = 0;
+  int result;
+
+  if (TEALET_IS_MAIN(current))
+    return TEALET_ERR_INVAL;
+  node = TEALET_SCHED_NODE(current);
+  /* a task past its deadline or cancelled would not block: hide the flags
+   * meanwhile
+   */
+  timed_out = node->timed_out;
+  node->timed_out = 0;
+  cancelled = node->flags & TEALET_SCHED_CANCELLED;
+  node->flags &= ~TEALET_SCHED_CANCELLED;
+  sched->n_remote_waiting++;
+  /* the remote thread may hold on to the task until the wakeup: take it
+   * on every path, retrying a switch that failed
+   */
+  while (!node->remote_permit) {
+    result = tealet_sched_suspend(sched);
+    if (result == TEALET_SCHED_TIMEOUT) {
+      timed_out = 1;
+      node->timed_out = 0;
+    } else if (result == TEALET_ERR_PANIC) {
+      panicked = 1;
+      cancelled |= node->flags & TEALET_SCHED_CANCELLED;
+      node->flags &= ~TEALET_SCHED_CANCELLED;
+    }
+  }
+  sched->n_remote_waiting--;
+  node->timed_out = timed_out;
+  node->flags |= cancelled;
+  node->remote_permit = 0;
+  return panicked || cancelled ? TEALET_ERR_PANIC : 0;
+}
+
+void tealet_sched_set_doorbell(tealet_sched_t *sched, tealet_sched_doorbell_t fn, void *arg) {
+  sched->doorbell = fn;
+  sched->doorbell_arg = arg;
+}
+
+/****************************************************************
+ * Channels.
+ * Each channel has a ring buffer and two circular wait queues.  A task
+ * that cannot complete any case links one waiter per case into the
+ * channels' queues and blocks.  Whoever completes one of its waiters
+ * withdraws the others and makes the task ready, or, for a send to a
+ * waiting receiver, switches to it directly.
+ */
+#define TEALET_CHAN_MIN_SIZE 16 /* first ring size of an unbounded channel */
+
+static void tealet_chan_enqueue(tealet_chan_waiter_t **pq, tealet_chan_waiter_t *w) {
+  if (*pq == NULL) {
+    w->next = w->prev = w;
+    *pq = w;
+  } else {
+    w->next = *pq;
+    w->prev = (*pq)->prev;
+    w->prev->next = w;
+    (*pq)->prev = w;
+  }
+}
+
+static void tealet_chan_dequeue(tealet_chan_waiter_t **pq, tealet_chan_waiter_t *w) {
+  if (w->next == w) {
+    *pq = NULL;
+  } else {
+    w->prev->next = w->next;
+    w->next->prev = w->prev;
+    if (*pq == w)
+      *pq = w->next;
+  }
+  w->next = w->prev = NULL;
+}
+
+static tealet_chan_waiter_t **tealet_chan_queue(tealet_chan_t *chan, int op) {
+  return op == TEALET_CHAN_SEND ? &chan->sendq : &chan->recvq;
+}
+
+/* unlink every waiter of a task that is still queued */
+static void tealet_chan_withdraw(tealet_sched_node_t *node) {
+  tealet_chan_waiter_t *x;
+  int i;
+
+  for (i = 0; i < node->n_waiters; i++) {
+    x = &node->waiters[i];
+    if (x->next != NULL)
+      tealet_chan_dequeue(tealet_chan_queue(x->chan, x->op), x);
+  }
+}
+
+/* complete 'w': withdraw every waiter of its task and record the result */
+static tealet_sched_node_t *tealet_chan_fire(tealet_chan_waiter_t *w, int status) {
+  tealet_sched_node_t *node = w->node;
+
+  tealet_chan_withdraw(node);
+  node->fired = w->index;
+  node->fired_status = status;
+  return node;
+}
+
+/* make a fired task ready, unless a tealet_sched_wake() already did */
+static void tealet_chan_ready(tealet_sched_t *sched, tealet_sched_node_t *node) {
+  if (node->state == TEALET_SCHED_BLOCKED)
+    tealet_sched_push(sched, node);
+}
+
+/* Switch to a receiver that was just given a value.  The sender goes to
+ * the front of the ready queue, so the pair keeps running back to back.
+ * From main, or if the receiver is already queued, it is only made ready.
+ */
+static void tealet_chan_handoff(tealet_sched_t *sched, tealet_sched_node_t *receiver) {
+  tealet_t *current = tealet_current(sched->main);
+  tealet_sched_node_t *node;
+  int result;
+
+  if (TEALET_IS_MAIN(current) || receiver->state != TEALET_SCHED_BLOCKED) {
+    tealet_chan_ready(sched, receiver);
+    return;
+  }
+  node = TEALET_SCHED_NODE(current);
+  tealet_sched_push_front(sched, node);
+  receiver->state = TEALET_SCHED_RUNNING;
+  sched->n_switches++;
+  result = tealet_switch(receiver->tealet, NULL, TEALET_XFER_DEFAULT);
+  if (result < 0 && result != TEALET_ERR_PANIC) {
+    tealet_sched_unlink(sched, node);
+    node->state = TEALET_SCHED_RUNNING;
+    tealet_sched_push(sched, receiver);
+  }
+}
+
+static int tealet_chan_put(tealet_chan_t *chan, void *value) {
+  void **buf;
+  size_t size, i;
+
+  if (chan->count == chan->size) {
+    /* only an unbounded channel gets here, a bounded ring is preallocated */
+    size = chan->size ? chan->size * 2 : TEALET_CHAN_MIN_SIZE;
+    buf = (void **)tealet_malloc(chan->sched->main, size * sizeof(void *));
+    if (buf == NULL)
+      return TEALET_ERR_MEM;
+    for (i = 0; i < chan->count; i++)
+      buf[i] = chan->buf[(chan->first + i) % chan->size];
+    if (chan->buf != NULL)
+      tealet_free(chan->sched->main, chan->buf);
+    chan->buf = buf;
+    chan->size = size;
+    chan->first = 0;
+  }
+  chan->buf[(chan->first + chan->count) % chan->size] = value;
+  chan->count++;
+  return 0;
+}
+
+static void *tealet_chan_take(tealet_chan_t *chan) {
+  void *value = chan->buf[chan->first];
+
+  chan->first = (chan->first + 1) % chan->size;
+  chan->count--;
+  return value;
+}
+
+/* try to complete a case without waiting; returns 1 with '*pstatus' set if it did */
+static int tealet_chan_poll(tealet_chan_case_t *c, int *pstatus) {
+  tealet_chan_t *chan = c->chan;
+  tealet_chan_waiter_t *w;
+
+  *pstatus = 0;
+  if (c->op == TEALET_CHAN_SEND) {
+    if (chan->closed) {
+      *pstatus = TEALET_ERR_INVAL;
+      return 1;
+    }
+    if (chan->recvq != NULL) {
+      /* a waiting receiver implies an empty buffer: hand the value over */
+      w = chan->recvq;
+      w->value = c->value;
+      chan->n_handoffs++;
+      tealet_chan_handoff(chan->sched, tealet_chan_fire(w, 0));
+      return 1;
+    }
+    if (chan->count < chan->capacity) {
+      *pstatus = tealet_chan_put(chan, c->value);
+      return 1;
+    }
+    return 0;
+  }
+
+  if (chan->count > 0) {
+    c->value = tealet_chan_take(chan);
+    if (chan->sendq != NULL) {
+      /* the oldest waiting sender fills the slot just freed */
+      w = chan->sendq;
+      tealet_chan_put(chan, w->value);
+      tealet_chan_ready(chan->sched, tealet_chan_fire(w, 0));
+    }
+    return 1;
+  }
+  if (chan->sendq != NULL) {
+    w = chan->sendq;
+    c->value = w->value;
+    tealet_chan_ready(chan->sched, tealet_chan_fire(w, 0));
+    return 1;
+  }
+  if (chan->closed) {
+    c->value = NULL;
+    *pstatus = TEALET_CHAN_CLOSED;
+    return 1;
+  }
+  return 0;
+}
+
+int tealet_chan_init(tealet_chan_t *chan, tealet_sched_t *sched, size_t capacity) {
+  chan->sched = sched;
+  chan->buf = NULL;
+  chan->size = 0;
+  chan->capacity = capacity;
+  chan->first = 0;
+  chan->count = 0;
+  chan->sendq = NULL;
+  chan->recvq = NULL;
+  chan->closed = 0;
+  chan->n_handoffs = 0;
+  if (capacity > 0 && capacity != TEALET_CHAN_UNBOUNDED) {
+    chan->buf = (void **)tealet_malloc(sched->main, capacity * sizeof(void *));
+    if (chan->buf == NULL)
+      return TEALET_ERR_MEM;
+    chan->size = capacity;
+  }
+  return 0;
+}
+
+int tealet_chan_destroy(tealet_chan_t *chan) {
+  if (chan->sendq != NULL || chan->recvq != NULL)
+    return TEALET_ERR_INVAL;
+  if (chan->buf != NULL)
+    tealet_free(chan->sched->main, chan->buf);
+  chan->buf = NULL;
+  chan->size = 0;
+  chan->count = 0;
+  return 0;
+}
+
+int tealet_chan_send(tealet_chan_t *chan, void *value) {
+  tealet_chan_case_t c;
+
+  c.chan = chan;
+  c.op = TEALET_CHAN_SEND;
+  c.value = value;
+  return tealet_chan_select(&c, 1, 0, NULL);
+}
+
+int tealet_chan_recv(tealet_chan_t *chan, void **pvalue) {
+  tealet_chan_case_t c;
+  int result;
+
+  c.chan = chan;
+  c.op = TEALET_CHAN_RECV;
+  c.value = NULL;
+  result = tealet_chan_select(&c, 1, 0, NULL);
+  if (result >= 0 && pvalue != NULL)
+    *pvalue = c.value;
+  return result;
+}
+
+void tealet_chan_close(tealet_chan_t *chan) {
+  tealet_chan_waiter_t *w;
+
+  chan->closed = 1;
+  while ((w = chan->recvq) != NULL) {
+    w->value = NULL;
+    tealet_chan_ready(chan->sched, tealet_chan_fire(w, TEALET_CHAN_CLOSED));
+  }
+  while ((w = chan->sendq) != NULL)
+    tealet_chan_ready(chan->sched, tealet_chan_fire(w, TEALET_ERR_INVAL));
+}
+
+int tealet_chan_select(tealet_chan_case_t *cases, int n, int flags, int *pindex) {
+  tealet_sched_t *sched;
+  tealet_sched_node_t *node;
+  tealet_chan_waiter_t *w;
+  tealet_t *current;
+  int status, result, i;
+
+  if (cases == NULL || n <= 0)
+    return TEALET_ERR_INVAL;
+  sched = cases[0].chan->sched;
+  current = tealet_current(sched->main);
+  for (;;) {
+    for (i = 0; i < n; i++) {
+      if (tealet_chan_poll(&cases[i], &status)) {
+        if (pindex != NULL)
+          *pindex = i;
+        return status;
+      }
+    }
+    if (flags & TEALET_CHAN_NOWAIT)
+      return TEALET_CHAN_WOULDBLOCK;
+    if (!TEALET_IS_MAIN(current))
+      break;
+    /* main cannot wait in a queue: run tasks until a case is ready */
+    if (sched->head == NULL)
+      return TEALET_ERR_INVAL; /* nothing can make a case ready */
+    result = tealet_sched_switch_next(sched, current);
+    if (result < 0 && result != TEALET_ERR_PANIC)
+      return result;
+  }
+
+  node = TEALET_SCHED_NODE(current);
+  if (node->flags & TEALET_SCHED_CANCELLED)
+    return TEALET_ERR_PANIC;
+  if (node->timed_out)
+    return TEALET_SCHED_TIMEOUT;
+  if (n == 1) {
+    w = &node->wait;
+  } else {
+    w = (tealet_chan_waiter_t *)tealet_malloc(current, n * sizeof(tealet_chan_waiter_t));
+    if (w == NULL)
+      return TEALET_ERR_MEM;
+  }
+  for (i = 0; i < n; i++) {
+    w[i].node = node;
+    w[i].chan = cases[i].chan;
+    w[i].op = cases[i].op;
+    w[i].index = i;
+    w[i].value = cases[i].value;
+    tealet_chan_enqueue(tealet_chan_queue(w[i].chan, w[i].op), &w[i]);
+  }
+  node->waiters = w;
+  node->n_waiters = n;
+  node->fired = -1;
+
+  /* A tealet_sched_wake() resumes the task early: keep it as a permit and
+   * wait again.  The deadline may have passed while it was ready, which
+   * only sets 'timed_out'.
+   */
+  for (;;) {
+    node->state = TEALET_SCHED_BLOCKED;
+    result = tealet_sched_switch_next(sched, current);
+    if (node->fired != -1 || node->timed_out || result < 0)
+      break;
+    node->permit = 1;
+  }
+
+  if (node->fired < 0) {
+    tealet_chan_withdraw(node);
+    if (node->fired == -2 || result >= 0)
+      result = TEALET_SCHED_TIMEOUT; /* the timer withdrew the waiters, or passed while ready */
+    else
+      node->state = TEALET_SCHED_RUNNING;
+  } else {
+    i = node->fired;
+    cases[i].value = w[i].value;
+    if (pindex != NULL)
+      *pindex = i;
+    result = node->fired_status;
+  }
+  node->waiters = NULL;
+  node->n_waiters = 0;
+  node->fired = -1;
+  if (w != &node->wait)
+    tealet_free(current, w);
+  return result;
+}
+
+/****************************************************************
+ * Synchronization primitives.
+ * Every object keeps a FIFO of waiting nodes.  The releasing side
+ * dequeues the oldest waiter, completes the operation on its behalf
+ * (mutex ownership, a semaphore unit) and sets 'sync_granted'; the waiter
+ * only has to return.  A condition variable signal moves the waiter to
+ * its mutex's queue when the mutex is held, so a broadcast wakes one
+ * task per unlock instead of all at once.
+ */
+static void tealet_sync_enqueue(tealet_waitq_t *q, tealet_sched_node_t *node) {
+  node->sync_next = NULL;
+  if (q->tail != NULL)
+    q->tail->sync_next = node;
+  else
+    q->head = node;
+  q->tail = node;
+  node->sync_queue = q;
+}
+
+static tealet_sched_node_t *tealet_sync_dequeue(tealet_waitq_t *q) {
+  tealet_sched_node_t *node = q->head;
+
+  if (node == NULL)
+    return NULL;
+  q->head = node->sync_next;
+  if (q->head == NULL)
+    q->tail = NULL;
+  node->sync_next = NULL;
+  node->sync_queue = NULL;
+  return node;
+}
+
+/* unlink a waiter that gave up; only timeouts get here */
+static void tealet_sync_unlink(tealet_sched_node_t *node) {
+  tealet_waitq_t *q = node->sync_queue;
+  tealet_sched_node_t **pp, *prev = NULL;
+
+  if (q == NULL)
+    return;
+  for (pp = &q->head; *pp != node; pp = &(*pp)->sync_next)
+    prev = *pp;
+  *pp = node->sync_next;
+  if (q->tail == node)
+    q->tail = prev;
+  node->sync_next = NULL;
+  node->sync_queue = NULL;
+}
+
+/* the operation of a dequeued waiter is complete: let it return */
+static void tealet_sync_grant(tealet_sched_t *sched, tealet_sched_node_t *node) {
+  node->sync_granted = 1;
+  if (node->state == TEALET_SCHED_BLOCKED)
+    tealet_sched_push(sched, node);
+}
+
+/* Block the current task in 'q' until it is granted.  The deadline or a
+ * panic ends the wait only if 'timed' is set.  Other wakeups are kept as
+ * a permit.
+ */
+static int tealet_sync_wait(tealet_sched_t *sched, tealet_sched_node_t *node, tealet_waitq_t *q, int timed) {
+  int result;
+
+  if (timed && (node->flags & TEALET_SCHED_CANCELLED))
+    return TEALET_ERR_PANIC;
+  if (timed && node->timed_out)
+    return TEALET_SCHED_TIMEOUT;
+  node->sync_granted = 0;
+  tealet_sync_enqueue(q, node);
+  for (;;) {
+    node->state = TEALET_SCHED_BLOCKED;
+    result = tealet_sched_switch_next(sched, node->tealet);
+    if (node->sync_granted) {
+      result = 0;
+      break;
+    }
+    if (result < 0 && (result != TEALET_ERR_PANIC || timed)) {
+      node->state = TEALET_SCHED_RUNNING;
+      break;
+    }
+    /* the deadline may have passed while a wakeup had the task ready */
+    if (timed && node->timed_out) {
+      result = TEALET_SCHED_TIMEOUT;
+      break;
+    }
+    if (node->fired == -2)
+      node->fired = -1;
+    else
+      node->permit = 1;
+  }
+  node->fired = -1; /* a deadline that passed as the grant arrived stays in 'timed_out' */
+  tealet_sync_unlink(node);
+  return result;
+}
+
+void tealet_mutex_init(tealet_mutex_t *mutex, tealet_sched_t *sched) {
+  mutex->sched = sched;
+  mutex->owner = NULL;
+  mutex->waiters.head = mutex->waiters.tail = NULL;
+  mutex->n_contended = 0;
+}
+
+int tealet_mutex_lock(tealet_mutex_t *mutex) {
+  tealet_t *current = tealet_current(mutex->sched->main);
+
+  if (mutex->owner == NULL) {
+    mutex->owner = current;
+    return 0;
+  }
+  if (mutex->owner == current || TEALET_IS_MAIN(current))
+    return TEALET_ERR_INVAL;
+  mutex->n_contended++;
+  return tealet_sync_wait(mutex->sched, TEALET_SCHED_NODE(current), &mutex->waiters, 1);
+}
+
+int tealet_mutex_trylock(tealet_mutex_t *mutex) {
+  if (mutex->owner != NULL)
+    return 0;
+  mutex->owner = tealet_current(mutex->sched->main);
+  return 1;
+}
+
+int tealet_mutex_unlock(tealet_mutex_t *mutex) {
+  tealet_sched_node_t *node;
+
+  if (mutex->owner != tealet_current(mutex->sched->main))
+    return TEALET_ERR_INVAL;
+  node = tealet_sync_dequeue(&mutex->waiters);
+  mutex->owner = node != NULL ? node->tealet : NULL;
+  if (node != NULL)
+    tealet_sync_grant(mutex->sched, node);
+  return 0;
+}
+
+void tealet_cond_init(tealet_cond_t *cond, tealet_sched_t *sched) {
+  cond->sched = sched;
+  cond->waiters.head = cond->waiters.tail = NULL;
+}
+
+int tealet_cond_wait(tealet_cond_t *cond, tealet_mutex_t *mutex) {
+  tealet_t *current = tealet_current(cond->sched->main);
+  tealet_sched_node_t *node;
+  int result;
+
+  if (TEALET_IS_MAIN(current) || mutex->owner != current)
+    return TEALET_ERR_INVAL;
+  node = TEALET_SCHED_NODE(current);
+  if (node->timed_out)
+    return TEALET_SCHED_TIMEOUT;
+  node->sync_mutex = mutex;
+  tealet_mutex_unlock(mutex);
+  /* granted means the mutex is ours again, wherever the wait ended */
+  result = tealet_sync_wait(cond->sched, node, &cond->waiters, 1);
+  if (result != 0 && mutex->owner != current) {
+    if (mutex->owner == NULL)
+      mutex->owner = current;
+    else
+      tealet_sync_wait(cond->sched, node, &mutex->waiters, 0);
+  }
+  node->sync_mutex = NULL;
+  return result;
+}
+
+int tealet_cond_signal(tealet_cond_t *cond) {
+  tealet_sched_node_t *node = tealet_sync_dequeue(&cond->waiters);
+  tealet_mutex_t *mutex;
+
+  if (node == NULL)
+    return 0;
+  mutex = node->sync_mutex;
+  if (mutex->owner == NULL) {
+    mutex->owner = node->tealet;
+    tealet_sync_grant(cond->sched, node);
+  } else {
+    tealet_sync_enqueue(&mutex->waiters, node);
+  }
+  return 1;
+}
+
+int tealet_cond_broadcast(tealet_cond_t *cond) {
+  int n = 0;
+
+  while (tealet_cond_signal(cond))
+    n++;
+  return n;
+}
+
+void tealet_sem_init(tealet_sem_t *sem, tealet_sched_t *sched, size_t count) {
+  sem->sched = sched;
+  sem->count = count;
+  sem->waiters.head = sem->waiters.tail = NULL;
+  sem->n_contended = 0;
+}
+
+int tealet_sem_acquire(tealet_sem_t *sem) {
+  tealet_t *current;
+
+  if (sem->count > 0) {
+    sem->count--;
+    return 0;
+  }
+  current = tealet_current(sem->sched->main);
+  if (TEALET_IS_MAIN(current))
+    return TEALET_ERR_INVAL;
+  sem->n_contended++;
+  return tealet_sync_wait(sem->sched, TEALET_SCHED_NODE(current), &sem->waiters, 1);
+}
+
+int tealet_sem_tryacquire(tealet_sem_t *sem) {
+  if (sem->count == 0)
+    return 0;
+  sem->count--;
+  return 1;
+}
+
+int tealet_sem_release(tealet_sem_t *sem, size_t n) {
+  tealet_sched_node_t *node;
+  int woken = 0;
+
+  for (; n > 0 && (node = tealet_sync_dequeue(&sem->waiters)) != NULL; n--) {
+    tealet_sync_grant(sem->sched, node);
+    woken++;
+  }
+  sem->count += n;
+  return woken;
+}
+
+int tealet_barrier_init(tealet_barrier_t *barrier, tealet_sched_t *sched, unsigned int parties) {
+  if (parties == 0)
+    return TEALET_ERR_INVAL;
+  barrier->sched = sched;
+  barrier->parties = parties;
+  barrier->arrived = 0;
+  barrier->waiters.head = barrier->waiters.tail = NULL;
+  barrier->n_cycles = 0;
+  return 0;
+}
+
+int tealet_barrier_wait(tealet_barrier_t *barrier) {
+  tealet_t *current = tealet_current(barrier->sched->main);
+  tealet_sched_node_t *node;
+  int result;
+
+  if (barrier->arrived + 1 == barrier->parties) {
+    barrier->arrived = 0;
+    barrier->n_cycles++;
+    while ((node = tealet_sync_dequeue(&barrier->waiters)) != NULL)
+      tealet_sync_grant(barrier->sched, node);
+    return TEALET_BARRIER_SERIAL;
+  }
+  if (TEALET_IS_MAIN(current))
+    return TEALET_ERR_INVAL;
+  barrier->arrived++;
+  result = tealet_sync_wait(barrier->sched, TEALET_SCHED_NODE(current), &barrier->waiters, 1);
+  if (result != 0)
+    barrier->arrived--;
+  return result;
+}
+
+/****************************************************************
+ * Task groups.
+ * Running children are on a doubly linked list so a returning child
+ * unlinks itself in O(1); it then moves to the completion queue, which
+ * reuses 'group_next', and wakes the task waiting on the group.  Main
+ * cannot block, so it waits by running the ready tasks instead.
+ */
+
+/* a returned child moves to the completion queue */
+static void tealet_taskgroup_finished(tealet_sched_node_t *node) {
+  tealet_taskgroup_t *group = node->group;
+
+  if (node->group_prev != NULL)
+    node->group_prev->group_next = node->group_next;
+  else
+    group->running = node->group_next;
+  if (node->group_next != NULL)
+    node->group_next->group_prev = node->group_prev;
+  node->group_next = node->group_prev = NULL;
+  if (group->done_tail != NULL)
+    group->done_tail->group_next = node;
+  else
+    group->done_head = node;
+  group->done_tail = node;
+  if (node->group_status == TEALET_TASKGROUP_FAILED)
+    group->failed = 1;
+  if (group->waiter != NULL)
+    tealet_sched_wake(group->sched, group->waiter);
+}
+
+/* Resume 'child' with a panic, or drop it if it never ran.  The wait the
+ * child was resumed in may have completed already and ignore the panic,
+ * so the child is also flagged and every later wait fails.  A task that
+ * cancels goes to the front of the ready queue, so it runs again as soon
+ * as the child blocks or returns.
+ */
+static void tealet_taskgroup_cancel_one(tealet_taskgroup_t *group, tealet_sched_node_t *child) {
+  tealet_sched_t *sched = group->sched;
+  tealet_t *current = tealet_current(sched->main);
+  tealet_sched_node_t *node = NULL;
+  unsigned int state = child->state;
+  int result;
+
+  child->group_status = TEALET_TASKGROUP_CANCELLED;
+  child->flags |= TEALET_SCHED_CANCELLED;
+  group->n_cancelled++;
+  if (state == TEALET_SCHED_READY)
+    tealet_sched_unlink(sched, child);
+  if (!(child->flags & TEALET_SCHED_STARTED)) {
+    child->state = TEALET_SCHED_DONE;
+    tealet_taskgroup_finished(child);
+    return;
+  }
+  if (!TEALET_IS_MAIN(current)) {
+    node = TEALET_SCHED_NODE(current);
+    tealet_sched_push_front(sched, node);
+  }
+  child->state = TEALET_SCHED_RUNNING;
+  sched->n_switches++;
+  result = tealet_switch(child->tealet, NULL, TEALET_XFER_PANIC);
+  if (result < 0 && result != TEALET_ERR_PANIC) {
+    if (node != NULL) {
+      tealet_sched_unlink(sched, node);
+      node->state = TEALET_SCHED_RUNNING;
+    }
+    if (state == TEALET_SCHED_READY)
+      tealet_sched_push(sched, child);
+    else
+      child->state = state;
+  }
+}
+
+/* Wait until a child has returned. */
+static int tealet_taskgroup_block(tealet_taskgroup_t *group) {
+  tealet_sched_t *sched = group->sched;
+  tealet_t *current = tealet_current(sched->main);
+  int result;
+
+  if (TEALET_IS_MAIN(current)) {
+    if (sched->head == NULL)
+      return TEALET_ERR_INVAL; /* nothing can return */
+    result = tealet_sched_switch_next(sched, current);
+    return result == TEALET_ERR_PANIC ? 0 : result;
+  }
+  group->waiter = current;
+  result = tealet_sched_suspend(sched);
+  group->waiter = NULL;
+  return result;
+}
+
+/* Join the returned child 'node' and return its status. */
+static int tealet_taskgroup_join(tealet_taskgroup_t *group, tealet_sched_node_t *node) {
+  tealet_sched_node_t **pp = &group->done_head;
+  tealet_sched_node_t *prev = NULL;
+  void **slot = node->group_slot;
+  int status = node->group_status;
+  void *result;
+
+  while (*pp != node) {
+    prev = *pp;
+    pp = &prev->group_next;
+  }
+  *pp = node->group_next;
+  if (group->done_tail == node)
+    group->done_tail = prev;
+  group->n_children--;
+  tealet_sched_join(group->sched, node->tealet, &result);
+  if (slot != NULL)
+    *slot = result;
+  return status;
+}
+
+static int tealet_taskgroup_is_child(tealet_taskgroup_t *group) {
+  tealet_t *current = tealet_current(group->sched->main);
+
+  return !TEALET_IS_MAIN(current) && TEALET_SCHED_NODE(current)->group == group;
+}
+
+/* the result slots may live on the owner's stack: only it may join */
+static int tealet_taskgroup_is_owner(tealet_taskgroup_t *group) {
+  return tealet_current(group->sched->main) == group->owner;
+}
+
+void tealet_taskgroup_init(tealet_taskgroup_t *group, tealet_sched_t *sched) {
+  group->sched = sched;
+  group->owner = tealet_current(sched->main);
+  group->running = NULL;
+  group->done_head = group->done_tail = NULL;
+  group->waiter = NULL;
+  group->n_children = 0;
+  group->failed = 0;
+  group->n_cancelled = 0;
+}
+
+int tealet_taskgroup_spawn(tealet_taskgroup_t *group, tealet_t **pchild, tealet_sched_fn_t fn, void *arg,
+                           size_t extrasize, void **presult) {
+  tealet_sched_node_t *node;
+  tealet_t *task;
+  int result;
+
+  if (pchild != NULL)
+    *pchild = NULL;
+  if (!tealet_taskgroup_is_owner(group))
+    return TEALET_ERR_INVAL;
+  result = tealet_sched_spawn(group->sched, &task, fn, arg, extrasize, 0);
+  if (result != 0)
+    return result;
+  node = TEALET_SCHED_NODE(task);
+  node->group = group;
+  node->group_slot = presult;
+  node->group_next = group->running;
+  if (group->running != NULL)
+    group->running->group_prev = node;
+  group->running = node;
+  group->n_children++;
+  if (pchild != NULL)
+    *pchild = task;
+  return 0;
+}
+
+int tealet_taskgroup_fail(tealet_taskgroup_t *group) {
+  if (!tealet_taskgroup_is_child(group))
+    return TEALET_ERR_INVAL;
+  TEALET_SCHED_NODE(tealet_current(group->sched->main))->group_status = TEALET_TASKGROUP_FAILED;
+  return 0;
+}
+
+int tealet_taskgroup_cancel(tealet_taskgroup_t *group) {
+  tealet_t *current = tealet_current(group->sched->main);
+  tealet_sched_node_t *node;
+  int n = 0;
+
+  group->failed = 0;
+  /* a cancelled child may return or others may finish meanwhile: rescan */
+  for (;;) {
+    for (node = group->running; node != NULL; node = node->group_next) {
+      if (node->group_status == 0 && node->tealet != current)
+        break;
+    }
+    if (node == NULL)
+      return n;
+    tealet_taskgroup_cancel_one(group, node);
+    n++;
+  }
+}
+
+int tealet_taskgroup_wait_any(tealet_taskgroup_t *group, tealet_t **pchild) {
+  tealet_sched_node_t *node;
+  int result;
+
+  if (pchild != NULL)
+    *pchild = NULL;
+  if (group->n_children == 0 || !tealet_taskgroup_is_owner(group))
+    return TEALET_ERR_INVAL;
+  for (;;) {
+    if (group->failed)
+      tealet_taskgroup_cancel(group);
+    if (group->done_head != NULL)
+      break;
+    result = tealet_taskgroup_block(group);
+    if (result < 0 || result == TEALET_SCHED_TIMEOUT)
+      return result;
+  }
+  node = group->done_head;
+  if (pchild != NULL)
+    *pchild = node->tealet;
+  return tealet_taskgroup_join(group, node);
+}
+
+int tealet_taskgroup_await(tealet_taskgroup_t *group, tealet_t *child) {
+  tealet_sched_node_t *node = TEALET_SCHED_NODE(child);
+  int result;
+
+  if (node->group != group || !tealet_taskgroup_is_owner(group))
+    return TEALET_ERR_INVAL;
+  for (;;) {
+    if (group->failed)
+      tealet_taskgroup_cancel(group);
+    if (node->state == TEALET_SCHED_DONE)
+      break;
+    result = tealet_taskgroup_block(group);
+    if (result < 0 || result == TEALET_SCHED_TIMEOUT)
+      return result;
+  }
+  return tealet_taskgroup_join(group, node);
+}
+
+int tealet_taskgroup_wait_all(tealet_taskgroup_t *group) {
+  tealet_t *current = tealet_current(group->sched->main);
+  unsigned int cancelled = 0;
+  int status = 0;
+  int result;
+
+  if (!tealet_taskgroup_is_owner(group))
+    return TEALET_ERR_INVAL;
+  while (group->n_children > 0) {
+    if (group->failed)
+      tealet_taskgroup_cancel(group);
+    if (group->done_head != NULL) {
+      if (tealet_taskgroup_join(group, group->done_head) == TEALET_TASKGROUP_FAILED && status == 0)
+        status = TEALET_TASKGROUP_FAILED;
+      continue;
+    }
+    result = tealet_taskgroup_block(group);
+    if (result == TEALET_ERR_PANIC) {
+      /* the waiter itself is cancelled: so is everything it waits for.
+       * Hide its flag until they have returned, or it could not block.
+       */
+      tealet_taskgroup_cancel(group);
+      status = TEALET_ERR_PANIC;
+      cancelled |= TEALET_SCHED_NODE(current)->flags & TEALET_SCHED_CANCELLED;
+      TEALET_SCHED_NODE(current)->flags &= ~TEALET_SCHED_CANCELLED;
+    } else if (result < 0 || result == TEALET_SCHED_TIMEOUT) {
+      status = result;
+      break;
+    }
+  }
+  if (cancelled)
+    TEALET_SCHED_NODE(current)->flags |= cancelled;
+  return status;
+}
+
+/****************************************************************
+ * The timer wheel.
+ * Each level has TEALET_WHEEL_SLOTS singly linked slots.  A timer goes
+ * into the lowest level whose range covers it, at the slot selected by
+ * its expiry tick.  When the level 0 index wraps around, the matching
+ * slot of the next level is cascaded: its timers are inserted again,
+ * landing one level lower.  Arming and cancelling are O(1).
+ */
+#define TEALET_WHEEL_MASK ((tealet_tick_t)TEALET_WHEEL_SLOTS - 1)
+#define TEALET_TIMER_NODE(t) ((tealet_sched_node_t *)((char *)(t)-offsetof(tealet_sched_node_t, timer)))
+
+static void tealet_timer_add(tealet_sched_t *sched, tealet_timer_t *timer) {
+  tealet_tick_t base = sched->now + 1; /* the next tick to be processed */
+  tealet_tick_t at = timer->expires;
+  tealet_tick_t delta;
+  tealet_timer_t **slot;
+  int level;
+
+  if (TEALET_TICK_BEFORE(at, base))
+    at = base; /* already due: expire on the next tick */
+  delta = at - base;
+  for (level = 0; level < TEALET_WHEEL_LEVELS - 1; level++)
+    if (delta < (tealet_tick_t)1 << ((level + 1) * TEALET_WHEEL_BITS))
+      break;
+  if (delta >= (tealet_tick_t)1 << (TEALET_WHEEL_LEVELS * TEALET_WHEEL_BITS))
+    at = base + ((tealet_tick_t)1 << (TEALET_WHEEL_LEVELS * TEALET_WHEEL_BITS)) - 1; /* park it */
+
+  slot = &sched->wheel[level][(at >> (level * TEALET_WHEEL_BITS)) & TEALET_WHEEL_MASK];
+  timer->next = *slot;
+  if (timer->next != NULL)
+    timer->next->pprev = &timer->next;
+  *slot = timer;
+  timer->pprev = slot;
+  timer->level = level;
+  sched->wheel_count[level]++;
+}
+
+static void tealet_timer_remove(tealet_sched_t *sched, tealet_timer_t *timer) {
+  *timer->pprev = timer->next;
+  if (timer->next != NULL)
+    timer->next->pprev = timer->pprev;
+  timer->next = NULL;
+  timer->pprev = NULL;
+  sched->wheel_count[timer->level]--;
+}
+
+static void tealet_timer_arm(tealet_sched_t *sched, tealet_timer_t *timer, tealet_tick_t expires) {
+  timer->expires = expires;
+  tealet_timer_add(sched, timer);
+  sched->n_timers++;
+}
+
+static void tealet_timer_disarm(tealet_sched_t *sched, tealet_timer_t *timer) {
+  if (timer->pprev == NULL)
+    return;
+  tealet_timer_remove(sched, timer);
+  sched->n_timers--;
+}
+
+/* move the timers of one slot down the wheel; returns the slot index */
+static int tealet_timer_cascade(tealet_sched_t *sched, int level, int index) {
+  tealet_timer_t *list = sched->wheel[level][index];
+  tealet_timer_t *timer;
+
+  sched->wheel[level][index] = NULL;
+  while ((timer = list) != NULL) {
+    list = timer->next;
+    sched->wheel_count[level]--;
+    tealet_timer_add(sched, timer);
+  }
+  return index;
+}
+
+/* the deadline of a task passed: end the wait it is blocked in, if any */
+static void tealet_timer_fire(tealet_sched_t *sched, tealet_timer_t *timer) {
+  tealet_sched_node_t *node = TEALET_TIMER_NODE(timer);
+
+  node->timed_out = 1;
+  if (node->state == TEALET_SCHED_BLOCKED) {
+    tealet_chan_withdraw(node);
+    node->fired = -2;
+    tealet_sched_push(sched, node);
+  }
+}
+
+int tealet_sched_advance(tealet_sched_t *sched, tealet_tick_t now) {
+  size_t expired = sched->n_expired;
+  tealet_timer_t *timer;
+  tealet_tick_t tick;
+  int level, index;
+
+  while (TEALET_TICK_BEFORE(sched->now, now)) {
+    if (sched->n_timers == 0) {
+      sched->now = now;
+      break;
+    }
+    tick = sched->now + 1;
+    index = (int)(tick & TEALET_WHEEL_MASK);
+    if (index != 0 && sched->wheel_count[0] == 0) {
+      /* nothing is due before the next cascade: skip to it */
+      tick += TEALET_WHEEL_SLOTS - index;
+      sched->now = TEALET_TICK_BEFORE(now, tick) ? now : tick - 1;
+      continue;
+    }
+    if (index == 0) {
+      for (level = 1; level < TEALET_WHEEL_LEVELS; level++)
+        if (tealet_timer_cascade(sched, level, (int)((tick >> (level * TEALET_WHEEL_BITS)) & TEALET_WHEEL_MASK)) != 0)
+          break;
+    }
+    while ((timer = sched->wheel[0][index]) != NULL) {
+      tealet_timer_remove(sched, timer);
+      sched->n_timers--;
+      sched->n_expired++;
+      tealet_timer_fire(sched, timer);
+    }
+    sched->now = tick;
+  }
+  return (int)(sched->n_expired - expired);
+}
+
+int tealet_sched_next_timer(tealet_sched_t *sched, tealet_tick_t *pticks) {
+  tealet_tick_t tick = sched->now + 1;
+  tealet_tick_t i;
+
+  if (sched->n_timers == 0)
+    return 0;
+  if (sched->wheel_count[0] > 0) {
+    for (i = 0; i < TEALET_WHEEL_SLOTS; i++) {
+      if (sched->wheel[0][(tick + i) & TEALET_WHEEL_MASK] != NULL) {
+        *pticks = i + 1;
+        return 1;
+      }
+    }
+  }
+  /* nothing can expire before the next cascade */
+  *pticks = (TEALET_WHEEL_SLOTS - (tick & TEALET_WHEEL_MASK)) % TEALET_WHEEL_SLOTS + 1;
+  return 1;
+}
+
+int tealet_sched_sleep(tealet_sched_t *sched, tealet_tick_t ticks) {
+  tealet_t *current = tealet_current(sched->main);
+  tealet_sched_node_t *node;
+  int result;
+
+  if (TEALET_IS_MAIN(current))
+    return TEALET_ERR_INVAL;
+  node = TEALET_SCHED_NODE(current);
+  if (node->flags & TEALET_SCHED_CANCELLED)
+    return TEALET_ERR_PANIC;
+  tealet_timer_disarm(sched, &node->timer);
+  node->timed_out = 0;
+  if (ticks == 0)
+    return tealet_sched_yield(sched);
+
+  tealet_timer_arm(sched, &node->timer, sched->now + ticks);
+  /* the timer may also expire while the task is ready after a wakeup */
+  for (;;) {
+    node->state = TEALET_SCHED_BLOCKED;
+    result = tealet_sched_switch_next(sched, current);
+    if (node->fired == -2 || node->timed_out || result < 0)
+      break;
+    node->permit = 1; /* woken early: keep the wakeup for the next suspend */
+  }
+  if (result < 0) {
+    tealet_timer_disarm(sched, &node->timer);
+    node->state = TEALET_SCHED_RUNNING;
+  } else {
+    result = 0;
+  }
+  node->fired = -1;
+  node->timed_out = 0;
+  return result;
+}
+
+int tealet_sched_set_deadline(tealet_sched_t *sched, tealet_tick_t deadline) {
+  tealet_t *current = tealet_current(sched->main);
+  tealet_sched_node_t *node;
+
+  if (TEALET_IS_MAIN(current))
+    return TEALET_ERR_INVAL;
+  node = TEALET_SCHED_NODE(current);
+  tealet_timer_disarm(sched, &node->timer);
+  node->timed_out = 0;
+  if (TEALET_TICK_BEFORE(sched->now, deadline))
+    tealet_timer_arm(sched, &node->timer, deadline);
+  else
+    node->timed_out = 1;
+  return 0;
+}
+
+void tealet_sched_clear_deadline(tealet_sched_t *sched) {
+  tealet_t *current = tealet_current(sched->main);
+  tealet_sched_node_t *node;
+
+  if (TEALET_IS_MAIN(current))
+    return;
+  node = TEALET_SCHED_NODE(current);
+  tealet_timer_disarm(sched, &node->timer);
+  node->timed_out = 0;
+}
+
+#if TEALET_WITH_REACTOR
+/****************************************************************
+ * The I/O reactor.
+ * Descriptors are registered once, edge-triggered for both directions.
+ * An edge sets the cached ready bits and wakes the waiting task; a wait
+ * consumes the bits it asked for, so an edge that arrives while nobody
+ * waits is not lost.
+ */
+static tealet_tick_t tealet_reactor_clock(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (tealet_tick_t)ts.tv_sec * 1000 + (tealet_tick_t)(ts.tv_nsec / 1000000);
+}
+
+static tealet_reactor_fd_t *tealet_reactor_lookup(tealet_reactor_t *reactor, int fd) {
+  tealet_reactor_fd_t *fds;
+  size_t size;
+
+  if ((size_t)fd >= reactor->n_fds) {
+    size = reactor->n_fds ? reactor->n_fds : 64;
+    while (size <= (size_t)fd)
+      size *= 2;
+    fds = (tealet_reactor_fd_t *)tealet_malloc(reactor->sched->main, size * sizeof(tealet_reactor_fd_t));
+    if (fds == NULL)
+      return NULL;
+    if (reactor->fds != NULL) {
+      memcpy(fds, reactor->fds, reactor->n_fds * sizeof(tealet_reactor_fd_t));
+      tealet_free(reactor->sched->main, reactor->fds);
+    }
+    memset(fds + reactor->n_fds, 0, (size - reactor->n_fds) * sizeof(tealet_reactor_fd_t));
+    reactor->fds = fds;
+    reactor->n_fds = size;
+  }
+  return &reactor->fds[fd];
+}
+
+#if TEALET_WITH_URING
+/****************************************************************
+ * The io_uring backend.
+ * Driven with the raw system calls, so liburing is not needed.  Both
+ * rings are shared with the kernel: we advance the submission tail and
+ * the completion head, the kernel the other two.  The ring descriptor is
+ * in the epoll set, so tealet_reactor_poll() wakes up for completions.
+ * Single-shot requests carry the waiting tealet as user_data; multishot
+ * accepts carry their descriptor and arming generation, tagged with the
+ * low bit, which a tealet pointer never has.
+ */
+struct tealet_uring_t {
+  int fd;
+  unsigned int *sq_head;
+  unsigned int *sq_tail;
+  unsigned int *sq_mask;
+  unsigned int *sq_array;
+  unsigned int sq_entries;
+  unsigned int unsubmitted; /* queued since the last io_uring_enter() */
+  struct io_uring_sqe *sqes;
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int *cq_mask;
+  struct io_uring_cqe *cqes;
+  void *sq_map;
+  void *cq_map;
+  size_t sq_map_size;
+  size_t cq_map_size;
+  char *bufs; /* the registered buffers, or NULL */
+  int free_bufs[TEALET_URING_BUFFERS];
+  int n_free;
+  int multishot_ok; /* a multishot accept has succeeded */
+  int no_multishot; /* the kernel rejected one: accept one at a time */
+};
+
+#define TEALET_URING_TAG(fd, gen) (((__u64)(gen) << 32) | ((__u64)(unsigned int)(fd) << 1) | 1)
+#define TEALET_URING_MAXLEN 0x40000000 /* bytes moved per request */
+
+/* the operations we need, all present since Linux 5.6 */
+static const unsigned char tealet_uring_ops[] = {IORING_OP_READ,       IORING_OP_WRITE,     IORING_OP_READ_FIXED,
+                                                 IORING_OP_WRITE_FIXED, IORING_OP_ACCEPT,    IORING_OP_FSYNC,
+                                                 IORING_OP_ASYNC_CANCEL};
+
+static void tealet_uring_close(tealet_reactor_t *reactor) {
+  struct tealet_uring_t *u = reactor->uring;
+
+  if (u == NULL)
+    return;
+  if (u->bufs != NULL)
+    munmap(u->bufs, (size_t)TEALET_URING_BUFFERS * TEALET_URING_BUFSIZE);
+  if ((void *)u->sqes != MAP_FAILED)
+    munmap(u->sqes, u->sq_entries * sizeof(struct io_uring_sqe));
+  if (u->cq_map != MAP_FAILED && u->cq_map != u->sq_map)
+    munmap(u->cq_map, u->cq_map_size);
+  if (u->sq_map != MAP_FAILED)
+    munmap(u->sq_map, u->sq_map_size);
+  close(u->fd);
+  tealet_free(reactor->sched->main, u);
+  reactor->uring = NULL;
+}
+
+static int tealet_uring_probe(int fd, tealet_t *main) {
+  struct io_uring_probe *probe;
+  size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+  int result = 0;
+  size_t i;
+
+  probe = (struct io_uring_probe *)tealet_malloc(main, size);
+  if (probe == NULL)
+    return TEALET_ERR_MEM;
+  memset(probe, 0, size);
+  if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+    result = TEALET_ERR_INVAL;
+  for (i = 0; result == 0 && i < sizeof(tealet_uring_ops); i++) {
+    if (tealet_uring_ops[i] > probe->last_op || !(probe->ops[tealet_uring_ops[i]].flags & IO_URING_OP_SUPPORTED))
+      result = TEALET_ERR_INVAL;
+  }
+  tealet_free(main, probe);
+  return result;
+}
+
+/* Set up the rings.  Registered buffers are optional: the locked memory
+ * limit may not allow them.
+ */
+static int tealet_uring_open(tealet_reactor_t *reactor) {
+  struct iovec iov[TEALET_URING_BUFFERS];
+  struct io_uring_params p;
+  struct tealet_uring_t *u;
+  struct epoll_event ev;
+  char *sq, *cq;
+  int fd, i;
+
+  memset(&p, 0, sizeof(p));
+  fd = (int)syscall(__NR_io_uring_setup, TEALET_URING_ENTRIES, &p);
+  if (fd < 0)
+    return TEALET_ERR_INVAL;
+  u = (struct tealet_uring_t *)tealet_malloc(reactor->sched->main, sizeof(struct tealet_uring_t));
+  if (u == NULL) {
+    close(fd);
+    return TEALET_ERR_MEM;
+  }
+  memset(u, 0, sizeof(struct tealet_uring_t));
+  u->fd = fd;
+  u->sq_entries = p.sq_entries;
+  u->sq_map = u->cq_map = MAP_FAILED;
+  u->sqes = (struct io_uring_sqe *)MAP_FAILED;
+  reactor->uring = u;
+  if (tealet_uring_probe(fd, reactor->sched->main) != 0)
+    goto fail;
+
+  u->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  u->cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (u->cq_map_size > u->sq_map_size)
+      u->sq_map_size = u->cq_map_size;
+    u->cq_map_size = u->sq_map_size;
+  }
+  u->sq_map = mmap(NULL, u->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (u->sq_map == MAP_FAILED)
+    goto fail;
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    u->cq_map = u->sq_map;
+  else {
+    u->cq_map = mmap(NULL, u->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (u->cq_map == MAP_FAILED)
+      goto fail;
+  }
+  u->sqes = (struct io_uring_sqe *)mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if ((void *)u->sqes == MAP_FAILED)
+    goto fail;
+  sq = (char *)u->sq_map;
+  cq = (char *)u->cq_map;
+  u->sq_head = (unsigned int *)(sq + p.sq_off.head);
+  u->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+  u->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+  u->sq_array = (unsigned int *)(sq + p.sq_off.array);
+  u->cq_head = (unsigned int *)(cq + p.cq_off.head);
+  u->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+  u->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  u->bufs = (char *)mmap(NULL, (size_t)TEALET_URING_BUFFERS * TEALET_URING_BUFSIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if ((void *)u->bufs == MAP_FAILED)
+    u->bufs = NULL;
+  if (u->bufs != NULL) {
+    for (i = 0; i < TEALET_URING_BUFFERS; i++) {
+      iov[i].iov_base = u->bufs + (size_t)i * TEALET_URING_BUFSIZE;
+      iov[i].iov_len = TEALET_URING_BUFSIZE;
+    }
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iov, TEALET_URING_BUFFERS) < 0) {
+      munmap(u->bufs, (size_t)TEALET_URING_BUFFERS * TEALET_URING_BUFSIZE);
+      u->bufs = NULL;
+    } else {
+      for (i = 0; i < TEALET_URING_BUFFERS; i++)
+        u->free_bufs[i] = TEALET_URING_BUFFERS - 1 - i;
+      u->n_free = TEALET_URING_BUFFERS;
+    }
+  }
+
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+    goto fail;
+  return 0;
+fail:
+  tealet_uring_close(reactor);
+  return TEALET_ERR_INVAL;
+}
+
+/* Hand the queued requests to the kernel. */
+static int tealet_uring_flush(tealet_reactor_t *reactor) {
+  struct tealet_uring_t *u = reactor->uring;
+  long n;
+
+  while (u->unsubmitted > 0) {
+    n = syscall(__NR_io_uring_enter, u->fd, u->unsubmitted, 0, 0, NULL, 0);
+    reactor->n_enters++;
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return errno == EAGAIN || errno == EBUSY ? 0 : TEALET_ERR_INVAL; /* retried at the next poll */
+    if (n == 0)
+      break;
+    u->unsubmitted -= (unsigned int)n;
+    reactor->n_submitted += (size_t)n;
+  }
+  return 0;
+}
+
+static int tealet_uring_accepted(tealet_reactor_t *reactor, __u64 data, int res, unsigned int flags);
+
+/* Consume every completion and wake the tasks waiting for them. */
+static int tealet_uring_reap(tealet_reactor_t *reactor) {
+  struct tealet_uring_t *u = reactor->uring;
+  struct io_uring_cqe *cqe;
+  tealet_sched_node_t *node;
+  unsigned int head, tail;
+  int woken = 0;
+
+  head = *u->cq_head;
+  tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; head++) {
+    cqe = &u->cqes[head & *u->cq_mask];
+    if (cqe->user_data == 0)
+      continue; /* a cancel request */
+    reactor->n_completed++;
+    if (cqe->user_data & 1) {
+      woken += tealet_uring_accepted(reactor, cqe->user_data, cqe->res, cqe->flags);
+      continue;
+    }
+    node = TEALET_SCHED_NODE((tealet_t *)(uintptr_t)cqe->user_data);
+    node->io_result = cqe->res;
+    node->io_done = 1;
+    woken += tealet_sched_wake(reactor->sched, node->tealet);
+  }
+  __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+  return woken;
+}
+
+/* A free submission entry, cleared, or NULL if the ring stays full.  It is
+ * queued by tealet_uring_push().
+ */
+static struct io_uring_sqe *tealet_uring_sqe(tealet_reactor_t *reactor) {
+  struct tealet_uring_t *u = reactor->uring;
+  unsigned int tail = *u->sq_tail;
+  unsigned int index;
+
+  if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries) {
+    /* the kernel may refuse new requests while completions pile up */
+    tealet_uring_reap(reactor);
+    tealet_uring_flush(reactor);
+    if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries)
+      return NULL;
+  }
+  index = tail & *u->sq_mask;
+  u->sq_array[index] = index;
+  memset(&u->sqes[index], 0, sizeof(struct io_uring_sqe));
+  return &u->sqes[index];
+}
+
+static void tealet_uring_push(tealet_reactor_t *reactor) {
+  struct tealet_uring_t *u = reactor->uring;
+
+  __atomic_store_n(u->sq_tail, *u->sq_tail + 1, __ATOMIC_RELEASE);
+  u->unsubmitted++;
+}
+
+/* Queue a cancellation of the requests carrying 'data'. */
+static void tealet_uring_cancel(tealet_reactor_t *reactor, __u64 data) {
+  struct io_uring_sqe *sqe = tealet_uring_sqe(reactor);
+
+  if (sqe == NULL)
+    return;
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = data;
+  tealet_uring_push(reactor);
+}
+
+/* A completion of a multishot accept: queue the connection or error for
+ * tealet_io_accept().  A completion without IORING_CQE_F_MORE ends the
+ * request, and the next tealet_io_accept() arms a new one.
+ */
+static int tealet_uring_accepted(tealet_reactor_t *reactor, __u64 data, int res, unsigned int flags) {
+  struct tealet_uring_t *u = reactor->uring;
+  int fd = (int)((data >> 1) & 0x7fffffff);
+  tealet_reactor_fd_t *rec;
+  size_t size;
+  int *accepted;
+
+  rec = (size_t)fd < reactor->n_fds ? &reactor->fds[fd] : NULL;
+  if (rec == NULL || !rec->accepting || rec->accept_gen != (unsigned int)(data >> 32)) {
+    if (res >= 0)
+      close(res); /* raced with tealet_reactor_forget() */
+    return 0;
+  }
+  if (!(flags & IORING_CQE_F_MORE))
+    rec->accepting = 0;
+  if (res == -EINVAL && !u->multishot_ok) {
+    u->no_multishot = 1; /* an older kernel: the waiter retries single-shot */
+  } else if (res != -ECANCELED) {
+    if (res >= 0)
+      u->multishot_ok = 1;
+    if (rec->n_accepted == rec->accepted_size) {
+      size = rec->accepted_size ? rec->accepted_size * 2 : 8;
+      accepted = (int *)tealet_malloc(reactor->sched->main, size * sizeof(int));
+      if (accepted == NULL) {
+        if (res >= 0)
+          close(res);
+        return 0;
+      }
+      if (rec->accepted != NULL) {
+        memcpy(accepted, rec->accepted, rec->n_accepted * sizeof(int));
+        tealet_free(reactor->sched->main, rec->accepted);
+      }
+      rec->accepted = accepted;
+      rec->accepted_size = size;
+    }
+    rec->accepted[rec->n_accepted++] = res;
+  }
+  if (rec->reader == NULL)
+    return 0;
+  return tealet_sched_wake(reactor->sched, rec->reader);
+}
+#endif /* TEALET_WITH_URING */
+
+/* the scheduler's doorbell: wake the epoll loop from another thread */
+static void tealet_reactor_ring(void *arg) {
+  tealet_reactor_t *reactor = (tealet_reactor_t *)arg;
+  uint64_t one = 1;
+
+  while (write(reactor->wakefd, &one, sizeof(one)) < 0 && errno == EINTR)
+    ;
+}
+
+int tealet_reactor_init(tealet_reactor_t *reactor, tealet_sched_t *sched) {
+  struct epoll_event ev;
+
+  reactor->sched = sched;
+  reactor->fds = NULL;
+  reactor->n_fds = 0;
+  reactor->n_waiting = 0;
+  reactor->n_polls = 0;
+  reactor->n_wakeups = 0;
+  reactor->uring = NULL;
+  reactor->n_submitted = 0;
+  reactor->n_completed = 0;
+  reactor->n_enters = 0;
+  reactor->n_doorbells = 0;
+  reactor->wakefd = -1;
+  reactor->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (reactor->epfd < 0)
+    return TEALET_ERR_INVAL;
+  reactor->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  ev.events = EPOLLIN;
+  ev.data.fd = reactor->wakefd;
+  if (reactor->wakefd < 0 || epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, reactor->wakefd, &ev) != 0) {
+    if (reactor->wakefd >= 0)
+      close(reactor->wakefd);
+    close(reactor->epfd);
+    reactor->epfd = reactor->wakefd = -1;
+    return TEALET_ERR_INVAL;
+  }
+  tealet_sched_set_doorbell(sched, tealet_reactor_ring, reactor);
+  tealet_sched_advance(sched, tealet_reactor_clock());
+  return 0;
+}
+
+int tealet_reactor_init_ex(tealet_reactor_t *reactor, tealet_sched_t *sched, int flags) {
+  int result = tealet_reactor_init(reactor, sched);
+
+  if (result != 0)
+    return result;
+#if TEALET_WITH_URING
+  if (flags & TEALET_REACTOR_URING)
+    tealet_uring_open(reactor); /* without it, the epoll path serves */
+#else
+  (void)flags;
+#endif
+  return 0;
+}
+
+void tealet_reactor_destroy(tealet_reactor_t *reactor) {
+  size_t i, j;
+
+#if TEALET_WITH_URING
+  tealet_uring_close(reactor);
+#endif
+  if (reactor->sched->doorbell_arg == reactor)
+    tealet_sched_set_doorbell(reactor->sched, NULL, NULL);
+  if (reactor->wakefd >= 0)
+    close(reactor->wakefd);
+  reactor->wakefd = -1;
+  if (reactor->epfd >= 0)
+    close(reactor->epfd);
+  reactor->epfd = -1;
+  for (i = 0; i < reactor->n_fds; i++) {
+    for (j = 0; j < reactor->fds[i].n_accepted; j++) {
+      if (reactor->fds[i].accepted[j] >= 0)
+        close(reactor->fds[i].accepted[j]);
+    }
+    if (reactor->fds[i].accepted != NULL)
+      tealet_free(reactor->sched->main, reactor->fds[i].accepted);
+  }
+  if (reactor->fds != NULL)
+    tealet_free(reactor->sched->main, reactor->fds);
+  reactor->fds = NULL;
+  reactor->n_fds = 0;
+}
+
+/* The descriptor has data to read or room to write for 'events' right
+ * now.  Errors and hangups are left to the caller's I/O, which reports them
+ * before it waits.
+ */
+static int tealet_fd_ready(int fd, int events) {
+  struct pollfd pfd;
+
+  pfd.fd = fd;
+  pfd.events = (short)(((events & TEALET_FD_READ) ? POLLIN : 0) | ((events & TEALET_FD_WRITE) ? POLLOUT : 0));
+  pfd.revents = 0;
+  return poll(&pfd, 1, 0) > 0 && (pfd.revents & pfd.events) != 0;
+}
+
+/* tealet_wait_fd().  Edges are consumed when a wait returns, so a caller
+ * that left data behind would get no new edge; unless 'drained' says that
+ * its I/O just failed with EAGAIN, check the descriptor before parking.
+ */
+static int tealet_reactor_wait(tealet_reactor_t *reactor, int fd, int events, long timeout, int drained) {
+  tealet_sched_t *sched = reactor->sched;
+  tealet_t *current = tealet_current(sched->main);
+  tealet_reactor_fd_t *rec;
+  struct epoll_event ev;
+  int result = 0;
+
+  if (TEALET_IS_MAIN(current) || fd < 0 || (events & ~(TEALET_FD_READ | TEALET_FD_WRITE)) != 0 || events == 0)
+    return TEALET_ERR_INVAL;
+  rec = tealet_reactor_lookup(reactor, fd);
+  if (rec == NULL)
+    return TEALET_ERR_MEM;
+  if (((events & TEALET_FD_READ) && rec->reader != NULL) || ((events & TEALET_FD_WRITE) && rec->writer != NULL))
+    return TEALET_ERR_INVAL;
+  if (!rec->registered) {
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = fd;
+    if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+      return errno == ENOMEM ? TEALET_ERR_MEM : TEALET_ERR_INVAL;
+    rec->registered = 1;
+    rec->ready = 0;
+    drained = 1; /* adding the descriptor reports its current state */
+  }
+  if (rec->ready & events) {
+    rec->ready &= ~events;
+    return 0;
+  }
+  if (!drained && tealet_fd_ready(fd, events))
+    return 0;
+
+  if (timeout >= 0) {
+    tealet_sched_advance(sched, tealet_reactor_clock());
+    tealet_sched_set_deadline(sched, sched->now + (tealet_tick_t)timeout);
+  }
+  if (events & TEALET_FD_READ)
+    rec->reader = current;
+  if (events & TEALET_FD_WRITE)
+    rec->writer = current;
+  reactor->n_waiting++;
+  /* suspend returns early for stray wakeups; wait for the edge itself */
+  while (!(rec->ready & events)) {
+    result = tealet_sched_suspend(sched);
+    if (result != 0)
+      break;
+    rec = &reactor->fds[fd]; /* the cache may have grown meanwhile */
+  }
+  rec = &reactor->fds[fd];
+  reactor->n_waiting--;
+  if (rec->reader == current)
+    rec->reader = NULL;
+  if (rec->writer == current)
+    rec->writer = NULL;
+  if (timeout >= 0)
+    tealet_sched_clear_deadline(sched);
+  if (rec->ready & events) {
+    rec->ready &= ~events;
+    result = 0;
+  }
+  return result;
+}
+
+int tealet_wait_fd(tealet_reactor_t *reactor, int fd, int events, long timeout) {
+  return tealet_reactor_wait(reactor, fd, events, timeout, 0);
+}
+
+int tealet_reactor_forget(tealet_reactor_t *reactor, int fd) {
+  tealet_reactor_fd_t *rec;
+  size_t i;
+
+  if (fd < 0 || (size_t)fd >= reactor->n_fds)
+    return 0;
+  rec = &reactor->fds[fd];
+  if (rec->reader != NULL || rec->writer != NULL)
+    return TEALET_ERR_INVAL;
+  if (rec->registered)
+    epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, fd, NULL);
+  rec->registered = 0;
+  rec->ready = 0;
+#if TEALET_WITH_URING
+  if (rec->accepting) {
+    /* the request holds the socket open: cancel it before it is closed */
+    rec->accepting = 0;
+    tealet_uring_cancel(reactor, TEALET_URING_TAG(fd, rec->accept_gen));
+    tealet_uring_flush(reactor);
+  }
+#endif
+  for (i = 0; i < rec->n_accepted; i++) {
+    if (rec->accepted[i] >= 0)
+      close(rec->accepted[i]);
+  }
+  rec->n_accepted = 0;
+  return 0;
+}
+
+int tealet_reactor_poll(tealet_reactor_t *reactor, long timeout) {
+  struct epoll_event events[TEALET_REACTOR_BATCH];
+  tealet_sched_t *sched = reactor->sched;
+  tealet_reactor_fd_t *rec;
+  tealet_tick_t ticks;
+  uint64_t count;
+  int woken = 0;
+  int bits, n, i;
+
+  if (sched->head != NULL)
+    timeout = 0; /* tasks are ready: only collect what is pending */
+  else if (tealet_sched_next_timer(sched, &ticks) && (timeout < 0 || (tealet_tick_t)timeout > ticks))
+    timeout = (long)ticks;
+#if TEALET_WITH_URING
+  if (reactor->uring != NULL) {
+    /* submit what the tasks queued, all in one call */
+    if (tealet_uring_flush(reactor) != 0)
+      return TEALET_ERR_INVAL;
+    woken += tealet_uring_reap(reactor);
+    if (woken > 0)
+      timeout = 0;
+  }
+#endif
+  /* a full batch means more events are pending: collect them too */
+  do {
+    n = epoll_wait(reactor->epfd, events, TEALET_REACTOR_BATCH, (int)timeout);
+    reactor->n_polls++;
+    if (n < 0 && errno != EINTR)
+      return TEALET_ERR_INVAL;
+    for (i = 0; i < n; i++) {
+#if TEALET_WITH_URING
+      if (reactor->uring != NULL && events[i].data.fd == reactor->uring->fd)
+        continue; /* completions are reaped below */
+#endif
+      if (events[i].data.fd == reactor->wakefd) {
+        if (read(reactor->wakefd, &count, sizeof(count)) == sizeof(count))
+          reactor->n_doorbells++;
+        woken += tealet_sched_remote_drain(sched);
+        continue;
+      }
+      rec = &reactor->fds[events[i].data.fd];
+      bits = 0;
+      if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+        bits |= TEALET_FD_READ;
+      if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+        bits |= TEALET_FD_WRITE;
+      rec->ready |= bits;
+      if ((bits & TEALET_FD_READ) && rec->reader != NULL)
+        woken += tealet_sched_wake(sched, rec->reader);
+      if ((bits & TEALET_FD_WRITE) && rec->writer != NULL && rec->writer != rec->reader)
+        woken += tealet_sched_wake(sched, rec->writer);
+    }
+    timeout = 0;
+  } while (n == TEALET_REACTOR_BATCH);
+#if TEALET_WITH_URING
+  if (reactor->uring != NULL)
+    woken += tealet_uring_reap(reactor);
+#endif
+  woken += tealet_sched_advance(sched, tealet_reactor_clock());
+  reactor->n_wakeups += (size_t)woken;
+  return woken;
+}
+
+int tealet_reactor_run(tealet_reactor_t *reactor) {
+  tealet_sched_t *sched = reactor->sched;
+  int result;
+
+  if (!TEALET_CURRENT_IS_MAIN(sched->main))
+    return TEALET_ERR_INVAL;
+  for (;;) {
+    result = tealet_sched_run(sched);
+    if (result <= 0)
+      return result;
+    if (reactor->n_waiting == 0 && sched->n_timers == 0 && sched->n_remote_waiting == 0)
+      return result; /* nothing left that could wake a task */
+    result = tealet_reactor_poll(reactor, -1);
+    if (result < 0)
+      return result;
+  }
+}
+
+/****************************************************************
+ * Submit-and-suspend I/O.
+ * Without io_uring, or from main, the calls are the plain system calls,
+ * retried around tealet_wait_fd() when a non-blocking descriptor is not
+ * ready.
+ */
+static int tealet_io_fail(int error) {
+  errno = error;
+  return -1;
+}
+
+/* map a tealet_wait_fd() error to errno */
+static int tealet_io_waitfail(int result) {
+  return tealet_io_fail(result == TEALET_SCHED_TIMEOUT   ? ETIMEDOUT
+                        : result == TEALET_ERR_MEM     ? ENOMEM
+                        : result == TEALET_ERR_PANIC ? ECANCELED
+                                                     : EINVAL);
+}
+
+static ssize_t tealet_io_retry(tealet_reactor_t *reactor, tealet_t *current, int events, int fd, void *buf,
+                               size_t len, off_t off) {
+  ssize_t n;
+  int result;
+
+  for (;;) {
+    if (events == TEALET_FD_READ)
+      n = off < 0 ? read(fd, buf, len) : pread(fd, buf, len, off);
+    else
+      n = off < 0 ? write(fd, buf, len) : pwrite(fd, buf, len, off);
+    if (n >= 0)
+      return n;
+    if (errno == EINTR)
+      continue;
+    if (TEALET_IS_MAIN(current) || (errno != EAGAIN && errno != EWOULDBLOCK))
+      return -1;
+    result = tealet_reactor_wait(reactor, fd, events, -1, 1);
+    if (result != 0)
+      return tealet_io_waitfail(result);
+  }
+}
+
+static int tealet_io_retry_accept(tealet_reactor_t *reactor, tealet_t *current, int fd, int flags) {
+  int result;
+  int s;
+
+  for (;;) {
+    s = accept(fd, NULL, NULL);
+    if (s >= 0)
+      break;
+    if (errno == EINTR)
+      continue;
+    if (TEALET_IS_MAIN(current) || (errno != EAGAIN && errno != EWOULDBLOCK))
+      return -1;
+    result = tealet_reactor_wait(reactor, fd, TEALET_FD_READ, -1, 1);
+    if (result != 0)
+      return tealet_io_waitfail(result);
+  }
+  if (((flags & SOCK_NONBLOCK) && fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK) != 0) ||
+      ((flags & SOCK_CLOEXEC) && fcntl(s, F_SETFD, FD_CLOEXEC) != 0)) {
+    result = errno;
+    close(s);
+    return tealet_io_fail(result);
+  }
+  return s;
+}
+
+/* true if any of 'len' bytes at 'buf' lies in the live part of the
+ * current task's stack, the part that is saved away when it switches out
+ */
+static int tealet_io_stacked(tealet_t *current, const void *buf, size_t len) {
+  void *far = tealet_get_far(current);
+  char here;
+  char *nearest = (char *)buf;
+  char *furthest = (char *)buf + (len ? len - 1 : 0);
+  char *swap;
+
+  /* order the ends as the stack does; the range may also cover it whole */
+  if (tealet_stack_diff(nearest, furthest) > 0) {
+    swap = nearest;
+    nearest = furthest;
+    furthest = swap;
+  }
+  return tealet_stack_diff(furthest, &here) > 0 && (far == NULL || tealet_stack_diff(far, nearest) > 0);
+}
+
+#if TEALET_WITH_URING
+/* Queue the request filled in 'sqe' and suspend until it completes.
+ * Past the deadline or on a panic the request is cancelled, but the task
+ * keeps waiting for the completion, because the kernel may still use the
+ * buffer.
+ */
+static long tealet_uring_wait(tealet_reactor_t *reactor, tealet_t *current, struct io_uring_sqe *sqe) {
+  tealet_sched_node_t *node = TEALET_SCHED_NODE(current);
+  unsigned int flagged = 0;
+  int cancelled = 0, timed = 0;
+  int result;
+
+  sqe->user_data = (__u64)(uintptr_t)current;
+  node->io_done = 0;
+  tealet_uring_push(reactor);
+  reactor->n_waiting++;
+  while (!node->io_done) {
+    result = tealet_sched_suspend(reactor->sched);
+    if ((result != TEALET_SCHED_TIMEOUT && result != TEALET_ERR_PANIC) || node->io_done)
+      continue;
+    if (result == TEALET_SCHED_TIMEOUT) {
+      timed = 1;
+      node->timed_out = 0; /* so that the task can block again */
+    } else {
+      flagged |= node->flags & TEALET_SCHED_CANCELLED;
+      node->flags &= ~TEALET_SCHED_CANCELLED; /* likewise */
+    }
+    if (!cancelled)
+      tealet_uring_cancel(reactor, (__u64)(uintptr_t)current);
+    cancelled = 1;
+  }
+  reactor->n_waiting--;
+  node->flags |= flagged;
+  if (timed) {
+    node->timed_out = 1;
+    if (node->io_result == -ECANCELED || node->io_result == -EINTR)
+      node->io_result = -ETIMEDOUT;
+  }
+  return node->io_result;
+}
+
+/* tealet_wait_fd() after -EAGAIN, with its error as a negated errno */
+static long tealet_uring_waitfd(tealet_reactor_t *reactor, int fd, int events) {
+  int result = tealet_reactor_wait(reactor, fd, events, -1, 1);
+
+  if (result == 0)
+    return 0;
+  return result == TEALET_SCHED_TIMEOUT ? -ETIMEDOUT
+         : result == TEALET_ERR_MEM     ? -ENOMEM
+         : result == TEALET_ERR_PANIC   ? -ECANCELED
+                                        : -EINVAL;
+}
+
+static ssize_t tealet_uring_rw(tealet_reactor_t *reactor, tealet_t *current, int events, int fd, void *buf,
+                               size_t len, off_t off) {
+  struct tealet_uring_t *u = reactor->uring;
+  struct io_uring_sqe *sqe;
+  void *data = buf;
+  int index = -1;
+  long result;
+
+  if (TEALET_SCHED_NODE(current)->flags & TEALET_SCHED_CANCELLED)
+    return tealet_io_fail(ECANCELED);
+  if (TEALET_SCHED_NODE(current)->timed_out)
+    return tealet_io_fail(ETIMEDOUT);
+  if (len > TEALET_URING_MAXLEN)
+    len = TEALET_URING_MAXLEN;
+  if (tealet_io_stacked(current, buf, len)) {
+    /* bounce through a buffer the kernel may use while the stack is away */
+    if (len <= TEALET_URING_BUFSIZE && u->n_free > 0) {
+      index = u->free_bufs[--u->n_free];
+      data = u->bufs + (size_t)index * TEALET_URING_BUFSIZE;
+    } else {
+      data = tealet_malloc(current, len ? len : 1);
+      if (data == NULL)
+        return tealet_io_fail(ENOMEM);
+    }
+    if (events == TEALET_FD_WRITE)
+      memcpy(data, buf, len);
+  }
+  for (;;) {
+    sqe = tealet_uring_sqe(reactor);
+    if (sqe == NULL) {
+      result = -EAGAIN;
+      break;
+    }
+    if (index >= 0) {
+      sqe->opcode = events == TEALET_FD_READ ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+      sqe->buf_index = (__u16)index;
+    } else
+      sqe->opcode = events == TEALET_FD_READ ? IORING_OP_READ : IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (__u64)(uintptr_t)data;
+    sqe->len = (__u32)len;
+    sqe->off = off < 0 ? (__u64)-1 : (__u64)off;
+    result = tealet_uring_wait(reactor, current, sqe);
+    if (result != -EAGAIN)
+      break;
+    /* a non-blocking descriptor that was not ready: wait for it with epoll */
+    result = tealet_uring_waitfd(reactor, fd, events);
+    if (result != 0)
+      break;
+  }
+  if (data != buf) {
+    if (events == TEALET_FD_READ && result > 0)
+      memcpy(buf, data, (size_t)result);
+    if (index >= 0)
+      u->free_bufs[u->n_free++] = index;
+    else
+      tealet_free(current, data);
+  }
+  if (result < 0)
+    return tealet_io_fail((int)-result);
+  return (ssize_t)result;
+}
+
+static int tealet_uring_accept(tealet_reactor_t *reactor, tealet_t *current, int fd, int flags) {
+  struct tealet_uring_t *u = reactor->uring;
+  struct io_uring_sqe *sqe;
+  tealet_reactor_fd_t *rec;
+  long result;
+
+  if (TEALET_SCHED_NODE(current)->flags & TEALET_SCHED_CANCELLED)
+    return tealet_io_fail(ECANCELED);
+  if (TEALET_SCHED_NODE(current)->timed_out)
+    return tealet_io_fail(ETIMEDOUT);
+  rec = tealet_reactor_lookup(reactor, fd);
+  if (rec == NULL)
+    return tealet_io_fail(ENOMEM);
+  if (rec->reader != NULL)
+    return tealet_io_fail(EINVAL);
+  while (rec->n_accepted == 0) {
+    if (!rec->accepting) {
+      sqe = tealet_uring_sqe(reactor);
+      if (sqe == NULL)
+        return tealet_io_fail(EAGAIN);
+      sqe->opcode = IORING_OP_ACCEPT;
+      sqe->fd = fd;
+      sqe->accept_flags = (__u32)flags;
+      if (u->no_multishot) {
+        result = tealet_uring_wait(reactor, current, sqe);
+        if (result == -EAGAIN && (result = tealet_uring_waitfd(reactor, fd, TEALET_FD_READ)) == 0)
+          continue;
+        return result < 0 ? tealet_io_fail((int)-result) : (int)result;
+      }
+      sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+      rec = &reactor->fds[fd];
+      rec->accepting = 1;
+      rec->accept_gen++;
+      sqe->user_data = TEALET_URING_TAG(fd, rec->accept_gen);
+      tealet_uring_push(reactor);
+    }
+    rec->reader = current;
+    reactor->n_waiting++;
+    result = tealet_sched_suspend(reactor->sched);
+    reactor->n_waiting--;
+    rec = &reactor->fds[fd]; /* the cache may have grown meanwhile */
+    rec->reader = NULL;
+    if (result == TEALET_SCHED_TIMEOUT || result == TEALET_ERR_PANIC)
+      return tealet_io_fail(result == TEALET_SCHED_TIMEOUT ? ETIMEDOUT : ECANCELED);
+  }
+  result = rec->accepted[0];
+  rec->n_accepted--;
+  memmove(rec->accepted, rec->accepted + 1, rec->n_accepted * sizeof(int));
+  if (result == -EAGAIN) {
+    /* a non-blocking listener on an older kernel */
+    result = tealet_uring_waitfd(reactor, fd, TEALET_FD_READ);
+    return result < 0 ? tealet_io_fail((int)-result) : tealet_uring_accept(reactor, current, fd, flags);
+  }
+  return result < 0 ? tealet_io_fail((int)-result) : (int)result;
+}
+#endif /* TEALET_WITH_URING */
+
+ssize_t tealet_io_read(tealet_reactor_t *reactor, int fd, void *buf, size_t len, off_t off) {
+  tealet_t *current = tealet_current(reactor->sched->main);
+
+#if TEALET_WITH_URING
+  if (reactor->uring != NULL && !TEALET_IS_MAIN(current))
+    return tealet_uring_rw(reactor, current, TEALET_FD_READ, fd, buf, len, off);
+#endif
+  return tealet_io_retry(reactor, current, TEALET_FD_READ, fd, buf, len, off);
+}
+
+ssize_t tealet_io_write(tealet_reactor_t *reactor, int fd, const void *buf, size_t len, off_t off) {
+  tealet_t *current = tealet_current(reactor->sched->main);
+
+#if TEALET_WITH_URING
+  if (reactor->uring != NULL && !TEALET_IS_MAIN(current))
+    return tealet_uring_rw(reactor, current, TEALET_FD_WRITE, fd, (void *)buf, len, off);
+#endif
+  return tealet_io_retry(reactor, current, TEALET_FD_WRITE, fd, (void *)buf, len, off);
+}
+
+int tealet_io_accept(tealet_reactor_t *reactor, int fd, int flags) {
+  tealet_t *current = tealet_current(reactor->sched->main);
+
+#if TEALET_WITH_URING
+  if (reactor->uring != NULL && !TEALET_IS_MAIN(current))
+    return tealet_uring_accept(reactor, current, fd, flags);
+#endif
+  return tealet_io_retry_accept(reactor, current, fd, flags);
+}
+
+int tealet_io_fsync(tealet_reactor_t *reactor, int fd) {
+  tealet_t *current = tealet_current(reactor->sched->main);
+#if TEALET_WITH_URING
+  struct io_uring_sqe *sqe;
+  long result;
+
+  if (reactor->uring != NULL && !TEALET_IS_MAIN(current)) {
+    if (TEALET_SCHED_NODE(current)->flags & TEALET_SCHED_CANCELLED)
+      return tealet_io_fail(ECANCELED);
+    if (TEALET_SCHED_NODE(current)->timed_out)
+      return tealet_io_fail(ETIMEDOUT);
+    sqe = tealet_uring_sqe(reactor);
+    if (sqe == NULL)
+      return tealet_io_fail(EAGAIN);
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = fd;
+    result = tealet_uring_wait(reactor, current, sqe);
+    return result < 0 ? tealet_io_fail((int)-result) : 0;
+  }
+#endif
+  (void)current;
+  return fsync(fd);
+}
+
+/****************************************************************
+ * Offloading blocking calls.
+ * Submission goes through a mutex-protected FIFO that idle workers wait
+ * on.  Completion needs no lock: the worker stores the result and hands
+ * the task back with tealet_wake_remote(), after which it must not touch
+ * the job again.
+ */
+struct tealet_offload_workers_t {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  tealet_offload_job_t *head; /* pending jobs, FIFO */
+  tealet_offload_job_t *tail;
+  int stopping;
+  size_t n_started;
+  pthread_t threads[1]; /* n_threads of them */
+};
+
+static void *tealet_offload_worker(void *arg) {
+  struct tealet_offload_workers_t *w = (struct tealet_offload_workers_t *)arg;
+  tealet_offload_job_t *job;
+  tealet_sched_node_t *node;
+
+  pthread_mutex_lock(&w->lock);
+  for (;;) {
+    while (w->head == NULL && !w->stopping)
+      pthread_cond_wait(&w->cond, &w->lock);
+    if (w->head == NULL)
+      break;
+    job = w->head;
+    w->head = job->next;
+    if (w->head == NULL)
+      w->tail = NULL;
+    pthread_mutex_unlock(&w->lock);
+
+    job->result = job->fn(job->arg);
+    node = (tealet_sched_node_t *)((char *)job - offsetof(tealet_sched_node_t, job));
+    tealet_wake_remote(node->tealet);
+    pthread_mutex_lock(&w->lock);
+  }
+  pthread_mutex_unlock(&w->lock);
+  return NULL;
+}
+
+static void tealet_offload_stop(tealet_offload_t *pool) {
+  struct tealet_offload_workers_t *w = pool->workers;
+  size_t i;
+
+  pthread_mutex_lock(&w->lock);
+  w->stopping = 1;
+  pthread_cond_broadcast(&w->cond);
+  pthread_mutex_unlock(&w->lock);
+  for (i = 0; i < w->n_started; i++)
+    pthread_join(w->threads[i], NULL);
+  pthread_cond_destroy(&w->cond);
+  pthread_mutex_destroy(&w->lock);
+  tealet_free(pool->reactor->sched->main, w);
+  pool->workers = NULL;
+}
+
+int tealet_offload_init(tealet_offload_t *pool, tealet_reactor_t *reactor, size_t n_threads) {
+  struct tealet_offload_workers_t *w;
+  size_t i;
+
+  if (n_threads == 0)
+    n_threads = TEALET_OFFLOAD_THREADS;
+  memset(pool, 0, sizeof(tealet_offload_t));
+  pool->reactor = reactor;
+  pool->n_threads = n_threads;
+  w = (struct tealet_offload_workers_t *)tealet_malloc(
+      reactor->sched->main, sizeof(struct tealet_offload_workers_t) + (n_threads - 1) * sizeof(pthread_t));
+  if (w == NULL)
+    return TEALET_ERR_MEM;
+  memset(w, 0, sizeof(struct tealet_offload_workers_t));
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->cond, NULL);
+  pool->workers = w;
+  for (i = 0; i < n_threads; i++) {
+    if (pthread_create(&w->threads[i], NULL, tealet_offload_worker, w) != 0) {
+      tealet_offload_stop(pool);
+      return TEALET_ERR_INVAL;
+    }
+    w->n_started++;
+  }
+  return 0;
+}
+
+int tealet_offload_destroy(tealet_offload_t *pool) {
+  if (pool->n_inflight > 0)
+    return TEALET_ERR_INVAL;
+  tealet_offload_stop(pool);
+  return 0;
+}
+
+int tealet_offload(tealet_offload_t *pool, tealet_offload_fn_t fn, void *arg, size_t argsize, void **presult) {
+  struct tealet_offload_workers_t *w = pool->workers;
+  tealet_sched_t *sched = pool->reactor->sched;
+  tealet_t *current = tealet_current(sched->main);
+  tealet_offload_job_t *job;
+  int result;
+
+  if (TEALET_IS_MAIN(current)) {
+    arg = fn(arg);
+    if (presult != NULL)
+      *presult = arg;
+    return 0;
+  }
+  if (argsize != 0 && tealet_io_stacked(current, arg, argsize))
+    return TEALET_ERR_INVAL;
+  job = &TEALET_SCHED_NODE(current)->job;
+  job->fn = fn;
+  job->arg = arg;
+  job->result = NULL;
+  job->next = NULL;
+  pthread_mutex_lock(&w->lock);
+  if (w->tail != NULL)
+    w->tail->next = job;
+  else
+    w->head = job;
+  w->tail = job;
+  pthread_cond_signal(&w->cond);
+  pthread_mutex_unlock(&w->lock);
+  pool->n_jobs++;
+  pool->n_inflight++;
+
+  /* the job cannot be called back: wait for it even past the deadline */
+  result = tealet_sched_suspend_remote(sched);
+  pool->n_inflight--;
+  if (presult != NULL)
+    *presult = job->result;
+  return result;
+}
+#endif /* TEALET_WITH_REACTOR */
@@ -6,6 +6,10 @@
 #ifndef _TEALET_EXTRAS_H_
 #define _TEALET_EXTRAS_H_
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /****************************************************************
  * A tealet allocator that gathers usage statistics
  */
@@ -20,6 +24,82 @@ typedef struct tealet_statsalloc_t {
 TEALET_API
 void tealet_statsalloc_init(tealet_statsalloc_t *alloc, tealet_alloc_t *base);
 
+/****************************************************************
+ * A process-wide pool of recycled stack buffers.
+ * Saved stack headers and chunks are rounded up to a few size classes
+ * and recycled instead of going back to the base allocator.  Each domain
+ * allocates through its own tealet_bufcache_t, which keeps two magazines
+ * of buffers per size class and needs no locking beyond the domain's own
+ * serialization.  Full magazines are exchanged with a global depot shared
+ * by all caches of the pool, using lock-free atomic slot operations, so
+ * buffers freed in one domain can be reused by another one without
+ * returning to the base allocator.
+ * Other allocations and oversized buffers go directly to the base
+ * allocator, which must be thread-safe if the pool is shared by threads.
+ */
+
+#define TEALET_BUFPOOL_CLASSES 8    /* size classes 256 bytes .. 32 kB */
+#define TEALET_BUFPOOL_MIN_SHIFT 8  /* log2 of the smallest size class */
+#define TEALET_BUFPOOL_ROUNDS 32    /* buffers per magazine */
+#define TEALET_BUFPOOL_DEPOT 64     /* depot slots per size class */
+
+typedef struct tealet_bufpool_magazine_t tealet_bufpool_magazine_t;
+
+typedef struct tealet_bufpool_t {
+  tealet_alloc_t *base; /* thread-safe base allocator */
+  tealet_bufpool_magazine_t *depot[TEALET_BUFPOOL_CLASSES][TEALET_BUFPOOL_DEPOT];
+  size_t n_depot_puts;  /* magazines handed to the depot (atomic) */
+  size_t n_depot_gets;  /* magazines taken from the depot (atomic) */
+  size_t n_base_allocs; /* buffers allocated from the base allocator (atomic) */
+  size_t n_base_frees;  /* buffers returned to the base allocator (atomic) */
+} tealet_bufpool_t;
+
+typedef struct tealet_bufcache_t {
+  tealet_alloc2_t alloc;   /* pass &cache->alloc to tealet_initialize2() */
+  tealet_bufpool_t *pool;  /* the shared pool */
+  tealet_bufpool_magazine_t *loaded[TEALET_BUFPOOL_CLASSES];
+  tealet_bufpool_magazine_t *previous[TEALET_BUFPOOL_CLASSES];
+  size_t n_hits;           /* buffer allocations served from magazines */
+  size_t n_misses;         /* buffer allocations that went to the base allocator */
+  size_t n_recycled;       /* buffer frees kept in magazines */
+  size_t n_depot_gets;     /* full magazines taken from the depot */
+  size_t n_depot_puts;     /* full magazines handed to the depot */
+} tealet_bufcache_t;
+
+/* Global pool statistics.  Counters are read without synchronization and
+ * are approximate while other threads use the pool.
+ */
+typedef struct tealet_bufpool_stats_t {
+  size_t n_depot_puts;
+  size_t n_depot_gets;
+  size_t n_base_allocs;
+  size_t n_base_frees;
+  size_t depot_magazines; /* magazines currently held by the depot */
+} tealet_bufpool_stats_t;
+
+/* Initialize a pool on top of 'base'. */
+TEALET_API
+void tealet_bufpool_init(tealet_bufpool_t *pool, tealet_alloc_t *base);
+
+/* Release all buffers held by the depot.  All caches must be flushed. */
+TEALET_API
+void tealet_bufpool_destroy(tealet_bufpool_t *pool);
+
+TEALET_API
+void tealet_bufpool_get_stats(tealet_bufpool_t *pool, tealet_bufpool_stats_t *stats);
+
+/* Initialize a per-domain cache of 'pool'.  Create the domain with
+ * tealet_initialize2(&cache->alloc, ...).
+ */
+TEALET_API
+void tealet_bufcache_init(tealet_bufcache_t *cache, tealet_bufpool_t *pool);
+
+/* Hand the cached buffers back to the pool, e.g. after tealet_finalize().
+ * The cache can be used again afterwards.
+ */
+TEALET_API
+void tealet_bufcache_flush(tealet_bufcache_t *cache);
+
 /****************************************************************
  * Convenience creation wrappers built on tealet_new() + tealet_run().
  */
@@ -50,4 +130,911 @@ int tealet_stub_new(tealet_t *tealet, tealet_t **pstub, void *stack_far);
 TEALET_API
 int tealet_stub_run(tealet_t *stub, tealet_run_t run, void **parg);
 
+/****************************************************************
+ * A pool of pre-captured stubs.
+ * The pool captures one prototype stub at a fixed stack depth and keeps
+ * up to 'capacity' duplicates of it ready to run.  Spawning from the pool
+ * takes a ready stub, or duplicates the prototype on a miss, and starts
+ * the run function without any per-spawn bookkeeping allocation: the
+ * pending run function and argument are handed over through the pool
+ * itself.  Refill the pool in batches when the program is idle.
+ */
+
+/* A function called through tealet_call_spilled(), see below. */
+typedef void *(*tealet_spill_t)(tealet_t *current, void *arg);
+
+typedef struct tealet_stubpool_t {
+  tealet_t *proto;      /* prototype stub, never run */
+  tealet_t **stubs;     /* ready stubs, duplicates of proto */
+  size_t capacity;      /* size of the stubs array */
+  size_t count;         /* number of ready stubs */
+  tealet_run_t run;     /* pending launch, consumed by the trampoline */
+  void *runarg;         /* pending launch argument */
+  tealet_spill_t spill; /* pending spilled call, see tealet_call_spilled() */
+  void *spillarg;       /* pending spilled call argument */
+  size_t n_hits;        /* spawns served by a ready stub */
+  size_t n_misses;      /* spawns that had to duplicate the prototype */
+  size_t n_refills;     /* stubs added by tealet_stubpool_refill() */
+} tealet_stubpool_t;
+
+/* Create a pool whose prototype stub is captured at the caller's stack
+ * depth (extended to 'stack_far' if given), and fill it to 'capacity'.
+ * Filling is best effort; the pool is returned even if fewer stubs could
+ * be prepared.
+ */
+TEALET_API
+int tealet_stubpool_new(tealet_t *tealet, tealet_stubpool_t **ppool, size_t capacity, void *stack_far);
+
+/* Delete all ready stubs, the prototype and the pool itself. */
+TEALET_API
+void tealet_stubpool_delete(tealet_stubpool_t *pool);
+
+/* Add up to 'max' ready stubs (0 means fill to capacity).
+ * Returns the number of stubs added, or TEALET_ERR_MEM if none could be
+ * added although the pool was not full.
+ */
+TEALET_API
+int tealet_stubpool_refill(tealet_stubpool_t *pool, size_t max);
+
+/* Take a stub from the pool and run 'run' on it, with the semantics of
+ * tealet_stub_run().  The created tealet is returned via 'pcreated'.
+ */
+TEALET_API
+int tealet_stubpool_spawn(tealet_stubpool_t *pool, tealet_t **pcreated, tealet_run_t run, void **parg);
+
+/****************************************************************
+ * Stack spilling for deep recursion.
+ * A switch copies the stack between the switching point and the tealet's
+ * far boundary, so a tealet that suspends deep inside a recursion pays
+ * for its whole depth on every switch.  tealet_call_spilled() moves such
+ * a call onto a fresh tealet that starts at the shallow depth of a stub
+ * pool, so that the deep prefix is saved once and later switches only
+ * copy the depth reached within the call.
+ */
+
+/* Call 'fn(current, *parg)' and store its result in '*parg'.
+ * If the current tealet is more than 'threshold' bytes deep, measured with
+ * tealet_stack_diff() from its far boundary (or from the pool's prototype
+ * stub for the unbounded main tealet), 'fn' instead runs on a stub taken
+ * from 'pool' and control returns here when 'fn' returns.  The stub is
+ * deleted afterwards.  The pool should be created at a shallow depth.
+ *
+ * Note that a spilled 'fn' runs as a different tealet: it must use the
+ * 'current' it is passed for switching, and the calling tealet must not be
+ * resumed by others until the call returns.
+ * Returns 0 on success, or a negative error from the switch to the stub.
+ */
+TEALET_API
+int tealet_call_spilled(tealet_stubpool_t *pool, tealet_spill_t fn, void **parg, size_t threshold);
+
+/****************************************************************
+ * A cooperative run-queue scheduler.
+ * Tasks are tealets created by tealet_sched_spawn().  Each task's extra
+ * area starts with a tealet_sched_node_t that links it into the ready
+ * queue or a wait list, so queueing never allocates.  A task that yields,
+ * blocks or exits switches directly to the next ready task; control only
+ * returns to the main tealet when no task is ready.  All scheduler calls
+ * must be made from tealets of the scheduler's domain.
+ */
+
+/* A task function.  Its return value is handed to tealet_sched_join(). */
+typedef void *(*tealet_sched_fn_t)(tealet_t *current, void *arg);
+
+typedef struct tealet_sched_t tealet_sched_t;
+
+/* rings the owner thread of a scheduler, see tealet_sched_set_doorbell() */
+typedef void (*tealet_sched_doorbell_t)(void *arg);
+
+/* task states */
+#define TEALET_SCHED_READY 0   /* in the ready queue */
+#define TEALET_SCHED_RUNNING 1 /* the current task */
+#define TEALET_SCHED_BLOCKED 2 /* suspended until woken */
+#define TEALET_SCHED_DONE 3    /* returned, waiting to be joined */
+
+/* spawn flags */
+#define TEALET_SCHED_DETACHED 1 /* delete the task when it returns; it cannot be joined */
+
+/* ready queue orderings, see tealet_sched_set_policy() */
+#define TEALET_SCHED_FIFO 0  /* strict arrival order */
+#define TEALET_SCHED_SLICE 1 /* prefer tasks that are cheap to switch to */
+
+#define TEALET_SCHED_WINDOW 8   /* default number of ready tasks compared per pick */
+#define TEALET_SCHED_FAIRNESS 4 /* default number of times a task may be passed over */
+
+/* result of a wait that ended at the task's deadline; distinct from the
+ * TEALET_CHAN_* results
+ */
+#define TEALET_SCHED_TIMEOUT 3
+
+/* Timer wheel geometry: TEALET_WHEEL_LEVELS levels of TEALET_WHEEL_SLOTS
+ * slots each, level n holding timers due within 64^(n+1) ticks.  Timers
+ * further out are parked in the last level and cascaded again.
+ */
+#define TEALET_WHEEL_BITS 6
+#define TEALET_WHEEL_SLOTS (1 << TEALET_WHEEL_BITS)
+#define TEALET_WHEEL_LEVELS 4
+
+/* A tick count.  The unit is whatever the caller passes to
+ * tealet_sched_advance(); comparisons are modular, so the count may wrap.
+ */
+typedef unsigned long tealet_tick_t;
+
+/* true if tick 'a' comes before tick 'b' */
+#define TEALET_TICK_BEFORE(a, b) ((long)((tealet_tick_t)(a) - (tealet_tick_t)(b)) < 0)
+
+/* a task's timer, linked into one slot of the scheduler's wheel */
+typedef struct tealet_timer_t {
+  struct tealet_timer_t *next;
+  struct tealet_timer_t **pprev; /* the link pointing here, or NULL if not armed */
+  tealet_tick_t expires;
+  int level; /* the wheel level it is linked into */
+} tealet_timer_t;
+
+/* A task waiting on a channel, see tealet_chan_select().  It lives in the
+ * task's scheduler node, or in a block from tealet_malloc() when a select
+ * waits on several channels, never on the task's own stack.
+ */
+typedef struct tealet_chan_waiter_t {
+  struct tealet_chan_waiter_t *next; /* channel wait queue, circular */
+  struct tealet_chan_waiter_t *prev;
+  struct tealet_sched_node_t *node; /* the waiting task */
+  struct tealet_chan_t *chan;
+  int op;      /* TEALET_CHAN_SEND or TEALET_CHAN_RECV */
+  int index;   /* case index in tealet_chan_select() */
+  void *value; /* the value to send, or the value received */
+} tealet_chan_waiter_t;
+
+/* A blocking call run on a worker thread, see tealet_offload().  It lives
+ * in the task's scheduler node while the task is suspended.
+ */
+typedef void *(*tealet_offload_fn_t)(void *arg);
+
+typedef struct tealet_offload_job_t {
+  struct tealet_offload_job_t *next; /* the pending queue */
+  tealet_offload_fn_t fn;
+  void *arg;
+  void *result;
+} tealet_offload_job_t;
+
+/* a FIFO of tasks waiting on a mutex, condition variable, semaphore or
+ * barrier, threaded through their scheduler nodes
+ */
+typedef struct tealet_waitq_t {
+  struct tealet_sched_node_t *head;
+  struct tealet_sched_node_t *tail;
+} tealet_waitq_t;
+
+struct tealet_mutex_t;
+struct tealet_taskgroup_t;
+
+typedef struct tealet_sched_node_t {
+  struct tealet_sched_node_t *next; /* ready queue link */
+  tealet_t *tealet;                 /* the task */
+  tealet_sched_t *sched;
+  tealet_sched_fn_t fn; /* task function */
+  void *arg;
+  void *result;     /* return value of fn */
+  tealet_t *joiner; /* tealet waiting in tealet_sched_join() */
+  unsigned int state;
+  unsigned int flags;
+  int permit;         /* a wakeup arrived while the task was not blocked */
+  unsigned int skips; /* times passed over by TEALET_SCHED_SLICE since queued */
+
+  /* channel waits in progress */
+  tealet_chan_waiter_t wait;     /* the waiter of a single send or recv */
+  tealet_chan_waiter_t *waiters; /* the waiters of the current operation */
+  int n_waiters;
+  int fired;        /* index of the completed waiter, -1, or -2 after a timeout */
+  int fired_status; /* its result: 0, TEALET_CHAN_CLOSED or TEALET_ERR_INVAL */
+
+  tealet_timer_t timer; /* deadline or sleep, see tealet_sched_set_deadline() */
+  int timed_out;        /* the deadline has passed */
+
+  /* an io_uring request in flight, see tealet_io_read() */
+  long io_result; /* its completion result */
+  int io_done;    /* the completion has arrived */
+
+  tealet_offload_job_t job; /* a call in progress on a worker thread */
+
+  /* a wakeup from another thread, see tealet_wake_remote() */
+  struct tealet_sched_node_t *remote_next; /* link in the remote stack, NULL when not queued */
+  int remote_permit;                       /* a remote wakeup was delivered */
+
+  /* a wait on a synchronization primitive, see tealet_mutex_lock() */
+  struct tealet_sched_node_t *sync_next; /* wait queue link */
+  tealet_waitq_t *sync_queue;            /* the queue it is linked into, or NULL */
+  struct tealet_mutex_t *sync_mutex;     /* the mutex tealet_cond_wait() takes back */
+  int sync_granted;                      /* the wait was satisfied */
+
+  /* membership of a task group, see tealet_taskgroup_spawn() */
+  struct tealet_taskgroup_t *group;           /* NULL for other tasks */
+  struct tealet_sched_node_t *group_next; /* running list, then completion queue */
+  struct tealet_sched_node_t *group_prev;
+  void **group_slot; /* where joining stores the result, or NULL */
+  int group_status;  /* 0, TEALET_TASKGROUP_FAILED or TEALET_TASKGROUP_CANCELLED */
+} tealet_sched_node_t;
+
+struct tealet_sched_t {
+  tealet_t *main;             /* the domain's main tealet */
+  tealet_sched_node_t *head;  /* ready queue, FIFO */
+  tealet_sched_node_t *tail;
+  size_t n_ready;             /* tasks in the ready queue */
+  size_t n_tasks;             /* tasks spawned and not yet joined or deleted */
+  size_t n_switches;          /* switches made by the scheduler */
+  size_t n_yields;            /* calls to tealet_sched_yield() that switched */
+  int policy;                 /* TEALET_SCHED_FIFO or TEALET_SCHED_SLICE */
+  unsigned int window;        /* ready tasks compared per pick */
+  unsigned int fairness;      /* times a task may be passed over */
+
+  /* timer wheel */
+  tealet_tick_t now;  /* the last tick passed to tealet_sched_advance() */
+  size_t n_timers;    /* armed timers */
+  size_t n_expired;   /* timers that have fired */
+  size_t wheel_count[TEALET_WHEEL_LEVELS];
+  tealet_timer_t *wheel[TEALET_WHEEL_LEVELS][TEALET_WHEEL_SLOTS];
+
+  /* wakeups from other threads */
+  tealet_sched_node_t *remote;      /* lock-free stack pushed by tealet_wake_remote() */
+  tealet_sched_doorbell_t doorbell; /* called when 'remote' stops being empty, or NULL */
+  void *doorbell_arg;
+  size_t n_remote;         /* remote wakeups delivered */
+  size_t n_remote_waiting; /* tasks in tealet_sched_suspend_remote() */
+};
+
+/* the scheduler node of a task, and the user part of its extra area */
+#define TEALET_SCHED_NODE(t) ((tealet_sched_node_t *)(t)->extra)
+#define TEALET_SCHED_EXTRA(t, tp) ((tp *)(TEALET_SCHED_NODE(t) + 1))
+
+/* Initialize a scheduler for the domain of 'tealet'. */
+TEALET_API
+void tealet_sched_init(tealet_sched_t *sched, tealet_t *tealet);
+
+/* Choose how the next task is picked from the ready queue.
+ * TEALET_SCHED_FIFO runs tasks in arrival order.  TEALET_SCHED_SLICE
+ * compares the first 'window' ready tasks with tealet_switch_cost() and
+ * runs the cheapest, so that tasks whose stacks do not overlap the live
+ * stack are preferred and fewer bytes are copied.  A task at the head of
+ * the queue is passed over at most 'fairness' times.  Zero selects the
+ * defaults TEALET_SCHED_WINDOW and TEALET_SCHED_FAIRNESS.
+ */
+TEALET_API
+int tealet_sched_set_policy(tealet_sched_t *sched, int policy, unsigned int window, unsigned int fairness);
+
+/* Create a task running 'fn(task, arg)' and append it to the ready queue.
+ * The task gets 'extrasize' bytes of its own behind the scheduler node, see
+ * TEALET_SCHED_EXTRA().  'flags' is 0 or TEALET_SCHED_DETACHED.
+ * The task starts when the scheduler reaches it, see tealet_sched_run().
+ */
+TEALET_API
+int tealet_sched_spawn(tealet_sched_t *sched, tealet_t **pcreated, tealet_sched_fn_t fn, void *arg, size_t extrasize,
+                       int flags);
+
+/* Run ready tasks until none is left, then return to the caller, which
+ * must be the main tealet.  Returns the number of tasks still alive, i.e.
+ * blocked or waiting to be joined.
+ */
+TEALET_API
+int tealet_sched_run(tealet_sched_t *sched);
+
+/* Move the current task to the back of the ready queue and switch to the
+ * next ready task.  Returns immediately if no other task is ready.
+ */
+TEALET_API
+int tealet_sched_yield(tealet_sched_t *sched);
+
+/* Block the current task until tealet_sched_wake() is called for it.
+ * A wakeup that arrived since the task last blocked is consumed instead,
+ * so wakeups are not lost.  Returns TEALET_SCHED_TIMEOUT if the task's
+ * deadline passes first, and TEALET_ERR_INVAL from the main tealet.
+ */
+TEALET_API
+int tealet_sched_suspend(tealet_sched_t *sched);
+
+/* Make a blocked task ready.  Returns 1 if it was blocked, otherwise 0 and
+ * the wakeup is kept for its next tealet_sched_suspend().
+ */
+TEALET_API
+int tealet_sched_wake(tealet_sched_t *sched, tealet_t *task);
+
+/* Wait for a task to return, store its result in '*presult' and delete it.
+ * A task can be joined only once.  Called from the main tealet, this runs
+ * the scheduler until the task is done and returns TEALET_ERR_INVAL if no
+ * task is ready before that, because the join would never finish.  A task
+ * joining past its deadline gets TEALET_SCHED_TIMEOUT.
+ */
+TEALET_API
+int tealet_sched_join(tealet_sched_t *sched, tealet_t *task, void **presult);
+
+/* Advance the scheduler's clock to tick 'now' and make every task whose
+ * timer expired ready, in one batch.  Tasks only run once the caller
+ * yields or calls tealet_sched_run().  Returns the number of timers that
+ * fired.  The first call may pass any starting tick.
+ */
+TEALET_API
+int tealet_sched_advance(tealet_sched_t *sched, tealet_tick_t now);
+
+/* If a timer is armed, store in '*pticks' how many ticks may pass before
+ * one can expire and return 1; otherwise return 0.  The count is exact
+ * for timers due within TEALET_WHEEL_SLOTS ticks and a lower bound beyond
+ * that, so a caller can sleep for it and ask again.
+ */
+TEALET_API
+int tealet_sched_next_timer(tealet_sched_t *sched, tealet_tick_t *pticks);
+
+/* Block the current task for 'ticks' ticks of tealet_sched_advance().
+ * A task has a single timer, so this cancels its deadline.  Wakeups from
+ * tealet_sched_wake() do not end the sleep.  Returns TEALET_ERR_INVAL
+ * from the main tealet.
+ */
+TEALET_API
+int tealet_sched_sleep(tealet_sched_t *sched, tealet_tick_t ticks);
+
+/* Give the current task a deadline at tick 'deadline'.  Once it passes,
+ * tealet_sched_suspend() and channel operations that would block return
+ * TEALET_SCHED_TIMEOUT instead, until tealet_sched_clear_deadline().
+ * Arming and clearing never allocate: the timer lives in the task's
+ * scheduler node.  Returns TEALET_ERR_INVAL from the main tealet.
+ */
+TEALET_API
+int tealet_sched_set_deadline(tealet_sched_t *sched, tealet_tick_t deadline);
+
+/* Cancel the current task's deadline. */
+TEALET_API
+void tealet_sched_clear_deadline(tealet_sched_t *sched);
+
+/* Make 'task' runnable from any thread, without the domain lock.  The
+ * task is pushed on the scheduler's lock-free wake stack; the owner
+ * thread takes the whole stack at its next scheduling point and wakes
+ * the tasks in order, as tealet_sched_wake() would.  A task that is
+ * already queued is not queued twice.  The doorbell rings when the stack
+ * stops being empty, so a burst of wakeups costs one signal.  The task
+ * must stay alive until the wakeup is delivered, which
+ * tealet_sched_suspend_remote() guarantees.  Returns TEALET_ERR_INVAL for
+ * a main tealet.
+ */
+TEALET_API
+int tealet_wake_remote(tealet_t *task);
+
+/* Block the current task until a wakeup from tealet_wake_remote() has
+ * been delivered to it; one delivered earlier is consumed instead.
+ * Local wakeups, the deadline, a panic and failed switches do not end the
+ * wait, since the remote thread may still hold on to the task.  Returns
+ * TEALET_ERR_PANIC if the task was cancelled meanwhile, and
+ * TEALET_ERR_INVAL from the main tealet.
+ */
+TEALET_API
+int tealet_sched_suspend_remote(tealet_sched_t *sched);
+
+/* Call 'fn(arg)' from the thread of the first tealet_wake_remote() that
+ * finds the wake stack empty, so that an owner thread sleeping outside
+ * tealet_sched_run() can be woken.  tealet_reactor_init() installs an
+ * eventfd here.  Set it before other threads can wake tasks.
+ */
+TEALET_API
+void tealet_sched_set_doorbell(tealet_sched_t *sched, tealet_sched_doorbell_t fn, void *arg);
+
+/****************************************************************
+ * Channels.
+ * A channel carries pointer-sized values between tasks of a scheduler.
+ * Buffered values are stored inline in a ring buffer, so small values
+ * can be sent cast to a pointer without allocating a message.  When a
+ * receiver is already waiting, a send stores the value in the receiver's
+ * waiter and switches directly to it; the sender runs next.  Channels can
+ * also be used from the main tealet, where a blocking operation runs the
+ * scheduler until it completes.
+ */
+
+#define TEALET_CHAN_UNBOUNDED ((size_t)-1) /* capacity of a channel that never fills */
+
+/* operations of a tealet_chan_case_t */
+#define TEALET_CHAN_SEND 0
+#define TEALET_CHAN_RECV 1
+
+/* flags for tealet_chan_select() */
+#define TEALET_CHAN_NOWAIT 1 /* fail with TEALET_CHAN_WOULDBLOCK instead of blocking */
+
+/* non-error results */
+#define TEALET_CHAN_CLOSED 1     /* the channel is closed and has no values left */
+#define TEALET_CHAN_WOULDBLOCK 2 /* TEALET_CHAN_NOWAIT was given and no case was ready */
+
+typedef struct tealet_chan_t {
+  tealet_sched_t *sched;
+  void **buf;      /* ring buffer of values */
+  size_t size;     /* slots allocated in buf */
+  size_t capacity; /* values that may be buffered, or TEALET_CHAN_UNBOUNDED */
+  size_t first;    /* index of the oldest value */
+  size_t count;    /* values in the buffer */
+  tealet_chan_waiter_t *sendq; /* blocked senders, oldest first */
+  tealet_chan_waiter_t *recvq; /* blocked receivers, oldest first */
+  int closed;
+  size_t n_handoffs; /* values handed directly to a waiting receiver */
+} tealet_chan_t;
+
+typedef struct tealet_chan_case_t {
+  tealet_chan_t *chan;
+  int op;      /* TEALET_CHAN_SEND or TEALET_CHAN_RECV */
+  void *value; /* the value to send, or the value received */
+} tealet_chan_case_t;
+
+/* Initialize a channel for the tasks of 'sched'.  A capacity of 0 makes
+ * every send wait for a receiver; TEALET_CHAN_UNBOUNDED grows the buffer
+ * as needed.  A bounded buffer is allocated here, from the main tealet's
+ * allocator.
+ */
+TEALET_API
+int tealet_chan_init(tealet_chan_t *chan, tealet_sched_t *sched, size_t capacity);
+
+/* Free the buffer.  Returns TEALET_ERR_INVAL if a task is still waiting. */
+TEALET_API
+int tealet_chan_destroy(tealet_chan_t *chan);
+
+/* Send a value, waiting while the channel is full.  Returns
+ * TEALET_ERR_INVAL if the channel is, or gets, closed, or
+ * TEALET_SCHED_TIMEOUT if the task's deadline passes first.
+ */
+TEALET_API
+int tealet_chan_send(tealet_chan_t *chan, void *value);
+
+/* Receive a value, waiting while the channel is empty.  Returns
+ * TEALET_CHAN_CLOSED, and stores NULL, once the channel is closed and
+ * drained, or TEALET_SCHED_TIMEOUT if the task's deadline passes first.
+ */
+TEALET_API
+int tealet_chan_recv(tealet_chan_t *chan, void **pvalue);
+
+/* Close a channel.  Waiting receivers get TEALET_CHAN_CLOSED and waiting
+ * senders TEALET_ERR_INVAL.  Buffered values can still be received.
+ */
+TEALET_API
+void tealet_chan_close(tealet_chan_t *chan);
+
+/* Complete one of 'n' send and receive cases, all on channels of the same
+ * scheduler.  The first ready case in array order is taken; otherwise the
+ * caller waits on all of them, unless 'flags' has TEALET_CHAN_NOWAIT.
+ * The index of the completed case is stored in '*pindex' and its result
+ * returned: 0, TEALET_CHAN_CLOSED for a receive, or TEALET_ERR_INVAL for a
+ * send on a closed channel.  A wait that reaches the task's deadline
+ * returns TEALET_SCHED_TIMEOUT.  Waiting on more than one case allocates
+ * the waiters with tealet_malloc().
+ */
+TEALET_API
+int tealet_chan_select(tealet_chan_case_t *cases, int n, int flags, int *pindex);
+
+/****************************************************************
+ * Synchronization primitives.
+ * A mutex, condition variable, semaphore and barrier for the tasks of
+ * one scheduler.  An operation that can complete at once never switches.
+ * Otherwise the task is linked into the object's wait queue through its
+ * scheduler node, so waiting never allocates, and the next ready task
+ * runs.  Whoever releases the object grants it to the oldest waiter
+ * directly: the waiter is made ready already owning the mutex or holding
+ * the unit, and only it is woken, so there is no herd and no barging.
+ * Waits end with TEALET_SCHED_TIMEOUT at the task's deadline, and with
+ * TEALET_ERR_PANIC when the task is cancelled.  Only an
+ * operation that would block fails from the main tealet, with
+ * TEALET_ERR_INVAL.
+ */
+
+#define TEALET_BARRIER_SERIAL 1 /* returned to the task that completes a barrier cycle */
+
+typedef struct tealet_mutex_t {
+  tealet_sched_t *sched;
+  tealet_t *owner;        /* the holder, or NULL */
+  tealet_waitq_t waiters; /* tasks waiting to own it, oldest first */
+  size_t n_contended;     /* locks that had to wait */
+} tealet_mutex_t;
+
+typedef struct tealet_cond_t {
+  tealet_sched_t *sched;
+  tealet_waitq_t waiters;
+} tealet_cond_t;
+
+typedef struct tealet_sem_t {
+  tealet_sched_t *sched;
+  size_t count; /* units available; zero while tasks wait */
+  tealet_waitq_t waiters;
+  size_t n_contended; /* acquires that had to wait */
+} tealet_sem_t;
+
+typedef struct tealet_barrier_t {
+  tealet_sched_t *sched;
+  unsigned int parties; /* tasks that complete a cycle */
+  unsigned int arrived; /* tasks waiting in the current cycle */
+  tealet_waitq_t waiters;
+  size_t n_cycles; /* cycles completed */
+} tealet_barrier_t;
+
+TEALET_API
+void tealet_mutex_init(tealet_mutex_t *mutex, tealet_sched_t *sched);
+
+/* Lock 'mutex', waiting while another tealet holds it.  The mutex is not
+ * recursive: relocking it returns TEALET_ERR_INVAL.
+ */
+TEALET_API
+int tealet_mutex_lock(tealet_mutex_t *mutex);
+
+/* Lock 'mutex' if it is free.  Returns 1 if it was locked, otherwise 0. */
+TEALET_API
+int tealet_mutex_trylock(tealet_mutex_t *mutex);
+
+/* Unlock 'mutex', handing it to the oldest waiter if there is one.
+ * Returns TEALET_ERR_INVAL if the current tealet does not hold it.
+ */
+TEALET_API
+int tealet_mutex_unlock(tealet_mutex_t *mutex);
+
+TEALET_API
+void tealet_cond_init(tealet_cond_t *cond, tealet_sched_t *sched);
+
+/* Unlock 'mutex', which the current task must hold, and wait for a
+ * signal.  The mutex is held again on return, also after a timeout.
+ */
+TEALET_API
+int tealet_cond_wait(tealet_cond_t *cond, tealet_mutex_t *mutex);
+
+/* Wake the oldest waiter.  If its mutex is held, the waiter moves to the
+ * mutex's wait queue instead of waking up only to block on it.  Returns 1
+ * if there was a waiter, otherwise 0.
+ */
+TEALET_API
+int tealet_cond_signal(tealet_cond_t *cond);
+
+/* As tealet_cond_signal() for every waiter.  They queue on the mutex and
+ * run one at a time as it is handed on.  Returns the number of waiters.
+ */
+TEALET_API
+int tealet_cond_broadcast(tealet_cond_t *cond);
+
+TEALET_API
+void tealet_sem_init(tealet_sem_t *sem, tealet_sched_t *sched, size_t count);
+
+/* Take one unit, waiting while none is available. */
+TEALET_API
+int tealet_sem_acquire(tealet_sem_t *sem);
+
+/* Take one unit if one is available.  Returns 1 if it did, otherwise 0. */
+TEALET_API
+int tealet_sem_tryacquire(tealet_sem_t *sem);
+
+/* Return 'n' units in one batch.  Each goes directly to a waiter, oldest
+ * first, and the rest to the count.  Returns the number of tasks woken.
+ */
+TEALET_API
+int tealet_sem_release(tealet_sem_t *sem, size_t n);
+
+/* Initialize a barrier for 'parties' tasks.  Returns TEALET_ERR_INVAL if
+ * 'parties' is 0.
+ */
+TEALET_API
+int tealet_barrier_init(tealet_barrier_t *barrier, tealet_sched_t *sched, unsigned int parties);
+
+/* Wait until 'parties' tasks have arrived.  The last one to arrive wakes
+ * the others, does not switch, and gets TEALET_BARRIER_SERIAL; the others
+ * get 0.  A task that times out is no longer counted as arrived.
+ */
+TEALET_API
+int tealet_barrier_wait(tealet_barrier_t *barrier);
+
+/****************************************************************
+ * Task groups.
+ * A group owns the tasks spawned into it and outlives none of them: the
+ * spawner waits for its children, joining each as it completes, so every
+ * child is deleted by the time the group is done with.  The spawner is
+ * the tealet that initialized the group, and only it may spawn into the
+ * group and wait on it.  The child's handle is its future.  Its result is
+ * a single pointer, written by the spawner to the slot given at spawn
+ * time, so the slot may live on the spawner's stack and a result needs no
+ * heap box.
+ * A child that calls tealet_taskgroup_fail() fails the group: the next
+ * wait cancels the remaining children.  Cancelling resumes a child with
+ * TEALET_XFER_PANIC, so the scheduler call it is blocked or queued in
+ * returns TEALET_ERR_PANIC, as does every wait it starts afterwards, and
+ * a child that has not started is dropped without running.  Cancellation is cooperative: the child is expected to
+ * unwind and return, and the group keeps waiting for it.
+ */
+
+/* status of a joined child; distinct from TEALET_SCHED_TIMEOUT */
+#define TEALET_TASKGROUP_FAILED 4    /* the child called tealet_taskgroup_fail() */
+#define TEALET_TASKGROUP_CANCELLED 5 /* the child was cancelled before it returned */
+
+typedef struct tealet_taskgroup_t {
+  tealet_sched_t *sched;
+  tealet_t *owner;                /* the spawner, which alone spawns and waits */
+  tealet_sched_node_t *running;   /* children not yet returned */
+  tealet_sched_node_t *done_head; /* returned children, oldest first */
+  tealet_sched_node_t *done_tail;
+  tealet_t *waiter;   /* the task blocked in a group wait, or NULL */
+  size_t n_children;  /* children spawned and not yet joined */
+  int failed;         /* a child failed and the rest are to be cancelled */
+  size_t n_cancelled; /* children cancelled */
+} tealet_taskgroup_t;
+
+TEALET_API
+void tealet_taskgroup_init(tealet_taskgroup_t *group, tealet_sched_t *sched);
+
+/* Spawn a child task into 'group', as tealet_sched_spawn() without flags.
+ * When the child is joined its result is stored in '*presult' if that is
+ * not NULL.  Children are joined only by the group waits below, never by
+ * tealet_sched_join().  Returns TEALET_ERR_INVAL unless called by the
+ * tealet that initialized the group.
+ */
+TEALET_API
+int tealet_taskgroup_spawn(tealet_taskgroup_t *group, tealet_t **pchild, tealet_sched_fn_t fn, void *arg,
+                           size_t extrasize, void **presult);
+
+/* Mark the current task, a child of 'group', as failed.  It should return
+ * afterwards.  Returns TEALET_ERR_INVAL if it is not a child of 'group'.
+ */
+TEALET_API
+int tealet_taskgroup_fail(tealet_taskgroup_t *group);
+
+/* Cancel every child that has not returned, except the caller.  Returns
+ * the number of children cancelled.
+ */
+TEALET_API
+int tealet_taskgroup_cancel(tealet_taskgroup_t *group);
+
+/* Wait for any child to return and join it.  Its handle, now deleted, is
+ * stored in '*pchild' to tell which future completed.  Returns the
+ * child's status: 0, TEALET_TASKGROUP_FAILED or
+ * TEALET_TASKGROUP_CANCELLED.  A failed child cancels the others first.
+ * Returns TEALET_ERR_INVAL if the group has no children, if the caller is
+ * not the tealet that initialized the group or, from main, if no task is
+ * ready.
+ */
+TEALET_API
+int tealet_taskgroup_wait_any(tealet_taskgroup_t *group, tealet_t **pchild);
+
+/* Wait for 'child' to return and join it.  Returns its status as
+ * tealet_taskgroup_wait_any().
+ */
+TEALET_API
+int tealet_taskgroup_await(tealet_taskgroup_t *group, tealet_t *child);
+
+/* Wait for every child to return and join them all.  Returns 0 if none
+ * failed, otherwise TEALET_TASKGROUP_FAILED once the cancelled rest have
+ * returned too.  A waiter that is cancelled itself cancels the children,
+ * still joins them and returns TEALET_ERR_PANIC.  On TEALET_SCHED_TIMEOUT
+ * or another error the unjoined children stay in the group.
+ */
+TEALET_API
+int tealet_taskgroup_wait_all(tealet_taskgroup_t *group);
+
+/****************************************************************
+ * The I/O reactor.
+ * Parks scheduler tasks on file descriptors with epoll, so one thread can
+ * serve many connections.  Each descriptor is registered edge-triggered
+ * the first time a task waits on it, and its readiness is cached until a
+ * waiter consumes it.  tealet_reactor_poll() makes every task whose
+ * descriptor became ready runnable in one batch.  The reactor drives the
+ * scheduler's timer wheel with a millisecond monotonic clock, so
+ * tealet_sched_sleep() and deadlines count milliseconds.  Linux only;
+ * define TEALET_WITH_REACTOR=0 to leave it out.
+ */
+#ifndef TEALET_WITH_REACTOR
+#if defined(__linux__)
+#define TEALET_WITH_REACTOR 1
+#else
+#define TEALET_WITH_REACTOR 0
+#endif
+#endif
+
+#if TEALET_WITH_REACTOR
+
+#include <sys/types.h>
+
+/* events for tealet_wait_fd() */
+#define TEALET_FD_READ 1
+#define TEALET_FD_WRITE 2
+
+#define TEALET_REACTOR_BATCH 64 /* epoll events fetched per poll */
+
+/* flags for tealet_reactor_init_ex() */
+#define TEALET_REACTOR_URING 1 /* use io_uring for tealet_io_*() if the kernel has it */
+
+/* the cached state of one descriptor */
+typedef struct tealet_reactor_fd_t {
+  int registered;     /* added to the epoll set */
+  int ready;          /* TEALET_FD_* edges not yet consumed */
+  tealet_t *reader;   /* task waiting to read, or to accept */
+  tealet_t *writer;   /* task waiting to write */
+
+  /* multishot accept, io_uring only */
+  int accepting;           /* armed on this listening descriptor */
+  unsigned int accept_gen; /* tells its completions from those of an earlier arming */
+  int *accepted;           /* connections, or negated errors, not yet taken */
+  size_t n_accepted;
+  size_t accepted_size;
+} tealet_reactor_fd_t;
+
+struct tealet_uring_t;
+
+typedef struct tealet_reactor_t {
+  tealet_sched_t *sched;
+  int epfd;
+  tealet_reactor_fd_t *fds; /* indexed by descriptor */
+  size_t n_fds;
+  size_t n_waiting; /* tasks parked on descriptors */
+  size_t n_polls;   /* calls to epoll_wait() */
+  size_t n_wakeups; /* tasks made ready by descriptors or timers */
+
+  struct tealet_uring_t *uring; /* the io_uring backend, or NULL */
+  size_t n_submitted;           /* io_uring requests handed to the kernel */
+  size_t n_completed;           /* io_uring completions reaped */
+  size_t n_enters;              /* calls to io_uring_enter() */
+
+  int wakefd;         /* eventfd rung by tealet_wake_remote() */
+  size_t n_doorbells; /* signals read from it */
+} tealet_reactor_t;
+
+/* Create the epoll set, start the scheduler's clock and install an
+ * eventfd as the scheduler's doorbell, see tealet_wake_remote().  Returns
+ * TEALET_ERR_INVAL if epoll is unavailable.
+ */
+TEALET_API
+int tealet_reactor_init(tealet_reactor_t *reactor, tealet_sched_t *sched);
+
+/* As tealet_reactor_init().  With TEALET_REACTOR_URING in 'flags', also
+ * set up an io_uring instance for tealet_io_read() and friends.  If the
+ * kernel lacks io_uring, or the library was built without it, 'uring'
+ * stays NULL and those calls use the epoll path; this is not an error.
+ */
+TEALET_API
+int tealet_reactor_init_ex(tealet_reactor_t *reactor, tealet_sched_t *sched, int flags);
+
+/* Close the epoll set and the io_uring instance and free the descriptor
+ * cache.  No request may be in flight.
+ */
+TEALET_API
+void tealet_reactor_destroy(tealet_reactor_t *reactor);
+
+/* Park the current task until 'fd' is ready for one of 'events', reports
+ * an error or hangup, or 'timeout' milliseconds pass.  A negative timeout
+ * waits without one, but still honours the task's deadline; a timeout
+ * replaces the deadline.  The descriptor should be non-blocking and the
+ * caller should retry its I/O after every return.  Waiting again without
+ * draining the descriptor, e.g. after a partial read, returns at once: a
+ * poll() checks the descriptor before the task parks.  Returns 0, or
+ * TEALET_SCHED_TIMEOUT, or TEALET_ERR_INVAL from main, for an invalid
+ * descriptor or when another task already waits for the same event.
+ */
+TEALET_API
+int tealet_wait_fd(tealet_reactor_t *reactor, int fd, int events, long timeout);
+
+/* Drop the cached registration of 'fd'; call it before closing the
+ * descriptor, as the number may be reused.  This also cancels a multishot
+ * accept and closes the connections it queued.  Returns TEALET_ERR_INVAL
+ * if a task is waiting on it.
+ */
+TEALET_API
+int tealet_reactor_forget(tealet_reactor_t *reactor, int fd);
+
+/* Wait up to 'timeout' milliseconds (negative: until something happens)
+ * for descriptor events, make the waiting tasks ready and expire timers.
+ * Does not block while tasks are ready or past the next timer.  Can be
+ * called from main or from an idle task.  Returns the number of tasks
+ * made ready.
+ */
+TEALET_API
+int tealet_reactor_poll(tealet_reactor_t *reactor, long timeout);
+
+/* Run the scheduler from main until every task has finished, polling
+ * whenever no task is ready.  Returns 0, or the number of tasks left when
+ * none of them waits on a descriptor, a timer or a remote wakeup.
+ */
+TEALET_API
+int tealet_reactor_run(tealet_reactor_t *reactor);
+
+/****************************************************************
+ * Submit-and-suspend I/O.
+ * With an io_uring backend, each call queues one request whose user_data
+ * is the calling task and suspends it; tealet_reactor_poll() submits the
+ * queued requests together and reaps the completions in a batch, waking
+ * each task with its result.  Regular files, which epoll cannot wait for,
+ * then no longer block the thread.  Without the backend the calls retry
+ * non-blocking I/O around tealet_wait_fd(), and file I/O blocks.
+ *
+ * The kernel accesses the buffer while the task is suspended, when its
+ * stack may be saved away.  A buffer on the task's own stack is therefore
+ * copied through one of the ring's registered buffers, or a block from
+ * tealet_malloc() if it is too large or none is free; other buffers are
+ * used in place.  The calls honour the task's deadline: a request still in
+ * flight is cancelled, and the call fails with ETIMEDOUT.  Called from the
+ * main tealet they make the plain system call.  Needs the Linux headers of
+ * io_uring to build; define TEALET_WITH_URING=0 to leave it out.
+ */
+#ifndef TEALET_WITH_URING
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define TEALET_WITH_URING 1
+#endif
+#endif
+#endif
+#ifndef TEALET_WITH_URING
+#define TEALET_WITH_URING 0
+#endif
+
+#define TEALET_URING_ENTRIES 256   /* submission queue size */
+#define TEALET_URING_BUFFERS 16    /* registered buffers */
+#define TEALET_URING_BUFSIZE 16384 /* size of each registered buffer */
+
+/* Read up to 'len' bytes at offset 'off', or at the current file position
+ * if 'off' is negative, as pread(2) or read(2).  Returns the number of
+ * bytes read, or -1 with errno set.
+ */
+TEALET_API
+ssize_t tealet_io_read(tealet_reactor_t *reactor, int fd, void *buf, size_t len, off_t off);
+
+/* Write up to 'len' bytes, as tealet_io_read(). */
+TEALET_API
+ssize_t tealet_io_write(tealet_reactor_t *reactor, int fd, const void *buf, size_t len, off_t off);
+
+/* Accept a connection on the listening socket 'fd'.  'flags' may hold
+ * SOCK_NONBLOCK and SOCK_CLOEXEC.  With io_uring the first call arms a
+ * multishot accept, with its flags, where the kernel supports it, and
+ * later connections are queued until taken; call tealet_reactor_forget()
+ * before closing the socket.  Returns the new descriptor, or -1 with
+ * errno set.
+ */
+TEALET_API
+int tealet_io_accept(tealet_reactor_t *reactor, int fd, int flags);
+
+/* Flush the file to storage, as fsync(2). */
+TEALET_API
+int tealet_io_fsync(tealet_reactor_t *reactor, int fd);
+
+/****************************************************************
+ * Offloading blocking calls.
+ * Some calls cannot be made asynchronous, such as getaddrinfo(), a
+ * compression library or stat() on a network file system, and would
+ * stall every task of the thread.  tealet_offload() runs such a call on a
+ * small pool of worker threads while the calling task is suspended.
+ * Workers hand finished jobs back with tealet_wake_remote(), and the
+ * reactor's doorbell wakes the domain, so tealets are only ever switched
+ * on the domain's own thread.
+ */
+
+#define TEALET_OFFLOAD_THREADS 4 /* default number of worker threads */
+
+struct tealet_offload_workers_t;
+
+typedef struct tealet_offload_t {
+  tealet_reactor_t *reactor;
+  struct tealet_offload_workers_t *workers; /* the threads and the pending queue */
+  size_t n_threads;
+  size_t n_inflight; /* jobs whose task has not resumed yet */
+  size_t n_jobs;     /* jobs run on worker threads */
+} tealet_offload_t;
+
+/* Start 'n_threads' workers (0 selects TEALET_OFFLOAD_THREADS) for the
+ * tasks of 'reactor'.  Returns TEALET_ERR_MEM, or TEALET_ERR_INVAL if the
+ * threads cannot be created.
+ */
+TEALET_API
+int tealet_offload_init(tealet_offload_t *pool, tealet_reactor_t *reactor, size_t n_threads);
+
+/* Stop and join the workers.  Returns TEALET_ERR_INVAL, and does
+ * nothing, while a job is in flight.
+ */
+TEALET_API
+int tealet_offload_destroy(tealet_offload_t *pool);
+
+/* Run 'fn(arg)' on a worker thread and suspend the current task until it
+ * returns; its result is stored in '*presult' if that is not NULL.  The
+ * task's deadline does not interrupt the call, which cannot be cancelled.
+ * 'fn' runs while other tasks own the stack, so the 'argsize' bytes at
+ * 'arg' must not overlap the calling task's stack: keep them on the heap
+ * or in TEALET_SCHED_EXTRA().  Returns TEALET_ERR_INVAL if they do.  Pass
+ * 0 when 'arg' does not point to data.  From the main tealet 'fn' is
+ * simply called.
+ */
+TEALET_API
+int tealet_offload(tealet_offload_t *pool, tealet_offload_fn_t fn, void *arg, size_t argsize, void **presult);
+
+#endif /* TEALET_WITH_REACTOR */
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* _TEALET_EXTRAS_H_ */
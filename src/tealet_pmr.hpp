@@ -0,0 +1,185 @@
+/**
+ * @file tealet_pmr.hpp
+ * @brief Header-only std::pmr adapters for libtealet allocators (C++17).
+ */
+#ifndef _TEALET_PMR_HPP_
+#define _TEALET_PMR_HPP_
+
+#include "tealet.h"
+
+#include <cstddef>
+#include <cstring>
+#include <memory_resource>
+#include <new>
+
+namespace tealet {
+
+/**
+ * @brief Allocator interfaces for tealet_initialize() and tealet_initialize2()
+ *        backed by a std::pmr::memory_resource.
+ *
+ * Stack chunks, tealet records and other library memory of a domain
+ * initialized with this adapter come from @p resource, so a per-request
+ * monotonic or pool resource releases them together with the request's
+ * other objects.
+ *
+ * memory_resource::deallocate() needs the block size, which the tealet
+ * free callbacks do not pass, so each block carries a small header in front
+ * of the returned pointer. The adapter is referenced by the installed
+ * callbacks: it must outlive every domain using it, and it cannot be copied
+ * or moved.
+ */
+class pmr_alloc {
+public:
+  explicit pmr_alloc(std::pmr::memory_resource *resource = std::pmr::get_default_resource()) noexcept
+      : resource_(resource) {
+    alloc_.malloc_p = &pmr_alloc::malloc_v1;
+    alloc_.free_p = &pmr_alloc::free_v1;
+    alloc_.context = this;
+    alloc2_.size = sizeof(alloc2_);
+    alloc2_.version = TEALET_ALLOC2_CURRENT_VERSION;
+    alloc2_.malloc_p = &pmr_alloc::malloc_v2;
+    alloc2_.realloc_p = &pmr_alloc::realloc_v2;
+    alloc2_.free_p = &pmr_alloc::free_v2;
+    alloc2_.context = this;
+  }
+
+  pmr_alloc(const pmr_alloc &) = delete;
+  pmr_alloc &operator=(const pmr_alloc &) = delete;
+
+  /** Version 1 interface for tealet_initialize(). */
+  tealet_alloc_t *alloc() noexcept { return &alloc_; }
+
+  /** Version 2 interface for tealet_initialize2(), with alignment and realloc. */
+  const tealet_alloc2_t *alloc2() const noexcept { return &alloc2_; }
+
+  std::pmr::memory_resource *resource() const noexcept { return resource_; }
+
+private:
+  struct header {
+    std::size_t total; /* bytes obtained from the resource */
+    std::size_t align; /* alignment requested from the resource */
+  };
+
+  static std::size_t offset(std::size_t align) noexcept { return (sizeof(header) + align - 1) & ~(align - 1); }
+
+  static header *header_of(void *p) noexcept {
+    return reinterpret_cast<header *>(static_cast<char *>(p) - sizeof(header));
+  }
+
+  void *allocate(std::size_t size, std::size_t align) noexcept {
+    std::size_t off;
+    char *base;
+    header *h;
+
+    if (align < alignof(header))
+      align = alignof(header);
+    off = offset(align);
+    if (size > static_cast<std::size_t>(-1) - off)
+      return nullptr;
+    try {
+      base = static_cast<char *>(resource_->allocate(off + size, align));
+    } catch (...) {
+      return nullptr; /* exceptions must not cross into C */
+    }
+    h = header_of(base + off);
+    h->total = off + size;
+    h->align = align;
+    return base + off;
+  }
+
+  void deallocate(void *p) noexcept {
+    header *h;
+
+    if (p == nullptr)
+      return;
+    h = header_of(p);
+    resource_->deallocate(static_cast<char *>(p) - offset(h->align), h->total, h->align);
+  }
+
+  static void *malloc_v1(size_t size, void *context) {
+    return static_cast<pmr_alloc *>(context)->allocate(size, alignof(std::max_align_t));
+  }
+
+  static void free_v1(void *ptr, void *context) { static_cast<pmr_alloc *>(context)->deallocate(ptr); }
+
+  static void *malloc_v2(size_t size, size_t align, tealet_alloc_purpose_t, void *context) {
+    if (align == 0)
+      align = alignof(std::max_align_t);
+    return static_cast<pmr_alloc *>(context)->allocate(size, align);
+  }
+
+  /* memory resources cannot resize in place: move the block */
+  static void *realloc_v2(void *ptr, size_t size, tealet_alloc_purpose_t, void *context) {
+    pmr_alloc *self = static_cast<pmr_alloc *>(context);
+    header *h;
+    std::size_t old_size;
+    void *result;
+
+    if (ptr == nullptr)
+      return self->allocate(size, alignof(std::max_align_t));
+    h = header_of(ptr);
+    old_size = h->total - offset(h->align);
+    result = self->allocate(size, h->align);
+    if (result == nullptr)
+      return nullptr;
+    std::memcpy(result, ptr, old_size < size ? old_size : size);
+    self->deallocate(ptr);
+    return result;
+  }
+
+  static void free_v2(void *ptr, tealet_alloc_purpose_t, void *context) {
+    static_cast<pmr_alloc *>(context)->deallocate(ptr);
+  }
+
+  tealet_alloc_t alloc_;
+  tealet_alloc2_t alloc2_;
+  std::pmr::memory_resource *resource_;
+};
+
+/**
+ * @brief A std::pmr::memory_resource that allocates through a tealet domain.
+ *
+ * Blocks come from tealet_malloc() or, for over-aligned requests,
+ * tealet_malloc_aligned(), so they are served by the domain's allocator
+ * with purpose #TEALET_ALLOC_PURPOSE_USER. Two resources compare equal
+ * when they use the same domain. The domain must outlive the resource and
+ * every block allocated from it.
+ */
+class resource : public std::pmr::memory_resource {
+public:
+  explicit resource(tealet_t *tealet) noexcept : main_(TEALET_MAIN(tealet)) {}
+
+  tealet_t *main() const noexcept { return main_; }
+
+private:
+  void *do_allocate(std::size_t bytes, std::size_t align) override {
+    void *p;
+
+    if (align <= alignof(std::max_align_t))
+      p = tealet_malloc(main_, bytes ? bytes : 1);
+    else
+      p = tealet_malloc_aligned(main_, bytes ? bytes : 1, align);
+    if (p == nullptr)
+      throw std::bad_alloc();
+    return p;
+  }
+
+  void do_deallocate(void *p, std::size_t, std::size_t align) override {
+    if (align <= alignof(std::max_align_t))
+      tealet_free(main_, p);
+    else
+      tealet_free_aligned(main_, p);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+    const resource *r = dynamic_cast<const resource *>(&other);
+    return r != nullptr && r->main_ == main_;
+  }
+
+  tealet_t *main_;
+};
+
+} /* namespace tealet */
+
+#endif /* _TEALET_PMR_HPP_ */
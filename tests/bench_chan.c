@@ -0,0 +1,170 @@
+/* Benchmark tealet_extras channels.
+ *
+ * A ping-pong between two tasks over a pair of unbuffered channels is
+ * compared with the hand-written alternative of switching back and forth
+ * with a heap-allocated payload.  A fan-in workload has several producers
+ * sending into one bounded channel drained by a single consumer.
+ * Build with BUILD_MODE=release for meaningful numbers:
+ *   make bench BUILD_MODE=release
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tealet_extras.h"
+
+static long g_messages = 1000000;
+static int g_producers = 8;
+static size_t g_capacity = 64;
+static tealet_sched_t g_sched;
+static tealet_chan_t g_ping;
+static tealet_chan_t g_pong;
+static volatile long g_sink;
+
+static double elapsed(clock_t start) { return (double)(clock() - start) / CLOCKS_PER_SEC; }
+
+static void report(const char *name, double seconds, long n) {
+  printf("%-30s %10.0f msgs/s %8.1f ns/msg\n", name, (double)n / seconds, seconds * 1e9 / (double)n);
+}
+
+static void *ponger(tealet_t *current, void *arg) {
+  void *value;
+
+  (void)current;
+  (void)arg;
+  while (tealet_chan_recv(&g_ping, &value) == 0)
+    tealet_chan_send(&g_pong, value);
+  return NULL;
+}
+
+static void *pinger(tealet_t *current, void *arg) {
+  void *value;
+  long i;
+
+  (void)current;
+  (void)arg;
+  for (i = 0; i < g_messages; i++) {
+    tealet_chan_send(&g_ping, (void *)(intptr_t)i);
+    tealet_chan_recv(&g_pong, &value);
+    g_sink += (long)(intptr_t)value;
+  }
+  tealet_chan_close(&g_ping);
+  return NULL;
+}
+
+static double bench_pingpong(tealet_t *main_tealet) {
+  clock_t start;
+
+  tealet_sched_init(&g_sched, main_tealet);
+  tealet_chan_init(&g_ping, &g_sched, 0);
+  tealet_chan_init(&g_pong, &g_sched, 0);
+  tealet_sched_spawn(&g_sched, NULL, ponger, NULL, 0, TEALET_SCHED_DETACHED);
+  tealet_sched_spawn(&g_sched, NULL, pinger, NULL, 0, TEALET_SCHED_DETACHED);
+  start = clock();
+  tealet_sched_run(&g_sched);
+  assert(g_sched.n_tasks == 0);
+  tealet_chan_destroy(&g_ping);
+  tealet_chan_destroy(&g_pong);
+  return elapsed(start);
+}
+
+/* the hand-written alternative: box each message and pass it in the switch */
+static tealet_t *raw_ponger(tealet_t *current, void *arg) {
+  void *p = arg;
+
+  for (;;) {
+    *(long *)p += 1;
+    tealet_switch(current->main, &p, TEALET_XFER_DEFAULT);
+    if (p == NULL)
+      break;
+  }
+  return current->main;
+}
+
+static double bench_raw_pingpong(tealet_t *main_tealet) {
+  tealet_t *t = tealet_new(main_tealet);
+  clock_t start = clock();
+  void *p = NULL;
+  long i;
+
+  for (i = 0; i < g_messages; i++) {
+    p = tealet_malloc(main_tealet, sizeof(long));
+    *(long *)p = i;
+    if (i == 0)
+      tealet_run(t, raw_ponger, &p, NULL, TEALET_START_SWITCH);
+    else
+      tealet_switch(t, &p, TEALET_XFER_DEFAULT);
+    g_sink += *(long *)p;
+    tealet_free(main_tealet, p);
+  }
+  p = NULL;
+  tealet_switch(t, &p, TEALET_XFER_DEFAULT);
+  tealet_delete(t);
+  return elapsed(start);
+}
+
+static void *producer(tealet_t *current, void *arg) {
+  long i;
+
+  (void)current;
+  (void)arg;
+  for (i = 0; i < g_messages / g_producers; i++)
+    tealet_chan_send(&g_ping, (void *)(intptr_t)i);
+  return NULL;
+}
+
+static double bench_fanin(tealet_t *main_tealet, long *pn) {
+  clock_t start;
+  void *value;
+  long n = 0;
+  int i;
+
+  tealet_sched_init(&g_sched, main_tealet);
+  tealet_chan_init(&g_ping, &g_sched, g_capacity);
+  for (i = 0; i < g_producers; i++)
+    tealet_sched_spawn(&g_sched, NULL, producer, NULL, 0, TEALET_SCHED_DETACHED);
+  start = clock();
+  /* main is the consumer; it runs the producers whenever the buffer is empty */
+  while (n < (g_messages / g_producers) * g_producers && tealet_chan_recv(&g_ping, &value) == 0) {
+    g_sink += (long)(intptr_t)value;
+    n++;
+  }
+  tealet_sched_run(&g_sched);
+  assert(g_sched.n_tasks == 0);
+  tealet_chan_destroy(&g_ping);
+  *pn = n;
+  return elapsed(start);
+}
+
+int main(int argc, char *argv[]) {
+  tealet_alloc_t talloc = TEALET_ALLOC_INIT_MALLOC;
+  tealet_t *main_tealet;
+  double seconds;
+  long n;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--messages") == 0) && i + 1 < argc)
+      g_messages = atol(argv[++i]);
+    else if ((strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--producers") == 0) && i + 1 < argc)
+      g_producers = atoi(argv[++i]);
+    else if ((strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--capacity") == 0) && i + 1 < argc)
+      g_capacity = (size_t)atol(argv[++i]);
+  }
+  assert(g_messages > 0 && g_producers > 0);
+
+  main_tealet = tealet_initialize(&talloc, 0);
+  printf("=== Ping-pong, %ld round trips ===\n\n", g_messages);
+  report("tealet_chan send/recv", bench_pingpong(main_tealet), g_messages);
+  report("switch with boxed payload", bench_raw_pingpong(main_tealet), g_messages);
+
+  printf("\n=== Fan-in, %d producers, capacity %lu ===\n\n", g_producers, (unsigned long)g_capacity);
+  seconds = bench_fanin(main_tealet, &n);
+  report("tealet_chan fan-in", seconds, n);
+  tealet_finalize(main_tealet);
+  return 0;
+}
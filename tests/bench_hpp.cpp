@@ -0,0 +1,150 @@
+/* Benchmark the tealet.hpp wrappers against the equivalent raw C calls.
+ *
+ * Build with BUILD_MODE=release for meaningful numbers:
+ *   make bench BUILD_MODE=release
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "tealet.hpp"
+
+static long g_iterations = 1000000;
+static volatile long g_sink;
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void report(const char *name, double seconds, long n) {
+  printf("%-34s %8.1f ns/op\n", name, seconds * 1e9 / (double)n);
+}
+
+/* raw C generator: the value is written to the extra area, as the wrapper does */
+static tealet_t *raw_extra_gen(tealet_t *t, void *arg) {
+  long i;
+
+  (void)arg;
+  for (i = 0; i < g_iterations; i++) {
+    *TEALET_EXTRA(t, long) = i;
+    tealet_switch(t->main, NULL, TEALET_XFER_DEFAULT);
+  }
+  return t->main;
+}
+
+static double bench_raw_extra(tealet_t *main_tealet) {
+  tealet_t *t = tealet_new_ex(main_tealet, sizeof(long));
+  auto start = std::chrono::steady_clock::now();
+  double s;
+
+  tealet_run(t, raw_extra_gen, NULL, NULL, TEALET_START_DEFAULT);
+  while (tealet_switch(t, NULL, TEALET_XFER_DEFAULT) == 0 && tealet_status(t) != TEALET_STATUS_EXITED)
+    g_sink += *TEALET_EXTRA(t, long);
+  s = seconds_since(start);
+  tealet_delete(t);
+  return s;
+}
+
+/* raw C generator that boxes each value with tealet_malloc() */
+static tealet_t *raw_boxed_gen(tealet_t *t, void *arg) {
+  long i;
+  void *p;
+
+  (void)arg;
+  for (i = 0; i < g_iterations; i++) {
+    p = tealet_malloc(t, sizeof(long));
+    *(long *)p = i;
+    tealet_switch(t->main, &p, TEALET_XFER_DEFAULT);
+  }
+  return t->main;
+}
+
+static double bench_raw_boxed(tealet_t *main_tealet) {
+  tealet_t *t = tealet_new(main_tealet);
+  auto start = std::chrono::steady_clock::now();
+  void *p = NULL;
+  double s;
+
+  tealet_run(t, raw_boxed_gen, NULL, NULL, TEALET_START_DEFAULT);
+  while (tealet_switch(t, &p, TEALET_XFER_DEFAULT) == 0 && tealet_status(t) != TEALET_STATUS_EXITED) {
+    g_sink += *(long *)p;
+    tealet_free(main_tealet, p);
+  }
+  s = seconds_since(start);
+  tealet_delete(t);
+  return s;
+}
+
+static double bench_generator(tealet_t *main_tealet) {
+  auto start = std::chrono::steady_clock::now();
+  long *v;
+  auto g = tealet::generator<long>::spawn(main_tealet, [](tealet::yielder<long> &y, long n) {
+    long i;
+    for (i = 0; i < n; i++)
+      y.yield(i);
+  }, g_iterations);
+
+  while ((v = g.next()) != nullptr)
+    g_sink += *v;
+  return seconds_since(start);
+}
+
+static tealet_t *raw_suspender(tealet_t *t, void *arg) {
+  long i;
+
+  (void)arg;
+  for (i = 0; i < g_iterations; i++)
+    tealet_switch(t->main, NULL, TEALET_XFER_DEFAULT);
+  return t->main;
+}
+
+static double bench_raw_switch(tealet_t *main_tealet) {
+  tealet_t *t = tealet_new(main_tealet);
+  auto start = std::chrono::steady_clock::now();
+  double s;
+
+  tealet_run(t, raw_suspender, NULL, NULL, TEALET_START_DEFAULT);
+  while (tealet_switch(t, NULL, TEALET_XFER_DEFAULT) == 0 && tealet_status(t) != TEALET_STATUS_EXITED)
+    ;
+  s = seconds_since(start);
+  tealet_delete(t);
+  return s;
+}
+
+static double bench_task(tealet_t *main_tealet) {
+  auto start = std::chrono::steady_clock::now();
+  auto t = tealet::task<long>::spawn(main_tealet, [](tealet::context &ctx, long n) {
+    long i;
+    for (i = 0; i < n; i++)
+      ctx.suspend();
+    return n;
+  }, g_iterations);
+
+  while (!t.resume())
+    ;
+  g_sink += t.get();
+  return seconds_since(start);
+}
+
+int main(int argc, char *argv[]) {
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--iterations") == 0) && i + 1 < argc)
+      g_iterations = atol(argv[++i]);
+  }
+  assert(g_iterations > 0);
+
+  tealet::domain d;
+  printf("=== tealet.hpp overhead, %ld round trips ===\n\n", g_iterations);
+  report("raw C switch", bench_raw_switch(d.get()), g_iterations);
+  report("tealet::task resume/suspend", bench_task(d.get()), g_iterations);
+  report("raw C value in extra area", bench_raw_extra(d.get()), g_iterations);
+  report("raw C value boxed by tealet_malloc", bench_raw_boxed(d.get()), g_iterations);
+  report("tealet::generator<long>", bench_generator(d.get()), g_iterations);
+  return 0;
+}
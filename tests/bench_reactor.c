@@ -0,0 +1,180 @@
+/* Benchmark the tealet_extras epoll reactor.
+ *
+ * Every connection is a non-blocking socketpair with an echo task on one
+ * end and a client task on the other; the clients send one byte at a
+ * time and wait for the echo.  All tasks run on one thread.  The run is
+ * repeated with tealet_io_read() and tealet_io_write() on an io_uring
+ * backend, when the kernel has one.
+ * Build with BUILD_MODE=release for meaningful numbers:
+ *   make bench BUILD_MODE=release
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tealet_extras.h"
+
+#if TEALET_WITH_REACTOR
+
+static int g_connections = 1000;
+static long g_roundtrips = 100; /* per connection */
+static tealet_sched_t g_sched;
+static tealet_reactor_t g_reactor;
+static int g_uring; /* use tealet_io_*() */
+
+static double now_seconds(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void xread(int fd, char *c) {
+  ssize_t n;
+
+  if (g_uring) {
+    n = tealet_io_read(&g_reactor, fd, c, 1, -1);
+    assert(n == 1);
+    return;
+  }
+  while ((n = read(fd, c, 1)) != 1) {
+    assert(n < 0 && errno == EAGAIN);
+    tealet_wait_fd(&g_reactor, fd, TEALET_FD_READ, -1);
+  }
+}
+
+static void xwrite(int fd, char c) {
+  ssize_t n;
+
+  if (g_uring) {
+    n = tealet_io_write(&g_reactor, fd, &c, 1, -1);
+    assert(n == 1);
+    return;
+  }
+  while ((n = write(fd, &c, 1)) != 1) {
+    assert(n < 0 && errno == EAGAIN);
+    tealet_wait_fd(&g_reactor, fd, TEALET_FD_WRITE, -1);
+  }
+}
+
+static void *echo_task(tealet_t *current, void *arg) {
+  int fd = (int)(intptr_t)arg;
+  long i;
+  char c;
+
+  (void)current;
+  for (i = 0; i < g_roundtrips; i++) {
+    xread(fd, &c);
+    xwrite(fd, c);
+  }
+  return NULL;
+}
+
+static void *client_task(tealet_t *current, void *arg) {
+  int fd = (int)(intptr_t)arg;
+  long i;
+  char c;
+
+  (void)current;
+  for (i = 0; i < g_roundtrips; i++) {
+    xwrite(fd, (char)i);
+    xread(fd, &c);
+    assert(c == (char)i);
+  }
+  return NULL;
+}
+
+static int bench_echo(tealet_t *main_tealet, int flags, const char *name) {
+  int(*fds)[2];
+  double start, seconds;
+  long total;
+  int i;
+
+  tealet_sched_init(&g_sched, main_tealet);
+  if (tealet_reactor_init_ex(&g_reactor, &g_sched, flags) != 0) {
+    fprintf(stderr, "epoll unavailable\n");
+    return 1;
+  }
+  g_uring = (flags & TEALET_REACTOR_URING) != 0;
+  if (g_uring && g_reactor.uring == NULL) {
+    printf("%-28s unavailable\n", name);
+    tealet_reactor_destroy(&g_reactor);
+    return 0;
+  }
+  fds = (int(*)[2])malloc(g_connections * sizeof(*fds));
+  for (i = 0; i < g_connections; i++) {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds[i]) != 0) {
+      perror("socketpair");
+      return 1;
+    }
+    fcntl(fds[i][0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[i][1], F_SETFL, O_NONBLOCK);
+    tealet_sched_spawn(&g_sched, NULL, echo_task, (void *)(intptr_t)fds[i][0], 0, TEALET_SCHED_DETACHED);
+    tealet_sched_spawn(&g_sched, NULL, client_task, (void *)(intptr_t)fds[i][1], 0, TEALET_SCHED_DETACHED);
+  }
+
+  start = now_seconds();
+  if (tealet_reactor_run(&g_reactor) != 0) {
+    fprintf(stderr, "tasks left waiting\n");
+    return 1;
+  }
+  seconds = now_seconds() - start;
+  total = (long)g_connections * g_roundtrips;
+  printf("%-28s %10.0f round trips/s %8.1f us/round trip\n", name, (double)total / seconds,
+         seconds * 1e6 / (double)total);
+  if (g_uring)
+    printf("%-28s %10.1f requests per io_uring_enter\n", "batching",
+           (double)g_reactor.n_submitted / g_reactor.n_enters);
+  else
+    printf("%-28s %10.1f tasks woken per epoll_wait\n", "batching", (double)g_reactor.n_wakeups / g_reactor.n_polls);
+
+  for (i = 0; i < g_connections; i++) {
+    tealet_reactor_forget(&g_reactor, fds[i][0]);
+    tealet_reactor_forget(&g_reactor, fds[i][1]);
+    close(fds[i][0]);
+    close(fds[i][1]);
+  }
+  free(fds);
+  tealet_reactor_destroy(&g_reactor);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  tealet_alloc_t talloc = TEALET_ALLOC_INIT_MALLOC;
+  tealet_t *main_tealet;
+  int result;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--connections") == 0) && i + 1 < argc)
+      g_connections = atoi(argv[++i]);
+    else if ((strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--roundtrips") == 0) && i + 1 < argc)
+      g_roundtrips = atol(argv[++i]);
+  }
+  assert(g_connections > 0 && g_roundtrips > 0);
+
+  main_tealet = tealet_initialize(&talloc, 0);
+  printf("=== Echo over socketpairs, %d connections x %ld round trips ===\n\n", g_connections, g_roundtrips);
+  result = bench_echo(main_tealet, 0, "tealet_wait_fd");
+  if (result == 0)
+    result = bench_echo(main_tealet, TEALET_REACTOR_URING, "tealet_io_read (io_uring)");
+  tealet_finalize(main_tealet);
+  return result;
+}
+
+#else
+
+int main(void) {
+  printf("the reactor is not available on this platform\n");
+  return 0;
+}
+
+#endif
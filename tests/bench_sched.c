@@ -0,0 +1,225 @@
+/* Benchmark the tealet_extras run-queue scheduler.
+ *
+ * Measures yields per second for a set of tasks that only yield, and
+ * compares it with a loop that bounces every yield through main.
+ * A second workload spawns tasks at several stack depths and reports the
+ * stack bytes copied per switch with the FIFO and SLICE policies; the last
+ * line widens the SLICE window and fairness bound to 16.
+ * A third workload has every task sleep on the timer wheel and reports
+ * the cost of arming, expiring and switching per timer.
+ * Build with BUILD_MODE=release for meaningful numbers:
+ *   make bench BUILD_MODE=release
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tealet_extras.h"
+
+static int g_tasks = 100;
+static long g_yields = 10000; /* per task */
+static tealet_sched_t g_sched;
+
+static double elapsed(clock_t start) { return (double)(clock() - start) / CLOCKS_PER_SEC; }
+
+static void report(const char *name, double seconds, long n) {
+  printf("%-28s %10.0f yields/s %8.1f ns/yield\n", name, (double)n / seconds, seconds * 1e9 / (double)n);
+}
+
+static void *sched_yielder(tealet_t *current, void *arg) {
+  long i;
+
+  (void)current;
+  (void)arg;
+  for (i = 0; i < g_yields; i++)
+    tealet_sched_yield(&g_sched);
+  return NULL;
+}
+
+static double bench_sched(tealet_t *main_tealet) {
+  clock_t start;
+  int i;
+
+  tealet_sched_init(&g_sched, main_tealet);
+  for (i = 0; i < g_tasks; i++) {
+    if (tealet_sched_spawn(&g_sched, NULL, sched_yielder, NULL, 0, TEALET_SCHED_DETACHED) != 0) {
+      fprintf(stderr, "spawn failed\n");
+      exit(1);
+    }
+  }
+  start = clock();
+  tealet_sched_run(&g_sched);
+  assert(g_sched.n_tasks == 0);
+  return elapsed(start);
+}
+
+/* the hand-written alternative: every yield goes back to a loop in main */
+static tealet_t *bounce_yielder(tealet_t *current, void *arg) {
+  long i;
+
+  (void)arg;
+  for (i = 0; i < g_yields; i++)
+    tealet_switch(current->main, NULL, TEALET_XFER_DEFAULT);
+  return current->main;
+}
+
+static double bench_bounce(tealet_t *main_tealet) {
+  tealet_t **t = (tealet_t **)malloc(g_tasks * sizeof(tealet_t *));
+  clock_t start;
+  int live = g_tasks;
+  int i;
+
+  for (i = 0; i < g_tasks; i++) {
+    t[i] = tealet_new(main_tealet);
+    tealet_run(t[i], bounce_yielder, NULL, NULL, TEALET_START_DEFAULT);
+  }
+  start = clock();
+  while (live > 0) {
+    for (i = 0; i < g_tasks; i++) {
+      if (t[i] == NULL)
+        continue;
+      tealet_switch(t[i], NULL, TEALET_XFER_DEFAULT);
+      if (tealet_status(t[i]) == TEALET_STATUS_EXITED) {
+        tealet_delete(t[i]);
+        t[i] = NULL;
+        live--;
+      }
+    }
+  }
+  free(t);
+  return elapsed(start);
+}
+
+/* the slicing workload: groups of tasks whose far boundaries are
+ * SLICE_STEP bytes apart, queued group by group
+ */
+#define SLICE_LEVELS 4
+#define SLICE_PER_LEVEL 4
+#define SLICE_STEP 4096
+
+static void *slice_task(tealet_t *current, void *arg) {
+  volatile char pad[512];
+  long i;
+
+  (void)current;
+  (void)arg;
+  for (i = 0; i < g_yields; i++) {
+    pad[i % sizeof(pad)] = (char)i;
+    tealet_sched_yield(&g_sched);
+  }
+  return NULL;
+}
+
+static void slice_spawn(int level) {
+  volatile char pad[SLICE_STEP];
+  int i;
+
+  pad[0] = (char)level;
+  if (level > 0) {
+    slice_spawn(level - 1);
+    pad[SLICE_STEP - 1] = pad[0]; /* keep the frame: no tail call */
+    return;
+  }
+  for (i = 0; i < SLICE_PER_LEVEL; i++) {
+    if (tealet_sched_spawn(&g_sched, NULL, slice_task, NULL, 0, TEALET_SCHED_DETACHED) != 0) {
+      fprintf(stderr, "spawn failed\n");
+      exit(1);
+    }
+  }
+  (void)pad[0];
+}
+
+static void bench_slice(tealet_t *main_tealet, int policy, unsigned int window, unsigned int fairness,
+                        const char *name) {
+  tealet_stats_t before, after;
+  clock_t start;
+  double seconds;
+  size_t switches, copied;
+  int level;
+
+  tealet_sched_init(&g_sched, main_tealet);
+  tealet_sched_set_policy(&g_sched, policy, window, fairness);
+  for (level = 0; level < SLICE_LEVELS; level++)
+    slice_spawn(level);
+  tealet_get_stats(main_tealet, &before);
+  start = clock();
+  tealet_sched_run(&g_sched);
+  seconds = elapsed(start);
+  tealet_get_stats(main_tealet, &after);
+  assert(g_sched.n_tasks == 0);
+
+  switches = after.n_switches - before.n_switches;
+  copied = (after.stack_bytes_saved - before.stack_bytes_saved) +
+           (after.stack_bytes_restored - before.stack_bytes_restored);
+  printf("%-28s %10.0f bytes/switch %8.1f ns/switch\n", name, switches ? (double)copied / switches : 0.0,
+         switches ? seconds * 1e9 / switches : 0.0);
+}
+
+/* the timer workload: every task sleeps for a different number of ticks */
+static void *timer_task(tealet_t *current, void *arg) {
+  tealet_tick_t delay = (tealet_tick_t)(intptr_t)arg;
+  long i;
+
+  (void)current;
+  for (i = 0; i < g_yields / 100 + 1; i++)
+    tealet_sched_sleep(&g_sched, delay);
+  return NULL;
+}
+
+static double bench_timers(tealet_t *main_tealet, long *pn) {
+  tealet_tick_t ticks;
+  clock_t start;
+  int i;
+
+  tealet_sched_init(&g_sched, main_tealet);
+  for (i = 0; i < g_tasks; i++)
+    tealet_sched_spawn(&g_sched, NULL, timer_task, (void *)(intptr_t)(1 + (i * 7919) % 5000), 0,
+                       TEALET_SCHED_DETACHED);
+  start = clock();
+  tealet_sched_run(&g_sched);
+  while (tealet_sched_next_timer(&g_sched, &ticks)) {
+    tealet_sched_advance(&g_sched, g_sched.now + ticks);
+    tealet_sched_run(&g_sched);
+  }
+  assert(g_sched.n_tasks == 0);
+  *pn = (long)g_sched.n_expired;
+  return elapsed(start);
+}
+
+int main(int argc, char *argv[]) {
+  tealet_alloc_t talloc = TEALET_ALLOC_INIT_MALLOC;
+  tealet_t *main_tealet;
+  double seconds;
+  long total;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--tasks") == 0) && i + 1 < argc)
+      g_tasks = atoi(argv[++i]);
+    else if ((strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--yields") == 0) && i + 1 < argc)
+      g_yields = atol(argv[++i]);
+  }
+  assert(g_tasks > 0 && g_yields > 0);
+  total = (long)g_tasks * g_yields;
+
+  main_tealet = tealet_initialize(&talloc, 0);
+  printf("=== Scheduler throughput, %d tasks x %ld yields ===\n\n", g_tasks, g_yields);
+  report("tealet_sched_yield", bench_sched(main_tealet), total);
+  report("switch through main", bench_bounce(main_tealet), total);
+
+  printf("\n=== Stack copying, %d depths x %d tasks x %ld yields ===\n\n", SLICE_LEVELS, SLICE_PER_LEVEL, g_yields);
+  bench_slice(main_tealet, TEALET_SCHED_FIFO, 0, 0, "TEALET_SCHED_FIFO");
+  bench_slice(main_tealet, TEALET_SCHED_SLICE, 0, 0, "TEALET_SCHED_SLICE");
+  bench_slice(main_tealet, TEALET_SCHED_SLICE, 16, 16, "TEALET_SCHED_SLICE 16/16");
+
+  printf("\n=== Timers, %d tasks x %ld sleeps ===\n\n", g_tasks, g_yields / 100 + 1);
+  seconds = bench_timers(main_tealet, &total);
+  printf("%-28s %10.0f timers/s %8.1f ns/timer\n", "tealet_sched_sleep", (double)total / seconds,
+         seconds * 1e9 / (double)total);
+  tealet_finalize(main_tealet);
+  return 0;
+}
@@ -0,0 +1,1539 @@
+#include "test_extras.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tealet_extras.h"
+#include "test_harness.h"
+
+#if TEALET_WITH_REACTOR
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+/* This file contains tests for the helper facilities in tealet_extras, and
+ * ensures that they compose correctly with the core lifecycle APIs.
+ */
+
+static int stubpool_runs;
+
+static tealet_t *stubpool_run(tealet_t *current, void *arg) {
+  (void)current;
+  stubpool_runs += (int)(intptr_t)arg;
+  return g_main;
+}
+
+/* The stub pool serves spawns from ready stubs and duplicates the prototype
+ * once it runs dry.  The launch argument arrives on both paths.
+ */
+void test_stubpool(void) {
+  tealet_stubpool_t *pool;
+  tealet_t *created[6];
+  void *arg;
+  int result;
+  int i;
+
+  init_test();
+  stubpool_runs = 0;
+  result = tealet_stubpool_new(g_main, &pool, 4, NULL);
+  assert(result == 0);
+  assert(pool != NULL);
+  assert(pool->count == 4);
+  assert(pool->n_refills == 4);
+
+  for (i = 0; i < 6; i++) {
+    arg = (void *)(intptr_t)(i + 1);
+    result = tealet_stubpool_spawn(pool, &created[i], stubpool_run, &arg);
+    assert(result == 0);
+    assert(created[i] != NULL);
+    assert(tealet_status(created[i]) == TEALET_STATUS_EXITED);
+  }
+  assert(stubpool_runs == 21);
+  assert(pool->n_hits == 4);
+  assert(pool->n_misses == 2);
+  assert(pool->count == 0);
+
+  result = tealet_stubpool_refill(pool, 3);
+  assert(result == 3);
+  assert(pool->count == 3);
+  result = tealet_stubpool_refill(pool, 0);
+  assert(result == 1);
+  assert(pool->n_refills == 8);
+  result = tealet_stubpool_refill(pool, 0);
+  assert(result == 0);
+
+  for (i = 0; i < 6; i++)
+    tealet_delete(created[i]);
+  tealet_stubpool_delete(pool);
+  fini_test();
+}
+
+#define SPILL_THRESHOLD 4096
+
+static tealet_stubpool_t *spill_pool;
+static tealet_t *spill_worker;
+static tealet_t *spill_current;
+
+static void *spill_leaf(tealet_t *current, void *arg) {
+  spill_current = current;
+  if (current != spill_worker)
+    tealet_switch(g_main, NULL, TEALET_XFER_DEFAULT);
+  return (void *)((intptr_t)arg + 1);
+}
+
+static intptr_t spill_recurse(int level, size_t threshold) {
+  volatile char pad[256];
+  void *arg;
+
+  pad[0] = (char)level;
+  if (level > 0)
+    return spill_recurse(level - 1, threshold) + pad[0] - level;
+  arg = (void *)(intptr_t)41;
+  assert(tealet_call_spilled(spill_pool, spill_leaf, &arg, threshold) == 0);
+  return (intptr_t)arg;
+}
+
+static tealet_t *spill_worker_run(tealet_t *current, void *arg) {
+  (void)arg;
+  /* deep call is spilled to a pool stub, which yields to main once */
+  assert(spill_recurse(64, SPILL_THRESHOLD) == 42);
+  assert(spill_current != current);
+  /* shallow enough: called directly on this tealet */
+  assert(spill_recurse(64, (size_t)1 << 30) == 42);
+  assert(spill_current == current);
+  status = 1;
+  return g_main;
+}
+
+/* A deep call moves onto a shallow pool stub and back; a call within the
+ * threshold runs in place.
+ */
+void test_call_spilled(void) {
+  tealet_t *spilled;
+  int result;
+
+  init_test();
+  result = tealet_stubpool_new(g_main, &spill_pool, 1, NULL);
+  assert(result == 0);
+
+  spill_worker = tealet_new(g_main);
+  assert(spill_worker != NULL);
+  result = tealet_run(spill_worker, spill_worker_run, NULL, NULL, TEALET_START_SWITCH);
+  assert(result == 0);
+
+  /* the spilled call yielded: it runs on a shallow stub, and the deep
+   * worker stack was saved once */
+  spilled = tealet_previous(g_main);
+  assert(spilled != spill_worker);
+  assert(spilled == spill_current);
+  assert(tealet_get_stacksize(spilled) < SPILL_THRESHOLD);
+  assert(tealet_get_stacksize(spill_worker) > 64 * 256);
+  assert(status == 0);
+
+  tealet_switch(spilled, NULL, TEALET_XFER_DEFAULT);
+  assert(status == 1);
+  assert(spill_pool->n_hits == 1);
+  tealet_delete(spill_worker);
+  tealet_stubpool_delete(spill_pool);
+  fini_test();
+}
+
+static tealet_bufpool_t bufpool;
+static tealet_alloc_t bufpool_base = TEALET_ALLOC_INIT_MALLOC;
+
+static tealet_t *bufpool_run(tealet_t *current, void *arg) {
+  (void)arg;
+  tealet_switch(current->main, NULL, TEALET_XFER_DEFAULT);
+  return current->main;
+}
+
+/* create, suspend and finish a batch of tealets in the current domain */
+static void bufpool_cycle(void) {
+  tealet_t *t[8];
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    t[i] = NULL;
+    assert(tealet_spawn(g_main, &t[i], bufpool_run, NULL, NULL, TEALET_START_SWITCH) == 0);
+  }
+  for (i = 0; i < 8; i++) {
+    tealet_switch(t[i], NULL, TEALET_XFER_DEFAULT);
+    tealet_delete(t[i]);
+  }
+}
+
+/* Stack buffers are recycled within a domain and, through the depot,
+ * across domains.  Destroying the pool frees them all.
+ */
+void test_bufpool(void) {
+  tealet_bufcache_t cache1;
+  tealet_bufcache_t cache2;
+  tealet_bufpool_stats_t stats;
+  size_t align;
+  void *p;
+
+  tealet_bufpool_init(&bufpool, &bufpool_base);
+  tealet_bufcache_init(&cache1, &bufpool);
+  tealet_bufcache_init(&cache2, &bufpool);
+
+  assert(g_main == NULL);
+  g_main = tealet_initialize2(&cache1.alloc, 0);
+  assert(g_main != NULL);
+  bufpool_cycle();
+  assert(cache1.n_misses > 0);
+  assert(cache1.n_recycled > 0);
+  bufpool_cycle();
+  assert(cache1.n_hits > 0);
+  /* alignments past malloc's, including the header's own size */
+  for (align = 16; align <= 128; align *= 2) {
+    p = tealet_malloc_aligned(g_main, 100, align);
+    assert(p != NULL && ((uintptr_t)p & (align - 1)) == 0);
+    tealet_free(g_main, p);
+  }
+  fini_test();
+  tealet_bufcache_flush(&cache1);
+  tealet_bufpool_get_stats(&bufpool, &stats);
+  assert(stats.depot_magazines > 0);
+  assert(stats.n_depot_puts == cache1.n_depot_puts);
+
+  /* a second domain picks up the buffers released by the first one */
+  g_main = tealet_initialize2(&cache2.alloc, 0);
+  assert(g_main != NULL);
+  bufpool_cycle();
+  assert(cache2.n_depot_gets > 0);
+  assert(cache2.n_hits > 0);
+  fini_test();
+  tealet_bufcache_flush(&cache2);
+
+  tealet_bufpool_destroy(&bufpool);
+  tealet_bufpool_get_stats(&bufpool, &stats);
+  assert(stats.depot_magazines == 0);
+  assert(stats.n_base_allocs == stats.n_base_frees);
+}
+
+static tealet_sched_t sched;
+static char sched_trace[64];
+static int sched_trace_len;
+
+static void *sched_worker(tealet_t *current, void *arg) {
+  char name = (char)(intptr_t)arg;
+  int i;
+
+  for (i = 0; i < 3; i++) {
+    sched_trace[sched_trace_len++] = name;
+    assert(tealet_sched_yield(&sched) == 0);
+    assert(tealet_current(g_main) == current);
+  }
+  return (void *)(intptr_t)(name - 'a');
+}
+
+/* Ready tasks run round-robin, switching from task to task directly rather
+ * than through main.
+ */
+void test_sched(void) {
+  tealet_t *task[3];
+  void *result;
+  int i;
+
+  init_test();
+  tealet_sched_init(&sched, g_main);
+  sched_trace_len = 0;
+  for (i = 0; i < 3; i++)
+    assert(tealet_sched_spawn(&sched, &task[i], sched_worker, (void *)(intptr_t)('a' + i), 0, 0) == 0);
+  assert(tealet_sched_spawn(&sched, NULL, sched_worker, (void *)(intptr_t)'d', 0, TEALET_SCHED_DETACHED) == 0);
+  assert(sched.n_ready == 4 && sched.n_tasks == 4);
+
+  /* one call runs everything: main is only resumed once the queue is empty */
+  assert(tealet_sched_run(&sched) == 3);
+  sched_trace[sched_trace_len] = '\0';
+  assert(strcmp(sched_trace, "abcdabcdabcd") == 0);
+  assert(sched.n_ready == 0);
+  assert(sched.n_yields == 12);
+
+  for (i = 0; i < 3; i++) {
+    assert(tealet_status(task[i]) == TEALET_STATUS_EXITED);
+    assert(tealet_sched_join(&sched, task[i], &result) == 0);
+    assert(result == (void *)(intptr_t)i);
+  }
+  assert(sched.n_tasks == 0);
+  fini_test();
+}
+
+/* The SLICE policy runs every task to completion and defers none beyond
+ * its fairness bound.
+ */
+void test_sched_slice(void) {
+  tealet_stats_t before, after;
+  int counts[4] = {0, 0, 0, 0};
+  int i;
+
+  init_test();
+  tealet_sched_init(&sched, g_main);
+  assert(sched.policy == TEALET_SCHED_FIFO);
+  assert(tealet_sched_set_policy(&sched, 42, 0, 0) == TEALET_ERR_INVAL);
+  assert(tealet_sched_set_policy(&sched, TEALET_SCHED_SLICE, 0, 0) == 0);
+  assert(sched.window == TEALET_SCHED_WINDOW && sched.fairness == TEALET_SCHED_FAIRNESS);
+  assert(tealet_sched_set_policy(&sched, TEALET_SCHED_SLICE, 4, 1) == 0);
+  assert(tealet_switch_cost(g_main) == 0);
+
+  sched_trace_len = 0;
+  for (i = 0; i < 4; i++)
+    assert(tealet_sched_spawn(&sched, NULL, sched_worker, (void *)(intptr_t)('a' + i), 0, TEALET_SCHED_DETACHED) ==
+           0);
+  tealet_get_stats(g_main, &before);
+  assert(tealet_sched_run(&sched) == 0);
+  tealet_get_stats(g_main, &after);
+  assert(sched.n_tasks == 0 && sched.n_yields == 12);
+
+  /* with a fairness bound of one, no task runs twice while another waits */
+  assert(sched_trace_len == 12);
+  for (i = 0; i < sched_trace_len; i++) {
+    counts[sched_trace[i] - 'a']++;
+    assert(counts[sched_trace[i] - 'a'] <= i / 4 + 2);
+  }
+  for (i = 0; i < 4; i++)
+    assert(counts[i] == 3);
+
+  assert(after.n_switches >= before.n_switches + 12);
+  assert(after.stack_bytes_saved > before.stack_bytes_saved);
+  assert(after.stack_bytes_restored > before.stack_bytes_restored);
+  fini_test();
+}
+
+static tealet_t *sched_sleeper;
+static int sched_woken;
+
+static void *sched_sleep(tealet_t *current, void *arg) {
+  (void)arg;
+  assert(tealet_sched_suspend(&sched) == 0);
+  sched_woken++;
+  /* a wakeup sent while running is kept for the next suspend */
+  tealet_sched_wake(&sched, current);
+  assert(tealet_sched_suspend(&sched) == 0);
+  sched_woken++;
+  return current;
+}
+
+static void *sched_joiner(tealet_t *current, void *arg) {
+  void *result = NULL;
+
+  (void)current;
+  assert(tealet_sched_join(&sched, (tealet_t *)arg, &result) == 0);
+  return result;
+}
+
+static void *sched_waker(tealet_t *current, void *arg) {
+  (void)current;
+  (void)arg;
+  assert(tealet_sched_wake(&sched, sched_sleeper) == 1);
+  assert(tealet_sched_wake(&sched, sched_sleeper) == 0);
+  return NULL;
+}
+
+/* Blocked tasks are woken and joined across tasks.  A join from main on a
+ * task nobody can wake fails.
+ */
+void test_sched_wake(void) {
+  tealet_t *joiner;
+  tealet_t *waker;
+  void *result = NULL;
+
+  init_test();
+  tealet_sched_init(&sched, g_main);
+  sched_woken = 0;
+  assert(tealet_sched_spawn(&sched, &sched_sleeper, sched_sleep, NULL, sizeof(int), 0) == 0);
+  *TEALET_SCHED_EXTRA(sched_sleeper, int) = 42;
+  assert(tealet_sched_spawn(&sched, &joiner, sched_joiner, sched_sleeper, 0, 0) == 0);
+  assert(tealet_sched_suspend(&sched) == TEALET_ERR_INVAL);
+
+  /* both tasks block: the sleeper on itself, the joiner on the sleeper */
+  assert(tealet_sched_run(&sched) == 2);
+  assert(TEALET_SCHED_NODE(sched_sleeper)->state == TEALET_SCHED_BLOCKED);
+  assert(TEALET_SCHED_NODE(joiner)->state == TEALET_SCHED_BLOCKED);
+  assert(tealet_sched_join(&sched, joiner, &result) == TEALET_ERR_INVAL);
+  assert(TEALET_SCHED_NODE(joiner)->joiner == NULL);
+
+  /* the second wakeup is absorbed by the permit of the running sleeper */
+  assert(tealet_sched_spawn(&sched, &waker, sched_waker, NULL, 0, TEALET_SCHED_DETACHED) == 0);
+  assert(*TEALET_SCHED_EXTRA(sched_sleeper, int) == 42);
+  assert(tealet_sched_join(&sched, joiner, &result) == 0);
+  assert(sched_woken == 2);
+  assert(result == (void *)sched_sleeper);
+  assert(sched.n_tasks == 0);
+  fini_test();
+}
+
+static tealet_chan_t chan_a;
+static tealet_chan_t chan_b;
+
+static void *chan_ponger(tealet_t *current, void *arg) {
+  void *value;
+  int n = 0;
+
+  (void)current;
+  (void)arg;
+  while (tealet_chan_recv(&chan_a, &value) == 0) {
+    assert(value == (void *)(intptr_t)n);
+    assert(tealet_chan_send(&chan_b, (void *)(intptr_t)(n + 100)) == 0);
+    n++;
+  }
+  return (void *)(intptr_t)n;
+}
+
+static void *chan_pinger(tealet_t *current, void *arg) {
+  void *value;
+  int i;
+
+  (void)current;
+  for (i = 0; i < (int)(intptr_t)arg; i++) {
+    assert(tealet_chan_send(&chan_a, (void *)(intptr_t)i) == 0);
+    assert(tealet_chan_recv(&chan_b, &value) == 0);
+    assert(value == (void *)(intptr_t)(i + 100));
+  }
+  tealet_chan_close(&chan_a);
+  return NULL;
+}
+
+static void *chan_producer(tealet_t *current, void *arg) {
+  int i;
+
+  (void)current;
+  for (i = 0; i < 10; i++)
+    assert(tealet_chan_send(&chan_a, (void *)(intptr_t)((intptr_t)arg * 100 + i)) == 0);
+  return NULL;
+}
+
+/* Values sent to a waiting receiver are handed over directly; buffered
+ * values arrive in order.
+ */
+void test_chan(void) {
+  tealet_t *ponger, *pinger;
+  void *result;
+  void *value;
+  int last[3] = {-1, -1, -1};
+  int i, p;
+
+  init_test();
+  tealet_sched_init(&sched, g_main);
+
+  /* unbuffered ping-pong: every send finds the other side waiting */
+  assert(tealet_chan_init(&chan_a, &sched, 0) == 0);
+  assert(tealet_chan_init(&chan_b, &sched, 0) == 0);
+  assert(tealet_sched_spawn(&sched, &ponger, chan_ponger, NULL, 0, 0) == 0);
+  assert(tealet_sched_spawn(&sched, &pinger, chan_pinger, (void *)(intptr_t)20, 0, 0) == 0);
+  assert(tealet_sched_join(&sched, ponger, &result) == 0);
+  assert(result == (void *)(intptr_t)20);
+  assert(tealet_sched_join(&sched, pinger, NULL) == 0);
+  /* one switch per message: the first send hands over, the rest find a waiting sender */
+  assert(chan_a.n_handoffs >= 1);
+  assert(sched.n_switches <= 2 * 20 + 4);
+  assert(tealet_chan_destroy(&chan_a) == 0 && tealet_chan_destroy(&chan_b) == 0);
+
+  /* fan-in through a bounded buffer, received from main */
+  assert(tealet_chan_init(&chan_a, &sched, 4) == 0);
+  for (i = 0; i < 3; i++)
+    assert(tealet_sched_spawn(&sched, NULL, chan_producer, (void *)(intptr_t)i, 0, TEALET_SCHED_DETACHED) == 0);
+  for (i = 0; i < 30; i++) {
+    assert(tealet_chan_recv(&chan_a, &value) == 0);
+    p = (int)(intptr_t)value / 100;
+    assert(p >= 0 && p < 3 && (int)(intptr_t)value % 100 == last[p] + 1);
+    last[p]++;
+    assert(chan_a.count <= 4);
+  }
+  /* nothing is left to send: main would wait forever */
+  assert(tealet_chan_recv(&chan_a, &value) == TEALET_ERR_INVAL);
+  assert(sched.n_tasks == 0);
+  tealet_chan_close(&chan_a);
+  assert(tealet_chan_recv(&chan_a, &value) == TEALET_CHAN_CLOSED && value == NULL);
+  assert(tealet_chan_send(&chan_a, NULL) == TEALET_ERR_INVAL);
+  assert(tealet_chan_destroy(&chan_a) == 0);
+
+  /* an unbounded channel grows instead of blocking */
+  assert(tealet_chan_init(&chan_a, &sched, TEALET_CHAN_UNBOUNDED) == 0);
+  for (i = 0; i < 100; i++)
+    assert(tealet_chan_send(&chan_a, (void *)(intptr_t)i) == 0);
+  tealet_chan_close(&chan_a);
+  for (i = 0; i < 100; i++) {
+    assert(tealet_chan_recv(&chan_a, &value) == 0);
+    assert(value == (void *)(intptr_t)i);
+  }
+  assert(tealet_chan_recv(&chan_a, &value) == TEALET_CHAN_CLOSED);
+  assert(tealet_chan_destroy(&chan_a) == 0);
+  fini_test();
+}
+
+static void *chan_selector(tealet_t *current, void *arg) {
+  tealet_chan_case_t cases[2];
+  int index = -1;
+  int got = 0;
+  int result;
+
+  (void)current;
+  (void)arg;
+  for (;;) {
+    cases[0].chan = &chan_a;
+    cases[0].op = TEALET_CHAN_RECV;
+    cases[1].chan = &chan_b;
+    cases[1].op = TEALET_CHAN_RECV;
+    result = tealet_chan_select(cases, 2, 0, &index);
+    if (result == TEALET_CHAN_CLOSED)
+      break;
+    assert(result == 0);
+    assert(cases[index].value == (void *)(intptr_t)(index + 1));
+    got += index + 1;
+  }
+  assert(index == 0);
+  return (void *)(intptr_t)got;
+}
+
+/* A select waiting on several channels completes exactly one case and
+ * withdraws its waiters from the others.
+ */
+void test_chan_select(void) {
+  tealet_chan_case_t c;
+  tealet_t *selector;
+  void *result;
+  int index;
+
+  init_test();
+  tealet_sched_init(&sched, g_main);
+  assert(tealet_chan_init(&chan_a, &sched, 0) == 0);
+  assert(tealet_chan_init(&chan_b, &sched, 1) == 0);
+
+  c.chan = &chan_a;
+  c.op = TEALET_CHAN_RECV;
+  assert(tealet_chan_select(&c, 1, TEALET_CHAN_NOWAIT, &index) == TEALET_CHAN_WOULDBLOCK);
+  c.chan = &chan_b;
+  c.op = TEALET_CHAN_SEND;
+  c.value = (void *)(intptr_t)2;
+  assert(tealet_chan_select(&c, 1, TEALET_CHAN_NOWAIT, &index) == 0 && index == 0);
+  assert(tealet_chan_select(&c, 1, TEALET_CHAN_NOWAIT, &index) == TEALET_CHAN_WOULDBLOCK);
+
+  /* the buffered value is taken first, then the selector waits on both */
+  assert(tealet_sched_spawn(&sched, &selector, chan_selector, NULL, 0, 0) == 0);
+  assert(tealet_sched_run(&sched) == 1);
+  assert(chan_a.recvq != NULL && chan_b.recvq != NULL);
+  assert(tealet_chan_send(&chan_a, (void *)(intptr_t)1) == 0);
+  assert(chan_a.recvq == NULL && chan_b.recvq == NULL);
+  assert(tealet_sched_run(&sched) == 1);
+  assert(tealet_chan_send(&chan_b, (void *)(intptr_t)2) == 0);
+  assert(tealet_sched_run(&sched) == 1);
+
+  /* a wakeup from outside does not end the wait */
+  assert(tealet_sched_wake(&sched, selector) == 1);
+  assert(tealet_sched_run(&sched) == 1);
+  assert(chan_a.recvq != NULL && chan_b.recvq != NULL);
+
+  tealet_chan_close(&chan_a);
+  assert(tealet_sched_join(&sched, selector, &result) == 0);
+  assert(result == (void *)(intptr_t)5);
+  assert(chan_b.recvq == NULL);
+  assert(tealet_chan_destroy(&chan_a) == 0 && tealet_chan_destroy(&chan_b) == 0);
+  fini_test();
+}
+
+static const tealet_tick_t timer_delays[] = {1, 5, 63, 64, 65, 4095, 4096, 4097, 300000, 17000000};
+#define N_TIMER_DELAYS (int)(sizeof(timer_delays) / sizeof(timer_delays[0]))
+
+static void *timer_sleeper(tealet_t *current, void *arg) {
+  tealet_tick_t start = sched.now;
+  tealet_tick_t delay = *(tealet_tick_t *)arg;
+
+  (void)current;
+  assert(tealet_sched_sleep(&sched, delay) == 0);
+  assert(sched.now == start + delay);
+  return NULL;
+}
+
+static void *timer_batch(tealet_t *current, void *arg) {
+  (void)current;
+  (void)arg;
+  assert(tealet_sched_sleep(&sched, 10) == 0);
+  return NULL;
+}
+
+static void *timer_recv(tealet_t *current, void *arg) {
+  void *value;
+
+  (void)current;
+  (void)arg;
+  assert(tealet_sched_set_deadline(&sched, sched.now + 10) == 0);
+  assert(tealet_chan_recv(&chan_a, &value) == TEALET_SCHED_TIMEOUT);
+  assert(chan_a.recvq == NULL);
+  tealet_sched_clear_deadline(&sched);
+  return NULL;
+}
+
+/* Sleeping tasks wake exactly at their tick on every wheel level, also
+ * across cascades, and when the timer expires after an early wakeup.
+ */
+void test_sched_timer(void) {
+  tealet_tick_t ticks;
+  tealet_t *task[2];
+  int i;
+
+  init_test();
+  tealet_sched_init(&sched, g_main);
+  assert(tealet_sched_next_timer(&sched, &ticks) == 0);
+  assert(tealet_sched_sleep(&sched, 1) == TEALET_ERR_INVAL);
+  /* any starting tick, close to wrapping around */
+  assert(tealet_sched_advance(&sched, (tealet_tick_t)-1000) == 0);
+
+  for (i = 0; i < N_TIMER_DELAYS; i++)
+    assert(tealet_sched_spawn(&sched, NULL, timer_sleeper, (void *)&timer_delays[i], 0, TEALET_SCHED_DETACHED) == 0);
+  assert(tealet_sched_run(&sched) == N_TIMER_DELAYS);
+  assert(sched.n_timers == N_TIMER_DELAYS);
+  while (tealet_sched_next_timer(&sched, &ticks)) {
+    assert(ticks > 0);
+    tealet_sched_advance(&sched, sched.now + ticks);
+    tealet_sched_run(&sched);
+  }
+  assert(sched.n_tasks == 0 && sched.n_expired == N_TIMER_DELAYS);
+
+  /* one advance wakes a whole batch */
+  for (i = 0; i < 100; i++)
+    assert(tealet_sched_spawn(&sched, NULL, timer_batch, NULL, 0, TEALET_SCHED_DETACHED) == 0);
+  assert(tealet_sched_run(&sched) == 100);
+  assert(tealet_sched_advance(&sched, sched.now + 9) == 0);
+  assert(tealet_sched_advance(&sched, sched.now + 1) == 100);
+  assert(sched.n_ready == 100);
+  assert(tealet_sched_run(&sched) == 0);
+
+  /* timers that expire while their tasks are ready after a wakeup */
+  assert(tealet_chan_init(&chan_a, &sched, 0) == 0);
+  assert(tealet_sched_spawn(&sched, &task[0], timer_batch, NULL, 0, TEALET_SCHED_DETACHED) == 0);
+  assert(tealet_sched_spawn(&sched, &task[1], timer_recv, NULL, 0, TEALET_SCHED_DETACHED) == 0);
+  assert(tealet_sched_run(&sched) == 2);
+  assert(tealet_sched_wake(&sched, task[0]) == 1 && tealet_sched_wake(&sched, task[1]) == 1);
+  assert(tealet_sched_advance(&sched, sched.now + 20) == 2);
+  assert(tealet_sched_run(&sched) == 0 && sched.n_timers == 0);
+  assert(tealet_chan_destroy(&chan_a) == 0);
+  fini_test();
+}
+
+static void *timer_deadline(tealet_t *current, void *arg) {
+  void *value;
+
+  (void)current;
+  (void)arg;
+  /* a receive that nobody answers ends at the deadline */
+  assert(tealet_sched_set_deadline(&sched, sched.now + 10) == 0);
+  assert(tealet_chan_recv(&chan_a, &value) == TEALET_SCHED_TIMEOUT);
+  assert(chan_a.recvq == NULL);
+  /* and stays expired until cleared */
+  assert(tealet_sched_suspend(&sched) == TEALET_SCHED_TIMEOUT);
+  tealet_sched_clear_deadline(&sched);
+
+  /* a wakeup before the deadline wins, and cancelling frees the timer */
+  assert(tealet_sched_set_deadline(&sched, sched.now + 10) == 0);
+  assert(sched.n_timers == 1);
+  assert(tealet_sched_suspend(&sched) == 0);
+  tealet_sched_clear_deadline(&sched);
+  assert(sched.n_timers == 0);
+
+  /* a deadline already in the past fails without blocking */
+  assert(tealet_sched_set_deadline(&sched, sched.now) == 0);
+  assert(tealet_chan_recv(&chan_a, &value) == TEALET_SCHED_TIMEOUT);
+  tealet_sched_clear_deadline(&sched);
+  return NULL;
+}
+
+/* A deadline ends channel and suspend waits and takes the task off the
+ * channel's queue.
+ */
+void test_sched_deadline(void) {
+  tealet_t *task;
+
+  init_test();
+  tealet_sched_init(&sched, g_main);
+  assert(tealet_chan_init(&chan_a, &sched, 0) == 0);
+  assert(tealet_sched_spawn(&sched, &task, timer_deadline, NULL, 0, 0) == 0);
+  assert(tealet_sched_run(&sched) == 1);
+  assert(chan_a.recvq != NULL);
+  assert(tealet_sched_advance(&sched, sched.now + 9) == 0);
+  assert(tealet_sched_advance(&sched, sched.now + 1) == 1);
+  assert(tealet_sched_run(&sched) == 1);
+  assert(TEALET_SCHED_NODE(task)->state == TEALET_SCHED_BLOCKED);
+  assert(tealet_sched_wake(&sched, task) == 1);
+  assert(tealet_sched_join(&sched, task, NULL) == 0);
+  assert(sched.n_timers == 0);
+  assert(tealet_chan_destroy(&chan_a) == 0);
+  fini_test();
+}
+
+static tealet_mutex_t sync_mutex;
+static tealet_cond_t sync_cond;
+static tealet_sem_t sync_sem;
+static tealet_barrier_t sync_barrier;
+static int sync_order[8];
+static int sync_n;
+static int sync_flag;
+
+static void *sync_holder(tealet_t *current, void *arg) {
+  size_t switches;
+
+  (void)arg;
+  /* uncontended operations never switch */
+  switches = sched.n_switches;
+  assert(tealet_mutex_lock(&sync_mutex) == 0);
+  assert(tealet_mutex_lock(&sync_mutex) == TEALET_ERR_INVAL);
+  assert(tealet_mutex_unlock(&sync_mutex) == 0);
+  assert(tealet_mutex_trylock(&sync_mutex) == 1);
+  assert(sched.n_switches == switches);
+
+  tealet_sched_yield(&sched); /* the lockers queue up behind us */
+  assert(sync_mutex.n_contended == 2);
+  assert(tealet_mutex_unlock(&sync_mutex) == 0);
+  /* handed over: the first locker owns it before it even runs */
+  assert(sync_mutex.owner != current && sync_mutex.owner != NULL);
+  assert(tealet_mutex_trylock(&sync_mutex) == 0);
+  assert(tealet_mutex_unlock(&sync_mutex) == TEALET_ERR_INVAL);
+  return NULL;
+}
+
+static void *sync_locker(tealet_t *current, void *arg) {
+  assert(tealet_mutex_lock(&sync_mutex) == 0);
+  assert(sync_mutex.owner == current);
+  sync_order[sync_n++] = (int)(intptr_t)arg;
+  tealet_sched_yield(&sched);
+  assert(tealet_mutex_unlock(&sync_mutex) == 0);
+  return NULL;
+}
+
+static void *sync_waiter(tealet_t *current, void *arg) {
+  assert(tealet_mutex_lock(&sync_mutex) == 0);
+  while (!sync_flag)
+    assert(tealet_cond_wait(&sync_cond, &sync_mutex) == 0);
+  assert(sync_mutex.owner == current);
+  sync_order[sync_n++] = (int)(intptr_t)arg;
+  assert(tealet_mutex_unlock(&sync_mutex) == 0);
+  return NULL;
+}
+
+static void *sync_broadcaster(tealet_t *current, void *arg) {
+  size_t ready;
+
+  (void)current;
+  (void)arg;
+  assert(tealet_mutex_lock(&sync_mutex) == 0);
+  sync_flag = 1;
+  ready = sched.n_ready;
+  assert(tealet_cond_broadcast(&sync_cond) == 3);
+  /* the waiters moved to the mutex instead of all waking up */
+  assert(sched.n_ready == ready && sync_cond.waiters.head == NULL);
+  assert(tealet_mutex_unlock(&sync_mutex) == 0);
+  assert(sched.n_ready == ready + 1);
+  return NULL;
+}
+
+static void *sync_timeout(tealet_t *current, void *arg) {
+  (void)arg;
+  /* the mutex is held by main: the lock ends at the deadline, unqueued */
+  assert(tealet_sched_set_deadline(&sched, sched.now + 5) == 0);
+  assert(tealet_mutex_lock(&sync_mutex) == TEALET_SCHED_TIMEOUT);
+  assert(sync_mutex.waiters.head == NULL);
+  tealet_sched_clear_deadline(&sched);
+
+  /* a wait that times out still returns with the mutex held */
+  assert(tealet_mutex_lock(&sync_mutex) == 0);
+  assert(tealet_sched_set_deadline(&sched, sched.now + 5) == 0);
+  assert(tealet_cond_wait(&sync_cond, &sync_mutex) == TEALET_SCHED_TIMEOUT);
+  assert(sync_mutex.owner == current && sync_cond.waiters.head == NULL);
+  tealet_sched_clear_deadline(&sched);
+  assert(tealet_mutex_unlock(&sync_mutex) == 0);
+  return NULL;
+}
+
+/* A mutex is handed to its oldest waiter, so a releaser cannot barge back
+ * in, and a broadcast moves the waiters to the mutex one at a time.
+ */
+void test_sync_mutex(void) {
+  int i;
+
+  init_test();
+  tealet_sched_init(&sched, g_main);
+  tealet_mutex_init(&sync_mutex, &sched);
+  tealet_cond_init(&sync_cond, &sched);
+  sync_n = 0;
+  sync_flag = 0;
+
+  assert(tealet_sched_spawn(&sched, NULL, sync_holder, NULL, 0, TEALET_SCHED_DETACHED) == 0);
+  for (i = 0; i < 2; i++)
+    assert(tealet_sched_spawn(&sched, NULL, sync_locker, (void *)(intptr_t)i, 0, TEALET_SCHED_DETACHED) == 0);
+  assert(tealet_sched_run(&sched) == 0);
+  assert(sync_n == 2 && sync_order[0] == 0 && sync_order[1] == 1);
+  assert(sync_mutex.owner == NULL);
+
+  sync_n = 0;
+  for (i = 0; i < 3; i++)
+    assert(tealet_sched_spawn(&sched, NULL, sync_waiter, (void *)(intptr_t)i, 0, TEALET_SCHED_DETACHED) == 0);
+  assert(tealet_sched_run(&sched) == 3);
+  assert(tealet_sched_spawn(&sched, NULL, sync_broadcaster, NULL, 0, TEALET_SCHED_DETACHED) == 0);
+  assert(tealet_sched_run(&sched) == 0);
+  assert(sync_n == 3 && sync_order[0] == 0 && sync_order[1] == 1 && sync_order[2] == 2);
+
+  /* main may lock a free mutex, but not wait for one */
+  assert(tealet_mutex_lock(&sync_mutex) == 0);
+  assert(tealet_sched_spawn(&sched, NULL, sync_timeout, NULL, 0, TEALET_SCHED_DETACHED) == 0);
+  assert(tealet_sched_run(&sched) == 1);
+  assert(tealet_sched_advance(&sched, sched.now + 5) == 1);
+  assert(tealet_sched_run(&sched) == 1);
+  assert(tealet_mutex_unlock(&sync_mutex) == 0);
+  assert(tealet_sched_run(&sched) == 1);
+  /* the task waits on the condition; the timeout must wait for main */
+  assert(tealet_mutex_lock(&sync_mutex) == 0);
+  assert(tealet_sched_advance(&sched, sched.now + 5) == 1);
+  assert(tealet_sched_run(&sched) == 1);
+  assert(sync_mutex.waiters.head != NULL);
+  assert(tealet_mutex_unlock(&sync_mutex) == 0);
+  assert(tealet_sched_run(&sched) == 0);
+  assert(sync_mutex.owner == NULL && sched.n_timers == 0);
+  fini_test();
+}
+
+static void *sync_acquirer(tealet_t *current, void *arg) {
+  (void)current;
+  assert(tealet_sem_acquire(&sync_sem) == 0);
+  sync_order[sync_n++] = (int)(intptr_t)arg;
+  return NULL;
+}
+
+static void *sync_expirer(tealet_t *current, void *arg) {
+  (void)current;
+  (void)arg;
+  assert(tealet_sched_set_deadline(&sched, sched.now + 10) == 0);
+  assert(tealet_sem_acquire(&sync_sem) == TEALET_SCHED_TIMEOUT);
+  assert(sync_sem.waiters.head == NULL);
+  tealet_sched_clear_deadline(&sched);
+  return NULL;
+}
+
+static void *sync_party(tealet_t *current, void *arg) {
+  int round, result;
+
+  (void)current;
+  (void)arg;
+  for (round = 0; round < 3; round++) {
+    result = tealet_barrier_wait(&sync_barrier);
+    assert(result == 0 || result == TEALET_BARRIER_SERIAL);
+    if (result == TEALET_BARRIER_SERIAL)
+      sync_order[round]++;
+  }
+  return NULL;
+}
+
+/* Semaphore units go straight to waiters in batches and a barrier releases
+ * its parties once per cycle.  Either completes without a switch when it
+ * can, and a deadline that passes while the waiter is ready still counts.
+ */
+void test_sync_sem(void) {
+  tealet_t *task;
+  size_t switches;
+  int i;
+
+  init_test();
+  tealet_sched_init(&sched, g_main);
+  sync_n = 0;
+
+  /* the fast paths, from main */
+  tealet_sem_init(&sync_sem, &sched, 2);
+  switches = sched.n_switches;
+  assert(tealet_sem_acquire(&sync_sem) == 0);
+  assert(tealet_sem_tryacquire(&sync_sem) == 1);
+  assert(tealet_sem_tryacquire(&sync_sem) == 0);
+  assert(tealet_sem_acquire(&sync_sem) == TEALET_ERR_INVAL);
+  assert(sched.n_switches == switches);
+
+  /* a deadline that passes while a wakeup has the waiter ready */
+  assert(tealet_sched_spawn(&sched, &task, sync_expirer, NULL, 0, TEALET_SCHED_DETACHED) == 0);
+  assert(tealet_sched_run(&sched) == 1);
+  assert(tealet_sched_wake(&sched, task) == 1);
+  assert(tealet_sched_advance(&sched, sched.now + 20) == 1);
+  assert(tealet_sched_run(&sched) == 0 && sched.n_timers == 0);
+
+  for (i = 0; i < 5; i++)
+    assert(tealet_sched_spawn(&sched, NULL, sync_acquirer, (void *)(intptr_t)i, 0, TEALET_SCHED_DETACHED) == 0);
+  assert(tealet_sched_run(&sched) == 5);
+  assert(sync_sem.n_contended == 6);
+  /* one batch of three units wakes three tasks, oldest first */
+  assert(tealet_sem_release(&sync_sem, 3) == 3);
+  assert(sync_sem.count == 0 && sched.n_ready == 3);
+  assert(tealet_sched_run(&sched) == 2);
+  assert(sync_n == 3 && sync_order[0] == 0 && sync_order[2] == 2);
+  /* more units than waiters: the rest is kept */
+  assert(tealet_sem_release(&sync_sem, 4) == 2);
+  assert(sync_sem.count == 2);
+  assert(tealet_sched_run(&sched) == 0);
+  assert(sync_n == 5 && sync_order[3] == 3 && sync_order[4] == 4);
+
+  /* four parties, three cycles, one serial task per cycle */
+  assert(tealet_barrier_init(&sync_barrier, &sched, 0) == TEALET_ERR_INVAL);
+  assert(tealet_barrier_init(&sync_barrier, &sched, 4) == 0);
+  memset(sync_order, 0, sizeof(sync_order));
+  for (i = 0; i < 4; i++)
+    assert(tealet_sched_spawn(&sched, NULL, sync_party, NULL, 0, TEALET_SCHED_DETACHED) == 0);
+  assert(tealet_sched_run(&sched) == 0);
+  assert(sync_barrier.n_cycles == 3 && sync_barrier.arrived == 0);
+  assert(sync_order[0] == 1 && sync_order[1] == 1 && sync_order[2] == 1);
+  assert(tealet_barrier_wait(&sync_barrier) == TEALET_ERR_INVAL);
+  fini_test();
+}
+
+static tealet_taskgroup_t group_outer;
+static tealet_taskgroup_t group_inner;
+static int group_results[4];
+static int group_ran;
+
+static void *group_value(tealet_t *current, void *arg) {
+  intptr_t i;
+
+  (void)current;
+  group_ran++;
+  for (i = 0; i < (intptr_t)arg; i++)
+    tealet_sched_yield(&sched);
+  return (void *)((intptr_t)arg * 10);
+}
+
+static void *group_blocker(tealet_t *current, void *arg) {
+  (void)current;
+  if (arg == NULL)
+    group_results[0] = tealet_sem_acquire(&sync_sem);
+  else
+    group_results[1] = tealet_sched_sleep(&sched, 100);
+  return NULL;
+}
+
+static void *group_failer(tealet_t *current, void *arg) {
+  (void)current;
+  (void)arg;
+  assert(tealet_taskgroup_wait_all(&group_inner) == TEALET_ERR_INVAL);
+  assert(tealet_taskgroup_fail(&group_outer) == TEALET_ERR_INVAL);
+  assert(tealet_taskgroup_fail(&group_inner) == 0);
+  return (void *)1;
+}
+
+static void *group_parent(tealet_t *current, void *arg) {
+  void *res[3];
+
+  (void)current;
+  (void)arg;
+  /* the result slots live on this task's stack */
+  tealet_taskgroup_init(&group_inner, &sched);
+  assert(tealet_taskgroup_spawn(&group_inner, NULL, group_blocker, NULL, 0, &res[0]) == 0);
+  assert(tealet_taskgroup_spawn(&group_inner, NULL, group_blocker, (void *)1, 0, &res[1]) == 0);
+  assert(tealet_taskgroup_spawn(&group_inner, NULL, group_failer, NULL, 0, &res[2]) == 0);
+  res[0] = res[1] = res[2] = (void *)-1;
+  assert(tealet_taskgroup_wait_all(&group_inner) == TEALET_TASKGROUP_FAILED);
+  assert(res[0] == NULL && res[1] == NULL && res[2] == (void *)1);
+  assert(group_inner.n_cancelled == 2 && group_inner.n_children == 0);
+  return NULL;
+}
+
+static void *group_nested(tealet_t *current, void *arg) {
+  (void)current;
+  (void)arg;
+  tealet_taskgroup_init(&group_inner, &sched);
+  assert(tealet_taskgroup_spawn(&group_inner, NULL, group_blocker, NULL, 0, NULL) == 0);
+  group_results[2] = tealet_taskgroup_wait_all(&group_inner);
+  return (void *)2;
+}
+
+static void *group_sender(tealet_t *current, void *arg) {
+  int result;
+
+  (void)current;
+  (void)arg;
+  while ((result = tealet_chan_send(&chan_a, NULL)) == 0)
+    group_ran++;
+  group_results[3] = result;
+  return NULL;
+}
+
+static void *group_receiver(tealet_t *current, void *arg) {
+  void *value;
+
+  (void)current;
+  (void)arg;
+  assert(tealet_chan_recv(&chan_a, &value) == 0);
+  return NULL;
+}
+
+static void *group_quitter(tealet_t *current, void *arg) {
+  (void)current;
+  (void)arg;
+  assert(tealet_taskgroup_fail(&group_inner) == 0);
+  return NULL;
+}
+
+static void *group_racer(tealet_t *current, void *arg) {
+  (void)current;
+  (void)arg;
+  tealet_taskgroup_init(&group_inner, &sched);
+  assert(tealet_taskgroup_spawn(&group_inner, NULL, group_sender, NULL, 0, NULL) == 0);
+  assert(tealet_taskgroup_spawn(&group_inner, NULL, group_quitter, NULL, 0, NULL) == 0);
+  assert(tealet_taskgroup_spawn(&group_inner, NULL, group_receiver, NULL, 0, NULL) == 0);
+  assert(tealet_taskgroup_wait_all(&group_inner) == TEALET_TASKGROUP_FAILED);
+  return NULL;
+}
+
+/* A task group joins its children as they complete and stores each result
+ * in its slot.  A failing child cancels its siblings, which are unblocked,
+ * dequeued and deleted, and a cancelled child fails every later wait.  Only
+ * the group's owner spawns and waits.
+ */
+void test_taskgroup(void) {
+  tealet_t *child[3], *done;
+  void *res[3];
+  int i;
+
+  init_test();
+  tealet_sched_init(&sched, g_main);
+  tealet_taskgroup_init(&group_outer, &sched);
+  memset(group_results, 0, sizeof(group_results));
+  group_ran = 0;
+  assert(tealet_taskgroup_wait_any(&group_outer, &done) == TEALET_ERR_INVAL);
+  assert(tealet_taskgroup_fail(&group_outer) == TEALET_ERR_INVAL);
+
+  /* the child that yields least completes first */
+  for (i = 0; i < 3; i++)
+    assert(tealet_taskgroup_spawn(&group_outer, &child[i], group_value, (void *)(intptr_t)(3 - i), 0, &res[i]) == 0);
+  for (i = 2; i >= 0; i--) {
+    assert(tealet_taskgroup_wait_any(&group_outer, &done) == 0);
+    assert(done == child[i] && res[i] == (void *)(intptr_t)((3 - i) * 10));
+  }
+  assert(group_outer.n_children == 0 && sched.n_tasks == 0);
+
+  /* a future is awaited out of order; the rest are joined together */
+  for (i = 0; i < 3; i++)
+    assert(tealet_taskgroup_spawn(&group_outer, &child[i], group_value, (void *)(intptr_t)i, 0, &res[i]) == 0);
+  assert(tealet_taskgroup_await(&group_outer, child[2]) == 0 && res[2] == (void *)20);
+  assert(tealet_taskgroup_wait_all(&group_outer) == 0);
+  assert(res[0] == (void *)0 && res[1] == (void *)10 && sched.n_tasks == 0);
+
+  /* children cancelled before they start never run */
+  group_ran = 0;
+  for (i = 0; i < 3; i++) {
+    res[i] = (void *)-1;
+    assert(tealet_taskgroup_spawn(&group_outer, NULL, group_value, NULL, 0, &res[i]) == 0);
+  }
+  assert(tealet_taskgroup_cancel(&group_outer) == 3 && sched.n_ready == 0);
+  assert(tealet_taskgroup_wait_any(&group_outer, NULL) == TEALET_TASKGROUP_CANCELLED);
+  assert(tealet_taskgroup_wait_all(&group_outer) == 0);
+  assert(group_ran == 0 && res[0] == NULL && res[1] == NULL && res[2] == NULL);
+
+  /* a failure cancels the siblings blocked on a semaphore and a timer */
+  tealet_sem_init(&sync_sem, &sched, 0);
+  assert(tealet_sched_spawn(&sched, &child[0], group_parent, NULL, 0, 0) == 0);
+  assert(tealet_sched_join(&sched, child[0], NULL) == 0);
+  assert(group_results[0] == TEALET_ERR_PANIC && group_results[1] == TEALET_ERR_PANIC);
+  assert(sync_sem.waiters.head == NULL && sched.n_timers == 0 && sched.n_tasks == 0);
+
+  /* cancelling a waiting parent cancels its own group too */
+  assert(tealet_taskgroup_spawn(&group_outer, NULL, group_nested, NULL, 0, &res[0]) == 0);
+  assert(tealet_sched_run(&sched) == 2);
+  /* only the task that owns the inner group spawns into it and waits */
+  assert(tealet_taskgroup_spawn(&group_inner, NULL, group_value, NULL, 0, NULL) == TEALET_ERR_INVAL);
+  assert(tealet_taskgroup_wait_any(&group_inner, NULL) == TEALET_ERR_INVAL);
+  assert(tealet_taskgroup_cancel(&group_outer) == 1);
+  assert(group_results[2] == TEALET_ERR_PANIC && group_inner.n_children == 0);
+  assert(tealet_taskgroup_wait_all(&group_outer) == 0 && res[0] == (void *)2);
+  assert(sync_sem.waiters.head == NULL && sched.n_tasks == 0);
+
+  /* a sender whose send completed before the cancel fails its next one */
+  assert(tealet_chan_init(&chan_a, &sched, 0) == 0);
+  group_ran = 0;
+  assert(tealet_sched_spawn(&sched, &child[0], group_racer, NULL, 0, 0) == 0);
+  assert(tealet_sched_join(&sched, child[0], NULL) == 0);
+  assert(group_ran == 1 && group_results[3] == TEALET_ERR_PANIC);
+  assert(chan_a.sendq == NULL && sched.n_tasks == 0);
+  assert(tealet_chan_destroy(&chan_a) == 0);
+  fini_test();
+}
+
+#if TEALET_WITH_REACTOR
+static tealet_reactor_t reactor;
+static int reactor_fds[2];
+
+static void set_nonblocking(int fd) { assert(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0); }
+
+static void *reactor_reader(tealet_t *current, void *arg) {
+  char buf[16];
+  long total = 0;
+  ssize_t n;
+
+  (void)current;
+  (void)arg;
+  for (;;) {
+    n = read(reactor_fds[0], buf, sizeof(buf));
+    if (n > 0)
+      total += n;
+    else if (n == 0)
+      break;
+    else if (errno == EAGAIN)
+      assert(tealet_wait_fd(&reactor, reactor_fds[0], TEALET_FD_READ, -1) == 0);
+    else
+      assert(0);
+  }
+  return (void *)(intptr_t)total;
+}
+
+static void *reactor_writer(tealet_t *current, void *arg) {
+  int i;
+
+  (void)current;
+  (void)arg;
+  /* a second reader on the same descriptor is refused */
+  assert(tealet_wait_fd(&reactor, reactor_fds[0], TEALET_FD_READ, 0) == TEALET_ERR_INVAL);
+  for (i = 0; i < 3; i++) {
+    assert(write(reactor_fds[1], "hello", 5) == 5);
+    assert(tealet_sched_sleep(&sched, 2) == 0);
+  }
+  assert(tealet_reactor_forget(&reactor, reactor_fds[1]) == 0);
+  close(reactor_fds[1]);
+  return NULL;
+}
+
+static void *reactor_pinger(tealet_t *current, void *arg) {
+  int fd = (int)(intptr_t)arg;
+  int i, count = 0;
+  char c;
+
+  (void)current;
+  for (i = 0; i < 100; i++) {
+    c = (char)i;
+    if (fd == reactor_fds[0]) {
+      while (write(fd, &c, 1) != 1)
+        assert(tealet_wait_fd(&reactor, fd, TEALET_FD_WRITE, -1) == 0);
+    }
+    while (read(fd, &c, 1) != 1)
+      assert(tealet_wait_fd(&reactor, fd, TEALET_FD_READ, -1) == 0);
+    assert(c == (char)i);
+    count++;
+    if (fd == reactor_fds[1]) {
+      while (write(fd, &c, 1) != 1)
+        assert(tealet_wait_fd(&reactor, fd, TEALET_FD_WRITE, -1) == 0);
+    }
+  }
+  return (void *)(intptr_t)count;
+}
+
+static void *reactor_timeout(tealet_t *current, void *arg) {
+  tealet_tick_t start;
+
+  (void)current;
+  (void)arg;
+  start = sched.now;
+  assert(tealet_wait_fd(&reactor, reactor_fds[0], TEALET_FD_READ, 5) == TEALET_SCHED_TIMEOUT);
+  assert(sched.now - start >= 5);
+  assert(sched.n_timers == 0);
+  return NULL;
+}
+
+static void *reactor_partial(tealet_t *current, void *arg) {
+  char buf[16];
+
+  (void)current;
+  (void)arg;
+  assert(tealet_wait_fd(&reactor, reactor_fds[0], TEALET_FD_READ, -1) == 0);
+  assert(read(reactor_fds[0], buf, 4) == 4);
+  /* no new edge comes for the bytes left behind */
+  assert(tealet_wait_fd(&reactor, reactor_fds[0], TEALET_FD_READ, 1000) == 0);
+  assert(read(reactor_fds[0], buf, sizeof(buf)) == 6);
+  return NULL;
+}
+
+static void *reactor_burst(tealet_t *current, void *arg) {
+  (void)current;
+  (void)arg;
+  assert(write(reactor_fds[1], "0123456789", 10) == 10);
+  return NULL;
+}
+
+/* Tasks parked on pipes and sockets are woken by the epoll loop, including
+ * for an edge that arrived before they waited and for data left behind by
+ * a partial read.
+ */
+void test_reactor(void) {
+  tealet_t *reader, *a, *b;
+  void *result;
+
+  init_test();
+  tealet_sched_init(&sched, g_main);
+  assert(tealet_reactor_init(&reactor, &sched) == 0);
+  assert(tealet_wait_fd(&reactor, 0, TEALET_FD_READ, -1) == TEALET_ERR_INVAL);
+
+  /* a pipe with a writer that pauses between messages */
+  assert(pipe(reactor_fds) == 0);
+  set_nonblocking(reactor_fds[0]);
+  assert(tealet_sched_spawn(&sched, &reader, reactor_reader, NULL, 0, 0) == 0);
+  assert(tealet_sched_spawn(&sched, NULL, reactor_writer, NULL, 0, TEALET_SCHED_DETACHED) == 0);
+  assert(tealet_reactor_run(&reactor) == 1);
+  assert(tealet_sched_join(&sched, reader, &result) == 0);
+  assert(result == (void *)(intptr_t)15);
+  assert(reactor.n_polls > 0 && reactor.n_waiting == 0);
+
+  /* an empty pipe times out */
+  assert(tealet_sched_spawn(&sched, NULL, reactor_timeout, NULL, 0, TEALET_SCHED_DETACHED) == 0);
+  assert(tealet_reactor_run(&reactor) == 0);
+  assert(tealet_reactor_forget(&reactor, reactor_fds[0]) == 0);
+  close(reactor_fds[0]);
+
+  /* a reader that waits again after a partial read */
+  assert(pipe(reactor_fds) == 0);
+  set_nonblocking(reactor_fds[0]);
+  assert(tealet_sched_spawn(&sched, NULL, reactor_partial, NULL, 0, TEALET_SCHED_DETACHED) == 0);
+  assert(tealet_sched_spawn(&sched, NULL, reactor_burst, NULL, 0, TEALET_SCHED_DETACHED) == 0);
+  assert(tealet_reactor_run(&reactor) == 0);
+  assert(tealet_reactor_forget(&reactor, reactor_fds[0]) == 0);
+  close(reactor_fds[0]);
+  close(reactor_fds[1]);
+
+  /* a ping-pong over a socketpair */
+  assert(socketpair(AF_UNIX, SOCK_STREAM, 0, reactor_fds) == 0);
+  set_nonblocking(reactor_fds[0]);
+  set_nonblocking(reactor_fds[1]);
+  assert(tealet_sched_spawn(&sched, &a, reactor_pinger, (void *)(intptr_t)reactor_fds[0], 0, 0) == 0);
+  assert(tealet_sched_spawn(&sched, &b, reactor_pinger, (void *)(intptr_t)reactor_fds[1], 0, 0) == 0);
+  assert(tealet_reactor_run(&reactor) == 2);
+  assert(tealet_sched_join(&sched, a, &result) == 0 && result == (void *)(intptr_t)100);
+  assert(tealet_sched_join(&sched, b, &result) == 0 && result == (void *)(intptr_t)100);
+  assert(tealet_reactor_forget(&reactor, reactor_fds[0]) == 0);
+  assert(tealet_reactor_forget(&reactor, reactor_fds[1]) == 0);
+  close(reactor_fds[0]);
+  close(reactor_fds[1]);
+
+  tealet_reactor_destroy(&reactor);
+  fini_test();
+}
+
+static int io_fd;
+static char io_heap[] = "abcdefghij"; /* not on any task's stack */
+/* Not in reactor_io_round() either: the stack guard that init_test()
+ * enables makes the page past a task's far end, which holds that frame,
+ * inaccessible while the task runs.
+ */
+static struct sockaddr_un io_addr;
+
+static void *io_file_task(tealet_t *current, void *arg) {
+  char small[21];
+  char large[TEALET_URING_BUFSIZE + 100]; /* too big for a registered buffer */
+  size_t i;
+
+  (void)current;
+  (void)arg;
+  memcpy(small, "0123456789", 10);
+  assert(tealet_io_write(&reactor, io_fd, small, 10, 0) == 10);
+  assert(tealet_io_write(&reactor, io_fd, io_heap, 10, 10) == 10);
+  for (i = 0; i < sizeof(large); i++)
+    large[i] = (char)(i * 7);
+  assert(tealet_io_write(&reactor, io_fd, large, sizeof(large), 20) == (ssize_t)sizeof(large));
+  assert(tealet_io_fsync(&reactor, io_fd) == 0);
+  memset(small, 0, sizeof(small));
+  memset(large, 0, sizeof(large));
+  assert(tealet_io_read(&reactor, io_fd, small, 20, 0) == 20);
+  assert(memcmp(small, "0123456789abcdefghij", 20) == 0);
+  assert(tealet_io_read(&reactor, io_fd, large, sizeof(large), 20) == (ssize_t)sizeof(large));
+  for (i = 0; i < sizeof(large); i++)
+    assert(large[i] == (char)(i * 7));
+  return NULL;
+}
+
+static void *io_sock_reader(tealet_t *current, void *arg) {
+  char buf[16];
+
+  (void)current;
+  (void)arg;
+  assert(tealet_io_read(&reactor, reactor_fds[0], buf, sizeof(buf), -1) == 5);
+  assert(memcmp(buf, "hello", 5) == 0);
+  /* nothing more arrives: the deadline cancels the read */
+  assert(tealet_sched_set_deadline(&sched, sched.now + 5) == 0);
+  assert(tealet_io_read(&reactor, reactor_fds[0], buf, sizeof(buf), -1) == -1 && errno == ETIMEDOUT);
+  tealet_sched_clear_deadline(&sched);
+  return NULL;
+}
+
+static void *io_sock_writer(tealet_t *current, void *arg) {
+  (void)current;
+  (void)arg;
+  tealet_sched_yield(&sched); /* let the reader wait first */
+  assert(tealet_io_write(&reactor, reactor_fds[1], "hello", 5, -1) == 5);
+  return NULL;
+}
+
+static void *io_acceptor(tealet_t *current, void *arg) {
+  int lfd = (int)(intptr_t)arg;
+  int i, s;
+  char c;
+
+  (void)current;
+  for (i = 0; i < 3; i++) {
+    s = tealet_io_accept(&reactor, lfd, SOCK_CLOEXEC);
+    assert(s >= 0);
+    assert(tealet_io_read(&reactor, s, &c, 1, -1) == 1 && c == (char)i);
+    close(s);
+  }
+  return NULL;
+}
+
+static void *io_connector(tealet_t *current, void *arg) {
+  socklen_t len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + strlen(io_addr.sun_path + 1));
+  int i, s;
+  char c;
+
+  (void)current;
+  (void)arg;
+  for (i = 0; i < 3; i++) {
+    tealet_sched_yield(&sched);
+    s = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(s >= 0 && connect(s, (struct sockaddr *)&io_addr, len) == 0);
+    c = (char)i;
+    assert(write(s, &c, 1) == 1);
+    close(s);
+  }
+  return NULL;
+}
+
+static void reactor_io_round(int flags) {
+  char path[] = "/tmp/tealet-io-XXXXXX";
+  int lfd;
+
+  assert(tealet_reactor_init_ex(&reactor, &sched, flags) == 0);
+  if (!(flags & TEALET_REACTOR_URING))
+    assert(reactor.uring == NULL);
+  io_fd = mkstemp(path);
+  assert(io_fd >= 0);
+  unlink(path);
+  assert(socketpair(AF_UNIX, SOCK_STREAM, 0, reactor_fds) == 0);
+  set_nonblocking(reactor_fds[0]);
+  set_nonblocking(reactor_fds[1]);
+  memset(&io_addr, 0, sizeof(io_addr));
+  io_addr.sun_family = AF_UNIX;
+  sprintf(io_addr.sun_path + 1, "tealet-io-%d-%d", (int)getpid(), flags); /* abstract */
+  lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  assert(lfd >= 0);
+  assert(bind(lfd, (struct sockaddr *)&io_addr,
+              (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + strlen(io_addr.sun_path + 1))) == 0);
+  assert(listen(lfd, 8) == 0);
+  set_nonblocking(lfd);
+
+  assert(tealet_sched_spawn(&sched, NULL, io_file_task, NULL, 0, TEALET_SCHED_DETACHED) == 0);
+  assert(tealet_sched_spawn(&sched, NULL, io_sock_reader, NULL, 0, TEALET_SCHED_DETACHED) == 0);
+  assert(tealet_sched_spawn(&sched, NULL, io_sock_writer, NULL, 0, TEALET_SCHED_DETACHED) == 0);
+  assert(tealet_sched_spawn(&sched, NULL, io_acceptor, (void *)(intptr_t)lfd, 0, TEALET_SCHED_DETACHED) == 0);
+  assert(tealet_sched_spawn(&sched, NULL, io_connector, NULL, 0, TEALET_SCHED_DETACHED) == 0);
+  assert(tealet_reactor_run(&reactor) == 0);
+  assert(sched.n_tasks == 0 && reactor.n_waiting == 0);
+  if (reactor.uring != NULL)
+    assert(reactor.n_submitted > 0 && reactor.n_completed > 0);
+  else
+    assert(reactor.n_submitted == 0);
+
+  assert(tealet_reactor_forget(&reactor, lfd) == 0);
+  assert(tealet_reactor_forget(&reactor, reactor_fds[0]) == 0);
+  assert(tealet_reactor_forget(&reactor, reactor_fds[1]) == 0);
+  close(lfd);
+  close(reactor_fds[0]);
+  close(reactor_fds[1]);
+  close(io_fd);
+  tealet_reactor_destroy(&reactor);
+}
+
+/* File and socket I/O suspends only the calling task, with io_uring and
+ * with the epoll fallback.  The kernel never writes into a stack that was
+ * switched out.
+ */
+void test_reactor_io(void) {
+  init_test();
+  tealet_sched_init(&sched, g_main);
+  reactor_io_round(TEALET_REACTOR_URING);
+  reactor_io_round(0);
+  fini_test();
+}
+
+static tealet_offload_t offload;
+static pthread_t offload_main_thread;
+static int offload_ticks;
+static int offload_pending;
+
+typedef struct offload_arg_t {
+  long in;
+  int other_thread;
+} offload_arg_t;
+
+static void *offload_slow(void *arg) {
+  offload_arg_t *a = (offload_arg_t *)arg;
+  struct timespec ts = {0, 2000000};
+
+  nanosleep(&ts, NULL); /* a call that blocks its thread */
+  a->other_thread = !pthread_equal(pthread_self(), offload_main_thread);
+  return (void *)(intptr_t)(a->in * 2);
+}
+
+static void *offload_task(tealet_t *current, void *arg) {
+  offload_arg_t *a = TEALET_SCHED_EXTRA(current, offload_arg_t);
+  offload_arg_t local;
+  void *result = NULL;
+  char *low;
+
+  a->in = (long)(intptr_t)arg;
+  a->other_thread = 0;
+  /* the worker would write into a stack that is switched out */
+  assert(tealet_offload(&offload, offload_slow, &local, sizeof(local), &result) == TEALET_ERR_INVAL);
+  /* an object starting in the unused part of a downward stack, reaching in */
+  if (tealet_stack_diff(&local, (char *)&local - 1) > 0) {
+    low = (char *)&local - 4096;
+    assert(tealet_offload(&offload, offload_slow, low, 4096 + sizeof(local), &result) == TEALET_ERR_INVAL);
+  }
+  assert(tealet_offload(&offload, offload_slow, a, sizeof(*a), &result) == 0);
+  assert(result == (void *)(intptr_t)(a->in * 2) && a->other_thread);
+  offload_pending--;
+  return NULL;
+}
+
+static void *offload_ticker(tealet_t *current, void *arg) {
+  (void)current;
+  (void)arg;
+  while (offload_pending > 0) {
+    offload_ticks++;
+    assert(tealet_sched_sleep(&sched, 1) == 0);
+  }
+  return NULL;
+}
+
+/* Blocking calls run on worker threads while the other tasks keep running,
+ * and resume their tasks on the domain's thread.
+ */
+void test_offload(void) {
+  offload_arg_t *a;
+  void *result;
+  int i;
+
+  init_test();
+  offload_main_thread = pthread_self();
+  offload_ticks = 0;
+  offload_pending = 8;
+  tealet_sched_init(&sched, g_main);
+  assert(tealet_reactor_init(&reactor, &sched) == 0);
+  assert(tealet_offload_init(&offload, &reactor, 2) == 0);
+
+  for (i = 0; i < 8; i++)
+    assert(tealet_sched_spawn(&sched, NULL, offload_task, (void *)(intptr_t)i, sizeof(offload_arg_t),
+                              TEALET_SCHED_DETACHED) == 0);
+  assert(tealet_sched_spawn(&sched, NULL, offload_ticker, NULL, 0, TEALET_SCHED_DETACHED) == 0);
+  assert(tealet_reactor_run(&reactor) == 0);
+  assert(offload_pending == 0 && offload.n_inflight == 0);
+  assert(offload.n_jobs == 8 && sched.n_remote == 8 && reactor.n_doorbells <= 8);
+  /* four rounds of 2ms jobs on two threads: the ticker kept running */
+  assert(offload_ticks > 1);
+
+  /* from main, the call is made in place */
+  a = (offload_arg_t *)malloc(sizeof(offload_arg_t));
+  a->in = 21;
+  assert(tealet_offload(&offload, offload_slow, a, sizeof(*a), &result) == 0);
+  assert(result == (void *)(intptr_t)42 && !a->other_thread);
+  free(a);
+
+  assert(tealet_offload_destroy(&offload) == 0);
+  tealet_reactor_destroy(&reactor);
+  fini_test();
+}
+
+#define REMOTE_TASKS 4
+#define REMOTE_ROUNDS 200
+
+static tealet_t *remote_slots[REMOTE_TASKS]; /* tasks waiting for the other thread */
+static int remote_rounds[REMOTE_TASKS];
+static int remote_rings;
+
+static void remote_ring(void *arg) {
+  (void)arg;
+  remote_rings++;
+}
+
+static void *remote_self(tealet_t *current, void *arg) {
+  (void)arg;
+  /* woken twice before it waits: the wakeups coalesce */
+  assert(tealet_wake_remote(current) == 0);
+  assert(tealet_wake_remote(current) == 0);
+  assert(remote_rings == 1);
+  assert(tealet_sched_suspend_remote(&sched) == 0);
+  return NULL;
+}
+
+static void *remote_task(tealet_t *current, void *arg) {
+  int i = (int)(intptr_t)arg;
+  int round;
+
+  for (round = 0; round < REMOTE_ROUNDS; round++) {
+    __atomic_store_n(&remote_slots[i], current, __ATOMIC_RELEASE);
+    assert(tealet_sched_suspend_remote(&sched) == 0);
+    remote_rounds[i]++;
+  }
+  return NULL;
+}
+
+static void *remote_waker(void *arg) {
+  long left = (long)REMOTE_TASKS * REMOTE_ROUNDS;
+  tealet_t *t;
+  int i;
+
+  (void)arg;
+  while (left > 0) {
+    for (i = 0; i < REMOTE_TASKS; i++) {
+      t = __atomic_exchange_n(&remote_slots[i], NULL, __ATOMIC_ACQ_REL);
+      if (t != NULL) {
+        assert(tealet_wake_remote(t) == 0);
+        left--;
+      }
+    }
+  }
+  return NULL;
+}
+
+/* Another thread wakes suspended tasks through the wake stack and the
+ * reactor's doorbell.  Every wakeup arrives, and tasks only ever run on the
+ * domain's thread.
+ */
+void test_wake_remote(void) {
+  pthread_t thread;
+  int i;
+
+  init_test();
+  memset(remote_slots, 0, sizeof(remote_slots));
+  memset(remote_rounds, 0, sizeof(remote_rounds));
+  remote_rings = 0;
+  tealet_sched_init(&sched, g_main);
+  assert(tealet_wake_remote(g_main) == TEALET_ERR_INVAL);
+  assert(tealet_sched_suspend_remote(&sched) == TEALET_ERR_INVAL);
+
+  /* without a reactor: the owner drains the stack at its next pick */
+  tealet_sched_set_doorbell(&sched, remote_ring, NULL);
+  assert(tealet_sched_spawn(&sched, NULL, remote_self, NULL, 0, TEALET_SCHED_DETACHED) == 0);
+  assert(tealet_sched_run(&sched) == 0);
+  assert(remote_rings == 1 && sched.n_remote == 1 && sched.n_remote_waiting == 0);
+
+  /* a foreign thread wakes tasks parked while main sleeps in epoll */
+  assert(tealet_reactor_init(&reactor, &sched) == 0);
+  for (i = 0; i < REMOTE_TASKS; i++)
+    assert(tealet_sched_spawn(&sched, NULL, remote_task, (void *)(intptr_t)i, 0, TEALET_SCHED_DETACHED) == 0);
+  assert(pthread_create(&thread, NULL, remote_waker, NULL) == 0);
+  assert(tealet_reactor_run(&reactor) == 0);
+  assert(pthread_join(thread, NULL) == 0);
+  for (i = 0; i < REMOTE_TASKS; i++)
+    assert(remote_rounds[i] == REMOTE_ROUNDS);
+  assert(sched.n_remote == 1 + REMOTE_TASKS * REMOTE_ROUNDS);
+  assert(reactor.n_doorbells <= REMOTE_TASKS * REMOTE_ROUNDS);
+  assert(remote_rings == 1);
+  tealet_reactor_destroy(&reactor);
+  assert(sched.doorbell == NULL);
+  fini_test();
+}
+#endif
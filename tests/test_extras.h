@@ -0,0 +1,26 @@
+#ifndef TEST_EXTRAS_H
+#define TEST_EXTRAS_H
+
+#include "tealet_extras.h"
+
+void test_stubpool(void);
+void test_call_spilled(void);
+void test_bufpool(void);
+void test_sched(void);
+void test_sched_wake(void);
+void test_sched_slice(void);
+void test_chan(void);
+void test_chan_select(void);
+void test_sched_timer(void);
+void test_sched_deadline(void);
+void test_sync_mutex(void);
+void test_sync_sem(void);
+void test_taskgroup(void);
+#if TEALET_WITH_REACTOR
+void test_reactor(void);
+void test_reactor_io(void);
+void test_offload(void);
+void test_wake_remote(void);
+#endif
+
+#endif
@@ -0,0 +1,245 @@
+/* Test the C++ wrapper in tealet.hpp */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <stdexcept>
+#include <string>
+
+#include "tealet.hpp"
+
+static int test_count = 0;
+static int test_passed = 0;
+
+#define TEST(name)                                                                                                     \
+  do {                                                                                                                 \
+    printf("Running test: %s\n", name);                                                                                \
+    test_count++;                                                                                                      \
+  } while (0)
+
+#define PASS()                                                                                                         \
+  do {                                                                                                                 \
+    printf("  PASSED\n");                                                                                              \
+    test_passed++;                                                                                                     \
+  } while (0)
+
+static size_t blocks_allocated(tealet_t *t) {
+  tealet_stats_t stats;
+
+  tealet_get_stats(t, &stats);
+  return stats.blocks_allocated_total;
+}
+
+/* yield from some depth so the body's stack is saved while the value is read */
+static void yield_deep(tealet::yielder<std::string> &y, int depth, int i) {
+  char pad[256];
+
+  memset(pad, i, sizeof(pad));
+  if (depth > 0)
+    yield_deep(y, depth - 1, i);
+  else
+    y.yield(std::string(40, (char)('a' + i % 26)));
+  assert(pad[0] == (char)i && pad[sizeof(pad) - 1] == (char)i);
+}
+
+static tealet_t *raw_suspender(tealet_t *t, void *arg) {
+  int i;
+
+  (void)arg;
+  for (i = 0; i < 10; i++)
+    tealet_switch(t->main, NULL, TEALET_XFER_DEFAULT);
+  return t->main;
+}
+
+/* allocation calls made by ten raw C suspend/resume round trips */
+static size_t raw_blocks(tealet_t *main_tealet) {
+  tealet_t *t = tealet_new(main_tealet);
+  size_t blocks;
+
+  assert(tealet_run(t, raw_suspender, NULL, NULL, TEALET_START_SWITCH) == 0);
+  blocks = blocks_allocated(main_tealet);
+  while (tealet_status(t) != TEALET_STATUS_EXITED)
+    tealet_switch(t, NULL, TEALET_XFER_DEFAULT);
+  blocks = blocks_allocated(main_tealet) - blocks;
+  tealet_delete(t);
+  return blocks;
+}
+
+/* A task receives typed arguments and returns a typed result, allocating
+ * no more per switch than the raw C calls.
+ */
+static void test_hpp_task(void) {
+  tealet::domain d;
+  size_t blocks;
+  int steps = 0;
+
+  TEST("test_hpp_task");
+  {
+    auto t = tealet::task<long>::spawn(
+        d.get(),
+        [&steps](tealet::context &ctx, int a, long b) {
+          int i;
+          for (i = 0; i < 10; i++) {
+            steps++;
+            ctx.suspend();
+          }
+          return a + b;
+        },
+        40, 2L);
+
+    assert(!t.done() && steps == 0);
+    assert(!t.resume());
+    blocks = blocks_allocated(d.get());
+    while (!t.resume())
+      ;
+    blocks = blocks_allocated(d.get()) - blocks;
+    assert(blocks <= raw_blocks(d.get()));
+    assert(steps == 10 && t.get() == 42);
+    assert(tealet_status(t.handle()) == TEALET_STATUS_EXITED);
+  }
+  PASS();
+}
+
+/* Generator values are read from the extra area, never from the body's
+ * saved stack.
+ */
+static void test_hpp_generator(void) {
+  tealet::domain d;
+  std::string *s;
+  int n = 0;
+
+  TEST("test_hpp_generator");
+  {
+    auto g = tealet::generator<std::string>::spawn(
+        d.get(),
+        [](tealet::yielder<std::string> &y, int count) {
+          int i;
+          for (i = 0; i < count; i++)
+            yield_deep(y, i % 4, i);
+        },
+        20);
+
+    while ((s = g.next()) != nullptr) {
+      assert(*s == std::string(40, (char)('a' + n % 26)));
+      n++;
+    }
+    assert(n == 20 && g.done() && g.next() == nullptr);
+  }
+  PASS();
+}
+
+/* An exception leaving a body is rethrown by the resumer, without unwinding
+ * through the C switch frames.
+ */
+static void test_hpp_exception(void) {
+  tealet::domain d;
+  bool caught = false;
+
+  TEST("test_hpp_exception");
+  {
+    auto t = tealet::task<void>::spawn(d.get(), [](tealet::context &ctx) {
+      ctx.suspend();
+      throw std::runtime_error("boom");
+    });
+
+    assert(!t.resume());
+    try {
+      t.resume();
+    } catch (const std::runtime_error &e) {
+      caught = strcmp(e.what(), "boom") == 0;
+    }
+    assert(caught && t.done());
+  }
+  PASS();
+}
+
+struct guard {
+  int *count;
+  ~guard() { (*count)++; }
+};
+
+/* Destroying a suspended generator unwinds its body, destroying its locals
+ * and the bound arguments.
+ */
+static void test_hpp_cancel(void) {
+  tealet::domain d;
+  int destroyed = 0;
+  int after = 0;
+
+  TEST("test_hpp_cancel");
+  {
+    auto g = tealet::generator<int>::spawn(
+        d.get(),
+        [&after](tealet::yielder<int> &y, guard arg) {
+          guard local = {arg.count};
+          int i;
+          for (i = 0;; i++)
+            y.yield(i);
+          after++;
+        },
+        guard{&destroyed});
+
+    destroyed = 0; /* ignore the temporaries moved into the frame */
+    assert(*g.next() == 0 && *g.next() == 1);
+  }
+  /* the local, the by-value parameter and the bound argument */
+  assert(destroyed == 3 && after == 0);
+
+  /* a task that never started drops its arguments without running */
+  {
+    auto t = tealet::task<void>::spawn(
+        d.get(), [](tealet::context &, guard) { assert(0); }, guard{&destroyed});
+    destroyed = 0;
+  }
+  assert(destroyed == 1);
+  PASS();
+}
+
+static tealet_t *fiber_run(tealet_t *t, void *arg) {
+  (void)arg;
+  tealet_switch(t->main, NULL, TEALET_XFER_DEFAULT);
+  return t->main;
+}
+
+/* Domain and fiber handles are move-only owners; each tealet is deleted
+ * once.
+ */
+static void test_hpp_handles(void) {
+  tealet::domain d;
+  tealet::domain d2(std::move(d));
+  tealet_stats_t stats;
+  int n_active;
+
+  TEST("test_hpp_handles");
+  assert(d.get() == nullptr && d2.get() != nullptr);
+  tealet_get_stats(d2.get(), &stats);
+  n_active = stats.n_active;
+  {
+    tealet::fiber f(tealet_new(d2.get()));
+    tealet::fiber f2;
+
+    assert(tealet_run(f.get(), fiber_run, NULL, NULL, TEALET_START_SWITCH) == 0);
+    assert(f.status() == TEALET_STATUS_ACTIVE);
+    f2 = std::move(f);
+    assert(!f && f2);
+    tealet_get_stats(d2.get(), &stats);
+    assert(stats.n_active == n_active + 1);
+  }
+  tealet_get_stats(d2.get(), &stats);
+  assert(stats.n_active == n_active);
+  PASS();
+}
+
+int main(void) {
+  printf("=== Testing tealet.hpp wrapper ===\n\n");
+
+  test_hpp_task();
+  test_hpp_generator();
+  test_hpp_exception();
+  test_hpp_cancel();
+  test_hpp_handles();
+
+  printf("\n=== Results: %d/%d tests passed ===\n", test_passed, test_count);
+  return test_passed == test_count ? 0 : 1;
+}
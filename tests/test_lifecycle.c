@@ -1,6 +1,7 @@
 #include "test_lifecycle.h"
 
 #include <assert.h>
+#include <limits.h>
 
 #include "tealet_extras.h"
 #include "test_harness.h"
@@ -231,3 +232,238 @@ void test_switch_new(void) {
   tealet_delete(tealet2);
   fini_test();
 }
+
+/* Counters live outside the creator's frame, which may be guarded while a
+ * spawned tealet runs.
+ */
+static int spawn_many_counters[8];
+
+static tealet_t *test_spawn_many_run(tealet_t *t, void *arg) {
+  int *counter = (int *)arg;
+  *counter += 1;
+  tealet_switch(t->main, NULL, TEALET_XFER_DEFAULT);
+  *counter += 10;
+  return g_main;
+}
+
+/* Batch spawn binds each member to its own argument from one shared
+ * capture, with a single allocation for the whole batch.
+ */
+void test_spawn_many(void) {
+  enum { N_SPAWN = 8 };
+  tealet_t *tealets[N_SPAWN];
+  void *args[N_SPAWN];
+  int *counters = spawn_many_counters;
+  tealet_stats_t before;
+  tealet_stats_t after;
+  int i;
+
+  init_test();
+  for (i = 0; i < N_SPAWN; i++) {
+    counters[i] = 0;
+    args[i] = &counters[i];
+  }
+  tealet_get_stats(g_main, &before);
+  assert(tealet_spawn_many(g_main, N_SPAWN, test_spawn_many_run, args, tealets) == 0);
+  tealet_get_stats(g_main, &after);
+  assert(after.n_active == before.n_active + N_SPAWN);
+  if (after.blocks_allocated_total != 0)
+    assert(after.blocks_allocated_total - before.blocks_allocated_total < N_SPAWN);
+
+  for (i = 0; i < N_SPAWN; i++) {
+    assert(tealet_status(tealets[i]) == TEALET_STATUS_ACTIVE);
+    assert(counters[i] == 0);
+  }
+
+  /* members may be deleted individually before they ever run */
+  tealet_delete(tealets[0]);
+  for (i = 1; i < N_SPAWN; i++) {
+    void *arg = NULL; /* ignored, members have their own argument */
+    tealet_switch(tealets[i], &arg, TEALET_XFER_DEFAULT);
+    assert(counters[i] == 1);
+  }
+  for (i = 1; i < N_SPAWN; i++) {
+    tealet_switch(tealets[i], NULL, TEALET_XFER_DEFAULT);
+    assert(counters[i] == 11);
+    tealet_delete(tealets[i]);
+  }
+  assert(counters[0] == 0);
+  fini_test();
+}
+
+/* Batch spawn without an argument array passes the first switch argument.
+ * An empty batch is accepted; a NULL run function or a count past INT_MAX
+ * is rejected.
+ */
+void test_spawn_many_switch_arg(void) {
+  tealet_t *tealets[3];
+  int *counter = &spawn_many_counters[0];
+  int i;
+
+  init_test();
+  *counter = 0;
+  assert(tealet_spawn_many(g_main, 0, test_spawn_many_run, NULL, tealets) == 0);
+  assert(tealet_spawn_many(g_main, 3, NULL, NULL, tealets) == TEALET_ERR_INVAL);
+  if ((size_t)-1 > (size_t)INT_MAX)
+    assert(tealet_spawn_many(g_main, (size_t)INT_MAX + 1, test_spawn_many_run, NULL, tealets) == TEALET_ERR_INVAL);
+  assert(tealet_spawn_many(g_main, 3, test_spawn_many_run, NULL, tealets) == 0);
+  for (i = 0; i < 3; i++) {
+    void *arg = counter;
+    tealet_switch(tealets[i], &arg, TEALET_XFER_DEFAULT);
+    assert(*counter == i + 1);
+  }
+  for (i = 0; i < 3; i++)
+    tealet_delete(tealets[i]);
+  fini_test();
+}
+
+static tealet_t *test_rebind_run(tealet_t *t, void *arg) {
+  (void)arg;
+  status += 1;
+  return t->main;
+}
+
+/* An exited tealet can be rebound and run again; one that has not exited
+ * cannot.
+ */
+void test_rebind(void) {
+  tealet_t *t;
+
+  init_test();
+  t = tealet_new(g_main);
+  assert(t != NULL);
+  assert(tealet_rebind(t) == TEALET_ERR_INVAL);
+  assert(tealet_rebind(g_main) == TEALET_ERR_INVAL);
+
+  assert(tealet_run(t, test_rebind_run, NULL, NULL, TEALET_START_DEFAULT) == 0);
+  assert(tealet_rebind(t) == TEALET_ERR_INVAL);
+  tealet_switch(t, NULL, TEALET_XFER_DEFAULT);
+  assert(status == 1);
+  assert(tealet_status(t) == TEALET_STATUS_EXITED);
+
+  assert(tealet_rebind(t) == 0);
+  assert(tealet_status(t) == TEALET_STATUS_NEW);
+  assert(tealet_get_far(t) == NULL);
+
+  assert(tealet_run(t, test_rebind_run, NULL, NULL, TEALET_START_DEFAULT) == 0);
+  tealet_switch(t, NULL, TEALET_XFER_DEFAULT);
+  assert(status == 2);
+  assert(tealet_status(t) == TEALET_STATUS_EXITED);
+  tealet_delete(t);
+  fini_test();
+}
+
+static tealet_t *test_teardown_run(tealet_t *t, void *arg) {
+  (void)arg;
+  status += 1;
+  tealet_switch(t->main, NULL, TEALET_XFER_DEFAULT);
+  /* never resumed: the domain is torn down while this tealet is suspended */
+  assert(0);
+  return t->main;
+}
+
+/* create a mix of suspended, unbound, duplicated and slab tealets */
+static void test_teardown_populate(void) {
+  tealet_t *t, *many[3];
+  int i;
+
+  for (i = 0; i < 3; i++) {
+    t = NULL;
+    assert(tealet_spawn(g_main, &t, test_teardown_run, NULL, NULL, TEALET_START_SWITCH) == 0);
+    assert(tealet_status(t) == TEALET_STATUS_ACTIVE);
+  }
+  assert(tealet_duplicate(t) != NULL);
+  assert(tealet_new(g_main) != NULL);
+  assert(tealet_spawn_many(g_main, 3, test_teardown_run, NULL, many) == 0);
+  for (i = 0; i < 3; i++)
+    tealet_switch(many[i], NULL, TEALET_XFER_DEFAULT);
+}
+
+/* tealet_finalize_all() releases the tealets and stacks still alive. */
+void test_finalize_all(void) {
+  init_test();
+  test_teardown_populate();
+  assert(status == 6);
+  tealet_finalize_all(g_main);
+  g_main = NULL;
+}
+
+/* tealet_reset() releases every tealet but main and leaves the domain
+ * usable.
+ */
+void test_reset(void) {
+  tealet_stats_t stats;
+  tealet_t *t;
+
+  init_test();
+  assert(tealet_reset(g_main) == 0);
+  test_teardown_populate();
+  t = tealet_new(g_main);
+  assert(t != NULL);
+  assert(tealet_reset(t) == TEALET_ERR_INVAL);
+
+  assert(tealet_reset(g_main) == 0);
+  tealet_get_stats(g_main, &stats);
+  if (stats.blocks_allocated != 0) {
+    assert(stats.n_active == 1);
+    assert(stats.stack_count == 0);
+    assert(stats.stack_chunk_count == 0);
+  }
+  assert(tealet_current(g_main) == g_main);
+  assert(tealet_previous(g_main) == NULL);
+
+  /* the domain is usable again */
+  status = 0;
+  test_teardown_populate();
+  assert(status == 6);
+  assert(tealet_reset(g_main) == 0);
+  fini_test();
+}
+
+/* Compact-mode tealets get reusable table handles with inline extra data.
+ * Teardown sweeps the table, which holds tealets missing from the list.
+ */
+void test_compact(void) {
+  enum { N_COMPACT = 300 };
+  static tealet_t *ts[N_COMPACT];
+  tealet_t *before, *t;
+  tealet_handle_t h;
+  int i;
+
+  init_test_extra(NULL, sizeof(int));
+  before = tealet_new(g_main);
+  assert(tealet_set_compact(before) == TEALET_ERR_INVAL);
+  assert(tealet_set_compact(g_main) == 0);
+  assert(tealet_get_handle(g_main) == TEALET_HANDLE_NONE);
+  assert(tealet_get_handle(before) == TEALET_HANDLE_NONE);
+
+  for (i = 0; i < N_COMPACT; i++) {
+    ts[i] = tealet_new(g_main);
+    assert(ts[i] != NULL);
+    assert(tealet_get_handle(ts[i]) == (tealet_handle_t)i);
+    *(int *)ts[i]->extra = i;
+  }
+  assert(tealet_handle_limit(g_main) == N_COMPACT);
+  for (h = 0; h < tealet_handle_limit(g_main); h++)
+    assert(*(int *)tealet_from_handle(g_main, h)->extra == (int)h);
+
+  /* released records are reused with the same handle */
+  h = tealet_get_handle(ts[7]);
+  tealet_delete(ts[7]);
+  assert(tealet_from_handle(g_main, h) == NULL);
+  t = tealet_new(g_main);
+  assert(tealet_get_handle(t) == h && tealet_from_handle(g_main, h) == t);
+  assert(tealet_handle_limit(g_main) == N_COMPACT);
+
+  /* running, duplicated and slab tealets mixed with table records */
+  status = 0;
+  test_teardown_populate();
+  assert(status == 6);
+  assert(tealet_reset(g_main) == 0);
+  for (h = 0; h < tealet_handle_limit(g_main); h++)
+    assert(tealet_from_handle(g_main, h) == NULL);
+
+  test_teardown_populate();
+  tealet_finalize_all(g_main);
+  g_main = NULL;
+}
@@ -10,5 +10,11 @@ void test_simple_create_and_run(void);
 void test_create_previous(void);
 void test_previous_cleared_on_manual_delete(void);
 void test_switch_new(void);
+void test_spawn_many(void);
+void test_spawn_many_switch_arg(void);
+void test_rebind(void);
+void test_finalize_all(void);
+void test_reset(void);
+void test_compact(void);
 
 #endif
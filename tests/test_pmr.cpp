@@ -0,0 +1,196 @@
+/* Test the std::pmr adapters in tealet_pmr.hpp */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "tealet_pmr.hpp"
+
+static int test_count = 0;
+static int test_passed = 0;
+
+#define TEST(name)                                                                                                     \
+  do {                                                                                                                 \
+    printf("Running test: %s\n", name);                                                                                \
+    test_count++;                                                                                                      \
+  } while (0)
+
+#define PASS()                                                                                                         \
+  do {                                                                                                                 \
+    printf("  PASSED\n");                                                                                              \
+    test_passed++;                                                                                                     \
+  } while (0)
+
+/* A resource that counts outstanding blocks and checks sizes on release */
+class counting_resource : public std::pmr::memory_resource {
+public:
+  size_t live_blocks = 0;
+  size_t live_bytes = 0;
+  size_t n_allocs = 0;
+
+private:
+  void *do_allocate(std::size_t bytes, std::size_t align) override {
+    live_blocks++;
+    live_bytes += bytes;
+    n_allocs++;
+    return std::pmr::new_delete_resource()->allocate(bytes, align);
+  }
+
+  void do_deallocate(void *p, std::size_t bytes, std::size_t align) override {
+    assert(live_blocks > 0 && live_bytes >= bytes);
+    live_blocks--;
+    live_bytes -= bytes;
+    std::pmr::new_delete_resource()->deallocate(p, bytes, align);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+};
+
+static int n_finished;
+
+static void deep_switch(tealet_t *t, int depth) {
+  char pad[512];
+
+  memset(pad, depth, sizeof(pad));
+  if (depth > 0)
+    deep_switch(t, depth - 1);
+  else
+    tealet_switch(t->main, NULL, TEALET_XFER_DEFAULT);
+  assert(pad[0] == (char)depth && pad[sizeof(pad) - 1] == (char)depth);
+}
+
+static tealet_t *deep_run(tealet_t *t, void *arg) {
+  (void)arg;
+  deep_switch(t, 8);
+  n_finished++;
+  return t->main;
+}
+
+/* run a few tealets that suspend at different depths, then finish them */
+static void exercise_domain(tealet_t *main_tealet) {
+  tealet_t *t[3];
+  int i;
+
+  n_finished = 0;
+  for (i = 0; i < 3; i++) {
+    t[i] = tealet_new(main_tealet);
+    assert(t[i] != NULL);
+    assert(tealet_run(t[i], deep_run, NULL, NULL, TEALET_START_SWITCH) == 0);
+  }
+  for (i = 0; i < 3; i++) {
+    tealet_switch(t[i], NULL, TEALET_XFER_DEFAULT);
+    assert(tealet_status(t[i]) == TEALET_STATUS_EXITED);
+    tealet_delete(t[i]);
+  }
+  assert(n_finished == 3);
+}
+
+/* A domain on the version 2 adapter takes all its memory from the resource
+ * and frees each block with its allocated size.
+ */
+static void test_pmr_alloc2(void) {
+  counting_resource counting;
+  tealet::pmr_alloc adapter(&counting);
+  tealet_t *main_tealet;
+  void *p;
+
+  TEST("test_pmr_alloc2");
+  main_tealet = tealet_initialize2(adapter.alloc2(), 32);
+  assert(main_tealet != NULL);
+  exercise_domain(main_tealet);
+
+  p = tealet_malloc_aligned(main_tealet, 100, 64);
+  assert(p != NULL && ((std::uintptr_t)p % 64) == 0);
+  tealet_free_aligned(main_tealet, p);
+
+  tealet_finalize(main_tealet);
+  assert(counting.n_allocs > 0);
+  assert(counting.live_blocks == 0 && counting.live_bytes == 0);
+  PASS();
+}
+
+/* The version 1 adapter works with tealet_initialize() and returns every
+ * block to the resource.
+ */
+static void test_pmr_alloc_v1(void) {
+  counting_resource counting;
+  tealet::pmr_alloc adapter(&counting);
+  tealet_t *main_tealet;
+
+  TEST("test_pmr_alloc_v1");
+  main_tealet = tealet_initialize(adapter.alloc(), 0);
+  assert(main_tealet != NULL);
+  exercise_domain(main_tealet);
+  tealet_finalize(main_tealet);
+  assert(counting.live_blocks == 0);
+  PASS();
+}
+
+/* A domain can live in a monotonic per-request arena, whose deallocation
+ * returns nothing.
+ */
+static void test_pmr_monotonic(void) {
+  static char buffer[64 * 1024];
+  counting_resource counting;
+  std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer), &counting);
+  tealet::pmr_alloc adapter(&arena);
+  tealet_t *main_tealet;
+
+  TEST("test_pmr_monotonic");
+  main_tealet = tealet_initialize2(adapter.alloc2(), 0);
+  assert(main_tealet != NULL);
+  exercise_domain(main_tealet);
+  tealet_finalize(main_tealet);
+  arena.release();
+  assert(counting.live_blocks == 0);
+  PASS();
+}
+
+/* tealet::resource serves pmr containers from the domain allocator and
+ * compares equal only within a domain.
+ */
+static void test_pmr_resource(void) {
+  counting_resource counting;
+  tealet::pmr_alloc adapter(&counting);
+  tealet_alloc_t alloc = TEALET_ALLOC_INIT_MALLOC;
+  tealet_t *main_tealet = tealet_initialize2(adapter.alloc2(), 0);
+  tealet_t *other = tealet_initialize(&alloc, 0);
+  size_t n_allocs;
+  void *p;
+
+  TEST("test_pmr_resource");
+  {
+    tealet::resource r(main_tealet), r2(main_tealet), r3(other);
+    std::pmr::vector<double> v(&r);
+    int i;
+
+    assert(r == r2 && !(r == r3));
+    n_allocs = counting.n_allocs;
+    for (i = 0; i < 1000; i++)
+      v.push_back(i);
+    assert(counting.n_allocs > n_allocs);
+
+    p = r.allocate(200, 128);
+    assert(((std::uintptr_t)p % 128) == 0);
+    r.deallocate(p, 200, 128);
+  }
+  tealet_finalize(other);
+  tealet_finalize(main_tealet);
+  assert(counting.live_blocks == 0);
+  PASS();
+}
+
+int main(void) {
+  printf("=== Testing tealet_pmr.hpp adapters ===\n\n");
+
+  test_pmr_alloc2();
+  test_pmr_alloc_v1();
+  test_pmr_monotonic();
+  test_pmr_resource();
+
+  printf("\n=== Results: %d/%d tests passed ===\n", test_passed, test_count);
+  return test_passed == test_count ? 0 : 1;
+}
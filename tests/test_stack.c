@@ -1,6 +1,7 @@
 #include "test_stack.h"
 
 #include <assert.h>
+#include <string.h>
 
 #include "test_harness.h"
 
@@ -118,3 +119,52 @@ void test_stack_far_isolation(void) {
   tealet_delete(parent);
   fini_test();
 }
+
+#define SCRATCH_TEST_SIZE 16384
+
+static tealet_t *test_scratch_range_run(tealet_t *current, void *arg) {
+  char buffer[SCRATCH_TEST_SIZE];
+  volatile int sentinel = 1234;
+  size_t i;
+  (void)arg;
+
+  assert(tealet_scratch_register(g_main, buffer, sizeof(buffer)) == TEALET_ERR_INVAL);
+  assert(tealet_scratch_register(current, buffer, sizeof(buffer)) == 0);
+  memset(buffer, 'x', sizeof(buffer));
+  tealet_switch(g_main, NULL, TEALET_XFER_DEFAULT);
+  assert(sentinel == 1234);
+
+  assert(tealet_scratch_unregister(current, buffer) == 0);
+  assert(tealet_scratch_unregister(current, buffer) == TEALET_ERR_INVAL);
+  memset(buffer, 'y', sizeof(buffer));
+  tealet_switch(g_main, NULL, TEALET_XFER_DEFAULT);
+  assert(sentinel == 1234);
+  for (i = 0; i < sizeof(buffer); i++)
+    assert(buffer[i] == 'y');
+  return g_main;
+}
+
+/* A registered scratch range is left out of stack saves while the locals
+ * around it are kept.  It is saved again once unregistered.
+ */
+void test_scratch_range(void) {
+  tealet_t *t;
+  tealet_stats_t stats;
+
+  init_test();
+  t = tealet_new_native_call(g_main, test_scratch_range_run, NULL, NULL);
+  assert(t != NULL);
+  tealet_get_stats(g_main, &stats);
+  if (stats.blocks_allocated != 0)
+    assert(stats.stack_bytes < SCRATCH_TEST_SIZE);
+
+  tealet_switch(t, NULL, TEALET_XFER_DEFAULT);
+  tealet_get_stats(g_main, &stats);
+  if (stats.blocks_allocated != 0)
+    assert(stats.stack_bytes > SCRATCH_TEST_SIZE);
+
+  tealet_switch(t, NULL, TEALET_XFER_DEFAULT);
+  assert(tealet_status(t) == TEALET_STATUS_EXITED);
+  tealet_delete(t);
+  fini_test();
+}
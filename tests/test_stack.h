@@ -3,5 +3,6 @@
 
 void test_stack_further(void);
 void test_stack_far_isolation(void);
+void test_scratch_range(void);
 
 #endif
@@ -1,6 +1,7 @@
 #include "test_stats_extra.h"
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "tealet_extras.h"
@@ -51,6 +52,56 @@ void test_extra(void) {
   fini_test();
 }
 
+/* Per-tealet extra sizes are kept by duplicates and charged at their own
+ * size in the byte accounting.
+ */
+void test_extra_sized(void) {
+  tealet_t *small;
+  tealet_t *big;
+  tealet_t *copy;
+  tealet_stats_t before;
+  tealet_stats_t stats;
+  char *payload;
+  size_t i;
+
+  init_test_extra(NULL, sizeof(extradata));
+  tealet_get_stats(g_main, &before);
+
+  small = tealet_new_ex(g_main, 0);
+  assert(small != NULL);
+  assert(small->extra == NULL);
+  assert(tealet_get_extrasize(small) == 0);
+
+  big = tealet_new_ex(g_main, 2048);
+  assert(big != NULL);
+  assert(big->extra != NULL);
+  assert(tealet_get_extrasize(big) == 2048);
+  payload = (char *)big->extra;
+  for (i = 0; i < 2048; i++)
+    payload[i] = (char)i;
+
+  tealet_get_stats(g_main, &stats);
+  if (before.blocks_allocated != 0)
+    assert(stats.bytes_allocated - before.bytes_allocated >= 2048);
+
+  copy = tealet_duplicate(big);
+  assert(copy != NULL);
+  assert(tealet_get_extrasize(copy) == 2048);
+  assert(memcmp(copy->extra, big->extra, 2048) == 0);
+  assert(tealet_get_extrasize(g_main) == sizeof(extradata));
+
+  tealet_delete(copy);
+  tealet_delete(big);
+  tealet_delete(small);
+  tealet_get_stats(g_main, &stats);
+  if (before.blocks_allocated != 0) {
+    /* odd-sized blocks are not recycled */
+    assert(stats.freelist_count == 0);
+    assert(stats.bytes_allocated == before.bytes_allocated);
+  }
+  fini_test();
+}
+
 /* Verify that the stats allocator wrapper records initialization allocations
  * and does not accidentally undercount allocation activity.
  */
@@ -101,3 +152,375 @@ void test_stats(void) {
   assert(stats.n_total == b);
   fini_test();
 }
+
+/* Deleted tealet blocks are recycled through the freelist rather than
+ * returned to the allocator on each create/delete cycle.
+ */
+void test_stats_freelist(void) {
+  tealet_t *t;
+  tealet_stats_t before;
+  tealet_stats_t stats;
+  int i;
+
+  init_test_extra(NULL, 0);
+  tealet_get_stats(g_main, &before);
+  if (before.blocks_allocated == 0) {
+    fini_test();
+    return;
+  }
+  assert(before.freelist_count == 0);
+  assert(before.freelist_reused == 0);
+
+  t = tealet_new(g_main);
+  assert(t != NULL);
+  tealet_delete(t);
+  tealet_get_stats(g_main, &stats);
+  assert(stats.freelist_count == 1);
+  assert(stats.blocks_allocated == before.blocks_allocated + 1);
+
+  for (i = 0; i < 10; i++) {
+    t = tealet_new(g_main);
+    assert(t != NULL);
+    assert(tealet_status(t) == TEALET_STATUS_NEW);
+    tealet_delete(t);
+  }
+  tealet_get_stats(g_main, &stats);
+  assert(stats.freelist_count == 1);
+  assert(stats.freelist_reused == 10);
+  assert(stats.blocks_allocated_total == before.blocks_allocated_total + 1);
+  assert(stats.n_total == before.n_total + 11);
+  fini_test();
+}
+
+/* version 2 allocator that counts allocations per purpose */
+static size_t alloc2_counts[TEALET_ALLOC_PURPOSE_ARENA + 1];
+static size_t alloc2_live;
+static size_t alloc2_reallocs;
+static tealet_t *alloc2_chain[4]; /* each tealet switches to its successor */
+
+static void *alloc2_malloc(size_t size, size_t align, tealet_alloc_purpose_t purpose, void *context) {
+  void *p;
+  assert(context == (void *)alloc2_counts);
+  assert(align == 0 || purpose == TEALET_ALLOC_PURPOSE_USER);
+  p = malloc(size);
+  if (p != NULL) {
+    alloc2_counts[purpose]++;
+    alloc2_live++;
+  }
+  return p;
+}
+
+static void *alloc2_realloc(void *ptr, size_t size, tealet_alloc_purpose_t purpose, void *context) {
+  (void)context;
+  assert(purpose == TEALET_ALLOC_PURPOSE_CHUNK);
+  alloc2_reallocs++;
+  return realloc(ptr, size);
+}
+
+static void alloc2_free(void *ptr, tealet_alloc_purpose_t purpose, void *context) {
+  (void)purpose;
+  (void)context;
+  alloc2_live--;
+  free(ptr);
+}
+
+/* consume some stack, so that switches leave a large unsaved extent */
+static void alloc2_recurse(int depth, tealet_t *next) {
+  volatile char pad[1024];
+  pad[0] = (char)depth;
+  if (depth > 0)
+    alloc2_recurse(depth - 1, next);
+  else
+    tealet_switch(next, NULL, TEALET_XFER_DEFAULT);
+  assert(pad[0] == (char)depth); /* restored intact */
+}
+
+static tealet_t *alloc2_run(tealet_t *t, void *arg) {
+  int i = 0;
+  (void)arg;
+  while (alloc2_chain[i] != t)
+    i++;
+  alloc2_recurse(8, alloc2_chain[i + 1]);
+  return g_main;
+}
+
+/* create and bind a tealet at the given extra stack depth */
+static tealet_t *alloc2_make(int depth) {
+  volatile char pad[1024];
+  tealet_t *t;
+  pad[0] = (char)depth;
+  if (depth > 0)
+    return alloc2_make(depth - 1);
+  t = tealet_new(g_main);
+  assert(t != NULL);
+  assert(tealet_run(t, alloc2_run, NULL, NULL, TEALET_START_DEFAULT) == 0);
+  pad[1] = pad[0];
+  return t;
+}
+
+/* A version 2 allocator sees purpose tags and in-place stack growth, and
+ * each free matches its allocation.
+ */
+void test_alloc2(void) {
+  tealet_alloc2_t alloc = TEALET_ALLOC2_INIT(alloc2_malloc, alloc2_realloc, alloc2_free, (void *)alloc2_counts);
+  tealet_alloc2_t bad = TEALET_ALLOC2_INIT(alloc2_malloc, NULL, NULL, (void *)alloc2_counts);
+  tealet_t *a, *t1, *t2;
+  void *p;
+
+  memset(alloc2_counts, 0, sizeof(alloc2_counts));
+  alloc2_live = alloc2_reallocs = 0;
+  assert(tealet_initialize2(&bad, 0) == NULL);
+  bad.free_p = alloc2_free;
+  bad.size = sizeof(tealet_alloc2_t) - 1;
+  assert(tealet_initialize2(&bad, 0) == NULL);
+
+  assert(g_main == NULL);
+  g_main = tealet_initialize2(&alloc, 0);
+  assert(g_main != NULL);
+  assert(alloc2_counts[TEALET_ALLOC_PURPOSE_TEALET] == 1);
+
+  p = tealet_malloc_aligned(g_main, 100, 64);
+  assert(p != NULL);
+  assert(alloc2_counts[TEALET_ALLOC_PURPOSE_USER] == 1);
+  tealet_free_aligned(g_main, p);
+  assert(tealet_malloc_aligned(g_main, 100, 48) == NULL);
+
+  /* 'a' is bound near the top of the stack, t2 deepest.  Switching
+   * a -> t2 -> t1 -> main saves a's stack in three steps, so the third
+   * step can grow its last chunk in place.
+   */
+  a = alloc2_make(0);
+  t1 = alloc2_make(4);
+  t2 = alloc2_make(6);
+  alloc2_chain[0] = a;
+  alloc2_chain[1] = t2;
+  alloc2_chain[2] = t1;
+  alloc2_chain[3] = g_main;
+  tealet_switch(a, NULL, TEALET_XFER_DEFAULT);
+  assert(tealet_current(g_main) == g_main);
+  assert(alloc2_counts[TEALET_ALLOC_PURPOSE_STACK_HEADER] > 0);
+  assert(alloc2_counts[TEALET_ALLOC_PURPOSE_CHUNK] > 0);
+  assert(alloc2_reallocs > 0);
+
+  /* resuming restores the grown stacks and lets each tealet exit */
+  tealet_switch(a, NULL, TEALET_XFER_DEFAULT);
+  tealet_switch(t2, NULL, TEALET_XFER_DEFAULT);
+  tealet_switch(t1, NULL, TEALET_XFER_DEFAULT);
+  assert(tealet_status(a) == TEALET_STATUS_EXITED);
+  assert(tealet_status(t1) == TEALET_STATUS_EXITED);
+  tealet_finalize_all(g_main);
+  g_main = NULL;
+  assert(alloc2_live == 0);
+}
+
+static size_t arena_used_in_tealet;
+
+static tealet_t *arena_run(tealet_t *t, void *arg) {
+  char *a = (char *)tealet_arena_alloc(t, 10);
+  char *b = (char *)tealet_arena_alloc(t, 3000);
+  char *c = (char *)tealet_arena_alloc(t, 10);
+  assert(a != NULL && b != NULL && c != NULL);
+  assert(((size_t)a % sizeof(double)) == 0 && ((size_t)c % sizeof(double)) == 0);
+  memset(b, 0x5a, 3000);
+  arena_used_in_tealet = tealet_arena_usage(t, NULL);
+  if (arg != NULL) {
+    tealet_exit(g_main, NULL, TEALET_EXIT_DELETE);
+    assert(0);
+  }
+  tealet_switch(g_main, NULL, TEALET_XFER_DEFAULT);
+  return g_main;
+}
+
+/* Per-tealet arenas are released on exit, exit-delete and delete, and the
+ * usage counters drop with them.
+ */
+void test_arena(void) {
+  tealet_stats_t stats;
+  tealet_t *t;
+  size_t reserved;
+  void *p;
+
+  init_test();
+  assert(tealet_arena_usage(g_main, &reserved) == 0 && reserved == 0);
+  p = tealet_arena_alloc(g_main, 100);
+  assert(p != NULL);
+  assert(tealet_arena_usage(g_main, &reserved) >= 100 && reserved >= 100);
+  tealet_get_stats(g_main, &stats);
+  if (stats.blocks_allocated != 0)
+    assert(stats.arena_bytes == reserved);
+
+  /* released on exit, the tealet stays alive */
+  t = tealet_new(g_main);
+  assert(tealet_run(t, arena_run, NULL, NULL, TEALET_START_SWITCH) == 0);
+  assert(arena_used_in_tealet >= 3020);
+  assert(tealet_arena_usage(t, NULL) == arena_used_in_tealet);
+  tealet_switch(t, NULL, TEALET_XFER_DEFAULT);
+  assert(tealet_status(t) == TEALET_STATUS_EXITED);
+  assert(tealet_arena_usage(t, &reserved) == 0 && reserved == 0);
+
+  /* released when deleted while suspended */
+  assert(tealet_rebind(t) == 0);
+  assert(tealet_run(t, arena_run, NULL, NULL, TEALET_START_SWITCH) == 0);
+  tealet_delete(t);
+
+  /* released on the exit-delete path */
+  t = NULL;
+  p = g_main; /* non-NULL argument requests TEALET_EXIT_DELETE */
+  assert(tealet_spawn(g_main, &t, arena_run, &p, NULL, TEALET_START_SWITCH) == 0);
+
+  tealet_arena_usage(g_main, &reserved);
+  tealet_get_stats(g_main, &stats);
+  if (stats.blocks_allocated != 0)
+    assert(stats.arena_bytes == reserved);
+  tealet_arena_release(g_main);
+  assert(tealet_arena_usage(g_main, &reserved) == 0 && reserved == 0);
+  tealet_get_stats(g_main, &stats);
+  assert(stats.arena_bytes == 0 && stats.arena_used == 0);
+  fini_test();
+}
+
+static tealet_t *group_run(tealet_t *t, void *arg) {
+  (void)arg;
+  tealet_switch(g_main, NULL, TEALET_XFER_DEFAULT);
+  return g_main;
+}
+
+/* Group counters follow saves, duplicates and deletes back to zero.  A full
+ * group refuses saves and spawns with TEALET_ERR_MEM, and a refused tealet
+ * stays usable.
+ */
+void test_group(void) {
+  tealet_group_t group;
+  tealet_t *t, *dup;
+
+  init_test();
+  tealet_group_init(&group, 0);
+  t = tealet_new(g_main);
+  assert(tealet_group_add(&group, g_main) == TEALET_ERR_INVAL);
+  assert(tealet_group_add(&group, t) == 0);
+  assert(tealet_group_add(&group, t) == TEALET_ERR_INVAL);
+  assert(tealet_get_group(t) == &group && tealet_get_group(g_main) == NULL);
+  assert(group.n_tealets == 1);
+
+  /* the suspended tealet's stack is charged to the group */
+  assert(tealet_run(t, group_run, NULL, NULL, TEALET_START_SWITCH) == 0);
+  assert(group.stack_bytes > 0 && group.stack_count == 1 && group.chunk_count >= 1);
+
+  /* duplicates inherit the group and share the charged stack */
+  dup = tealet_duplicate(t);
+  assert(dup != NULL && tealet_get_group(dup) == &group);
+  assert(group.n_tealets == 2 && group.stack_count == 1);
+  tealet_delete(dup);
+  assert(group.n_tealets == 1);
+
+  tealet_switch(t, NULL, TEALET_XFER_DEFAULT);
+  assert(tealet_status(t) == TEALET_STATUS_EXITED);
+  assert(group.stack_bytes == 0 && group.stack_count == 0 && group.chunk_count == 0);
+
+  /* a save that would exceed the quota fails and leaves the tealet NEW */
+  assert(tealet_rebind(t) == 0);
+  group.quota = 1;
+  assert(tealet_run(t, group_run, NULL, NULL, TEALET_START_DEFAULT) == TEALET_ERR_MEM);
+  assert(tealet_status(t) == TEALET_STATUS_NEW);
+  assert(group.n_quota_failures == 1 && group.stack_bytes == 0);
+
+  /* once over quota, spawns fail before saving anything */
+  group.quota = 0;
+  assert(tealet_run(t, group_run, NULL, NULL, TEALET_START_DEFAULT) == 0);
+  group.quota = group.stack_bytes;
+  dup = tealet_new(g_main);
+  assert(tealet_group_add(&group, dup) == 0);
+  assert(tealet_run(dup, group_run, NULL, NULL, TEALET_START_SWITCH) == TEALET_ERR_MEM);
+  assert(tealet_duplicate(t) == NULL);
+  assert(group.n_quota_failures == 3);
+
+  tealet_delete(dup);
+  tealet_delete(t);
+  assert(group.n_tealets == 0 && group.stack_bytes == 0 && group.stack_count == 0);
+  fini_test();
+}
+
+static tealet_group_t group_a;
+static tealet_t *group_a1, *group_b1, *group_b2;
+
+static tealet_t *group_b1_run(tealet_t *t, void *arg) {
+  size_t failures = group_a.n_quota_failures;
+
+  (void)t;
+  (void)arg;
+  /* the switch grows the partially saved stack of group A's tealet */
+  group_a.quota = group_a.stack_bytes;
+  assert(tealet_switch(group_b2, NULL, TEALET_XFER_DEFAULT) == 0);
+  assert(group_a.stack_bytes > group_a.quota && group_a.n_quota_failures == failures);
+  return group_a1;
+}
+
+static tealet_t *group_a_run(tealet_t *t, void *arg) {
+  (void)t;
+  (void)arg;
+  assert(tealet_run(group_b1, group_b1_run, NULL, NULL, TEALET_START_SWITCH) == 0);
+  return g_main;
+}
+
+/* A group at its quota doesn't fail switches between tealets of another
+ * group, which grow its tealets' partially saved stacks.
+ */
+void test_group_foreign(void) {
+  tealet_group_t group_b;
+
+  init_test();
+  tealet_group_init(&group_a, 0);
+  tealet_group_init(&group_b, 0);
+  group_b2 = tealet_new(g_main);
+  assert(tealet_group_add(&group_b, group_b2) == 0);
+  assert(tealet_run(group_b2, group_run, NULL, NULL, TEALET_START_SWITCH) == 0);
+
+  group_a1 = tealet_new(g_main);
+  group_b1 = tealet_new(g_main);
+  assert(tealet_group_add(&group_a, group_a1) == 0);
+  assert(tealet_group_add(&group_b, group_b1) == 0);
+  assert(tealet_run(group_a1, group_a_run, NULL, NULL, TEALET_START_SWITCH) == 0);
+  /* group_b2 returned to main; resume group_b1, which returns to group_a1 */
+  assert(tealet_status(group_b2) == TEALET_STATUS_EXITED);
+  tealet_switch(group_b1, NULL, TEALET_XFER_DEFAULT);
+  assert(tealet_status(group_a1) == TEALET_STATUS_EXITED && tealet_status(group_b1) == TEALET_STATUS_EXITED);
+  assert(group_a.stack_bytes == 0 && group_b.stack_bytes == 0);
+
+  tealet_delete(group_b2);
+  tealet_delete(group_b1);
+  tealet_delete(group_a1);
+  fini_test();
+}
+
+/* stack_bytes_expanded counts a shared stack once per tealet referencing
+ * it, and drops the bytes of released stacks.
+ */
+void test_stats_expanded(void) {
+  tealet_stats_t base, stats;
+  tealet_t *t, *dup;
+  size_t one;
+
+  init_test();
+  tealet_get_stats(g_main, &base);
+  if (base.blocks_allocated == 0) {
+    fini_test();
+    return;
+  }
+  t = tealet_new(g_main);
+  assert(tealet_run(t, group_run, NULL, NULL, TEALET_START_DEFAULT) == 0);
+  tealet_get_stats(g_main, &stats);
+  one = stats.stack_bytes_expanded - base.stack_bytes_expanded;
+  assert(one > 0 && stats.stack_bytes_naive > base.stack_bytes_naive);
+
+  dup = tealet_duplicate(t);
+  assert(dup != NULL);
+  tealet_get_stats(g_main, &stats);
+  assert(stats.stack_bytes_expanded == base.stack_bytes_expanded + 2 * one);
+
+  tealet_delete(dup);
+  tealet_delete(t);
+  tealet_get_stats(g_main, &stats);
+  assert(stats.stack_bytes_expanded == base.stack_bytes_expanded);
+  assert(stats.stack_bytes_naive == base.stack_bytes_naive);
+  fini_test();
+}
@@ -2,7 +2,14 @@
 #define TEST_STATS_EXTRA_H
 
 void test_extra(void);
+void test_extra_sized(void);
 void test_memstats(void);
 void test_stats(void);
+void test_stats_freelist(void);
+void test_alloc2(void);
+void test_arena(void);
+void test_group(void);
+void test_group_foreign(void);
+void test_stats_expanded(void);
 
 #endif
@@ -5,6 +5,7 @@
 
 #include "tealet.h"
 #include "tealet_extras.h"
+#include "test_extras.h"
 #include "test_harness.h"
 #include "test_lifecycle.h"
 #include "test_lock_helpers.h"
@@ -384,6 +385,7 @@ static test_entry_t test_list[] = {
     {"test_set_far_non_main_invalid", test_set_far_non_main_invalid},
     {"test_stack_further", test_stack_further},
     {"test_stack_far_isolation", test_stack_far_isolation},
+    {"test_scratch_range", test_scratch_range},
     {"test_add_unbound_phase1", test_add_unbound_phase1},
     {"test_simple", test_simple},
     {"test_lock_transitions", test_lock_transitions},
@@ -401,12 +403,44 @@ static test_entry_t test_list[] = {
     {"test_start_switch_panic_propagates_to_creator", test_start_switch_panic_propagates_to_creator},
     {"test_stub_run_panic_propagates_to_creator", test_stub_run_panic_propagates_to_creator},
     {"test_switch_new", test_switch_new},
+    {"test_spawn_many", test_spawn_many},
+    {"test_spawn_many_switch_arg", test_spawn_many_switch_arg},
+    {"test_rebind", test_rebind},
+    {"test_finalize_all", test_finalize_all},
+    {"test_reset", test_reset},
+    {"test_compact", test_compact},
     {"test_arg", test_arg},
     {"test_random", test_random},
     {"test_random2", test_random2},
     {"test_extra", test_extra},
+    {"test_extra_sized", test_extra_sized},
     {"test_memstats", test_memstats},
     {"test_stats", test_stats},
+    {"test_stats_freelist", test_stats_freelist},
+    {"test_alloc2", test_alloc2},
+    {"test_arena", test_arena},
+    {"test_group", test_group},
+    {"test_group_foreign", test_group_foreign},
+    {"test_stats_expanded", test_stats_expanded},
+    {"test_stubpool", test_stubpool},
+    {"test_call_spilled", test_call_spilled},
+    {"test_bufpool", test_bufpool},
+    {"test_sched", test_sched},
+    {"test_sched_wake", test_sched_wake},
+    {"test_sched_slice", test_sched_slice},
+    {"test_chan", test_chan},
+    {"test_chan_select", test_chan_select},
+    {"test_sched_timer", test_sched_timer},
+    {"test_sched_deadline", test_sched_deadline},
+    {"test_sync_mutex", test_sync_mutex},
+    {"test_sync_sem", test_sync_sem},
+    {"test_taskgroup", test_taskgroup},
+#if TEALET_WITH_REACTOR
+    {"test_reactor", test_reactor},
+    {"test_reactor_io", test_reactor_io},
+    {"test_offload", test_offload},
+    {"test_wake_remote", test_wake_remote},
+#endif
     {"test_mem_error", test_mem_error},
     {"test_oom_force_marks_source_defunct", test_oom_force_marks_source_defunct},
     {"test_oom_force_main_not_defunct", test_oom_force_main_not_defunct},